@@ -0,0 +1,33 @@
+#ifndef _ACCESS_LOG_PRIVATE
+#define _ACCESS_LOG_PRIVATE
+
+#include <pthread.h>
+#include <time.h>
+#include "access_log.h"
+
+#define ACCESS_LOG_TIMESTAMP_LEN 32
+
+/**
+ * @brief Lines a thread logged that aren't written out yet.
+ *        Only contended when the log is flushed periodically or reopened.
+ */
+typedef struct access_log_buffer {
+    pthread_mutex_t lock;
+    time_t timestamp_sec;                        /**< Second timestamp was formatted for, it's reused until the next one. */
+    char timestamp[ACCESS_LOG_TIMESTAMP_LEN];
+    size_t len;
+    char data[ACCESS_LOG_BUFFER_SIZE];
+} access_log_buffer;
+
+/**
+ * @brief Format a log line.
+ *
+ * @param entry what to log. Quotes, backslashes and control characters of the uri are escaped.
+ * @param timestamp time of the request, as in "10/Oct/2000:13:55:36 -0700".
+ * @param line buffer to store the line in, newline included.
+ * @param max_len size of line, longer lines are cut short (but still end with a newline).
+ * @return size_t length of the line.
+ */
+size_t format_access_log_line(const access_log_entry *entry, const char *timestamp, char *line, size_t max_len);
+
+#endif
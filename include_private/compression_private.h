@@ -0,0 +1,66 @@
+#ifndef _COMPRESSION_PRIVATE
+#define _COMPRESSION_PRIVATE
+
+#include <pthread.h>
+#include "compression.h"
+#include "http.h"
+
+#define COMPRESSED_CACHE_BUCKETS 256 // Must be a power of 2
+#define MAX_COMPRESSIBLE_TYPES 20
+#define MAX_ENTRY_CACHE_FRACTION 4   // A single entry can use at most 1/4 of the cache
+
+struct _compressed_entry {
+    char path[MAX_SERVER_ROOT_LEN + MAX_URI_LEN];
+    ino_t ino;
+    time_t mtime;
+    off_t ressource_size;
+    content_coding coding;
+
+    char *data;
+    size_t data_len;
+
+    int refcount;                       /**< References held by the cache and in flight responses. */
+    bool cached;                        /**< Still reachable from the cache index. */
+    struct _compressed_entry *hash_next;
+    struct _compressed_entry *lru_prev; /**< Towards most recently used. */
+    struct _compressed_entry *lru_next; /**< Towards least recently used. */
+};
+
+/**
+ * @brief Compression in progress. Requests for the same version of a ressource wait
+ *        for its result instead of compressing it again.
+ */
+struct compression_flight {
+    char path[MAX_SERVER_ROOT_LEN + MAX_URI_LEN];
+    ino_t ino;
+    time_t mtime;
+    off_t ressource_size;
+    content_coding coding;
+
+    struct _compressed_entry *entry;    /**< Result, with a reference for each waiter. NULL if it failed. */
+    bool done;
+    int num_waiters;                    /**< The last one out frees the flight. */
+    pthread_cond_t done_cond;
+    struct compression_flight *next;
+};
+
+struct compressed_cache {
+    pthread_mutex_t lock;
+    size_t used;                                              /**< Bytes of compressed data held by cached entries. */
+    struct _compressed_entry *buckets[COMPRESSED_CACHE_BUCKETS];
+    struct _compressed_entry *lru_head;                       /**< Most recently used. */
+    struct _compressed_entry *lru_tail;                       /**< Least recently used, evicted first. */
+    struct compression_flight *flights;                       /**< Compressions in progress. */
+};
+
+/**
+ * @brief Drop every cached entry (entries in flight stay valid until released).
+ */
+void clear_compressed_cache();
+
+/**
+ * @brief Number of bytes of compressed data currently cached.
+ */
+size_t get_compressed_cache_usage();
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef _CONTENT_CODING_PRIVATE
+#define _CONTENT_CODING_PRIVATE
+
+#include <pthread.h>
+#include "content_coding.h"
+#include "http.h"
+
+#define SIDECAR_CACHE_SIZE 512 // Must be a power of 2
+
+typedef struct coding_map {
+    content_coding coding;
+    char *token;      /**< Accept-Encoding / Content-Encoding token. */
+    char *extension;  /**< Extension of precompressed siblings. */
+} coding_map;
+
+typedef struct sidecar_cache_entry {
+    char path[MAX_SERVER_ROOT_LEN + MAX_URI_LEN]; /**< Ressource path, empty for unused entries. */
+    ino_t ino;                                    /**< Inode of the ressource when probed. */
+    time_t mtime;                                 /**< Modification time of the ressource when probed. */
+    unsigned int available;                       /**< Mask of codings with an up to date sibling. */
+} sidecar_cache_entry;
+
+struct sidecar_cache {
+    pthread_rwlock_t lock;
+    sidecar_cache_entry entries[SIDECAR_CACHE_SIZE]; // Direct mapped on the path hash
+};
+
+/**
+ * @brief Forget every cached sibling lookup.
+ */
+void clear_precompressed_cache();
+
+#endif
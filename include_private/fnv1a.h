@@ -0,0 +1,29 @@
+#ifndef _FNV1A
+#define _FNV1A
+
+#include <stdint.h>
+
+#define FNV1A_OFFSET_BASIS 2166136261u
+#define FNV1A_PRIME 16777619u
+
+/**
+ * @brief Mix one more byte into an FNV-1a hash, starting from FNV1A_OFFSET_BASIS.
+ */
+static inline uint32_t fnv1a_add(uint32_t hash, unsigned char byte){
+    return (hash ^ byte) * FNV1A_PRIME;
+}
+
+/**
+ * @brief FNV-1a hash of a string (eg: a path or an uri), to index hash tables with.
+ */
+static inline uint32_t fnv1a(const char *str){
+    uint32_t hash = FNV1A_OFFSET_BASIS;
+
+    for(; *str; str++){
+        hash = fnv1a_add(hash, (unsigned char) *str);
+    }
+
+    return hash;
+}
+
+#endif
@@ -3,8 +3,16 @@
 
 #include <sys/stat.h>
 #include "http.h"
+#include "content_coding.h"
+#include "compression.h"
+#include "root_index.h"
 
-#define NUM_RECOGNIZED_EXT_MAPPINGS 5
+#define MAX_HEADER_LINE_LEN         512
+#define MAX_NUM_HEADER_LINES        100
+#define MAX_BYTE_RANGES             8
+#define MAX_BOUNDARY_LEN            40
+#define MAX_ETAG_LEN                60
+#define MAX_HTTP_DATE_LEN           40
 
 struct _http_req{
     http_method method;
@@ -15,8 +23,18 @@ struct _http_req{
     char _ressource_name[MAX_RESSOURCE_LEN];
     char _ressource_location[MAX_URL_LEN];
     char _ressource_abs_path[MAX_SERVER_ROOT_LEN + MAX_URI_LEN];
+
+    // Recognized request headers (see recognized_headers in http.c)
+    char _range[MAX_HEADER_VALUE_LEN];
+    char _if_range[MAX_HEADER_VALUE_LEN];
+    char _accept_encoding[MAX_HEADER_VALUE_LEN];
 };
 
+typedef struct byte_range {
+    off_t offset; /**< First byte of the range within the ressource. */
+    off_t length; /**< Number of bytes in the range. */
+} byte_range;
+
 struct _http_resp {
     char status[MAX_RESP_STATUS_LEN];
     char headers[MAX_RESP_HEADERS_LEN];
@@ -27,12 +45,31 @@ struct _http_resp {
     off_t            _content_len;
     char             _content_type[MAX_RES_TYPE_LEN];
     http_return_code _return_code;
+    off_t            _ressource_len; // Full size of the ressource, _content_len may only cover some ranges
+    time_t           _last_modified;
+    char             _etag[MAX_ETAG_LEN];
+    int              _num_ranges;    // 0 means the whole ressource is sent
+    byte_range       _ranges[MAX_BYTE_RANGES];
+    char             _boundary[MAX_BOUNDARY_LEN];
+    content_coding   _content_coding; // Coding of the bytes in ressource_fd
+    bool             _vary_encoding;  // Response depends on the request's Accept-Encoding
+    ino_t            _ressource_ino;
+    bool             _compressed_on_the_fly;
+    compressed_entry_t _body_entry;   // Compressed body sent in place of ressource_fd, NULL if unused
+    content_coding   _stream_coding;  // Coding to apply to ressource_fd while sending it
+    bool             _owns_ressource_fd; // ressource_fd must be closed with the response
+    bool             _holds_root_index;  // Entered the snapshot, must exit it with the response
+    root_index_hold_t _root_index_hold;  // Keeps the snapshot alive while the response is sent
+    const root_index_entry *_index_entry; // Snapshot entry of the requested ressource, NULL if not indexed
+    const char       *_mapped_body;   // Ressource content mapped in memory (site pack), NULL if sent from ressource_fd
+    bool             _looked_up;      // ressource_fd and _lookup_info were resolved by the I/O pool
+    struct stat      _lookup_info;
 };
 
-typedef struct ext_map {
-    char *extension;
-    char *content_type;
-} ext_map;
+typedef struct header_map {
+    char   *name;   /**< Header field name, matched case-insensitively. */
+    size_t offset;  /**< Offset of the destination buffer within struct _http_req. */
+} header_map;
 
 /**
  * @brief Allocate http_req without need of a client fd. This
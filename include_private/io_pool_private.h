@@ -0,0 +1,18 @@
+#ifndef _IO_POOL_PRIVATE
+#define _IO_POOL_PRIVATE
+
+#include <stdbool.h>
+#include "io_pool.h"
+
+/**
+ * @brief Lookup queued to the I/O threads, lives on the waiting worker's stack.
+ */
+typedef struct io_request {
+    const char *path;
+    io_lookup *result;          /**< fd is already set when only the first read is left. */
+    int completion_fd;          /**< eventfd of the waiting worker. */
+    struct io_request *followers; /**< Lookups of the same path waiting on this one, chained by next. */
+    struct io_request *next;
+} io_request;
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef _LOG_PRIVATE
+#define _LOG_PRIVATE
+
+#include <stdatomic.h>
+#include <time.h>
+#include "log.h"
+
+#define LOG_CACHE_LINE_SIZE 64
+
+typedef struct log_record {
+    struct timespec timestamp;  /**< When LOG was called, records of every thread are written in this order. */
+    log_level level;
+    char msg[MAX_LOG_LEVEL_NAME_LEN + MAX_LOG_MSG_LEN];
+} log_record;
+
+/**
+ * @brief Single producer (the owning thread), single consumer (the log thread) ring.
+ *        head and tail only grow, they're reduced modulo LOG_RING_SLOTS to index records.
+ */
+typedef struct log_ring {
+    _Atomic unsigned long head;           /**< Next record to write out, only moved by the log thread. */
+    char _head_pad[LOG_CACHE_LINE_SIZE - sizeof(unsigned long)];
+    _Atomic unsigned long tail;           /**< Next free record, only moved by the owning thread. */
+    _Atomic unsigned long num_dropped;    /**< Messages lost because the ring was full. */
+    char _tail_pad[LOG_CACHE_LINE_SIZE - 2 * sizeof(unsigned long)];
+    log_record records[LOG_RING_SLOTS];
+} log_ring;
+
+/**
+ * @brief Messages waiting to be written to one stream.
+ */
+typedef struct log_batch {
+    int fd;
+    size_t len;
+    char data[LOG_BATCH_SIZE];
+} log_batch;
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef _METRICS_PRIVATE
+#define _METRICS_PRIVATE
+
+#include <stdatomic.h>
+#include "metrics.h"
+
+#define METRICS_CACHE_LINE_SIZE 64
+#define NUM_METRICS_STATUS_CODES 11     // Codes of http_return_code, any other one is counted as "other"
+#define METRICS_SUB_BUCKET_BITS 4
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BUCKET_BITS) // Buckets per power of 2, so values are within 1/16th
+#define METRICS_MAX_EXPONENT 35                             // Up to 2^40ns (18 minutes), longer goes in the last bucket
+#define NUM_METRICS_BUCKETS ((METRICS_MAX_EXPONENT + 2) * METRICS_SUB_BUCKETS)
+#define NUM_METRICS_QUANTILES 4
+
+/**
+ * @brief Log-linear histogram of durations: values below METRICS_SUB_BUCKETS
+ *        have a bucket each, then every power of 2 is split in METRICS_SUB_BUCKETS.
+ */
+typedef struct metrics_histogram {
+    _Atomic unsigned long sum_ns;
+    _Atomic unsigned long buckets[NUM_METRICS_BUCKETS];
+} metrics_histogram;
+
+/**
+ * @brief Counters of one thread, only written by that thread.
+ *        Aligned so two threads never write the same cache line.
+ */
+typedef struct metrics_shard {
+    _Atomic unsigned long requests[NUM_METRICS_STATUS_CODES + 1]; /**< Indexed like metrics_status_codes, "other" last. */
+    _Atomic unsigned long sent_bytes;
+    _Atomic unsigned long busy_us;
+    _Atomic unsigned long connections_opened;
+    _Atomic unsigned long connections_closed;
+    _Atomic unsigned long cache_hits;
+    _Atomic unsigned long cache_misses;
+    metrics_histogram stages[NUM_METRICS_STAGES];
+} __attribute__((aligned(METRICS_CACHE_LINE_SIZE))) metrics_shard;
+
+/**
+ * @brief Sum of every shard.
+ */
+typedef struct metrics_totals {
+    unsigned long requests[NUM_METRICS_STATUS_CODES + 1];
+    unsigned long sent_bytes;
+    unsigned long busy_us;
+    unsigned long connections_opened;
+    unsigned long connections_closed;
+    unsigned long cache_hits;
+    unsigned long cache_misses;
+    struct {
+        unsigned long count;
+        unsigned long sum_ns;
+        unsigned long buckets[NUM_METRICS_BUCKETS];
+    } stages[NUM_METRICS_STAGES];
+} metrics_totals;
+
+extern const int metrics_status_codes[NUM_METRICS_STATUS_CODES];
+extern const char *metrics_stage_names[NUM_METRICS_STAGES];
+extern const double metrics_quantiles[NUM_METRICS_QUANTILES];
+
+/**
+ * @brief Get the histogram bucket a duration is counted in.
+ *
+ * @param ns the duration.
+ * @return int index of the bucket.
+ */
+int metrics_bucket_idx(unsigned long ns);
+
+/**
+ * @brief Get the longest duration counted in a bucket.
+ *
+ * @param idx index of the bucket.
+ * @return unsigned long the duration, in nanoseconds.
+ */
+unsigned long metrics_bucket_max_ns(int idx);
+
+/**
+ * @brief Get a percentile out of merged histogram buckets.
+ *
+ * @param buckets NUM_METRICS_BUCKETS counts.
+ * @param count sum of the counts.
+ * @param quantile between 0 and 1 (0.99 for the p99).
+ * @return unsigned long longest duration of the bucket the percentile falls in, 0 without any count.
+ */
+unsigned long get_metrics_percentile(const unsigned long *buckets, unsigned long count, double quantile);
+
+/**
+ * @brief Add up the counters of every thread.
+ *
+ * @param totals reference to store the sums in.
+ */
+void get_metrics_totals(metrics_totals *totals);
+
+/**
+ * @brief Format the metrics in the Prometheus text format.
+ *
+ * @param config what else to report (queue depth...), can be NULL.
+ * @param buff buffer to store the metrics in.
+ * @param max_len size of buff.
+ * @return size_t length of the metrics, cut short if they don't fit.
+ */
+size_t render_metrics(const metrics_config *config, char *buff, size_t max_len);
+
+/**
+ * @brief Answer one scrape (or anything else with a 404) and close client_fd.
+ *
+ * @param client_fd connection of the scraper.
+ */
+void serve_metrics_client(int client_fd);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef _MIME_PRIVATE
+#define _MIME_PRIVATE
+
+#include "mime.h"
+#include "http.h"
+
+#define MIME_REGISTRY_SIZE 4096                          // Must be a power of 2
+#define MAX_MIME_REGISTRY_LOAD (MIME_REGISTRY_SIZE / 2)  // Keep probe sequences short
+#define MAX_MIME_LINE_LEN 1024
+
+typedef struct ext_map {
+    char *extension;
+    char *content_type;
+} ext_map;
+
+typedef struct mime_entry {
+    char extension[MAX_RES_EXT_LEN]; /**< Lowercase extension without the '.', empty for unused slots. */
+    char content_type[MAX_RES_TYPE_LEN];
+} mime_entry;
+
+struct mime_registry {
+    int num_entries;
+    mime_entry entries[MIME_REGISTRY_SIZE]; /**< Open addressing with linear probing. */
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef _PREWARM_PRIVATE
+#define _PREWARM_PRIVATE
+
+#include "prewarm.h"
+
+typedef struct prewarm_path {
+    char uri[MAX_URI_LEN];
+    unsigned long hits;        /**< Times the path appears in the source. */
+    unsigned long first_seen;  /**< Line of the first appearance, breaks ties (manifests keep their order). */
+} prewarm_path;
+
+/**
+ * @brief Extract the requested path from a manifest or access log line.
+ *
+ * @param line line to parse.
+ * @param uri buffer of MAX_URI_LEN bytes to store the path in, without query string.
+ * @return int 0 if the line names a path, otherwise -1 (comments, other methods, malformed...).
+ */
+int parse_prewarm_line(const char *line, char *uri);
+
+/**
+ * @brief Pick the most requested paths of a manifest or access log.
+ *
+ * @param source file to read.
+ * @param top maximum number of paths to pick.
+ * @param paths reference to store the picked paths in, most requested first. Must be freed.
+ * @return int number of paths picked, -1 if the source can't be read.
+ */
+int select_prewarm_paths(const char *source, int top, prewarm_path **paths);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef _ROOT_INDEX_PRIVATE
+#define _ROOT_INDEX_PRIVATE
+
+#include <stdatomic.h>
+#include "root_index.h"
+
+#define MAX_ROOT_INDEX_ENTRIES 4096  // Each entry holds an fd open
+#define MAX_PACK_INDEX_CAPACITY (1 << 20) // Pack entries hold no fd, only memory
+#define MAX_ROOT_INDEX_READERS 64    // Threads that can use a snapshot
+#define MAX_ROOT_INDEX_DEPTH 16
+#define ROOT_INDEX_GRACE_POLL_US 1000
+#define CACHE_LINE_SIZE 64
+
+struct root_index {
+    size_t capacity;              /**< Number of slots in entries, a power of 2. */
+    size_t num_entries;
+    bool complete;                /**< Every regular file of the server root fit in the snapshot. */
+    root_index_entry *entries;    /**< Open addressing with linear probing, empty uri for unused slots. */
+    void *pack;                   /**< Mapped site pack the entries point into, NULL for a walked server root. */
+    size_t pack_len;
+    _Atomic int refs;             /**< 1 while it's the current snapshot, plus one per hold. */
+};
+
+/**
+ * @brief Reader announcement, padded so readers don't share cache lines.
+ */
+typedef struct root_index_reader {
+    _Atomic unsigned long epoch;  /**< Epoch seen when entering, 0 while not using a snapshot. */
+    char _pad[CACHE_LINE_SIZE - sizeof(unsigned long)];
+} root_index_reader;
+
+#endif
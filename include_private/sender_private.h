@@ -0,0 +1,43 @@
+#ifndef _SENDER_PRIVATE
+#define _SENDER_PRIVATE
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include "sender.h"
+#include "timer_wheel.h"
+
+struct _send_job {
+    int client_fd;
+    size_t head_len;
+    size_t head_sent;
+    sendfile_op file;              /**< in_fd is owned by the job (through snapshot if set), -1 if unused. */
+    root_index_hold_t snapshot;    /**< Snapshot in_fd belongs to, NULL if the job closes in_fd. */
+    size_t file_len;               /**< Bytes of in_fd the job sends in total. */
+    wheel_timer progress_timer;    /**< Jobs that don't progress for RIO_WRITE_TIMEOUT_MS are dropped. */
+    bool logs_access;              /**< Log the response once a sender thread is done with it. */
+    access_log_entry access;       /**< Strings point to the copies below (method excepted, it's static). */
+    char client_addr[INET6_ADDRSTRLEN];
+    char uri[MAX_URI_LEN];
+    char version[MAX_VER_LEN];
+    unsigned long picked_up_ns;    /**< duration_us of the logged response is measured from then. */
+    struct _send_job *prev;        /**< Jobs of the same sender thread. */
+    struct _send_job *next;
+    struct _send_job *next_submitted;
+    char head[];                   /**< Status and headers, sent before the file. */
+};
+
+/**
+ * @brief One sender thread and the jobs it multiplexes.
+ */
+typedef struct sender_thread {
+    pthread_t tid;
+    int epoll_fd;
+    pthread_mutex_t lock;          /**< Protects jobs and submitted, jobs are added by workers. */
+    struct _send_job *jobs;
+    size_t num_jobs;
+    struct _send_job *submitted;   /**< Jobs whose progress timer the thread has yet to arm. */
+    timer_wheel_t wheel;           /**< Only used by the sender thread. */
+} sender_thread;
+
+#endif
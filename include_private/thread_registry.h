@@ -0,0 +1,57 @@
+#ifndef _THREAD_REGISTRY
+#define _THREAD_REGISTRY
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/*
+ * Fixed array of per thread objects (log rings, access log buffers, metrics shards),
+ * written by their own thread and read by whoever aggregates them.
+ * Objects are never unregistered: they live as long as the process, so what a
+ * thread left behind is still read once it exited.
+ */
+typedef struct {
+    _Atomic(void *) *slots;
+    int max_slots;
+    _Atomic int num_slots;
+} thread_registry;
+
+#define THREAD_REGISTRY_INITIALIZER(SLOTS) {.slots = (SLOTS), .max_slots = sizeof(SLOTS) / sizeof((SLOTS)[0]), .num_slots = 0}
+
+/**
+ * @brief Claim a slot for the calling thread, to publish its object in once initialized.
+ *
+ * @return int index of the slot, -1 if every slot is taken.
+ */
+static inline int thread_registry_claim(thread_registry *registry){
+    int idx = atomic_fetch_add(&(registry->num_slots), 1);
+
+    return idx < registry->max_slots ? idx : -1;
+}
+
+/**
+ * @brief Make an initialized object visible to thread_registry_get.
+ */
+static inline void thread_registry_publish(thread_registry *registry, int idx, void *object){
+    atomic_store(&(registry->slots[idx]), object);
+}
+
+/**
+ * @brief Number of slots claimed so far, the indexes to go through with thread_registry_get.
+ */
+static inline int thread_registry_size(thread_registry *registry){
+    int num_slots = atomic_load(&(registry->num_slots));
+
+    return num_slots < registry->max_slots ? num_slots : registry->max_slots;
+}
+
+/**
+ * @brief Get the object published in a slot.
+ *
+ * @return void* the object, NULL if its thread is still initializing it.
+ */
+static inline void *thread_registry_get(thread_registry *registry, int idx){
+    return atomic_load(&(registry->slots[idx]));
+}
+
+#endif
@@ -0,0 +1,82 @@
+/**
+ * @file access_log.h
+ * @brief File containing the access log APIs.
+ *
+ * Every response is logged in the Common Log Format, followed by the time spent
+ * handling the request and waiting in the queue (both in microseconds):
+ *
+ *     127.0.0.1 - - [10/Oct/2000:13:55:36 -0700] "GET /index.html HTTP/1.1" 200 2326 153 12
+ *
+ * Responses handed off to a sender thread are logged by it once it's done with
+ * them, with the bytes it actually sent.
+ *
+ * Workers format lines into a buffer of their own and write it out in one go
+ * (the file is opened with O_APPEND, so workers never lock each other out) when
+ * it fills up, or at least every ACCESS_LOG_FLUSH_INTERVAL_MS.
+ *
+ */
+
+#ifndef _ACCESS_LOG
+#define _ACCESS_LOG
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define ACCESS_LOG_BUFFER_SIZE (64 * 1024)   // Per thread, written out in a single write when full
+#define MAX_ACCESS_LOG_LINE_LEN 1024
+#define MAX_ACCESS_LOG_BUFFERS 128           // Threads that get a buffer, the others write each line
+#define ACCESS_LOG_FLUSH_INTERVAL_MS 1000    // Longest a line waits in a buffer
+
+typedef struct access_log_entry {
+    const char *client_addr;   /**< Numeric address of the client. */
+    const char *method;
+    const char *uri;
+    const char *version;       /**< HTTP version, without the "HTTP/" prefix. */
+    int status_code;
+    off_t bytes_sent;          /**< Body bytes, headers excluded. */
+    long duration_us;          /**< From the request being picked up by a worker to the response being sent (by a sender thread if handed off). */
+    long queue_wait_us;        /**< From the connection being accepted to a worker picking it up. */
+} access_log_entry;
+
+
+/**
+ * @brief Open (or create) the access log and start flushing it periodically.
+ *
+ * @param path file to append to.
+ * @return int 0 on success, otherwise -1.
+ */
+int access_log_open(const char *path);
+
+
+/**
+ * @brief Check whether responses are logged.
+ *
+ * @return true if access_log_open succeeded (and access_log_close wasn't called).
+ */
+bool access_log_enabled();
+
+
+/**
+ * @brief Log a response, from the calling thread's buffer.
+ *
+ * @param entry what to log. Strings are copied.
+ */
+void access_log_write(const access_log_entry *entry);
+
+
+/**
+ * @brief Write out every buffered line, then reopen the access log under its path.
+ *
+ * @note Meant to be called after the log was moved away to rotate it.
+ *
+ * @return int 0 on success, -1 if the log can't be reopened (lines keep going to the previous file).
+ */
+int access_log_reopen();
+
+
+/**
+ * @brief Write out every buffered line and close the access log.
+ */
+void access_log_close();
+
+#endif
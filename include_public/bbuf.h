@@ -30,6 +30,15 @@ void bbuf_destroy(bbuf_t bbuf_to_destroy);
  */
 int bbuf_insert(bbuf_t bbuf, int fd_to_insert);
 
+/**
+ * @brief Add an item to the bounded buffer if there's a free slot, without waiting for one.
+ * 
+ * @param bbuf reference to the bbuf_t handler you want to insert into.
+ * @param fd_to_insert int containing the file descriptor to insert into the buffer.
+ * @return int 0 on success of adding fd, -1 if the buffer is full (or on error).
+ */
+int bbuf_try_insert(bbuf_t bbuf, int fd_to_insert);
+
 /**
  * @brief Remove an item from the bounded buffer. This will block until
  * There's an item to remove from the buffer and the mutex can be acquired.
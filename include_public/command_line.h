@@ -2,17 +2,51 @@
 #define _CMD_LINE
 
 #include <stdbool.h>
+#include <netinet/in.h>
 
 #define MIN_ARGUMENTS 3
 #define PORT_MIN 1500
 #define PORT_MAX 10000
 #define MAX_SERVER_ROOT_LEN 500
+#define MAX_CLI_LIST_LEN 300
+
+#define DEFAULT_GZIP_LEVEL 6
+#define DEFAULT_GZIP_MIN_SIZE 1024
+#define DEFAULT_GZIP_CACHE_SIZE (32 * 1024 * 1024)
+#define DEFAULT_GZIP_TYPES "text/*,application/javascript,application/json,application/xml,image/svg+xml"
 
 extern char server_root_location[MAX_SERVER_ROOT_LEN];
 
 struct cli {
     int port; /**< Port in which the server will run locally. */
     char server_root[MAX_SERVER_ROOT_LEN]; /**< Relative path to where server ressources are located.*/
+    char mime_types[MAX_SERVER_ROOT_LEN];  /**< mime.types file mapping extensions to content types. */
+    bool snapshot_root;                    /**< Serve an in-memory snapshot of the server root, refreshed on SIGHUP. */
+    char pack_path[MAX_SERVER_ROOT_LEN];   /**< Site pack to serve in place of the server root, empty if unused. */
+
+    bool gzip_enabled;                  /**< Compress responses on the fly when there's no precompressed sibling. */
+    int gzip_level;                     /**< zlib compression level, 1 (fastest) to 9 (smallest). */
+    long gzip_min_size;                 /**< Ressources smaller than this (bytes) are sent uncompressed. */
+    long gzip_cache_size;               /**< Max bytes of compressed responses kept in memory. */
+    char gzip_types[MAX_CLI_LIST_LEN];  /**< Comma separated content types worth compressing (a "*" subtype matches a whole type). */
+
+    long io_sequential_min_size;        /**< Transfers from this size up are hinted as sequential and read ahead. */
+    long io_readahead_size;             /**< Bytes read ahead when a sequential transfer starts. */
+    long io_dontneed_min_size;          /**< Transfers from this size up are dropped from the page cache once sent, 0 to disable. */
+    bool hugepages;                     /**< Ask for transparent huge pages on site packs. */
+    int io_threads;                     /**< Threads resolving ressources that aren't cached, 0 to resolve them on the workers. */
+
+    char prewarm_source[MAX_SERVER_ROOT_LEN]; /**< Manifest or access log of the paths to warm up, empty if unused. */
+    int prewarm_top;                    /**< Number of most requested paths to warm up. */
+    long prewarm_budget;                /**< Bytes read per second while warming up, 0 for no limit. */
+
+    char access_log[MAX_SERVER_ROOT_LEN]; /**< File every response is logged to, empty if unused. */
+    int metrics_port;                   /**< Port metrics are served on, 0 if unused. */
+    char metrics_address[INET_ADDRSTRLEN]; /**< IPv4 address metrics are served on. */
+
+    int rate_limit;                     /**< Requests per second a client address can keep up, 0 for no limit. */
+    int rate_limit_burst;               /**< Requests a client address can send at once, 0 for rate_limit. */
+    int max_client_connections;         /**< Connections a client address can have open, 0 for no limit. */
 };
 
 
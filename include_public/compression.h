@@ -0,0 +1,127 @@
+/**
+ * @file compression.h
+ * @brief File containing APIs for compressing responses on the fly.
+ *
+ * Compressible ressources without a precompressed sibling are gzip/deflate
+ * compressed by the worker handling the request. Compressed bytes are kept
+ * in a bounded in-memory cache keyed on the ressource's path, version and coding,
+ * so each version of a ressource is compressed once. Ressources too big to be
+ * cached are compressed chunk by chunk while they're sent instead.
+ *
+ */
+
+#ifndef _COMPRESSION
+#define _COMPRESSION
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include "content_coding.h"
+
+#define COMPRESSION_CHUNK_SIZE (64 * 1024)
+
+typedef struct _compressed_entry *compressed_entry_t;
+
+typedef struct compression_config {
+    bool enabled;        /**< Compress responses on the fly. */
+    int level;           /**< zlib compression level (1-9). */
+    long min_size;       /**< Ressources smaller than this are sent uncompressed. */
+    long cache_size;     /**< Max bytes of compressed data kept in memory. */
+    const char *types;   /**< Comma separated content types to compress, a "*" subtype matches a whole type. */
+} compression_config;
+
+
+/**
+ * @brief Configure on the fly compression. Must be called before any worker starts.
+ *
+ * @param config compression settings to use.
+ * @return int 0 on success, otherwise -1.
+ */
+int compression_init(const compression_config *config);
+
+
+/**
+ * @brief Check whether a ressource should be compressed on the fly.
+ *
+ * @param content_type content type of the ressource.
+ * @param size size of the ressource in bytes.
+ * @return true if compression is enabled, the type is allowed and the ressource is big enough.
+ */
+bool compression_applies(const char *content_type, off_t size);
+
+
+/**
+ * @brief Get the codings that can be produced on the fly.
+ *
+ * @return unsigned int mask of codings (see CODING_MASK), 0 when compression is disabled.
+ */
+unsigned int compression_available_codings();
+
+
+/**
+ * @brief Get the compressed version of a ressource, compressing it if it's not cached yet.
+ *
+ * @note The returned entry holds a reference which must be dropped with
+ *       release_compressed_entry. Ressources that are too big to be cached
+ *       return NULL and should be sent with compress_stream instead.
+ *
+ * @param abs_path path of the ressource, used as cache key.
+ * @param ressource_fd fd to read the ressource from (its file offset isn't used).
+ * @param ressource_info metadata of ressource_fd.
+ * @param coding CODING_GZIP or CODING_DEFLATE.
+ * @return compressed_entry_t the compressed ressource, NULL if it must be streamed or on error.
+ */
+compressed_entry_t get_compressed_entry(const char *abs_path, int ressource_fd, const struct stat *ressource_info, content_coding coding);
+
+
+/**
+ * @brief Check whether a ressource of the given size fits in the compressed response cache.
+ */
+bool compression_is_cacheable(off_t size);
+
+
+/**
+ * @brief Get the compressed bytes held by an entry.
+ *
+ * @param entry entry returned by get_compressed_entry.
+ * @param data reference to store the pointer to the compressed bytes.
+ * @param data_len reference to store the number of compressed bytes.
+ * @return int 0 on success, otherwise -1.
+ */
+int get_compressed_entry_data(compressed_entry_t entry, const char **data, size_t *data_len);
+
+
+/**
+ * @brief Drop a reference to an entry returned by get_compressed_entry.
+ *
+ * @param entry pointer to the entry to release, set to NULL.
+ */
+void release_compressed_entry(compressed_entry_t *entry);
+
+
+/**
+ * @brief Compress num_bytes of in_fd into a newly allocated buffer, without caching it.
+ *
+ * @param in_fd File descriptor to read from (its file offset isn't used).
+ * @param num_bytes Number of bytes of in_fd to compress.
+ * @param coding CODING_GZIP or CODING_DEFLATE.
+ * @param out reference to store the compressed bytes, to be freed by the caller.
+ * @param out_len reference to store the number of compressed bytes.
+ * @return int 0 on success, otherwise -1.
+ */
+int compress_to_buffer(int in_fd, off_t num_bytes, content_coding coding, char **out, size_t *out_len);
+
+
+/**
+ * @brief Compress num_bytes of in_fd chunk by chunk and write the result to out_fd.
+ *
+ * @param out_fd File descriptor to write to.
+ * @param in_fd File descriptor to read from (its file offset isn't used).
+ * @param num_bytes Number of bytes of in_fd to compress.
+ * @param coding CODING_GZIP or CODING_DEFLATE.
+ * @param bytes_written if not NULL, set to the number of compressed bytes written to out_fd.
+ * @return int 0 if everything was compressed and written, otherwise -1.
+ */
+int compress_stream(int out_fd, int in_fd, off_t num_bytes, content_coding coding, off_t *bytes_written);
+
+#endif
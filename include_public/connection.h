@@ -0,0 +1,54 @@
+/**
+ * @file connection.h
+ * @brief File containing the APIs serving a client connection.
+ *
+ * serve_connection is all a worker does with a client fd it took out of the
+ * bounded buffer: parse the request, formulate and send the response, count
+ * and log it. It only needs a connected fd, so it can be driven in process
+ * (through a socketpair) as well as by the worker threads.
+ *
+ */
+
+#ifndef _CONNECTION
+#define _CONNECTION
+
+#include <netinet/in.h>
+#include "http.h"
+
+#define RESPONSE_HANDED_OFF 1 // The client fd now belongs to a sender thread
+
+typedef struct _connection_t {
+    unsigned long accepted_ns;              /**< metrics_now_ns() when accepted, 0 if unknown. */
+    char client_addr[INET6_ADDRSTRLEN];     /**< Empty if unknown. */
+} connection_t;
+
+
+/**
+ * @brief Serve the request of a client, then close client_fd (unless a
+ *        sender thread now owns it).
+ *
+ * @note If an error is encountered while handling the request, the server will
+ *       attempt to respond with the appropriate HTTP status code. If this is not possible,
+ *       client_fd is closed without a response.
+ *
+ * @param client_fd file descriptor of the client connection.
+ * @param connection client address and accept time of the connection, zeroed if unknown.
+ * @return int 0 if a response was sent (or handed off), otherwise -1.
+ */
+int serve_connection(int client_fd, const connection_t *connection);
+
+
+/**
+ * @brief Write the status line, headers and body of response to client_fd.
+ *
+ * @note The body is either the whole ressource or, for 206 responses, each of
+ *       the requested byte ranges preceded by their part headers (if any).
+ *
+ * @param client_fd file descriptor of the client connection.
+ * @param response the response to send.
+ * @return int 0 if the whole response was written, RESPONSE_HANDED_OFF if a
+ *         sender thread now owns client_fd, otherwise -1.
+ */
+int send_http_response(int client_fd, http_resp response);
+
+#endif
@@ -0,0 +1,103 @@
+/**
+ * @file content_coding.h
+ * @brief File containing helpers for negotiating the Content-Encoding of a response.
+ *
+ * Ressources can be shipped alongside precompressed siblings (eg: app.js.br, app.js.gz).
+ * These APIs parse what the client accepts and find out (once per ressource version)
+ * which siblings exist, so the compressed bytes can be sent as is with sendfile.
+ *
+ */
+
+#ifndef _CONTENT_CODING
+#define _CONTENT_CODING
+
+#include <stdbool.h>
+#include <sys/stat.h>
+
+#define MAX_CODING_NAME_LEN 10
+
+// Note: If you need to add new elems to FOREACH macros, only append, don't insert
+
+#define FOREACH_CONTENT_CODING(CODING)                  \
+                    CODING(IDENTITY)                    \
+                    CODING(BROTLI)                      \
+                    CODING(GZIP)                        \
+                    CODING(DEFLATE)                     \
+                    CODING(CONTENT_CODING_MAX)
+
+#define CODING_ENUM_GEN(ENUM) CODING_##ENUM,
+
+typedef enum _content_coding {
+    FOREACH_CONTENT_CODING(CODING_ENUM_GEN)
+} content_coding;
+
+#define CODING_MASK(coding) (1u << (coding))
+
+/**
+ * @brief Get the Content-Encoding token for a coding (eg: "gzip").
+ *
+ * @param coding coding to get the token for.
+ * @return const char* the token, "identity" for unrecognized codings.
+ */
+const char *content_coding_token(content_coding coding);
+
+
+/**
+ * @brief Get the file extension of precompressed siblings for a coding (eg: ".gz").
+ *
+ * @param coding coding to get the extension for.
+ * @return const char* the extension, empty string for codings that are never precompressed.
+ */
+const char *content_coding_extension(content_coding coding);
+
+
+/**
+ * @brief Parse the value of an Accept-Encoding request header.
+ *
+ * @note Codings with q=0 are not acceptable. "*" accepts every coding that
+ *       isn't listed on its own (so "gzip;q=0, *" still refuses gzip).
+ *
+ * @param accept_encoding value of the header, can be empty.
+ * @return unsigned int mask of the acceptable codings (see CODING_MASK).
+ */
+unsigned int parse_accept_encoding(const char *accept_encoding);
+
+
+/**
+ * @brief Find out which precompressed siblings exist next to a ressource.
+ *
+ * @note Lookups are cached per ressource path and invalidated when the ressource's
+ *       inode or modification time change, so only the first request for a given
+ *       version of a ressource probes the filesystem. Siblings older than the
+ *       ressource are considered stale and ignored.
+ *
+ * @param abs_path absolute path of the uncompressed ressource.
+ * @param ressource_info metadata of the uncompressed ressource.
+ * @return unsigned int mask of the codings that have an up to date sibling.
+ */
+unsigned int get_precompressed_codings(const char *abs_path, const struct stat *ressource_info);
+
+
+/**
+ * @brief Get the codings the last lookup of a ressource found siblings for, without
+ *        checking whether the ressource changed since.
+ *
+ * @note Only a hint, to decide whether a ressource is worth stat'ing to go straight
+ *       to its sibling. The result of get_precompressed_codings is what counts.
+ *
+ * @param abs_path absolute path of the uncompressed ressource.
+ * @return unsigned int mask of the codings found by the last lookup, 0 if there was none.
+ */
+unsigned int peek_precompressed_codings(const char *abs_path);
+
+
+/**
+ * @brief Pick the coding to send among the available ones, by order of preference.
+ *
+ * @param accepted mask of the codings the client accepts.
+ * @param available mask of the codings that can be served.
+ * @return content_coding preferred coding, CODING_IDENTITY if none match.
+ */
+content_coding select_content_coding(unsigned int accepted, unsigned int available);
+
+#endif
@@ -11,6 +11,7 @@
 
 #include <stdlib.h>
 #include "command_line.h"
+#include "content_coding.h"
 
 #define MAX_METHOD_LEN        5
 #define MAX_URL_LEN           50
@@ -18,10 +19,13 @@
 #define MAX_URI_LEN           MAX_URL_LEN + MAX_RESSOURCE_LEN
 #define MAX_VER_LEN           4  // 1.0, 1.1, etc. 
 #define MAX_RES_EXT_LEN       10
-#define MAX_RES_TYPE_LEN      30
+#define MAX_RES_TYPE_LEN      80
+
+#define MAX_HEADER_VALUE_LEN  200
 
 #define MAX_RESP_STATUS_LEN  60
 #define MAX_RESP_HEADERS_LEN 500
+#define MAX_RANGE_PART_HEADERS_LEN 200
 
 #define ENUM_GEN(ENUM) ENUM,
 #define STRING_GEN(STRING) #STRING,
@@ -43,13 +47,17 @@
 
 typedef struct _http_req *http_req;
 typedef struct _http_resp *http_resp;
+struct root_index; // Snapshot, see root_index.h (which includes this file)
 
 
 typedef enum _http_return_code {
     OK                  = 200,
+    PARTIAL_CONTENT     = 206,
     BAD_REQUEST         = 400,
     UNAUTHORIZED        = 401, 
     FILE_NOT_FOUND      = 404,
+    RANGE_NOT_SATISFIABLE = 416,
+    TOO_MANY_REQUESTS   = 429,
     INTERNAL_ERROR      = 500,
     NOT_IMPLEMENTED     = 501,
     SERVICE_UNAVAILABLE = 503,
@@ -143,6 +151,15 @@ http_resp get_http_response_from_request(http_req request_to_process);
 http_resp get_server_shutting_down_response();
 
 
+/**
+ * @brief Get a response object with status code and headers telling a
+ *        client that it sent too many requests.
+ * 
+ * @return http_resp the initialized too many requests response object.
+ */
+http_resp get_too_many_requests_response();
+
+
 /**
  * @brief Get the http response status
  * 
@@ -174,6 +191,19 @@ int get_http_response_content_size(http_resp response, off_t *content_size);
 int get_http_response_ressource_fd(http_resp response, int *ressource_fd);
 
 
+/**
+ * @brief Take the ressource fd away from the response, it's no longer released with it.
+ *
+ * @note An fd shared with a snapshot comes with the snapshot hold keeping it open,
+ *       to release with root_index_release instead of closing the fd.
+ *
+ * @param response the response from which to take the ressource fd
+ * @param snapshot reference to store the snapshot hold, set to NULL if the fd is the caller's to close
+ * @return int the ressource fd, -1 if there is none (or it couldn't be taken)
+ */
+int take_http_response_ressource_fd(http_resp response, struct root_index **snapshot);
+
+
 /**
  * @brief Get the http response headers
  * 
@@ -204,4 +234,75 @@ int get_http_response_type(http_resp response, int *type);
 int get_http_response_status_code(http_resp response, int *status_code);
 
 
+/**
+ * @brief Get the number of byte ranges that make up the response body.
+ * 
+ * @param response the response from which to retrieve the number of ranges.
+ * @param num_ranges reference to store the number of ranges. 0 means the whole
+ *                   ressource is sent (see get_http_response_content_size).
+ * @return int 0 if the number of ranges was retrieved, otherwise -1
+ */
+int get_http_response_num_ranges(http_resp response, int *num_ranges);
+
+
+/**
+ * @brief Get one of the byte ranges that make up a 206 response body.
+ * 
+ * @note For multipart/byteranges responses, part_headers holds the boundary and
+ *       part headers that must be written before the range. It's empty for single ranges.
+ * 
+ * @param response the response from which to retrieve the range.
+ * @param range_idx index of the range, in [0, num_ranges).
+ * @param offset reference to store the offset of the range within the ressource fd.
+ * @param length reference to store the number of bytes in the range.
+ * @param part_headers buffer to store the part headers.
+ * @param max_part_headers_len max length of part headers to copy into provided buffer.
+ * @return int 0 if the range was retrieved, otherwise -1
+ */
+int get_http_response_range(http_resp response, int range_idx, off_t *offset, off_t *length, 
+                            char *part_headers, size_t max_part_headers_len);
+
+
+/**
+ * @brief Get what needs to be written after the last range of a response body.
+ * 
+ * @note This is the closing boundary for multipart/byteranges responses, otherwise empty.
+ * 
+ * @param response the response from which to retrieve the trailer.
+ * @param trailer buffer to store the trailer.
+ * @param max_trailer_len max length of trailer to copy into provided buffer.
+ * @return int 0 if the trailer was retrieved, otherwise -1
+ */
+int get_http_response_range_trailer(http_resp response, char *trailer, size_t max_trailer_len);
+
+
+/**
+ * @brief Get the in memory body to send in place of the ressource fd.
+ *
+ * @note Set for ressources compressed on the fly that fit in the compressed cache,
+ *       and for ressources served from a site pack (where ranges index into the body).
+ *       The body stays valid until the response is destroyed.
+ *
+ * @param response http_resp handle.
+ * @param body reference to store the body, set to NULL when the ressource fd should be sent.
+ * @param body_len reference to store the number of bytes in body.
+ * @return int 0 if the body was retrieved, otherwise -1
+ */
+int get_http_response_body(http_resp response, const char **body, size_t *body_len);
+
+
+/**
+ * @brief Get the coding to apply to the ressource fd while sending it.
+ *
+ * @note Set for ressources too big to be compressed up front. The response then has
+ *       no Content-length, its end is signaled by closing the connection, and the
+ *       content size is the number of bytes to read from the ressource fd.
+ *
+ * @param response http_resp handle.
+ * @param coding reference to store the coding, CODING_IDENTITY if the fd is sent as is.
+ * @return int 0 if the coding was retrieved, otherwise -1
+ */
+int get_http_response_stream_coding(http_resp response, content_coding *coding);
+
+
 #endif
\ No newline at end of file
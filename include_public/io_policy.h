@@ -0,0 +1,95 @@
+/**
+ * @file io_policy.h
+ * @brief File containing APIs applying page cache hints based on the size of what's sent.
+ *
+ * Ressources fall in size classes, each with its own I/O policy:
+ *
+ *   - small (below sequential_min_size): left to the kernel's default heuristics.
+ *   - large: POSIX_FADV_SEQUENTIAL and an explicit readahead() of the start of the
+ *     transfer, so the first chunks are read in big sequential requests.
+ *   - very large (dontneed_min_size and up, when set): on top of that, dropped from
+ *     the page cache (POSIX_FADV_DONTNEED) once sent, so one cold download doesn't
+ *     evict the hot set.
+ *
+ * Mapped content (site packs) can also ask for transparent huge pages.
+ *
+ */
+
+#ifndef _IO_POLICY
+#define _IO_POLICY
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define DEFAULT_IO_SEQUENTIAL_MIN_SIZE (1024 * 1024)
+#define DEFAULT_IO_READAHEAD_SIZE (2 * 1024 * 1024)
+#define DEFAULT_IO_DONTNEED_MIN_SIZE 0 // Disabled
+#define DEFAULT_IO_RESIDENCY_SAMPLE_RATE 64
+
+typedef struct io_policy_config {
+    long sequential_min_size;  /**< Transfers from this size up are hinted as sequential, 0 to disable. */
+    long readahead_size;       /**< Bytes read ahead when a sequential transfer starts, 0 to disable. */
+    long dontneed_min_size;    /**< Transfers from this size up are dropped from the page cache once sent, 0 to disable. */
+    long residency_sample_rate; /**< 1 in N read aheads first checks what's already cached (mmap + mincore), 0 to disable. */
+    bool hugepages;            /**< Ask for transparent huge pages on mapped content. */
+} io_policy_config;
+
+typedef struct io_policy_counters {
+    unsigned long sequential_hints;   /**< Transfers hinted as sequential. */
+    unsigned long readahead_bytes;    /**< Bytes explicitly read ahead. */
+    unsigned long sampled_bytes;      /**< Of those, bytes checked against the page cache. */
+    unsigned long resident_bytes;     /**< Of the sampled bytes, the ones already in the page cache (no I/O needed). */
+    unsigned long dontneed_hints;     /**< Transfers dropped from the page cache once sent. */
+    unsigned long dontneed_bytes;
+    unsigned long hugepage_mappings;  /**< Mappings that accepted MADV_HUGEPAGE. */
+    unsigned long hugepage_failures;  /**< Mappings that refused it (eg: no THP support for the filesystem). */
+} io_policy_counters;
+
+
+/**
+ * @brief Set the I/O policies. Must be called before any worker starts.
+ *
+ * @param config thresholds to use.
+ * @return int 0 on success, otherwise -1.
+ */
+int io_policy_init(const io_policy_config *config);
+
+
+/**
+ * @brief Apply the policy of a transfer that's about to start.
+ *
+ * @param fd file being sent.
+ * @param offset offset of the first byte sent.
+ * @param length number of bytes sent.
+ */
+void io_policy_before_send(int fd, off_t offset, off_t length);
+
+
+/**
+ * @brief Apply the policy of a transfer that completed.
+ *
+ * @param fd file that was sent.
+ * @param offset offset of the first byte sent.
+ * @param length number of bytes sent.
+ */
+void io_policy_after_send(int fd, off_t offset, off_t length);
+
+
+/**
+ * @brief Apply the policy of content mapped in memory.
+ *
+ * @param addr start of the mapping, page aligned.
+ * @param length length of the mapping.
+ */
+void io_policy_map(void *addr, size_t length);
+
+
+/**
+ * @brief Get a snapshot of the counters.
+ *
+ * @param counters reference to store the counters in.
+ */
+void get_io_policy_counters(io_policy_counters *counters);
+
+#endif
@@ -0,0 +1,83 @@
+/**
+ * @file io_pool.h
+ * @brief File containing APIs for resolving ressources on a dedicated blocking I/O thread pool.
+ *
+ * On a cold cache, looking a ressource up (path walk, open, fstat) and reading
+ * its first page can block for milliseconds on slow or network backed disks.
+ * Lookups are first tried inline without blocking (RESOLVE_CACHED path walk,
+ * RWF_NOWAIT read), so anything already in the dentry/inode/page caches is
+ * resolved right away. Only what would block is queued to the I/O threads,
+ * which signal completion to the waiting worker through its eventfd - hot
+ * lookups never queue behind cold ones. Concurrent cold lookups of the same
+ * path are coalesced: the first one does the I/O, the others get a duplicate
+ * of its fd.
+ *
+ * The pool is disabled (every lookup done inline, the historical behaviour)
+ * until io_pool_init is called with at least one thread.
+ *
+ */
+
+#ifndef _IO_POOL
+#define _IO_POOL
+
+#include <stdbool.h>
+#include <sys/stat.h>
+
+#define MAX_IO_THREADS 64
+#define IO_POOL_FIRST_READ_SIZE (64 * 1024) // Read on behalf of the worker so the first send doesn't block
+
+typedef struct io_lookup {
+    int fd;             /**< Ressource opened read only, -1 on failure. */
+    int error;          /**< errno of the step that failed, 0 on success. */
+    struct stat info;   /**< Metadata of fd. */
+} io_lookup;
+
+typedef struct io_pool_counters {
+    unsigned long cached_lookups;     /**< Lookups resolved inline, without blocking. */
+    unsigned long offloaded_lookups;  /**< Lookups handed to the I/O threads. */
+    unsigned long coalesced_lookups;  /**< Of those, lookups served by a lookup of the same path in progress. */
+    unsigned long first_reads;        /**< Lookups that also had to read the first page in. */
+} io_pool_counters;
+
+
+/**
+ * @brief Start the I/O threads.
+ *
+ * @param num_threads number of I/O threads, at most MAX_IO_THREADS.
+ * @return int 0 on success, otherwise -1.
+ */
+int io_pool_init(int num_threads);
+
+
+/**
+ * @brief Check whether lookups go through the pool.
+ */
+bool io_pool_enabled();
+
+
+/**
+ * @brief Open a ressource read only and get its metadata, making sure the start
+ *        of its content is in the page cache. Blocks the caller until done, but
+ *        cold lookups run on the I/O threads.
+ *
+ * @param path path of the ressource.
+ * @param result reference to store the lookup in. On success, the caller owns result->fd.
+ * @return int 0 on success, otherwise -1 with result->error set.
+ */
+int io_pool_lookup(const char *path, io_lookup *result);
+
+
+/**
+ * @brief Get a snapshot of the counters.
+ *
+ * @param counters reference to store the counters in.
+ */
+void get_io_pool_counters(io_pool_counters *counters);
+
+
+/**
+ * @brief Complete queued lookups, then stop the I/O threads. Lookups are done inline from then on.
+ */
+void io_pool_destroy();
+
+#endif
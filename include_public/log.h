@@ -1,9 +1,33 @@
+/**
+ * @file log.h
+ * @brief File containing the logging APIs.
+ *
+ * Once log_init is called, LOG only formats the message into a ring buffer
+ * owned by the calling thread, without taking any lock. A background thread
+ * drains every ring, in timestamp order, and writes the messages in batches.
+ * Before that (or when a thread can't get a ring), messages are written
+ * synchronously.
+ *
+ * Calls below SWS_MIN_LOG_LEVEL (set at build time) are compiled out, calls
+ * below the runtime level only cost a predicted branch.
+ *
+ */
+
 #ifndef __LOG
 #define __LOG
 #include <stdio.h>
 #include <string.h>
 
 #define MAX_LOG_MSG_LEN 1000
+#define MAX_LOG_LEVEL_NAME_LEN 30
+#define LOG_RING_SLOTS 256            // Messages a thread can have waiting, must be a power of 2
+#define MAX_LOG_RINGS 128             // Threads that get a ring, the others log synchronously
+#define LOG_FLUSH_INTERVAL_MS 10      // How often the log thread looks for new messages
+#define LOG_BATCH_SIZE (64 * 1024)
+
+#ifndef SWS_MIN_LOG_LEVEL
+#define SWS_MIN_LOG_LEVEL DEBUG
+#endif
 
 typedef enum _log_level {
     DEBUG,
@@ -14,22 +38,47 @@ typedef enum _log_level {
     MAX_LEVEL
 } log_level;
 
+extern log_level user_provided_log_level;
+
+
+// Levels below the default are expected to be filtered out, the others to be logged
+#define LOG_LEVEL_ENABLED(level)                                      \
+        ((level) >= SWS_MIN_LOG_LEVEL && (level) < MAX_LEVEL &&       \
+         __builtin_expect((level) >= user_provided_log_level, (level) >= DEFAULT))
+
 
 #define LOG(level, ...)                                               \
         do {                                                          \
-            extern log_level user_provided_log_level;                 \
-                                                                      \
-            if(level < 0 || level >= MAX_LEVEL) break;                \
-            else if(level < user_provided_log_level) break;           \
-                                                                      \
-            char __log[MAX_LOG_MSG_LEN+30] = {0};                                     \
-            char __usr_msg[MAX_LOG_MSG_LEN] = {0};                    \
+            if(!LOG_LEVEL_ENABLED(level)) break;                      \
                                                                       \
-            sprintf(__log, "%s:", #level);                            \
-            snprintf(__usr_msg, MAX_LOG_MSG_LEN, __VA_ARGS__);        \
-            strcat(__log, __usr_msg);                                 \
-            fprintf(level <= INFO ? stdout : stderr, "%s", __log);    \
+            log_message(level, #level, __VA_ARGS__);                  \
                                                                       \
         } while (0)
 
-#endif
\ No newline at end of file
+
+/**
+ * @brief Start the log thread, messages are written asynchronously from then on.
+ *
+ * @note Everything still queued is written at exit.
+ *
+ * @return int 0 on success, otherwise -1 (messages keep being written synchronously).
+ */
+int log_init();
+
+
+/**
+ * @brief Queue a message, use LOG instead.
+ *
+ * @param level level of the message, DEBUG and INFO go to stdout, the others to stderr.
+ * @param level_name name the message is prefixed with.
+ * @param format printf format of the message.
+ */
+void log_message(log_level level, const char *level_name, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+
+/**
+ * @brief Stop the log thread and write every queued message. Logging is synchronous from then on.
+ */
+void log_flush();
+
+#endif
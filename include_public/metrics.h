@@ -0,0 +1,114 @@
+/**
+ * @file metrics.h
+ * @brief File containing the metrics APIs.
+ *
+ * Counters are sharded per thread: every thread only writes its own cache line
+ * aligned shard, with plain (relaxed) loads and stores, and shards are only
+ * added up when the metrics are scraped. So counting a request costs a couple
+ * of additions, without any atomic read-modify-write on a shared line.
+ *
+ * The time spent in each stage of the request pipeline goes in per thread
+ * log-linear (HDR style) histograms, merged on scrape and reported as percentiles.
+ *
+ * Metrics are served in the Prometheus text format, from memory, on their own
+ * port (GET /metrics), so scrapes never wait behind client requests. They're
+ * only served on the loopback interface unless another address is given.
+ *
+ */
+
+#ifndef _METRICS
+#define _METRICS
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include "bbuf.h"
+
+#define MAX_METRICS_SHARDS 128              // Threads that get a shard, the others share one (with atomic adds)
+#define METRICS_PATH "/metrics"
+#define DEFAULT_METRICS_ADDRESS "127.0.0.1"     // Only local scrapers, unless asked otherwise
+#define MAX_METRICS_REQUEST_LEN 1024
+#define MAX_METRICS_RESPONSE_LEN (16 * 1024)
+#define METRICS_CLIENT_TIMEOUT_SEC 1        // Scrapers that don't send their request by then are dropped
+
+// Stages of the request pipeline that are timed
+#define FOREACH_METRICS_STAGE(STAGE)                                                                                            \
+                    STAGE(STAGE_QUEUE_WAIT, "queue_wait")       /* Accepted until picked up by a worker */                      \
+                    STAGE(STAGE_PARSE, "parse")                 /* Reading and parsing the request */                           \
+                    STAGE(STAGE_VALIDATE, "validate")           /* Method, uri (snapshot lookup, access checks) and version */  \
+                    STAGE(STAGE_LOOKUP, "lookup")               /* Opening the ressource and getting its size */                \
+                    STAGE(STAGE_WRITE_HEADERS, "write_headers") /* Status line and headers, when written on their own */        \
+                    STAGE(STAGE_SEND, "send")                   /* Whole response, until sent or handed off to a sender thread */
+
+#define METRICS_STAGE_ENUM_GEN(ENUM, NAME) ENUM,
+
+typedef enum metrics_stage {
+    FOREACH_METRICS_STAGE(METRICS_STAGE_ENUM_GEN)
+    NUM_METRICS_STAGES
+} metrics_stage;
+
+typedef struct metrics_config {
+    const char *address;    /**< IPv4 address metrics are served on, NULL for DEFAULT_METRICS_ADDRESS. */
+    int port;               /**< Port metrics are served on. */
+    bbuf_t bbuf;            /**< Bounded buffer the queue depth is taken from. */
+    int num_workers;        /**< Number of worker threads, to put busy time in perspective. */
+} metrics_config;
+
+
+/**
+ * @brief Start serving the metrics on a background thread.
+ *
+ * @param config where to serve them and what to report. Copied.
+ * @return int 0 if the port was bound and the thread started, otherwise -1.
+ */
+int metrics_start(const metrics_config *config);
+
+
+/**
+ * @brief Stop serving the metrics. Counting goes on.
+ */
+void metrics_stop();
+
+
+/**
+ * @brief Count a response.
+ *
+ * @param status_code status code of the response.
+ * @param bytes_sent body bytes sent (or handed off to be sent).
+ * @param busy_us time the worker spent on the request.
+ */
+void metrics_count_request(int status_code, off_t bytes_sent, long busy_us);
+
+
+/**
+ * @brief Get a timestamp to time a stage with.
+ *
+ * @return unsigned long monotonic time in nanoseconds.
+ */
+unsigned long metrics_now_ns();
+
+
+/**
+ * @brief Record the time spent in a stage of the request pipeline.
+ *
+ * @param stage the stage.
+ * @param started_ns metrics_now_ns() when the stage started, it ends now.
+ */
+void metrics_record_stage(metrics_stage stage, unsigned long started_ns);
+
+
+/**
+ * @brief Count a client connection being accepted or closed.
+ *
+ * @param opened true when accepted, false when closed.
+ */
+void metrics_count_connection(bool opened);
+
+
+/**
+ * @brief Count a lookup of the compressed response cache.
+ *
+ * @param hit true if the response was already compressed (or being compressed by another worker).
+ */
+void metrics_count_cache_lookup(bool hit);
+
+#endif
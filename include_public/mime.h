@@ -0,0 +1,39 @@
+/**
+ * @file mime.h
+ * @brief File containing APIs for mapping ressources to their Content-Type.
+ *
+ * The registry is built once at startup from a mime.types file (one type per
+ * line followed by its extensions) and is read-only afterwards, so lookups
+ * from the workers need no locking.
+ *
+ */
+
+#ifndef _MIME
+#define _MIME
+
+#define DEFAULT_MIME_TYPES_PATH "/etc/mime.types"
+#define DEFAULT_CONTENT_TYPE "text/plain"
+
+/**
+ * @brief Build the registry from a mime.types file. Must be called before any worker starts.
+ *
+ * @note A handful of common types are always registered, so the server still
+ *       serves sensible types when the file can't be read.
+ *
+ * @param mime_types_path path of the file to load, NULL for DEFAULT_MIME_TYPES_PATH.
+ * @return int number of extensions registered, -1 if the file couldn't be read.
+ */
+int mime_registry_init(const char *mime_types_path);
+
+
+/**
+ * @brief Get the Content-Type of a ressource from its last extension (case-insensitive).
+ *
+ * @note Doesn't allocate or log, this is called for every request.
+ *
+ * @param path path of the ressource, only the part after the last '/' is considered.
+ * @return const char* content type, NULL if the extension isn't registered.
+ */
+const char *get_mime_type(const char *path);
+
+#endif
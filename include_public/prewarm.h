@@ -0,0 +1,69 @@
+/**
+ * @file prewarm.h
+ * @brief File containing APIs for warming caches up after a restart.
+ *
+ * The most requested paths, taken from a manifest (one uri per line) or from a
+ * previous access log (Common Log Format), are read ahead into the page cache on
+ * a background thread. Compressible ones are also compressed into the compressed
+ * response cache, and looking them up fills the dentry and inode caches, so the
+ * first clients after a restart don't pay for a cold start.
+ *
+ * Reads are paced to stay under an I/O budget, so warming up doesn't compete
+ * with the traffic the server is already handling.
+ *
+ */
+
+#ifndef _PREWARM
+#define _PREWARM
+
+#include <stdbool.h>
+#include "http.h"
+
+#define DEFAULT_PREWARM_TOP 1000
+#define DEFAULT_PREWARM_BUDGET (32 * 1024 * 1024) // Bytes read ahead per second
+#define MAX_PREWARM_PATHS 65536                    // Distinct paths counted while reading the source
+#define MAX_PREWARM_LINE_LEN 2048
+#define PREWARM_PACE_SLICE_MS 100                  // Longest sleep between checks for a stop request
+
+typedef struct prewarm_config {
+    const char *source;        /**< Manifest or access log listing the paths to warm. */
+    const char *server_root;   /**< Directory the paths are relative to. */
+    int top;                   /**< Number of most requested paths to warm. */
+    long budget;               /**< Bytes read ahead per second, 0 for no limit. */
+} prewarm_config;
+
+typedef struct prewarm_stats {
+    unsigned long num_paths;   /**< Paths selected from the source. */
+    unsigned long num_warmed;  /**< Of those, paths that were found and read ahead. */
+    unsigned long bytes;       /**< Bytes read ahead. */
+    unsigned long num_compressed; /**< Paths added to the compressed response cache. */
+} prewarm_stats;
+
+
+/**
+ * @brief Warm the caches up on a background thread, returns right away.
+ *
+ * @note The mime registry, compression and snapshot (if any) must be initialized first.
+ *
+ * @param config what to warm and how fast. Strings are copied.
+ * @return int 0 if the thread started, otherwise -1.
+ */
+int prewarm_start(const prewarm_config *config);
+
+
+/**
+ * @brief Warm the caches up from the calling thread.
+ *
+ * @param config what to warm and how fast.
+ * @param stats reference to store what was warmed in, can be NULL.
+ * @return int 0 on success, -1 if the source can't be read.
+ */
+int prewarm_run(const prewarm_config *config, prewarm_stats *stats);
+
+
+/**
+ * @brief Interrupt the background warm up, if still running, and wait for its thread.
+ */
+void prewarm_stop();
+
+#endif
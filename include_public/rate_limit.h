@@ -0,0 +1,85 @@
+/**
+ * @file rate_limit.h
+ * @brief File containing the APIs limiting what a single client address can take.
+ *
+ * Every client address gets a token bucket of requests per second and a count
+ * of the connections it has open, checked when a connection is accepted (before
+ * it takes a slot of the bounded buffer). They live in a table split in
+ * RATE_LIMIT_SHARDS shards, each an open addressing table of RATE_LIMIT_SHARD_SLOTS
+ * entries updated with atomics only. Buckets are refilled lazily, from the time
+ * elapsed since they were last drawn from, so nothing runs in the background.
+ *
+ * Entries of clients without open connections and with a full bucket are reused
+ * for new addresses. If every entry a new address could go in is in use, the
+ * address isn't limited.
+ *
+ */
+
+#ifndef _RATE_LIMIT
+#define _RATE_LIMIT
+
+#include <stdbool.h>
+#include <sys/socket.h>
+
+#define RATE_LIMIT_SHARDS 16
+#define RATE_LIMIT_SHARD_SLOTS 4096     // Power of 2
+#define RATE_LIMIT_MAX_PROBES 16        // Entries looked at for an address before giving up
+#define MAX_RATE_LIMIT_BURST 16000      // Most requests a bucket holds
+#define MAX_RATE_LIMIT_RATE 1000000     // Most requests per second a bucket is refilled with
+
+typedef struct rate_limit_config {
+    int requests_per_sec;       /**< Requests per second a client can keep up, 0 for no limit. */
+    int burst;                  /**< Requests a client can send at once, 0 for requests_per_sec. */
+    int max_connections;        /**< Connections a client can have open at once, 0 for no limit. */
+    int max_fds;                /**< Client fds from this one up aren't counted against max_connections. */
+} rate_limit_config;
+
+typedef enum rate_limit_verdict {
+    RATE_LIMIT_ALLOW,
+    RATE_LIMIT_TOO_MANY_REQUESTS,       /**< The bucket of the client is empty, answer 429. */
+    RATE_LIMIT_TOO_MANY_CONNECTIONS     /**< The client has max_connections open already, close. */
+} rate_limit_verdict;
+
+
+/**
+ * @brief Allocate the table and start limiting clients.
+ *
+ * @param config limits, nothing is limited if both requests_per_sec and max_connections are 0.
+ * @return int 0 on success, otherwise -1.
+ */
+int rate_limit_init(const rate_limit_config *config);
+
+
+/**
+ * @brief Check whether clients are limited.
+ */
+bool rate_limit_enabled();
+
+
+/**
+ * @brief Take a token from the bucket of a client and count its new connection.
+ *
+ * @note Connections allowed in must be released with rate_limit_release once closed.
+ *
+ * @param client_fd file descriptor of the new connection.
+ * @param addr address of the client.
+ * @return rate_limit_verdict RATE_LIMIT_ALLOW if the connection can be served,
+ *         otherwise what the client went over (nothing is taken then).
+ */
+rate_limit_verdict rate_limit_admit(int client_fd, const struct sockaddr *addr);
+
+
+/**
+ * @brief Stop counting a connection against its client, once it's closed.
+ *
+ * @param client_fd file descriptor of the connection, nothing is done if it wasn't counted.
+ */
+void rate_limit_release(int client_fd);
+
+
+/**
+ * @brief Stop limiting clients and free the table.
+ */
+void rate_limit_destroy();
+
+#endif
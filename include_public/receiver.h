@@ -0,0 +1,70 @@
+/**
+ * @file receiver.h
+ * @brief File containing APIs for holding accepted connections until their request arrived.
+ *
+ * Workers read requests with blocking reads, so a client that connects and
+ * never sends a newline would hold a worker for as long as it likes. Accepted
+ * connections go to a small pool of receiver threads first, which wait with
+ * epoll until the request head (request line and headers) is complete and only
+ * then insert the connection in the bounded buffer. Nothing is read meanwhile,
+ * the head is peeked at, so workers parse it as before.
+ *
+ * Each receiver thread keeps the deadlines of its connections on a timing wheel.
+ * A connection is closed once it stayed silent for the idle timeout, or didn't
+ * complete its head within the header timeout however slowly it trickles it.
+ *
+ */
+
+#ifndef _RECEIVER
+#define _RECEIVER
+
+#include <stdbool.h>
+#include "bbuf.h"
+
+#define MAX_RECEIVER_THREADS 16
+#define RECEIVER_MAX_EVENTS 64
+#define RECEIVER_POLL_INTERVAL_MS 1000        // Longest wait for events, so a stop is noticed
+#define RECEIVER_TICK_MS 100                  // Resolution of the timeouts
+#define RECEIVER_RETRY_INTERVAL_MS 10         // Wait between attempts to queue requests while the bounded buffer is full
+#define RECEIVER_IDLE_TIMEOUT_MS 10000        // Longest silence before the request head is complete
+#define RECEIVER_HEADER_TIMEOUT_MS 30000      // Longest time from accept to a complete request head
+
+typedef struct receiver_config {
+    int num_threads;            /**< At most MAX_RECEIVER_THREADS. */
+    bbuf_t bbuf;                /**< Connections with a complete request head are inserted in it. */
+    int idle_timeout_ms;        /**< 0 for RECEIVER_IDLE_TIMEOUT_MS. */
+    int header_timeout_ms;      /**< 0 for RECEIVER_HEADER_TIMEOUT_MS. */
+} receiver_config;
+
+
+/**
+ * @brief Start the receiver threads.
+ *
+ * @param config number of threads, bounded buffer and timeouts.
+ * @return int 0 on success, otherwise -1.
+ */
+int receiver_pool_init(const receiver_config *config);
+
+
+/**
+ * @brief Check whether connections can be submitted.
+ */
+bool receiver_pool_running();
+
+
+/**
+ * @brief Hand an accepted connection over to the receiver threads. They now own
+ *        client_fd, it's either inserted in the bounded buffer or closed.
+ *
+ * @param client_fd socket of the connection.
+ * @return int 0 on success, -1 if the pool can't take it (client_fd is still the caller's).
+ */
+int receiver_submit(int client_fd);
+
+
+/**
+ * @brief Stop the receiver threads, closing the connections still waiting for their request.
+ */
+void receiver_pool_destroy();
+
+#endif
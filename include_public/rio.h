@@ -17,11 +17,32 @@
 
 #include <stddef.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #define RIO_BUFFSIZE 8192
+#define RIO_WRITE_TIMEOUT_MS 30000       // Longest wait for a non-blocking fd to become writable
+#define SENDFILE_CHUNK_SIZE (256 * 1024) // Most bytes sent per resume, so one big transfer can't hog its thread
 #define min(a,b) ((a) < (b) ? (a) : (b))
 
 typedef struct rio_struct *rio_t;
 
+typedef enum sendfile_status {
+    SENDFILE_DONE,     /**< Every byte was sent. */
+    SENDFILE_PENDING,  /**< A chunk was sent, resume to send the next one. */
+    SENDFILE_BLOCKED,  /**< out_fd is full (EAGAIN), resume once it's writable. */
+    SENDFILE_ERROR
+} sendfile_status;
+
+/**
+ * @brief State of a file transfer that can be resumed where it stopped.
+ */
+typedef struct sendfile_op {
+    int out_fd;         /**< Socket to write to, usually non-blocking. */
+    int in_fd;          /**< File to read from, its file offset is left untouched. */
+    off_t offset;       /**< Offset within in_fd of the next byte to send. */
+    size_t remaining;   /**< Bytes left to send. */
+    size_t chunk_size;  /**< Most bytes sent per call to sendfile_op_resume. */
+} sendfile_op;
+
 
 /**
  * @brief Initialize handler for descriptor fd.
@@ -66,6 +87,8 @@ ssize_t readline_b(rio_t rp, void *userbuf, size_t maxlen);
 /**
  * @brief Attempt to write num_bytes from a userbuf to fd.
  * 
+ * @note A non-blocking fd is waited on (up to RIO_WRITE_TIMEOUT_MS) whenever it's full.
+ * 
  * @param fd File descriptor to write to.
  * @param userbuf Pointer to buffer containing contents to write.
  * @param num_bytes Number of bytes to write from userbuf.
@@ -75,13 +98,55 @@ ssize_t writen_b(int fd, void *userbuf, size_t num_bytes);
 
 
 /**
- * @brief Attempt to write num_bytes from in_fd to out_fd.
+ * @brief Attempt to write every buffer of iov to fd, gathering them in as few syscalls as possible.
+ * 
+ * @note iov is updated as buffers get written, it can't be reused as is afterwards.
+ * 
+ * @param fd File descriptor to write to.
+ * @param iov Buffers to write, in order.
+ * @param iovcnt Number of buffers in iov.
+ * @return 0 if everything was written, otherwise -1.
+ */
+ssize_t writev_b(int fd, struct iovec *iov, int iovcnt);
+
+
+/**
+ * @brief Attempt to write num_bytes from in_fd, starting at offset, to out_fd.
+ * 
+ * @note The file offset of in_fd is left untouched, so the same in_fd can be
+ *       used to send several ranges of a file. The file is sent one chunk at a
+ *       time, waiting (up to RIO_WRITE_TIMEOUT_MS) whenever a non-blocking
+ *       out_fd is full.
  * 
  * @param out_fd File descriptor to write to.
  * @param in_fd File descriptor to read from.
+ * @param offset Offset within in_fd of the first byte to write.
  * @param num_bytes Number of bytes to write between fds.
  * @return 0 if everything was written, otherwise -1.
  */
-ssize_t writen(int out_fd, int in_fd, size_t num_bytes);
+ssize_t writen(int out_fd, int in_fd, off_t offset, size_t num_bytes);
+
+
+/**
+ * @brief Prepare a resumable transfer of num_bytes from in_fd, starting at offset, to out_fd.
+ * 
+ * @param op transfer to initialize.
+ * @param out_fd File descriptor to write to.
+ * @param in_fd File descriptor to read from.
+ * @param offset Offset within in_fd of the first byte to write.
+ * @param num_bytes Number of bytes to write between fds.
+ * @param chunk_size Most bytes to send per resume, 0 for SENDFILE_CHUNK_SIZE.
+ */
+void sendfile_op_init(sendfile_op *op, int out_fd, int in_fd, off_t offset, size_t num_bytes, size_t chunk_size);
+
+
+/**
+ * @brief Send the next chunk of a transfer, stopping early if out_fd would block.
+ * 
+ * @param op transfer to resume, its offset and remaining bytes are updated.
+ * @return sendfile_status SENDFILE_DONE once everything was sent, SENDFILE_PENDING or
+ *         SENDFILE_BLOCKED when it should be resumed later, SENDFILE_ERROR on failure.
+ */
+sendfile_status sendfile_op_resume(sendfile_op *op);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,127 @@
+/**
+ * @file root_index.h
+ * @brief File containing APIs for serving an immutable server root from an in-memory snapshot.
+ *
+ * When enabled, the server root is walked once and every regular file is kept
+ * open alongside its metadata and content type, so routing a request doesn't
+ * need any access/open/fstat syscall. The snapshot can be rebuilt (eg: on SIGHUP
+ * after a deploy) while requests are being served: readers never take a lock,
+ * they only announce when they start and stop using the snapshot, and the old
+ * snapshot is released once every reader that could see it is done.
+ *
+ * A snapshot can also be loaded from a site pack (see site_pack.h), in which case
+ * ressources are served straight from the mapped pack.
+ *
+ */
+
+#ifndef _ROOT_INDEX
+#define _ROOT_INDEX
+
+#include <stdbool.h>
+#include <sys/stat.h>
+#include "http.h"
+
+typedef struct root_index_entry {
+    char uri[MAX_URI_LEN];                 /**< Path relative to the server root (eg: /css/site.css). */
+    int fd;                                /**< Opened ressource (shared, never close it), -1 if it isn't readable. */
+    const char *data;                      /**< Content mapped in memory (site packs), NULL when served from fd. */
+    struct stat info;                      /**< Metadata of the ressource when the snapshot was taken. */
+    char content_type[MAX_RES_TYPE_LEN];
+    unsigned int precompressed;            /**< Mask of codings with an up to date sibling in the snapshot. */
+} root_index_entry;
+
+typedef struct root_index *root_index_hold_t;
+
+
+/**
+ * @brief Walk the server root and publish a new snapshot of it, replacing the current one.
+ *
+ * @note Blocks until no reader can still be looking up the replaced snapshot. Its fds are
+ *       closed once the last response holding it is done.
+ *       The mime registry must be initialized first.
+ *
+ * @param server_root directory to walk.
+ * @return int number of ressources in the new snapshot, -1 on error (the current snapshot is kept).
+ */
+int root_index_build(const char *server_root);
+
+
+/**
+ * @brief Map a site pack and publish it as the new snapshot, replacing the current one.
+ *
+ * @note Blocks until no reader can still be using the replaced snapshot, then releases it.
+ *
+ * @param pack_path site pack created with site_pack_write.
+ * @return int number of ressources in the new snapshot, -1 on error (the current snapshot is kept).
+ */
+int root_index_load_pack(const char *pack_path);
+
+
+/**
+ * @brief Rebuild the snapshot from where the current one came from (server root or site pack).
+ *
+ * @return int number of ressources in the new snapshot, -1 on error (the current snapshot is kept).
+ */
+int root_index_reload();
+
+
+/**
+ * @brief Check whether requests should be routed through a snapshot.
+ */
+bool root_index_enabled();
+
+
+/**
+ * @brief Start using the current snapshot from the calling thread.
+ *
+ * @note Entries returned by root_index_lookup stay valid (fds included) until root_index_exit.
+ *       Calls don't nest, each thread uses at most one snapshot at a time.
+ *
+ * @return int 0 on success, -1 if there is no snapshot (or too many reader threads).
+ */
+int root_index_enter();
+
+
+/**
+ * @brief Stop using the snapshot entered with root_index_enter.
+ */
+void root_index_exit();
+
+
+/**
+ * @brief Keep the snapshot entered by the calling thread alive past root_index_exit.
+ *
+ * @note Entries already looked up (fds and mapped data included) stay valid until the
+ *       hold is released, while reloads go ahead. Meant for responses, so a slow
+ *       client doesn't hold back a reload for as long as its transfer takes.
+ *
+ * @return root_index_hold_t to release with root_index_release, NULL if no snapshot was entered.
+ */
+root_index_hold_t root_index_hold();
+
+
+/**
+ * @brief Release a snapshot held with root_index_hold, freeing it if it was replaced since.
+ *
+ * @param hold reference to the hold, set to NULL.
+ */
+void root_index_release(root_index_hold_t *hold);
+
+
+/**
+ * @brief Find a ressource in the snapshot entered by the calling thread.
+ *
+ * @param uri path relative to the server root (eg: /index.html).
+ * @param authoritative set to true if the snapshot holds every ressource of the server
+ *                      root, meaning a miss is a ressource that doesn't exist.
+ * @return const root_index_entry* the ressource, NULL if it isn't in the snapshot.
+ */
+const root_index_entry *root_index_lookup(const char *uri, bool *authoritative);
+
+
+/**
+ * @brief Release the current snapshot and stop routing requests through it.
+ */
+void root_index_destroy();
+
+#endif
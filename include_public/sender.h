@@ -0,0 +1,129 @@
+/**
+ * @file sender.h
+ * @brief File containing APIs for handing responses over to dedicated sender threads.
+ *
+ * Workers parse requests and resolve ressources, then only try to send the
+ * response right away. Whatever a client doesn't take immediately (slow
+ * client, big download) becomes a send job: the remaining header bytes and
+ * the file region left to send. Jobs are multiplexed with epoll by a small
+ * pool of sender threads, one chunk at a time, so a few slow clients can't
+ * tie up the workers. Each thread keeps the progress timeouts of its jobs on a
+ * timing wheel, pushed back whenever a job sends something.
+ *
+ */
+
+#ifndef _SENDER
+#define _SENDER
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <time.h>
+#include "rio.h"
+#include "root_index.h"
+#include "access_log.h"
+
+#define MAX_SENDER_THREADS 16
+#define SENDER_MAX_EVENTS 64
+#define SENDER_POLL_INTERVAL_MS 1000   // Longest wait for events, so a stop is noticed
+#define SENDER_TICK_MS 100             // Resolution of the progress timeouts
+#define SENDER_DRAIN_TIMEOUT_MS 5000   // Time given to in flight jobs on shutdown
+
+typedef struct _send_job *send_job_t;
+
+
+/**
+ * @brief Start the sender threads.
+ *
+ * @param num_threads number of sender threads, at most MAX_SENDER_THREADS.
+ * @return int 0 on success, otherwise -1.
+ */
+int sender_pool_init(int num_threads);
+
+
+/**
+ * @brief Prepare the transfer of a response: head (status and headers) then
+ *        num_bytes of in_fd starting at offset.
+ *
+ * @note head is copied, while in_fd (and snapshot) now belong to the job, even if it
+ *       can't be created. client_fd isn't owned by the job until submitted.
+ *
+ * @param client_fd non-blocking socket to send to.
+ * @param head bytes to send before the file, can be NULL.
+ * @param head_len number of bytes in head.
+ * @param in_fd file to send from, -1 if there's nothing to send after head.
+ * @param offset offset within in_fd of the first byte to send.
+ * @param num_bytes number of bytes of in_fd to send.
+ * @param snapshot snapshot in_fd is shared with, released (in_fd left open) with the job.
+ *                 NULL if in_fd is closed with the job.
+ * @return send_job_t handle for the job, NULL on error.
+ */
+send_job_t send_job_create(int client_fd, const char *head, size_t head_len, int in_fd, off_t offset, size_t num_bytes, root_index_hold_t snapshot);
+
+
+/**
+ * @brief Have the sender thread log the response to the access log, if the job gets handed over.
+ *
+ * @note The line is written once the sender thread is done with the job, with the body
+ *       bytes actually sent and the time taken until then. Jobs that are never submitted
+ *       don't log anything, whoever sent the response logs it.
+ *
+ * @param job job sending the response.
+ * @param entry what to log, bytes_sent and duration_us are filled in by the sender thread.
+ *              Strings are copied, except method which must be static (eg: http_method_strings).
+ * @param picked_up_ns metrics_now_ns() when a worker picked up the request.
+ */
+void send_job_log_access(send_job_t job, const access_log_entry *entry, unsigned long picked_up_ns);
+
+
+/**
+ * @brief Send the next part of a job without blocking.
+ *
+ * @param job job to resume.
+ * @return sendfile_status SENDFILE_DONE once everything was sent, SENDFILE_PENDING or
+ *         SENDFILE_BLOCKED when it should be resumed later, SENDFILE_ERROR on failure.
+ */
+sendfile_status send_job_resume(send_job_t job);
+
+
+/**
+ * @brief Free a job that was never submitted. The client fd is left open.
+ *
+ * @param job reference to the job to destroy, set to NULL.
+ */
+void send_job_destroy(send_job_t *job);
+
+
+/**
+ * @brief Check whether jobs can be submitted.
+ */
+bool sender_pool_running();
+
+
+/**
+ * @brief Hand a job over to the sender threads. They now own it and its client fd,
+ *        which is closed once the job is done (or failed).
+ *
+ * @param job job to submit.
+ * @return int 0 on success, -1 if the pool can't take it (the job is still the caller's).
+ */
+int sender_submit(send_job_t job);
+
+
+/**
+ * @brief Give in flight jobs up to SENDER_DRAIN_TIMEOUT_MS to complete, then stop the sender threads.
+ */
+void sender_pool_destroy();
+
+
+/**
+ * @brief Give in flight jobs until deadline to complete, then stop the sender threads.
+ *
+ * @note Meant for shutdowns that already spent part of their time elsewhere, the
+ *       drain still never lasts more than SENDER_DRAIN_TIMEOUT_MS.
+ *
+ * @param deadline CLOCK_MONOTONIC time at which jobs still in flight are dropped.
+ */
+void sender_pool_destroy_by(const struct timespec *deadline);
+
+#endif
@@ -0,0 +1,62 @@
+/**
+ * @file site_pack.h
+ * @brief File containing the format of site packs and the API to create them.
+ *
+ * A site pack holds a whole server root in a single file, so it can be deployed
+ * as one unit and served from a single mmap instead of one fd per ressource:
+ *
+ *   site_pack_header | site_pack_entry[num_entries] (sorted by uri) | payloads
+ *
+ * Every payload starts on a page boundary. Precompressed siblings found in the
+ * server root (or generated while packing) are packed as ressources of their own
+ * and linked to the ressource they compress through its precompressed mask.
+ *
+ */
+
+#ifndef _SITE_PACK
+#define _SITE_PACK
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SITE_PACK_MAGIC "SWSPACK"
+#define SITE_PACK_VERSION 1
+#define SITE_PACK_MAX_URI_LEN 128
+#define SITE_PACK_MAX_TYPE_LEN 80
+#define SITE_PACK_ALIGNMENT 4096
+
+typedef struct site_pack_header {
+    char     magic[8];           /**< SITE_PACK_MAGIC, nul terminated. */
+    uint32_t version;
+    uint32_t num_entries;
+    uint64_t index_offset;       /**< Offset of the first site_pack_entry. */
+    uint64_t pack_size;          /**< Size of the whole pack, to detect truncated files. */
+} site_pack_header;
+
+typedef struct site_pack_entry {
+    char     uri[SITE_PACK_MAX_URI_LEN];           /**< Path relative to the server root (eg: /css/site.css). */
+    char     content_type[SITE_PACK_MAX_TYPE_LEN];
+    uint64_t offset;                               /**< Offset of the payload within the pack. */
+    uint64_t size;
+    int64_t  mtime;                                /**< Modification time of the packed file. */
+    uint64_t ino;                                  /**< Inode of the packed file, keeps entity tags stable across repacks. */
+    uint32_t precompressed;                        /**< Mask of codings with a sibling in the pack (see CODING_MASK). */
+    uint32_t _reserved;
+} site_pack_entry;
+
+
+/**
+ * @brief Pack every regular file under server_root into a site pack.
+ *
+ * @note Content types come from the mime registry, which must be initialized first.
+ *       When gzip variants are requested, the ressources selected by the compression
+ *       config (see compression_applies) that don't already have a .gz sibling get one.
+ *
+ * @param server_root directory to pack.
+ * @param pack_path file to write the pack to, replaced atomically.
+ * @param gzip_variants generate missing gzip variants.
+ * @return int number of packed ressources, -1 on error.
+ */
+int site_pack_write(const char *server_root, const char *pack_path, bool gzip_variants);
+
+#endif
@@ -0,0 +1,113 @@
+/**
+ * @file timer_wheel.h
+ * @brief File containing the APIs of a hierarchical timing wheel.
+ *
+ * Timers are embedded in whatever they time out (connections, send jobs) and
+ * hashed by deadline into TIMER_WHEEL_LEVELS wheels of TIMER_WHEEL_SLOTS slots,
+ * each level ticking TIMER_WHEEL_SLOTS times slower than the one below. Arming,
+ * re-arming and cancelling a timer are O(1), so deadlines can be pushed back on
+ * every I/O event. Timers of a higher level are cascaded down as their slot comes
+ * up, and fire once they reach the lowest level.
+ *
+ * A wheel isn't synchronized, it belongs to the thread that advances it.
+ *
+ */
+
+#ifndef _TIMER_WHEEL
+#define _TIMER_WHEEL
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4 // 64^4 ticks, more than a day with 10ms ticks
+
+typedef struct _timer_wheel *timer_wheel_t;
+
+/**
+ * @brief Timer to embed in what it times out.
+ */
+typedef struct wheel_timer {
+    struct wheel_timer *prev;   /**< NULL while the timer isn't armed. */
+    struct wheel_timer *next;
+    unsigned long expires;      /**< Tick the timer fires at. */
+    void *data;                 /**< Left to the owner of the timer. */
+} wheel_timer;
+
+/**
+ * @brief Called for every timer that fires, the timer is disarmed and can be armed again.
+ */
+typedef void (*timer_expired_fn)(wheel_timer *timer, void *args);
+
+
+/**
+ * @brief Initialize an empty timing wheel.
+ *
+ * @param now_ms current time in milliseconds, on the clock deadlines are given in.
+ * @param tick_ms resolution of the wheel, timers fire up to tick_ms late but never early.
+ * @return timer_wheel_t handle to the wheel, NULL on error.
+ */
+timer_wheel_t timer_wheel_init(unsigned long now_ms, unsigned int tick_ms);
+
+
+/**
+ * @brief Free a timing wheel. Timers still armed are left as they are.
+ *
+ * @param wheel reference to the wheel to destroy, set to NULL.
+ */
+void timer_wheel_destroy(timer_wheel_t *wheel);
+
+
+/**
+ * @brief Arm a timer, or move the deadline of an armed one.
+ *
+ * @param wheel the wheel to arm the timer on.
+ * @param timer the timer, armed on this wheel or not armed at all.
+ * @param deadline_ms time the timer should fire at, a passed one fires on the next tick.
+ */
+void timer_wheel_arm(timer_wheel_t wheel, wheel_timer *timer, unsigned long deadline_ms);
+
+
+/**
+ * @brief Disarm a timer, nothing is done if it isn't armed.
+ */
+void timer_wheel_cancel(timer_wheel_t wheel, wheel_timer *timer);
+
+
+/**
+ * @brief Check whether a timer is armed.
+ */
+bool timer_armed(const wheel_timer *timer);
+
+
+/**
+ * @brief Move the wheel forward to now_ms, firing every timer whose deadline passed.
+ *
+ * @note on_expired may arm and cancel any timer of the wheel, including the one that fired.
+ *
+ * @param wheel the wheel to advance.
+ * @param now_ms current time in milliseconds.
+ * @param on_expired function called for each timer that fires.
+ * @param args passed on to on_expired.
+ * @return int number of timers that fired.
+ */
+int timer_wheel_advance(timer_wheel_t wheel, unsigned long now_ms, timer_expired_fn on_expired, void *args);
+
+
+/**
+ * @brief Get how long a caller can wait before the wheel needs to be advanced, eg: as an epoll_wait timeout.
+ *
+ * @param wheel the wheel.
+ * @param now_ms current time in milliseconds.
+ * @return int milliseconds until the next timer might fire, -1 if no timer is armed.
+ */
+int timer_wheel_next_timeout_ms(timer_wheel_t wheel, unsigned long now_ms);
+
+
+/**
+ * @brief Get the number of timers armed on the wheel.
+ */
+size_t get_timer_wheel_size(timer_wheel_t wheel);
+
+#endif
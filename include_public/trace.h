@@ -0,0 +1,36 @@
+/**
+ * @file trace.h
+ * @brief File containing the static tracepoints of the request lifecycle.
+ *
+ * TRACE places a USDT probe (sys/sdt.h) of the "sws" provider: a single nop in
+ * the code and a note in the ELF file, so disabled probes cost nothing and
+ * bpftrace or perf can attach to a running server, eg:
+ *
+ *     bpftrace -e 'usdt:./sws:sws:parse_done { printf("%d %s\n", arg0, str(arg1)); }'
+ *
+ * Probes and their arguments:
+ *   accept(fd, client_addr)                   connection accepted
+ *   queue_insert(fd, depth)                   fd put in the bounded buffer, depth after the insert
+ *   queue_remove(fd, depth)                   fd taken out by a worker, depth after the remove
+ *   parse_done(fd, uri, method)               request parsed
+ *   response(uri, status_code, content_size)  response formulated, on the thread of the matching parse_done
+ *   send_start(fd, status_code, content_size) worker starts writing the response
+ *   send_done(fd, status_code, bytes_sent, handed_off) worker done, handed off to a sender thread or not
+ *   close(fd, bytes_left)                     connection closed, with what was left to send
+ *
+ * Without sys/sdt.h (or with -DSWS_USDT=OFF) TRACE compiles to nothing.
+ *
+ */
+
+#ifndef _TRACE
+#define _TRACE
+
+#ifdef SWS_USDT
+#include <sys/sdt.h>
+
+#define TRACE(probe, ...) STAP_PROBEV(sws, probe, __VA_ARGS__)
+#else
+#define TRACE(probe, ...) do {} while(0)
+#endif
+
+#endif
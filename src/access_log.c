@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "access_log_private.h"
+#include "thread_registry.h"
+#include "log.h"
+
+static void *run_flush_thread(void *args);
+static access_log_buffer *get_thread_buffer();
+static void flush_buffer(access_log_buffer *buffer);
+static void flush_all_buffers();
+static void write_lines(const char *data, size_t len);
+static size_t escape_uri(const char *uri, char *escaped, size_t max_len);
+static void format_timestamp(time_t now, char *timestamp);
+
+static char log_path[PATH_MAX];
+static int log_fd = -1;
+static pthread_rwlock_t fd_lock = PTHREAD_RWLOCK_INITIALIZER; // Write locked only to swap log_fd
+static _Atomic bool enabled = false;
+static _Atomic(void *) buffer_slots[MAX_ACCESS_LOG_BUFFERS];
+static thread_registry buffers = THREAD_REGISTRY_INITIALIZER(buffer_slots);
+static __thread access_log_buffer *thread_buffer = NULL;
+static __thread bool thread_buffer_unavailable = false;
+static pthread_t flush_tid;
+static bool flushing = false;
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flush_cond;
+
+
+int access_log_open(const char *path){
+    pthread_condattr_t cond_attr;
+    int fd;
+
+    if(strlen(path) >= PATH_MAX){
+        LOG(ERROR, "Access log path is too long\n");
+        return -1;
+    }
+
+    else if((fd = openat(AT_FDCWD, path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644)) == -1){
+        LOG(ERROR, "Failed to open access log %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    strcpy(log_path, path);
+    log_fd = fd;
+
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&flush_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    flushing = true;
+
+    if(pthread_create(&flush_tid, NULL, run_flush_thread, NULL) != 0){
+        LOG(ERROR, "Failed to start access log flush thread\n");
+        flushing = false;
+        close(fd);
+        log_fd = -1;
+        return -1;
+    }
+
+    atomic_store(&enabled, true);
+    LOG(INFO, "Logging accesses to %s\n", path);
+    return 0;
+}
+
+
+bool access_log_enabled(){
+    return atomic_load_explicit(&enabled, memory_order_relaxed);
+}
+
+
+void access_log_write(const access_log_entry *entry){
+    access_log_buffer *buffer = get_thread_buffer();
+    time_t now = time(NULL);
+
+    if(!buffer){
+        char timestamp[ACCESS_LOG_TIMESTAMP_LEN];
+        char line[MAX_ACCESS_LOG_LINE_LEN];
+
+        format_timestamp(now, timestamp);
+        write_lines(line, format_access_log_line(entry, timestamp, line, MAX_ACCESS_LOG_LINE_LEN));
+        return;
+    }
+
+    pthread_mutex_lock(&(buffer->lock));
+
+    // Formatting the time is the costly part of a line, it only changes once a second
+    if(now != buffer->timestamp_sec){
+        format_timestamp(now, buffer->timestamp);
+        buffer->timestamp_sec = now;
+    }
+
+    if(ACCESS_LOG_BUFFER_SIZE - buffer->len < MAX_ACCESS_LOG_LINE_LEN){
+        flush_buffer(buffer);
+    }
+
+    buffer->len += format_access_log_line(entry, buffer->timestamp, buffer->data + buffer->len, MAX_ACCESS_LOG_LINE_LEN);
+    pthread_mutex_unlock(&(buffer->lock));
+}
+
+
+int access_log_reopen(){
+    int fd = openat(AT_FDCWD, log_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+
+    if(fd == -1){
+        LOG(ERROR, "Failed to reopen access log %s: %s, still logging to the previous file\n", log_path, strerror(errno));
+        return -1;
+    }
+
+    // What's buffered so far belongs to the previous file
+    flush_all_buffers();
+
+    pthread_rwlock_wrlock(&fd_lock);
+    close(log_fd);
+    log_fd = fd;
+    pthread_rwlock_unlock(&fd_lock);
+
+    return 0;
+}
+
+
+void access_log_close(){
+    if(!atomic_exchange(&enabled, false)){
+        return;
+    }
+
+    pthread_mutex_lock(&flush_lock);
+    flushing = false;
+    pthread_cond_signal(&flush_cond);
+    pthread_mutex_unlock(&flush_lock);
+    pthread_join(flush_tid, NULL);
+
+    flush_all_buffers();
+
+    pthread_rwlock_wrlock(&fd_lock);
+    close(log_fd);
+    log_fd = -1;
+    pthread_rwlock_unlock(&fd_lock);
+
+    pthread_cond_destroy(&flush_cond);
+}
+
+
+size_t format_access_log_line(const access_log_entry *entry, const char *timestamp, char *line, size_t max_len){
+    char uri[MAX_ACCESS_LOG_LINE_LEN];
+    char bytes_sent[24] = "-";
+    int len;
+
+    escape_uri(entry->uri ? entry->uri : "-", uri, sizeof(uri));
+
+    if(entry->bytes_sent > 0){
+        snprintf(bytes_sent, sizeof(bytes_sent), "%lld", (long long) entry->bytes_sent);
+    }
+
+    len = snprintf(line, max_len, "%s - - [%s] \"%s %s HTTP/%s\" %d %s %ld %ld\n",
+                   entry->client_addr && entry->client_addr[0] != '\0' ? entry->client_addr : "-",
+                   timestamp,
+                   entry->method ? entry->method : "-",
+                   uri,
+                   entry->version ? entry->version : "-",
+                   entry->status_code,
+                   bytes_sent,
+                   entry->duration_us,
+                   entry->queue_wait_us);
+
+    if(len < 0){
+        line[0] = '\0';
+        return 0;
+    }
+
+    // A truncated line still ends the line, the next one starts where it should
+    else if((size_t) len >= max_len){
+        len = max_len - 1;
+        line[len - 1] = '\n';
+    }
+
+    return len;
+}
+
+
+// HELPERS //
+
+static void *run_flush_thread(void *args){
+    struct timespec deadline;
+
+    pthread_mutex_lock(&flush_lock);
+
+    while(flushing){
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += ACCESS_LOG_FLUSH_INTERVAL_MS / 1000;
+        deadline.tv_nsec += (ACCESS_LOG_FLUSH_INTERVAL_MS % 1000) * 1000000L;
+
+        if(deadline.tv_nsec >= 1000000000L){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        pthread_cond_timedwait(&flush_cond, &flush_lock, &deadline);
+
+        pthread_mutex_unlock(&flush_lock);
+        flush_all_buffers();
+        pthread_mutex_lock(&flush_lock);
+    }
+
+    pthread_mutex_unlock(&flush_lock);
+    return NULL;
+}
+
+
+/**
+ * @brief Get the calling thread's buffer, allocated on first use.
+ *
+ * @return access_log_buffer* the buffer, NULL if the thread can't get one.
+ */
+static access_log_buffer *get_thread_buffer(){
+    if(thread_buffer || thread_buffer_unavailable){
+        return thread_buffer;
+    }
+
+    int idx = thread_registry_claim(&buffers);
+
+    if(idx == -1 || !(thread_buffer = (access_log_buffer *) calloc(1, sizeof(access_log_buffer)))){
+        thread_buffer_unavailable = true;
+        return NULL;
+    }
+
+    pthread_mutex_init(&(thread_buffer->lock), NULL);
+    thread_registry_publish(&buffers, idx, thread_buffer);
+    return thread_buffer;
+}
+
+
+/**
+ * @brief Write out the lines of a buffer, its lock must be held.
+ */
+static void flush_buffer(access_log_buffer *buffer){
+    write_lines(buffer->data, buffer->len);
+    buffer->len = 0;
+}
+
+
+static void flush_all_buffers(){
+    for(int i = 0; i < thread_registry_size(&buffers); i++){
+        access_log_buffer *buffer = (access_log_buffer *) thread_registry_get(&buffers, i);
+
+        if(!buffer){
+            continue;
+        }
+
+        pthread_mutex_lock(&(buffer->lock));
+        flush_buffer(buffer);
+        pthread_mutex_unlock(&(buffer->lock));
+    }
+}
+
+
+/**
+ * @brief Append whole lines to the log, O_APPEND keeps writes of different threads apart.
+ */
+static void write_lines(const char *data, size_t len){
+    size_t written = 0;
+
+    pthread_rwlock_rdlock(&fd_lock);
+
+    while(log_fd != -1 && written < len){
+        ssize_t rc = write(log_fd, data + written, len - written);
+
+        if(rc == -1 && errno == EINTR){
+            continue;
+        }
+
+        else if(rc == -1){
+            LOG(ERROR, "Failed to write to access log, %lu bytes lost: %s\n", (unsigned long) (len - written), strerror(errno));
+            break;
+        }
+
+        written += rc;
+    }
+
+    pthread_rwlock_unlock(&fd_lock);
+}
+
+
+/**
+ * @brief Copy uri, replacing quotes, backslashes and control characters with \xHH
+ *        so a request can't forge a line (or a field) of its own.
+ *
+ * @return size_t length of the escaped uri, cut short if it doesn't fit in max_len.
+ */
+static size_t escape_uri(const char *uri, char *escaped, size_t max_len){
+    size_t len = 0;
+
+    for(const unsigned char *c = (const unsigned char *) uri; *c != '\0' && len + 5 <= max_len; c++){
+        if(*c == '"' || *c == '\\' || *c < 0x20 || *c >= 0x7f){
+            len += snprintf(escaped + len, max_len - len, "\\x%02X", *c);
+        }
+
+        else {
+            escaped[len++] = *c;
+        }
+    }
+
+    escaped[len] = '\0';
+    return len;
+}
+
+
+static void format_timestamp(time_t now, char *timestamp){
+    struct tm local;
+
+    localtime_r(&now, &local);
+    strftime(timestamp, ACCESS_LOG_TIMESTAMP_LEN, "%d/%b/%Y:%H:%M:%S %z", &local);
+}
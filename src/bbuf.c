@@ -5,9 +5,11 @@
 #include <stdio.h>
 #include "bbuf_private.h"
 #include "log.h"
+#include "trace.h"
 
 /*Forward Declarations*/
 static sem_t *init_unamed_semaphore(unsigned int initial_value);
+static void insert_item(bbuf_t bbuf, int fd_to_insert);
 
 
 bbuf_t bbuf_init(){
@@ -60,19 +62,22 @@ int bbuf_insert(bbuf_t bbuf, int fd_to_insert){
         LOG(ERROR, "NULL buffer reference provided!\n");
         return -1;
     }
-    pthread_t thread_id = pthread_self();
     // Wait until there's a free slot
     sem_wait(bbuf->slots);
-    // Wait until the mutex is free
-    sem_wait(bbuf->mutex);
-    // Insert slot at end of buffer
-    bbuf->buff[(bbuf->rear)%(bbuf->max_size)] = fd_to_insert;
-    (bbuf->rear)++;
-    LOG(DEBUG, "Thread %lu: Inserted fd %d at index %d\n", (unsigned long)thread_id, fd_to_insert, (bbuf->rear)%(bbuf->max_size));
-    // Release mutex
-    sem_post(bbuf->mutex);
-    // Increment Item
-    sem_post(bbuf->items);
+    insert_item(bbuf, fd_to_insert);
+    return 0;
+}
+
+int bbuf_try_insert(bbuf_t bbuf, int fd_to_insert){
+    if(!bbuf){
+        LOG(ERROR, "NULL buffer reference provided!\n");
+        return -1;
+    }
+    // Only take a slot that's free right now
+    if(sem_trywait(bbuf->slots) != 0){
+        return -1;
+    }
+    insert_item(bbuf, fd_to_insert);
     return 0;
 }
 
@@ -92,6 +97,7 @@ int bbuf_remove(bbuf_t bbuf, int *fd){
     // Remove item from front of buffer
     removed_fd = bbuf->buff[(bbuf->front)%(bbuf->max_size)];
     (bbuf->front)++;
+    TRACE(queue_remove, removed_fd, bbuf->rear - bbuf->front);
     LOG(DEBUG, "Thread %lu: Removed fd %d from index %d\n",(unsigned long)thread_id, removed_fd, (bbuf->front)%(bbuf->max_size));
     // Release mutex
     sem_post(bbuf->mutex);
@@ -143,6 +149,24 @@ int get_bbuf_items(bbuf_t bbuf){
     return tmp;
 }
 
+/**
+ * @brief Insert an item in a slot the caller already took.
+ */
+static void insert_item(bbuf_t bbuf, int fd_to_insert){
+    pthread_t thread_id = pthread_self();
+    // Wait until the mutex is free
+    sem_wait(bbuf->mutex);
+    // Insert slot at end of buffer
+    bbuf->buff[(bbuf->rear)%(bbuf->max_size)] = fd_to_insert;
+    (bbuf->rear)++;
+    TRACE(queue_insert, fd_to_insert, bbuf->rear - bbuf->front);
+    LOG(DEBUG, "Thread %lu: Inserted fd %d at index %d\n", (unsigned long)thread_id, fd_to_insert, (bbuf->rear)%(bbuf->max_size));
+    // Release mutex
+    sem_post(bbuf->mutex);
+    // Increment Item
+    sem_post(bbuf->items);
+}
+
 static sem_t *init_unamed_semaphore(unsigned int initial_value){
     sem_t *sem = (sem_t *) malloc(sizeof(sem_t));
     if(!sem){
@@ -2,13 +2,165 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <limits.h>
+#include <arpa/inet.h>
 #include "command_line_private.h"
+#include "mime.h"
+#include "io_policy.h"
+#include "io_pool.h"
+#include "prewarm.h"
+#include "metrics.h"
+#include "rate_limit.h"
 #include "log.h"
 
 static void _print_help();
+static void set_cli_defaults(struct cli *result);
+static bool parse_cli_options(int argc, char *argv[], struct cli *result);
+static bool parse_long_option(char *value, long min, long max, long *result);
+static bool set_verbose(char *value, struct cli *result);
+static bool set_mime_types(char *value, struct cli *result);
+static bool set_snapshot_root(char *value, struct cli *result);
+static bool set_pack_path(char *value, struct cli *result);
+static bool set_gzip_enabled(char *value, struct cli *result);
+static bool set_gzip_level(char *value, struct cli *result);
+static bool set_gzip_min_size(char *value, struct cli *result);
+static bool set_gzip_cache_size(char *value, struct cli *result);
+static bool set_gzip_types(char *value, struct cli *result);
+static bool set_io_sequential_min_size(char *value, struct cli *result);
+static bool set_io_readahead_size(char *value, struct cli *result);
+static bool set_io_dontneed_min_size(char *value, struct cli *result);
+static bool set_hugepages(char *value, struct cli *result);
+static bool set_io_threads(char *value, struct cli *result);
+static bool set_prewarm_source(char *value, struct cli *result);
+static bool set_prewarm_top(char *value, struct cli *result);
+static bool set_prewarm_budget(char *value, struct cli *result);
+static bool set_access_log(char *value, struct cli *result);
+static bool set_metrics_port(char *value, struct cli *result);
+static bool set_metrics_address(char *value, struct cli *result);
+static bool set_rate_limit(char *value, struct cli *result);
+static bool set_rate_limit_burst(char *value, struct cli *result);
+static bool set_max_client_connections(char *value, struct cli *result);
 
 typedef bool (*cli_validation_func)(char *, struct cli *);
 
+typedef struct cli_option {
+    char *name;                 /**< Option as typed on the command line (eg: -v). */
+    char *value_name;           /**< Name of the option's value in the help, NULL for flags. */
+    cli_validation_func setter; /**< Validates and stores the option's value (value is NULL for flags). */
+    char *help;                 /**< Description printed in the help. */
+} cli_option;
+
+static cli_option cli_options[] = {{.name = "-v",
+                                    .setter = set_verbose,
+                                    .help = "to run server with added verbosity"},
+
+                                   {.name = "--mime-types",
+                                    .value_name = "FILE",
+                                    .setter = set_mime_types,
+                                    .help = "file mapping extensions to content types (default: " DEFAULT_MIME_TYPES_PATH ")"},
+
+                                   {.name = "--snapshot",
+                                    .setter = set_snapshot_root,
+                                    .help = "to serve an immutable server root from memory (send SIGHUP after a deploy)"},
+
+                                   {.name = "--pack",
+                                    .value_name = "FILE",
+                                    .setter = set_pack_path,
+                                    .help = "site pack (see sws-pack) to serve in place of the server root (send SIGHUP after a deploy)"},
+
+                                   {.name = "--gzip",
+                                    .setter = set_gzip_enabled,
+                                    .help = "to compress responses on the fly for clients that accept gzip/deflate"},
+
+                                   {.name = "--gzip-level",
+                                    .value_name = "LEVEL",
+                                    .setter = set_gzip_level,
+                                    .help = "zlib compression level from 1 (fastest) to 9 (smallest)"},
+
+                                   {.name = "--gzip-min-size",
+                                    .value_name = "BYTES",
+                                    .setter = set_gzip_min_size,
+                                    .help = "smallest ressource worth compressing"},
+
+                                   {.name = "--gzip-cache-size",
+                                    .value_name = "BYTES",
+                                    .setter = set_gzip_cache_size,
+                                    .help = "memory used to keep compressed responses around"},
+
+                                   {.name = "--gzip-types",
+                                    .value_name = "TYPES",
+                                    .setter = set_gzip_types,
+                                    .help = "comma separated content types to compress (eg: text/*,application/json)"},
+
+                                   {.name = "--io-sequential-min",
+                                    .value_name = "BYTES",
+                                    .setter = set_io_sequential_min_size,
+                                    .help = "transfers from this size up are read sequentially and ahead of time (0 to disable)"},
+
+                                   {.name = "--io-readahead",
+                                    .value_name = "BYTES",
+                                    .setter = set_io_readahead_size,
+                                    .help = "bytes read ahead when a sequential transfer starts"},
+
+                                   {.name = "--io-dontneed-min",
+                                    .value_name = "BYTES",
+                                    .setter = set_io_dontneed_min_size,
+                                    .help = "transfers from this size up are dropped from the page cache once sent (default: 0, disabled)"},
+
+                                   {.name = "--hugepages",
+                                    .setter = set_hugepages,
+                                    .help = "to back site packs with transparent huge pages"},
+
+                                   {.name = "--io-threads",
+                                    .value_name = "NUM",
+                                    .setter = set_io_threads,
+                                    .help = "threads opening ressources that aren't cached yet, for slow disks (default: 0, workers open them)"},
+
+                                   {.name = "--prewarm",
+                                    .value_name = "FILE",
+                                    .setter = set_prewarm_source,
+                                    .help = "manifest (one path per line) or access log listing the paths to warm up after starting"},
+
+                                   {.name = "--prewarm-top",
+                                    .value_name = "NUM",
+                                    .setter = set_prewarm_top,
+                                    .help = "number of most requested paths to warm up"},
+
+                                   {.name = "--prewarm-budget",
+                                    .value_name = "BYTES",
+                                    .setter = set_prewarm_budget,
+                                    .help = "bytes read per second while warming up (0 for no limit)"},
+
+                                   {.name = "--access-log",
+                                    .value_name = "FILE",
+                                    .setter = set_access_log,
+                                    .help = "file every response is logged to, in the Common Log Format (reopened on SIGUSR1)"},
+
+                                   {.name = "--metrics-port",
+                                    .value_name = "PORT",
+                                    .setter = set_metrics_port,
+                                    .help = "port serving Prometheus metrics at " METRICS_PATH " (default: not served)"},
+
+                                   {.name = "--metrics-address",
+                                    .value_name = "ADDR",
+                                    .setter = set_metrics_address,
+                                    .help = "IPv4 address metrics are served on, 0.0.0.0 for every interface (default: " DEFAULT_METRICS_ADDRESS ")"},
+
+                                   {.name = "--rate-limit",
+                                    .value_name = "NUM",
+                                    .setter = set_rate_limit,
+                                    .help = "requests per second a client address can keep up, then answered 429 (default: 0, no limit)"},
+
+                                   {.name = "--rate-limit-burst",
+                                    .value_name = "NUM",
+                                    .setter = set_rate_limit_burst,
+                                    .help = "requests a client address can send at once (default: the rate limit)"},
+
+                                   {.name = "--max-client-connections",
+                                    .value_name = "NUM",
+                                    .setter = set_max_client_connections,
+                                    .help = "connections a client address can have open, others are closed (default: 0, no limit)"}};
+
 // Externs
 char server_root_location[MAX_SERVER_ROOT_LEN];
 log_level user_provided_log_level = DEFAULT;
@@ -31,12 +183,11 @@ bool parse_cli(int argc, char *argv[], struct cli *result){
         return false;
     }
 
-    else if(argc > MIN_ARGUMENTS){
-        for(int i = MIN_ARGUMENTS; i < argc; i++){
-            if(strcmp(argv[i], "-v") == 0){
-                user_provided_log_level = DEBUG;
-            }
-        }
+    set_cli_defaults(result);
+
+    if(!parse_cli_options(argc, argv, result)){
+        _print_help();
+        return false;
     }
 
     // Note: Important that validation functions are ordered the same as
@@ -114,11 +265,310 @@ bool validate_server_root(char *server_root_to_validate, struct cli *result){
 }
 
 
+/**
+ * @brief Parse the optional arguments that follow PORT and SERVER_ROOT.
+ * 
+ * @note Unrecognized options are ignored.
+ * 
+ * @return true if every recognized option is valid, otherwise false.
+ */
+static bool parse_cli_options(int argc, char *argv[], struct cli *result){
+    for(int i = MIN_ARGUMENTS; i < argc; i++){
+        cli_option *option = NULL;
+        char *value = NULL;
+
+        for(int j = 0; j < (sizeof(cli_options) / sizeof(cli_options[0])); j++){
+            if(strcmp(argv[i], cli_options[j].name) == 0){
+                option = &cli_options[j];
+                break;
+            }
+        }
+
+        if(!option){
+            LOG(WARNING, "Ignoring unrecognized option %s\n", argv[i]);
+            continue;
+        }
+
+        else if(option->value_name){
+            if(i + 1 >= argc){
+                LOG(ERROR, "Option %s expects a %s value!...\n", option->name, option->value_name);
+                return false;
+            }
+            value = argv[++i];
+        }
+
+        if(!option->setter(value, result)){
+            LOG(ERROR, "Invalid value provided for option %s!...\n", option->name);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+static void set_cli_defaults(struct cli *result){
+    strncpy(result->mime_types, DEFAULT_MIME_TYPES_PATH, MAX_SERVER_ROOT_LEN-1);
+    result->snapshot_root = false;
+    result->pack_path[0] = '\0';
+    result->gzip_enabled = false;
+    result->gzip_level = DEFAULT_GZIP_LEVEL;
+    result->gzip_min_size = DEFAULT_GZIP_MIN_SIZE;
+    result->gzip_cache_size = DEFAULT_GZIP_CACHE_SIZE;
+    strncpy(result->gzip_types, DEFAULT_GZIP_TYPES, MAX_CLI_LIST_LEN-1);
+    result->io_sequential_min_size = DEFAULT_IO_SEQUENTIAL_MIN_SIZE;
+    result->io_readahead_size = DEFAULT_IO_READAHEAD_SIZE;
+    result->io_dontneed_min_size = DEFAULT_IO_DONTNEED_MIN_SIZE;
+    result->hugepages = false;
+    result->io_threads = 0;
+    result->prewarm_source[0] = '\0';
+    result->prewarm_top = DEFAULT_PREWARM_TOP;
+    result->prewarm_budget = DEFAULT_PREWARM_BUDGET;
+    result->access_log[0] = '\0';
+    result->metrics_port = 0;
+    strcpy(result->metrics_address, DEFAULT_METRICS_ADDRESS);
+    result->rate_limit = 0;
+    result->rate_limit_burst = 0;
+    result->max_client_connections = 0;
+}
+
+
+/**
+ * @brief Convert value to a long in the range [min, max].
+ */
+static bool parse_long_option(char *value, long min, long max, long *result){
+    char *end;
+    long tmp = strtol(value, &end, 10);
+
+    if(end == value || *end != '\0' || tmp < min || tmp > max){
+        return false;
+    }
+
+    *result = tmp;
+    return true;
+}
+
+
+static bool set_verbose(char *value, struct cli *result){
+    user_provided_log_level = DEBUG;
+
+    if(SWS_MIN_LOG_LEVEL > DEBUG){
+        LOG(WARNING, "Debug logs are compiled out of this build (SWS_MIN_LOG_LEVEL), -v has no effect\n");
+    }
+
+    return true;
+}
+
+
+static bool set_mime_types(char *value, struct cli *result){
+    if(strlen(value) >= MAX_SERVER_ROOT_LEN){
+        return false;
+    }
+
+    strcpy(result->mime_types, value);
+    return true;
+}
+
+
+static bool set_snapshot_root(char *value, struct cli *result){
+    result->snapshot_root = true;
+    return true;
+}
+
+
+static bool set_pack_path(char *value, struct cli *result){
+    if(strlen(value) == 0 || strlen(value) >= MAX_SERVER_ROOT_LEN){
+        return false;
+    }
+
+    strcpy(result->pack_path, value);
+    return true;
+}
+
+
+static bool set_gzip_enabled(char *value, struct cli *result){
+    result->gzip_enabled = true;
+    return true;
+}
+
+
+static bool set_gzip_level(char *value, struct cli *result){
+    long level;
+
+    if(!parse_long_option(value, 1, 9, &level)){
+        return false;
+    }
+
+    result->gzip_level = (int) level;
+    return true;
+}
+
+
+static bool set_gzip_min_size(char *value, struct cli *result){
+    return parse_long_option(value, 0, LONG_MAX, &(result->gzip_min_size));
+}
+
+
+static bool set_gzip_cache_size(char *value, struct cli *result){
+    return parse_long_option(value, 0, LONG_MAX, &(result->gzip_cache_size));
+}
+
+
+static bool set_gzip_types(char *value, struct cli *result){
+    if(strlen(value) >= MAX_CLI_LIST_LEN){
+        return false;
+    }
+
+    strcpy(result->gzip_types, value);
+    return true;
+}
+
+
+static bool set_io_sequential_min_size(char *value, struct cli *result){
+    return parse_long_option(value, 0, LONG_MAX, &(result->io_sequential_min_size));
+}
+
+
+static bool set_io_readahead_size(char *value, struct cli *result){
+    return parse_long_option(value, 0, LONG_MAX, &(result->io_readahead_size));
+}
+
+
+static bool set_io_dontneed_min_size(char *value, struct cli *result){
+    return parse_long_option(value, 0, LONG_MAX, &(result->io_dontneed_min_size));
+}
+
+
+static bool set_hugepages(char *value, struct cli *result){
+    result->hugepages = true;
+    return true;
+}
+
+
+static bool set_io_threads(char *value, struct cli *result){
+    long num_threads;
+
+    if(!parse_long_option(value, 0, MAX_IO_THREADS, &num_threads)){
+        return false;
+    }
+
+    result->io_threads = (int) num_threads;
+    return true;
+}
+
+
+static bool set_prewarm_source(char *value, struct cli *result){
+    if(strlen(value) == 0 || strlen(value) >= MAX_SERVER_ROOT_LEN){
+        return false;
+    }
+
+    strcpy(result->prewarm_source, value);
+    return true;
+}
+
+
+static bool set_prewarm_top(char *value, struct cli *result){
+    long top;
+
+    if(!parse_long_option(value, 1, INT_MAX, &top)){
+        return false;
+    }
+
+    result->prewarm_top = (int) top;
+    return true;
+}
+
+
+static bool set_prewarm_budget(char *value, struct cli *result){
+    return parse_long_option(value, 0, LONG_MAX, &(result->prewarm_budget));
+}
+
+
+static bool set_access_log(char *value, struct cli *result){
+    if(strlen(value) == 0 || strlen(value) >= MAX_SERVER_ROOT_LEN){
+        return false;
+    }
+
+    strcpy(result->access_log, value);
+    return true;
+}
+
+
+static bool set_metrics_port(char *value, struct cli *result){
+    long port;
+
+    if(!parse_long_option(value, PORT_MIN, PORT_MAX, &port)){
+        return false;
+    }
+
+    result->metrics_port = (int) port;
+    return true;
+}
+
+
+static bool set_metrics_address(char *value, struct cli *result){
+    struct in_addr addr;
+
+    if(strlen(value) >= INET_ADDRSTRLEN || inet_pton(AF_INET, value, &addr) != 1){
+        return false;
+    }
+
+    strcpy(result->metrics_address, value);
+    return true;
+}
+
+
+static bool set_rate_limit(char *value, struct cli *result){
+    long rate;
+
+    if(!parse_long_option(value, 0, MAX_RATE_LIMIT_RATE, &rate)){
+        return false;
+    }
+
+    result->rate_limit = (int) rate;
+    return true;
+}
+
+
+static bool set_rate_limit_burst(char *value, struct cli *result){
+    long burst;
+
+    if(!parse_long_option(value, 1, MAX_RATE_LIMIT_BURST, &burst)){
+        return false;
+    }
+
+    result->rate_limit_burst = (int) burst;
+    return true;
+}
+
+
+static bool set_max_client_connections(char *value, struct cli *result){
+    long max_connections;
+
+    if(!parse_long_option(value, 0, INT_MAX, &max_connections)){
+        return false;
+    }
+
+    result->max_client_connections = (int) max_connections;
+    return true;
+}
+
+
 static void _print_help(){
-    printf("Usage: sws PORT SERVER_ROOT [-v]\n\n");
+    printf("Usage: sws PORT SERVER_ROOT [OPTIONS]\n\n");
     printf("\nPORT must be in range %d to %d and represents the port that your server will run on.\n", PORT_MIN, PORT_MAX);
     printf("\nSERVER_ROOT must be a valid path on host machine which doesn't exceed %d characters.\n", MAX_SERVER_ROOT_LEN-1);
-    printf("\n-v to run server with added verbosity");
+    printf("\nOPTIONS:\n");
+
+    for(int i = 0; i < (sizeof(cli_options) / sizeof(cli_options[0])); i++){
+        if(cli_options[i].value_name){
+            printf("\n%s %s %s", cli_options[i].name, cli_options[i].value_name, cli_options[i].help);
+        }
+        else {
+            printf("\n%s %s", cli_options[i].name, cli_options[i].help);
+        }
+    }
+
     printf("\n");
     return;
 }
\ No newline at end of file
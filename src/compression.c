@@ -0,0 +1,619 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "compression_private.h"
+#include "fnv1a.h"
+#include "command_line.h"
+#include "rio.h"
+#include "metrics.h"
+#include "log.h"
+
+#define GZIP_WINDOW_BITS (15 + 16) // zlib adds a gzip header and trailer
+#define ZLIB_WINDOW_BITS 15        // HTTP "deflate" is the zlib format
+#define ZLIB_MEM_LEVEL 8
+
+static uint32_t hash_entry_key(const char *path, content_coding coding);
+static bool content_type_matches(const char *content_type, const char *pattern);
+static int init_deflate_stream(z_stream *stream, content_coding coding);
+static struct _compressed_entry *find_cached_entry(const char *path, const struct stat *ressource_info, content_coding coding);
+static void insert_cached_entry(struct _compressed_entry *entry);
+static void unlink_cached_entry(struct _compressed_entry *entry);
+static void lru_move_to_front(struct _compressed_entry *entry);
+static void free_entry_if_unused(struct _compressed_entry *entry);
+static struct compression_flight *find_flight(const char *path, const struct stat *ressource_info, content_coding coding);
+static struct compression_flight *start_flight(const char *path, const struct stat *ressource_info, content_coding coding);
+static void finish_flight(struct compression_flight *flight, struct _compressed_entry *entry);
+static void free_flight_if_unused(struct compression_flight *flight);
+
+static compression_config config = {.enabled = false};
+static char compressible_types[MAX_COMPRESSIBLE_TYPES][MAX_RES_TYPE_LEN];
+static int num_compressible_types = 0;
+
+static struct compressed_cache cache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+
+int compression_init(const compression_config *new_config){
+    char types[MAX_CLI_LIST_LEN];
+    char *save_ptr;
+
+    if(!new_config){
+        LOG(ERROR, "Invalid compression config provided!\n");
+        return -1;
+    }
+
+    else if(new_config->enabled && (new_config->level < Z_BEST_SPEED || new_config->level > Z_BEST_COMPRESSION)){
+        LOG(ERROR, "Invalid compression level %d!\n", new_config->level);
+        return -1;
+    }
+
+    config = *new_config;
+    num_compressible_types = 0;
+
+    snprintf(types, MAX_CLI_LIST_LEN, "%s", new_config->types ? new_config->types : "");
+
+    for(char *type = strtok_r(types, ",", &save_ptr); type; type = strtok_r(NULL, ",", &save_ptr)){
+        while(*type == ' ') type++;
+
+        if(num_compressible_types >= MAX_COMPRESSIBLE_TYPES){
+            LOG(WARNING, "Only the first %d compressible types are used\n", MAX_COMPRESSIBLE_TYPES);
+            break;
+        }
+
+        else if(strlen(type) == 0 || strlen(type) >= MAX_RES_TYPE_LEN){
+            LOG(WARNING, "Ignoring invalid compressible type '%s'\n", type);
+            continue;
+        }
+
+        strcpy(compressible_types[num_compressible_types++], type);
+    }
+
+    config.types = NULL; // Only the parsed copy is kept around
+
+    if(config.enabled){
+        LOG(INFO, "Compressing responses on the fly (level %d, min size %ldB, cache %ldB)\n",
+                  config.level, config.min_size, config.cache_size);
+    }
+
+    return 0;
+}
+
+
+bool compression_applies(const char *content_type, off_t size){
+    if(!config.enabled || !content_type || size < config.min_size || size == 0){
+        return false;
+    }
+
+    for(int i = 0; i < num_compressible_types; i++){
+        if(content_type_matches(content_type, compressible_types[i])){
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+unsigned int compression_available_codings(){
+    return config.enabled ? (CODING_MASK(CODING_GZIP) | CODING_MASK(CODING_DEFLATE)) : 0;
+}
+
+
+bool compression_is_cacheable(off_t size){
+    return size <= config.cache_size / MAX_ENTRY_CACHE_FRACTION;
+}
+
+
+compressed_entry_t get_compressed_entry(const char *abs_path, int ressource_fd, const struct stat *ressource_info, content_coding coding){
+    struct _compressed_entry *entry;
+    struct compression_flight *flight;
+
+    if(!abs_path || !ressource_info || ressource_fd < 0){
+        LOG(ERROR, "Invalid input for getting compressed ressource!\n");
+        return NULL;
+    }
+
+    else if(coding != CODING_GZIP && coding != CODING_DEFLATE){
+        LOG(ERROR, "Can't compress %s with %s\n", abs_path, content_coding_token(coding));
+        return NULL;
+    }
+
+    else if(!compression_is_cacheable(ressource_info->st_size) || strlen(abs_path) >= sizeof(entry->path)){
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache.lock);
+    entry = find_cached_entry(abs_path, ressource_info, coding);
+
+    if(entry){
+        entry->refcount++;
+        lru_move_to_front(entry);
+        pthread_mutex_unlock(&cache.lock);
+        metrics_count_cache_lookup(true);
+        return entry;
+    }
+
+    flight = find_flight(abs_path, ressource_info, coding);
+
+    if(flight){
+        // Another worker is compressing this version already (eg: right after a deploy)
+        flight->num_waiters++;
+
+        while(!flight->done){
+            pthread_cond_wait(&(flight->done_cond), &cache.lock);
+        }
+
+        entry = flight->entry; // Our reference was taken when the flight finished
+        flight->num_waiters--;
+        free_flight_if_unused(flight);
+        pthread_mutex_unlock(&cache.lock);
+
+        // The leader may have failed, then nothing was served from the cache
+        metrics_count_cache_lookup(entry != NULL);
+        return entry;
+    }
+
+    metrics_count_cache_lookup(false);
+
+    // Not coalesced if it can't be allocated, the miss is still served
+    flight = start_flight(abs_path, ressource_info, coding);
+    pthread_mutex_unlock(&cache.lock);
+
+    // Cache miss - compress outside of the lock so other ressources can still be served
+    entry = (struct _compressed_entry *) calloc(1, sizeof(struct _compressed_entry));
+
+    if(!entry){
+        LOG(ERROR, "Failed to allocate compressed entry for %s\n", abs_path);
+        goto finish;
+    }
+
+    strcpy(entry->path, abs_path);
+    entry->ino = ressource_info->st_ino;
+    entry->mtime = ressource_info->st_mtime;
+    entry->ressource_size = ressource_info->st_size;
+    entry->coding = coding;
+
+    if(compress_to_buffer(ressource_fd, ressource_info->st_size, coding, &(entry->data), &(entry->data_len)) != 0){
+        LOG(ERROR, "Failed to compress %s\n", abs_path);
+        free(entry);
+        entry = NULL;
+        goto finish;
+    }
+
+    LOG(DEBUG, "Compressed %s from %ldB to %luB (%s)\n", abs_path, ressource_info->st_size, entry->data_len, content_coding_token(coding));
+
+    finish:
+        pthread_mutex_lock(&cache.lock);
+
+        if(entry){
+            entry->refcount = 1; // Caller's reference
+            insert_cached_entry(entry);
+        }
+
+        if(flight){
+            finish_flight(flight, entry);
+        }
+
+        pthread_mutex_unlock(&cache.lock);
+        return entry;
+}
+
+
+int get_compressed_entry_data(compressed_entry_t entry, const char **data, size_t *data_len){
+    if(!entry || !data || !data_len){
+        return -1;
+    }
+
+    *data = entry->data;
+    *data_len = entry->data_len;
+    return 0;
+}
+
+
+void release_compressed_entry(compressed_entry_t *entry){
+    if(!entry || !(*entry)) return;
+
+    pthread_mutex_lock(&cache.lock);
+    (*entry)->refcount--;
+    free_entry_if_unused(*entry);
+    pthread_mutex_unlock(&cache.lock);
+
+    *entry = NULL;
+}
+
+
+int compress_stream(int out_fd, int in_fd, off_t num_bytes, content_coding coding, off_t *bytes_written){
+    z_stream stream;
+    char in_buf[COMPRESSION_CHUNK_SIZE];
+    char out_buf[COMPRESSION_CHUNK_SIZE];
+    off_t offset = 0;
+    off_t written = 0;
+    int flush;
+    int rc = 0;
+
+    if(init_deflate_stream(&stream, coding) != 0){
+        return -1;
+    }
+
+    do {
+        ssize_t bytes_read = pread(in_fd, in_buf, min(COMPRESSION_CHUNK_SIZE, num_bytes - offset), offset);
+
+        if(bytes_read == -1){
+            LOG(ERROR, "Failed to read fd %d at offset %ld\n", in_fd, offset);
+            rc = -1;
+            break;
+        }
+
+        offset += bytes_read;
+        flush = (bytes_read == 0 || offset >= num_bytes) ? Z_FINISH : Z_NO_FLUSH;
+
+        stream.next_in = (Bytef *) in_buf;
+        stream.avail_in = bytes_read;
+
+        // Drain everything deflate produces for this chunk before reading the next
+        do {
+            stream.next_out = (Bytef *) out_buf;
+            stream.avail_out = COMPRESSION_CHUNK_SIZE;
+
+            if(deflate(&stream, flush) == Z_STREAM_ERROR){
+                rc = -1;
+                break;
+            }
+
+            size_t produced = COMPRESSION_CHUNK_SIZE - stream.avail_out;
+
+            if(produced != 0 && writen_b(out_fd, out_buf, produced) == -1){
+                rc = -1;
+                break;
+            }
+
+            written += produced;
+        } while(stream.avail_out == 0);
+
+    } while(rc == 0 && flush != Z_FINISH);
+
+    if(bytes_written){
+        *bytes_written = written;
+    }
+
+    deflateEnd(&stream);
+    return rc;
+}
+
+
+// The input is read chunk by chunk, only the (smaller) output is held in memory
+int compress_to_buffer(int in_fd, off_t num_bytes, content_coding coding, char **out, size_t *out_len){
+    z_stream stream;
+    char in_buf[COMPRESSION_CHUNK_SIZE];
+    off_t offset = 0;
+    int flush;
+    int deflate_rc;
+
+    if(init_deflate_stream(&stream, coding) != 0){
+        return -1;
+    }
+
+    // deflateBound is the worst case, so the output never needs to grow
+    size_t out_capacity = deflateBound(&stream, num_bytes);
+    char *out_buf = (char *) malloc(out_capacity);
+
+    if(!out_buf){
+        deflateEnd(&stream);
+        return -1;
+    }
+
+    stream.next_out = (Bytef *) out_buf;
+    stream.avail_out = out_capacity;
+
+    do {
+        ssize_t bytes_read = pread(in_fd, in_buf, min(COMPRESSION_CHUNK_SIZE, num_bytes - offset), offset);
+
+        if(bytes_read == -1){
+            LOG(ERROR, "Failed to read fd %d at offset %ld\n", in_fd, offset);
+            free(out_buf);
+            deflateEnd(&stream);
+            return -1;
+        }
+
+        offset += bytes_read;
+        flush = (bytes_read == 0 || offset >= num_bytes) ? Z_FINISH : Z_NO_FLUSH;
+
+        stream.next_in = (Bytef *) in_buf;
+        stream.avail_in = bytes_read;
+        deflate_rc = deflate(&stream, flush);
+
+    } while(deflate_rc != Z_STREAM_ERROR && flush != Z_FINISH);
+
+    deflateEnd(&stream);
+
+    // A stream that didn't end would be cached truncated
+    if(deflate_rc != Z_STREAM_END){
+        LOG(ERROR, "Failed to compress fd %d (deflate returned %d)\n", in_fd, deflate_rc);
+        free(out_buf);
+        return -1;
+    }
+
+    *out_len = out_capacity - stream.avail_out;
+
+    // The cache only accounts for the compressed size, don't hold on to the rest of the bound
+    char *shrunk = (char *) realloc(out_buf, *out_len);
+
+    *out = shrunk ? shrunk : out_buf;
+
+    return 0;
+}
+
+
+void clear_compressed_cache(){
+    pthread_mutex_lock(&cache.lock);
+
+    while(cache.lru_tail){
+        struct _compressed_entry *entry = cache.lru_tail;
+        unlink_cached_entry(entry);
+        free_entry_if_unused(entry);
+    }
+
+    pthread_mutex_unlock(&cache.lock);
+}
+
+
+size_t get_compressed_cache_usage(){
+    size_t used;
+
+    pthread_mutex_lock(&cache.lock);
+    used = cache.used;
+    pthread_mutex_unlock(&cache.lock);
+
+    return used;
+}
+
+
+// HELPERS //
+
+/**
+ * @brief FNV-1a hash of a path, mixed with the coding.
+ */
+static uint32_t hash_entry_key(const char *path, content_coding coding){
+    return fnv1a_add(fnv1a(path), (unsigned char) coding);
+}
+
+
+/**
+ * @brief Match a content type (which may carry parameters, eg: "; charset=utf-8")
+ *        against an exact type, or a whole type when the pattern's subtype is "*".
+ */
+static bool content_type_matches(const char *content_type, const char *pattern){
+    size_t pattern_len = strlen(pattern);
+    size_t type_len = strcspn(content_type, "; ");
+
+    if(pattern_len >= 2 && strcmp(pattern + pattern_len - 2, "/*") == 0){
+        return strncasecmp(content_type, pattern, pattern_len - 1) == 0;
+    }
+
+    return type_len == pattern_len && strncasecmp(content_type, pattern, pattern_len) == 0;
+}
+
+
+static int init_deflate_stream(z_stream *stream, content_coding coding){
+    int window_bits = coding == CODING_GZIP ? GZIP_WINDOW_BITS : ZLIB_WINDOW_BITS;
+
+    memset(stream, 0, sizeof(z_stream));
+
+    if(deflateInit2(stream, config.level, Z_DEFLATED, window_bits, ZLIB_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK){
+        LOG(ERROR, "Failed to initialize %s compression\n", content_coding_token(coding));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Find an entry for the current version of a ressource. Cache lock must be held.
+ */
+static struct _compressed_entry *find_cached_entry(const char *path, const struct stat *ressource_info, content_coding coding){
+    struct _compressed_entry *entry = cache.buckets[hash_entry_key(path, coding) & (COMPRESSED_CACHE_BUCKETS - 1)];
+
+    for(; entry; entry = entry->hash_next){
+        if(entry->coding == coding &&
+           entry->ino == ressource_info->st_ino &&
+           entry->mtime == ressource_info->st_mtime &&
+           entry->ressource_size == ressource_info->st_size &&
+           strcmp(entry->path, path) == 0){
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Add an entry to the cache, evicting least recently used entries (and stale
+ *        versions of the same ressource) to make room. Cache lock must be held.
+ */
+static void insert_cached_entry(struct _compressed_entry *entry){
+    uint32_t bucket = hash_entry_key(entry->path, entry->coding) & (COMPRESSED_CACHE_BUCKETS - 1);
+
+    // Drop older versions of this ressource, as well as a concurrent compression of the same one
+    for(struct _compressed_entry *other = cache.buckets[bucket]; other; ){
+        struct _compressed_entry *next = other->hash_next;
+
+        if(other->coding == entry->coding && strcmp(other->path, entry->path) == 0){
+            unlink_cached_entry(other);
+            free_entry_if_unused(other);
+        }
+        other = next;
+    }
+
+    while(cache.lru_tail && cache.used + entry->data_len > (size_t) config.cache_size){
+        struct _compressed_entry *victim = cache.lru_tail;
+        LOG(DEBUG, "Evicting compressed %s from cache\n", victim->path);
+        unlink_cached_entry(victim);
+        free_entry_if_unused(victim);
+    }
+
+    if(entry->data_len > (size_t) config.cache_size){
+        return; // Never fits, only the caller gets to use it
+    }
+
+    entry->hash_next = cache.buckets[bucket];
+    cache.buckets[bucket] = entry;
+
+    entry->lru_prev = NULL;
+    entry->lru_next = cache.lru_head;
+
+    if(cache.lru_head){
+        cache.lru_head->lru_prev = entry;
+    }
+    cache.lru_head = entry;
+
+    if(!cache.lru_tail){
+        cache.lru_tail = entry;
+    }
+
+    entry->cached = true;
+    entry->refcount++; // Cache's reference
+    cache.used += entry->data_len;
+}
+
+
+/**
+ * @brief Remove an entry from the cache index and LRU list. Cache lock must be held.
+ */
+static void unlink_cached_entry(struct _compressed_entry *entry){
+    uint32_t bucket = hash_entry_key(entry->path, entry->coding) & (COMPRESSED_CACHE_BUCKETS - 1);
+    struct _compressed_entry **link = &cache.buckets[bucket];
+
+    if(!entry->cached){
+        return;
+    }
+
+    while(*link && *link != entry){
+        link = &((*link)->hash_next);
+    }
+
+    if(*link){
+        *link = entry->hash_next;
+    }
+
+    if(entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+    else cache.lru_head = entry->lru_next;
+
+    if(entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+    else cache.lru_tail = entry->lru_prev;
+
+    entry->hash_next = entry->lru_prev = entry->lru_next = NULL;
+    entry->cached = false;
+    entry->refcount--; // Cache's reference
+    cache.used -= entry->data_len;
+}
+
+
+static void lru_move_to_front(struct _compressed_entry *entry){
+    if(cache.lru_head == entry){
+        return;
+    }
+
+    // Unlink from current position
+    entry->lru_prev->lru_next = entry->lru_next;
+
+    if(entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+    else cache.lru_tail = entry->lru_prev;
+
+    entry->lru_prev = NULL;
+    entry->lru_next = cache.lru_head;
+    cache.lru_head->lru_prev = entry;
+    cache.lru_head = entry;
+}
+
+
+static void free_entry_if_unused(struct _compressed_entry *entry){
+    if(entry->refcount > 0 || entry->cached){
+        return;
+    }
+
+    free(entry->data);
+    free(entry);
+}
+
+
+/**
+ * @brief Find the compression in progress of a version of a ressource. Cache lock must be held.
+ */
+static struct compression_flight *find_flight(const char *path, const struct stat *ressource_info, content_coding coding){
+    struct compression_flight *flight = cache.flights;
+
+    for(; flight; flight = flight->next){
+        if(flight->coding == coding &&
+           flight->ino == ressource_info->st_ino &&
+           flight->mtime == ressource_info->st_mtime &&
+           flight->ressource_size == ressource_info->st_size &&
+           strcmp(flight->path, path) == 0){
+            return flight;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Advertise a compression about to start. Cache lock must be held.
+ *
+ * @return struct compression_flight* the flight to finish once compressed, NULL on error.
+ */
+static struct compression_flight *start_flight(const char *path, const struct stat *ressource_info, content_coding coding){
+    struct compression_flight *flight = (struct compression_flight *) calloc(1, sizeof(struct compression_flight));
+
+    if(!flight){
+        return NULL;
+    }
+
+    strcpy(flight->path, path);
+    flight->ino = ressource_info->st_ino;
+    flight->mtime = ressource_info->st_mtime;
+    flight->ressource_size = ressource_info->st_size;
+    flight->coding = coding;
+    pthread_cond_init(&(flight->done_cond), NULL);
+
+    flight->next = cache.flights;
+    cache.flights = flight;
+    return flight;
+}
+
+
+/**
+ * @brief Hand the result of a compression to the requests waiting on it. Cache lock must be held.
+ */
+static void finish_flight(struct compression_flight *flight, struct _compressed_entry *entry){
+    struct compression_flight **link = &cache.flights;
+
+    while(*link != flight){
+        link = &((*link)->next);
+    }
+    *link = flight->next;
+
+    // Waiters get their reference now, the entry may be evicted before they wake up
+    if(entry){
+        entry->refcount += flight->num_waiters;
+    }
+
+    flight->entry = entry;
+    flight->done = true;
+    pthread_cond_broadcast(&(flight->done_cond));
+    free_flight_if_unused(flight);
+}
+
+
+static void free_flight_if_unused(struct compression_flight *flight){
+    if(!flight->done || flight->num_waiters > 0){
+        return;
+    }
+
+    pthread_cond_destroy(&(flight->done_cond));
+    free(flight);
+}
@@ -0,0 +1,357 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "connection.h"
+#include "rio.h"
+#include "compression.h"
+#include "sender.h"
+#include "io_policy.h"
+#include "access_log.h"
+#include "metrics.h"
+#include "rate_limit.h"
+#include "log.h"
+#include "trace.h"
+
+/*Forward Declarations*/
+static int parse_request(int client_fd, http_req *result);
+static int send_response(int client_fd, http_resp response, const access_log_entry *access_entry, unsigned long picked_up_ns,
+                         off_t *bytes_sent);
+static int send_file_response(int client_fd, const char *status, const char *headers, http_resp response, off_t offset, off_t length,
+                              const access_log_entry *access_entry, unsigned long picked_up_ns);
+static void prepare_access_entry(const connection_t *connection, unsigned long picked_up_ns, http_req request, int status_code,
+                                 char *uri, char *version, access_log_entry *entry);
+
+
+int serve_connection(int client_fd, const connection_t *connection){
+    int rc = -1;
+    bool handed_off = false;
+    int status_code;
+    off_t bytes_sent;
+    long busy_us;
+    unsigned long picked_up_ns = metrics_now_ns();
+    unsigned long send_started_ns;
+    access_log_entry access_entry = {0};
+    char access_uri[MAX_URI_LEN] = {0};
+    char access_version[MAX_VER_LEN] = {0};
+    bool logs_access = access_log_enabled();
+    http_req request = NULL;
+    http_resp response = NULL;
+
+    if(connection->accepted_ns != 0){
+        metrics_record_stage(STAGE_QUEUE_WAIT, connection->accepted_ns);
+    }
+
+    if(parse_request(client_fd, &request) != 0){
+        LOG(ERROR,"Something went wrong parsing HTTP Request\n");
+        goto clean_up;
+    }
+
+    metrics_record_stage(STAGE_PARSE, picked_up_ns);
+
+    LOG(DEBUG,"Formulating HTTP response...\n");
+
+    response = get_http_response_from_request(request);
+
+    if (!response){
+        LOG(ERROR,"Something went wrong processing HTTP request\n");
+        goto clean_up;
+    }
+
+    LOG(DEBUG, "Sending the HTTP response back to the client...\n");
+    shutdown(client_fd, SHUT_RD);
+
+    // A client that stops reading times out instead of holding the worker forever
+    fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL) | O_NONBLOCK);
+
+    get_http_response_status_code(response, &status_code);
+    get_http_response_content_size(response, &bytes_sent);
+    TRACE(send_start, client_fd, status_code, bytes_sent);
+
+    if(logs_access){
+        prepare_access_entry(connection, picked_up_ns, request, status_code, access_uri, access_version, &access_entry);
+    }
+
+    send_started_ns = metrics_now_ns();
+    // Compressed while sending, the body is smaller than the ressource and only known once sent
+    rc = send_response(client_fd, response, logs_access ? &access_entry : NULL, picked_up_ns, &bytes_sent);
+    metrics_record_stage(STAGE_SEND, send_started_ns);
+
+    if(rc == -1){
+        LOG(ERROR,"Failed to send HTTP response back to client on fd %d\n", client_fd);
+    }
+
+    handed_off = rc == RESPONSE_HANDED_OFF;
+
+    // Handed off responses are counted once handed off, the sender threads don't time them
+    busy_us = (metrics_now_ns() - picked_up_ns) / 1000;
+
+    if(rc == -1){
+        bytes_sent = 0;
+    }
+
+    TRACE(send_done, client_fd, status_code, bytes_sent, handed_off);
+    metrics_count_request(status_code, bytes_sent, busy_us);
+
+    // Handed off responses are logged by the sender thread, once it knows what it sent
+    if(logs_access && !handed_off){
+        access_entry.bytes_sent = bytes_sent;
+        access_entry.duration_us = busy_us;
+        access_log_write(&access_entry);
+    }
+
+    clean_up:
+        if(!handed_off){
+            shutdown(client_fd, SHUT_WR);
+            rate_limit_release(client_fd);
+            close(client_fd);
+            metrics_count_connection(false);
+            TRACE(close, client_fd, 0);
+        }
+        destroy_http_request(&request);
+        destroy_http_response(&response);
+
+    return rc == -1 ? -1 : 0;
+}
+
+
+int send_http_response(int client_fd, http_resp response){
+    return send_response(client_fd, response, NULL, 0, NULL);
+}
+
+
+// HELPERS //
+
+/**
+ * @brief Send a response, having the sender threads log it if they end up sending it.
+ *
+ * @param access_entry access log entry of the response, NULL if it isn't logged.
+ * @param picked_up_ns when the worker took the connection out of the bounded buffer.
+ * @param bytes_sent if not NULL, set to the compressed body size when the response is compressed while being sent.
+ */
+static int send_response(int client_fd, http_resp response, const access_log_entry *access_entry, unsigned long picked_up_ns,
+                         off_t *bytes_sent){
+    int ressource_fd;
+    int num_ranges;
+    char status[MAX_RESP_STATUS_LEN];
+    char resp_headers[MAX_RESP_HEADERS_LEN];
+    char part_headers[MAX_RANGE_PART_HEADERS_LEN];
+    off_t content_size;
+    off_t range_offset;
+    off_t range_len;
+    const char *body;
+    size_t body_len;
+    content_coding stream_coding;
+
+    get_http_response_status(response, status, MAX_RESP_STATUS_LEN);
+    get_http_response_headers(response, resp_headers, MAX_RESP_HEADERS_LEN);
+    get_http_response_content_size(response, &content_size);
+    get_http_response_ressource_fd(response, &ressource_fd);
+    get_http_response_num_ranges(response, &num_ranges);
+    get_http_response_body(response, &body, &body_len);
+    get_http_response_stream_coding(response, &stream_coding);
+
+    // Whole in memory bodies go out with the status and headers in a single syscall
+    if(body && num_ranges == 0){
+        struct iovec iov[] = {{.iov_base = status, .iov_len = strlen(status)},
+                              {.iov_base = resp_headers, .iov_len = strlen(resp_headers)},
+                              {.iov_base = (void *) body, .iov_len = content_size}};
+
+        return writev_b(client_fd, iov, sizeof(iov) / sizeof(iov[0])) == -1 ? -1 : 0;
+    }
+
+    // Plain file transfers are what slow clients drag on, let the sender threads finish them
+    if(!body && stream_coding == CODING_IDENTITY && num_ranges == 0 && content_size != 0 && sender_pool_running()){
+        return send_file_response(client_fd, status, resp_headers, response, 0, content_size, access_entry, picked_up_ns);
+    }
+
+    else if(!body && stream_coding == CODING_IDENTITY && num_ranges == 1 && sender_pool_running()){
+        if(get_http_response_range(response, 0, &range_offset, &range_len, part_headers, MAX_RANGE_PART_HEADERS_LEN) != 0){
+            return -1;
+        }
+
+        // A single range has no part headers
+        return send_file_response(client_fd, status, resp_headers, response, range_offset, range_len, access_entry, picked_up_ns);
+    }
+
+    unsigned long headers_started_ns = metrics_now_ns();
+
+    if(writen_b(client_fd, status, strlen(status)) == -1){
+        return -1;
+    }
+
+    else if(writen_b(client_fd, resp_headers, strlen(resp_headers)) == -1){
+        return -1;
+    }
+
+    metrics_record_stage(STAGE_WRITE_HEADERS, headers_started_ns);
+
+    // Only try to write from ressource fd if there is content to read
+    // content size will be 0 in case of errors
+    if(content_size == 0){
+        return 0;
+    }
+
+    else if(stream_coding != CODING_IDENTITY){
+        return compress_stream(client_fd, ressource_fd, content_size, stream_coding, bytes_sent);
+    }
+
+    else if(num_ranges == 0){
+        io_policy_before_send(ressource_fd, 0, content_size);
+
+        if(writen(client_fd, ressource_fd, 0, content_size) == -1){
+            return -1;
+        }
+
+        io_policy_after_send(ressource_fd, 0, content_size);
+        return 0;
+    }
+
+    for(int i = 0; i < num_ranges; i++){
+        if(get_http_response_range(response, i, &range_offset, &range_len, part_headers, MAX_RANGE_PART_HEADERS_LEN) != 0){
+            return -1;
+        }
+
+        else if(strlen(part_headers) != 0 && writen_b(client_fd, part_headers, strlen(part_headers)) == -1){
+            return -1;
+        }
+
+        else if(body && writen_b(client_fd, (void *) (body + range_offset), range_len) == -1){
+            return -1;
+        }
+
+        else if(!body){
+            io_policy_before_send(ressource_fd, range_offset, range_len);
+
+            if(writen(client_fd, ressource_fd, range_offset, range_len) == -1){
+                return -1;
+            }
+
+            io_policy_after_send(ressource_fd, range_offset, range_len);
+        }
+    }
+
+    get_http_response_range_trailer(response, part_headers, MAX_RANGE_PART_HEADERS_LEN);
+
+    if(strlen(part_headers) != 0 && writen_b(client_fd, part_headers, strlen(part_headers)) == -1){
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Send a response made of headers and a region of a file, handing whatever
+ *        the client doesn't take right away over to the sender threads.
+ * 
+ * @note The ressource fd of the response goes to the job, the response can't send it anymore.
+ *
+ * @param access_entry access log entry of the response, logged by the sender thread if handed over.
+ * @param picked_up_ns when the worker took the connection out of the bounded buffer.
+ * @return int 0 if the response was sent, RESPONSE_HANDED_OFF if a sender thread
+ *         now owns client_fd, -1 on error.
+ */
+static int send_file_response(int client_fd, const char *status, const char *headers, http_resp response, off_t offset, off_t length,
+                              const access_log_entry *access_entry, unsigned long picked_up_ns){
+    char head[MAX_RESP_STATUS_LEN + MAX_RESP_HEADERS_LEN];
+    int head_len = snprintf(head, sizeof(head), "%s%s", status, headers);
+    root_index_hold_t snapshot;
+    int ressource_fd = take_http_response_ressource_fd(response, &snapshot);
+    send_job_t job = send_job_create(client_fd, head, head_len, ressource_fd, offset, length, snapshot);
+
+    if(!job){
+        return -1;
+    }
+
+    send_job_log_access(job, access_entry, picked_up_ns);
+
+    // Small responses to clients keeping up are done in one go, without a hand off
+    sendfile_status job_status = send_job_resume(job);
+
+    if(job_status == SENDFILE_DONE || job_status == SENDFILE_ERROR){
+        send_job_destroy(&job);
+        return job_status == SENDFILE_DONE ? 0 : -1;
+    }
+
+    else if(sender_submit(job) != 0){
+        send_job_destroy(&job);
+        return -1;
+    }
+
+    return RESPONSE_HANDED_OFF;
+}
+
+
+static int parse_request(int client_fd, http_req *result){
+    http_req tmp_req;
+    http_method method;
+    char version[MAX_VER_LEN] = {0};
+    char uri[MAX_URI_LEN] = {0};
+
+    if(!result){
+        LOG(ERROR, "Invalid result reference provided!\n");
+        return -1;
+    }
+
+    if(client_fd < 0){
+        LOG(ERROR, "Bad client file descriptor provided!\n");
+        return -1;
+    }
+
+    tmp_req = init_http_request(client_fd);
+    
+    if(!tmp_req){
+        LOG(ERROR, "failed to parse request!\n");
+        return -1;
+    }
+    
+    get_http_request_method(tmp_req, &method);
+    get_http_request_uri(tmp_req, uri);
+    get_http_request_version(tmp_req, version);
+    TRACE(parse_done, client_fd, uri, method);
+
+    LOG(DEBUG, "Got the following request:\n \
+    METHOD:   %s\n \
+    URI:      %s\n \
+    HTTP VER: %s\n", http_method_strings[method], uri, version);
+
+    *result = tmp_req;
+    return 0;
+}
+
+
+/**
+ * @brief Fill in the access log entry of a response, except for what's only known once it's sent.
+ *
+ * @param connection client address and accept time of the connection, zeroed if unknown.
+ * @param picked_up_ns when the worker took the connection out of the bounded buffer.
+ * @param request the request.
+ * @param status_code status code of the response.
+ * @param uri buffer of MAX_URI_LEN bytes for the entry's uri.
+ * @param version buffer of MAX_VER_LEN bytes for the entry's version.
+ * @param entry entry to fill in, bytes_sent and duration_us are left alone.
+ */
+static void prepare_access_entry(const connection_t *connection, unsigned long picked_up_ns, http_req request, int status_code,
+                                 char *uri, char *version, access_log_entry *entry){
+    http_method method;
+
+    get_http_request_method(request, &method);
+    get_http_request_uri(request, uri);
+    get_http_request_version(request, version);
+
+    entry->client_addr = connection->client_addr;
+    entry->method = http_method_strings[method];
+    entry->uri = uri;
+    entry->version = version;
+    entry->status_code = status_code;
+
+    if(connection->accepted_ns != 0){
+        entry->queue_wait_us = (picked_up_ns - connection->accepted_ns) / 1000;
+    }
+}
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "content_coding_private.h"
+#include "fnv1a.h"
+#include "log.h"
+
+#define LEN(arr) sizeof(arr) / sizeof(arr[0])
+
+static const coding_map *find_coding(content_coding coding);
+static unsigned int probe_precompressed_codings(const char *abs_path, const struct stat *ressource_info);
+
+// Ordered by preference, best compression first
+static const coding_map recognized_codings[] = {{.coding = CODING_BROTLI,
+                                                 .token = "br",
+                                                 .extension = ".br"},
+
+                                                {.coding = CODING_GZIP,
+                                                 .token = "gzip",
+                                                 .extension = ".gz"},
+
+                                                {.coding = CODING_DEFLATE,
+                                                 .token = "deflate",
+                                                 .extension = NULL}}; // Only ever compressed on the fly
+
+static struct sidecar_cache sidecar_cache = {.lock = PTHREAD_RWLOCK_INITIALIZER};
+
+
+const char *content_coding_token(content_coding coding){
+    const coding_map *map = find_coding(coding);
+    return map ? map->token : "identity";
+}
+
+
+const char *content_coding_extension(content_coding coding){
+    const coding_map *map = find_coding(coding);
+    return (map && map->extension) ? map->extension : "";
+}
+
+
+unsigned int parse_accept_encoding(const char *accept_encoding){
+    unsigned int accepted = 0;
+    unsigned int listed = 0;        // Codings with their own entry, whatever their quality
+    bool wildcard = false;
+    const char *cursor = accept_encoding;
+
+    if(!accept_encoding){
+        return 0;
+    }
+
+    while(*cursor){
+        char token[MAX_CODING_NAME_LEN] = {0};
+        size_t token_len = 0;
+        double quality = 1.0;
+
+        while(*cursor == ' ' || *cursor == '\t' || *cursor == ',') cursor++;
+
+        while(*cursor && *cursor != ',' && *cursor != ';' && *cursor != ' ' && *cursor != '\t'){
+            if(token_len < MAX_CODING_NAME_LEN - 1){
+                token[token_len++] = *cursor;
+            }
+            cursor++;
+        }
+
+        // Parameters, we only care about the quality value
+        while(*cursor && *cursor != ','){
+            if(*cursor == ';'){
+                cursor++;
+                while(*cursor == ' ' || *cursor == '\t') cursor++;
+
+                if(strncasecmp(cursor, "q=", 2) == 0){
+                    quality = strtod(cursor + 2, NULL);
+                }
+                continue;
+            }
+            cursor++;
+        }
+
+        if(token_len == 0){
+            continue;
+        }
+
+        else if(strcmp(token, "*") == 0){
+            wildcard = quality > 0;
+            continue;
+        }
+
+        for(int i = 0; i < LEN(recognized_codings); i++){
+            if(strcasecmp(token, recognized_codings[i].token) == 0){
+                listed |= CODING_MASK(recognized_codings[i].coding);
+                accepted |= quality > 0 ? CODING_MASK(recognized_codings[i].coding) : 0;
+            }
+        }
+    }
+
+    // "*" only stands for the codings that weren't listed (RFC 7231 5.3.4)
+    if(wildcard){
+        for(int i = 0; i < LEN(recognized_codings); i++){
+            accepted |= CODING_MASK(recognized_codings[i].coding) & ~listed;
+        }
+    }
+
+    return accepted;
+}
+
+
+unsigned int get_precompressed_codings(const char *abs_path, const struct stat *ressource_info){
+    sidecar_cache_entry *entry;
+    unsigned int available;
+
+    if(!abs_path || !ressource_info){
+        LOG(ERROR, "Invalid input for finding precompressed siblings!\n");
+        return 0;
+    }
+
+    else if(strlen(abs_path) >= sizeof(entry->path)){
+        return 0;
+    }
+
+    entry = &sidecar_cache.entries[fnv1a(abs_path) & (SIDECAR_CACHE_SIZE - 1)];
+
+    pthread_rwlock_rdlock(&sidecar_cache.lock);
+
+    if(entry->ino == ressource_info->st_ino &&
+       entry->mtime == ressource_info->st_mtime &&
+       strcmp(entry->path, abs_path) == 0){
+
+        available = entry->available;
+        pthread_rwlock_unlock(&sidecar_cache.lock);
+        return available;
+    }
+
+    pthread_rwlock_unlock(&sidecar_cache.lock);
+
+    // Cache miss - probe outside of the lock, concurrent misses on the
+    // same ressource will both probe and store the same result
+    available = probe_precompressed_codings(abs_path, ressource_info);
+
+    pthread_rwlock_wrlock(&sidecar_cache.lock);
+    strcpy(entry->path, abs_path);
+    entry->ino = ressource_info->st_ino;
+    entry->mtime = ressource_info->st_mtime;
+    entry->available = available;
+    pthread_rwlock_unlock(&sidecar_cache.lock);
+
+    return available;
+}
+
+
+unsigned int peek_precompressed_codings(const char *abs_path){
+    sidecar_cache_entry *entry;
+    unsigned int available = 0;
+
+    if(!abs_path || strlen(abs_path) >= sizeof(entry->path)){
+        return 0;
+    }
+
+    entry = &sidecar_cache.entries[fnv1a(abs_path) & (SIDECAR_CACHE_SIZE - 1)];
+
+    pthread_rwlock_rdlock(&sidecar_cache.lock);
+
+    if(strcmp(entry->path, abs_path) == 0){
+        available = entry->available;
+    }
+
+    pthread_rwlock_unlock(&sidecar_cache.lock);
+    return available;
+}
+
+
+content_coding select_content_coding(unsigned int accepted, unsigned int available){
+    for(int i = 0; i < LEN(recognized_codings); i++){
+        if(accepted & available & CODING_MASK(recognized_codings[i].coding)){
+            return recognized_codings[i].coding;
+        }
+    }
+
+    return CODING_IDENTITY;
+}
+
+
+void clear_precompressed_cache(){
+    pthread_rwlock_wrlock(&sidecar_cache.lock);
+    memset(sidecar_cache.entries, 0, sizeof(sidecar_cache.entries));
+    pthread_rwlock_unlock(&sidecar_cache.lock);
+}
+
+
+// HELPERS //
+
+static const coding_map *find_coding(content_coding coding){
+    for(int i = 0; i < LEN(recognized_codings); i++){
+        if(recognized_codings[i].coding == coding){
+            return &recognized_codings[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Stat every possible sibling of abs_path and keep the ones that are
+ *        regular files at least as recent as the ressource itself.
+ */
+static unsigned int probe_precompressed_codings(const char *abs_path, const struct stat *ressource_info){
+    char sidecar_path[MAX_SERVER_ROOT_LEN + MAX_URI_LEN + MAX_CODING_NAME_LEN];
+    struct stat sidecar_info;
+    unsigned int available = 0;
+
+    for(int i = 0; i < LEN(recognized_codings); i++){
+        if(!recognized_codings[i].extension){
+            continue;
+        }
+
+        snprintf(sidecar_path, sizeof(sidecar_path), "%s%s", abs_path, recognized_codings[i].extension);
+
+        if(stat(sidecar_path, &sidecar_info) != 0 || !S_ISREG(sidecar_info.st_mode)){
+            continue;
+        }
+
+        else if(sidecar_info.st_mtime < ressource_info->st_mtime){
+            LOG(WARNING, "Ignoring %s since it's older than the ressource it compresses\n", sidecar_path);
+            continue;
+        }
+
+        available |= CODING_MASK(recognized_codings[i].coding);
+    }
+
+    LOG(DEBUG, "Precompressed siblings of %s: 0x%x\n", abs_path, available);
+    return available;
+}
@@ -1,13 +1,25 @@
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <time.h>
+#include <errno.h>
 #include <regex.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include "http_private.h"
+#include "content_coding.h"
+#include "compression.h"
+#include "mime.h"
+#include "root_index.h"
+#include "io_pool.h"
+#include "metrics.h"
 #include "rio.h"
 #include "log.h"
+#include "trace.h"
 
 #define MINIMUM_NUM_HTTP_REQ_ARGUMENTS 2 // Expecting at minimum a METHOD and URI (simple request)
 #define SERVER_HTTP_VER 1.0
@@ -26,15 +38,40 @@ static void validate_http_version(http_req request_to_process, http_resp respons
 static void process_requested_ressource(http_req request_to_process, http_resp response);
 static void precheck_request(http_req request_to_process, http_resp response);
 static void get_ressource_size(http_req request, http_resp response);
+static void lookup_ressource(http_req request, http_resp response);
+static int open_ressource(const char *path, struct stat *ressource_info);
 static int get_ressource_content_type(http_req request, http_resp response);
+static void set_ressource_info(http_resp response, int ressource_fd, const struct stat *ressource_info, content_coding coding);
+static bool open_precompressed_ressource(http_req request, http_resp response, content_coding coding);
+static bool open_known_sibling(http_req request, http_resp response);
+static void use_indexed_ressource(http_req request, http_resp response);
+static void use_indexed_precompressed_ressource(http_req request, http_resp response, content_coding coding);
+static void compress_ressource(http_req request, http_resp response);
 static void parse_http_method(const char *in_buf, http_req request);
 static void parse_http_uri(const char *in_buf, http_req request);
 static void parse_http_version(const char *in_buf, size_t in_buf_len, http_req request);
+static void parse_http_headers(rio_t in_parser, http_req request);
+static void process_range_request(http_req request, http_resp response);
+static int parse_byte_ranges(const char *range_header, off_t ressource_len, byte_range *ranges, int max_ranges);
+static bool if_range_matches(http_req request, http_resp response);
+static void format_http_date(time_t timestamp, char *buff, size_t max_len);
+static int format_range_part_headers(http_resp response, int range_idx, char *buff, size_t max_len);
+static int format_range_trailer(http_resp response, char *buff, size_t max_len);
 static int get_match_object_len(regmatch_t match);
 
 char *http_response_type_strings[] = {FOREACH_HTTP_METHOD(STRING_GEN)};
 char *http_method_strings[] = {FOREACH_HTTP_METHOD(STRING_GEN)};
 
+// Request headers the server acts on - everything else is read and dropped
+static header_map recognized_headers[] = {{.name = "Range",
+                                           .offset = offsetof(struct _http_req, _range)},
+
+                                          {.name = "If-Range",
+                                           .offset = offsetof(struct _http_req, _if_range)},
+
+                                          {.name = "Accept-Encoding",
+                                           .offset = offsetof(struct _http_req, _accept_encoding)}};
+
 // REQUEST //
 
 http_req init_http_request(int client_fd){
@@ -58,12 +95,18 @@ http_req init_http_request(int client_fd){
     memset(in_buf, 0, status_line_len);
 
     (void) readline_b(in_parser, in_buf, status_line_len-1);
-    readn_b_destroy(&in_parser);
 
     parse_http_method(in_buf, result);
     parse_http_uri(in_buf, result);
     parse_http_version(in_buf, status_line_len, result);
 
+    // Simple requests don't carry any headers, so only keep reading for full requests
+    if(strlen(result->version) != 0){
+        parse_http_headers(in_parser, result);
+    }
+
+    readn_b_destroy(&in_parser);
+
     return result;
 }
 
@@ -123,14 +166,29 @@ http_resp init_http_response(){
 
     response = (http_resp) calloc(1, sizeof(struct _http_resp));
 
+    if(response){
+        response->ressource_fd = -1; // No ressource attached yet
+    }
+
     return response;
 }
 
 
 void destroy_http_response(http_resp *response_to_destroy){
-    if(!response_to_destroy) return; // Nothing to free...
+    if(!response_to_destroy || !(*response_to_destroy)) return; // Nothing to free...
+
+    if((*response_to_destroy)->_owns_ressource_fd){
+        close((*response_to_destroy)->ressource_fd);
+    }
+
+    // Indexed fds are shared and stay open until no response uses the snapshot
+    if((*response_to_destroy)->_holds_root_index){
+        root_index_exit();
+    }
 
-    close((*response_to_destroy)->ressource_fd);
+    root_index_release(&((*response_to_destroy)->_root_index_hold));
+
+    release_compressed_entry(&((*response_to_destroy)->_body_entry));
 
     free(*response_to_destroy);
     *response_to_destroy = NULL;
@@ -163,6 +221,37 @@ int get_http_response_ressource_fd(http_resp response, int *ressource_fd){
 }
 
 
+int take_http_response_ressource_fd(http_resp response, struct root_index **snapshot){
+    int ressource_fd;
+
+    if(!response || !snapshot) return -1;
+
+    *snapshot = NULL;
+    ressource_fd = response->ressource_fd;
+
+    if(ressource_fd == -1){
+        return -1;
+    }
+
+    else if(response->_owns_ressource_fd){
+        response->_owns_ressource_fd = false;
+    }
+
+    // Indexed fds stay open as long as their snapshot, which now goes with the fd
+    else if(response->_root_index_hold){
+        *snapshot = response->_root_index_hold;
+        response->_root_index_hold = NULL;
+    }
+
+    else {
+        ressource_fd = dup(ressource_fd);
+    }
+
+    response->ressource_fd = -1;
+    return ressource_fd;
+}
+
+
 int get_http_response_headers(http_resp response, char *headers, size_t max_header_len){
     if(!response || !headers)
         return -1;
@@ -190,6 +279,67 @@ int get_http_response_status_code(http_resp response, int *status_code){
 }
 
 
+int get_http_response_num_ranges(http_resp response, int *num_ranges){
+    if(!response || !num_ranges)
+        return -1;
+
+    *num_ranges = response->_num_ranges;
+    return 0;
+}
+
+
+int get_http_response_range(http_resp response, int range_idx, off_t *offset, off_t *length, 
+                            char *part_headers, size_t max_part_headers_len){
+    if(!response || !offset || !length || !part_headers)
+        return -1;
+
+    else if(range_idx < 0 || range_idx >= response->_num_ranges)
+        return -1;
+
+    *offset = response->_ranges[range_idx].offset;
+    *length = response->_ranges[range_idx].length;
+
+    return format_range_part_headers(response, range_idx, part_headers, max_part_headers_len) < 0 ? -1 : 0;
+}
+
+
+int get_http_response_body(http_resp response, const char **body, size_t *body_len){
+    if(!response || !body || !body_len)
+        return -1;
+
+    else if(response->_mapped_body){
+        *body = response->_mapped_body;
+        *body_len = response->_ressource_len;
+        return 0;
+    }
+
+    else if(!response->_body_entry){
+        *body = NULL;
+        *body_len = 0;
+        return 0;
+    }
+
+    return get_compressed_entry_data(response->_body_entry, body, body_len);
+}
+
+
+int get_http_response_stream_coding(http_resp response, content_coding *coding){
+    if(!response || !coding)
+        return -1;
+
+    *coding = response->_stream_coding;
+    return 0;
+}
+
+
+int get_http_response_range_trailer(http_resp response, char *trailer, size_t max_trailer_len){
+    if(!response || !trailer)
+        return -1;
+
+    return format_range_trailer(response, trailer, max_trailer_len) < 0 ? -1 : 0;
+}
+
+
 
 /**
  * @brief This specifically provides a response object that looks like the following:
@@ -229,6 +379,34 @@ http_resp get_server_shutting_down_response(){
 }
 
 
+http_resp get_too_many_requests_response(){
+    char status_code_str[30];
+
+    http_resp response = init_http_response();
+
+    if(!response){
+        LOG(ERROR,"Something went wrong trying to initialize the response!\n");
+        return NULL;
+    }
+
+    http_resp_status_code_to_str(TOO_MANY_REQUESTS, status_code_str);
+    snprintf(response->status,
+             MAX_RESP_STATUS_LEN,
+             "HTTP/%.1f %d %s\r\n",
+             SERVER_HTTP_VER,
+             TOO_MANY_REQUESTS,
+             status_code_str);
+
+    // Tokens are refilled every second
+    snprintf(response->headers,
+             MAX_RESP_HEADERS_LEN,
+             "Connection: close\r\nRetry-After: 1\r\nContent-type: text/plain\r\n\r\n");
+
+    response->_return_code = TOO_MANY_REQUESTS;
+    return response;
+}
+
+
 /**
  * @brief Get the http response from request object
  * 
@@ -253,14 +431,32 @@ http_resp get_http_response_from_request(http_req request_to_process){
     // This will get modified throughout processing pipeline accordingly
     response->_return_code = OK;
 
+    if(root_index_enabled()){
+        response->_holds_root_index = root_index_enter() == 0;
+    }
+
+    unsigned long stage_started_ns = metrics_now_ns();
     precheck_request(request_to_process, response);
+    metrics_record_stage(STAGE_VALIDATE, stage_started_ns);
 
     if (response->_return_code != OK){
         goto generate_response;
     }
 
     // Process the ressource
+    stage_started_ns = metrics_now_ns();
     get_ressource_size(request_to_process, response);
+    metrics_record_stage(STAGE_LOOKUP, stage_started_ns);
+
+    if(response->response_type == FULL && response->_return_code == OK){
+        if(get_ressource_content_type(request_to_process, response) != 0){
+            response->_return_code = INTERNAL_ERROR;
+            goto generate_response;
+        }
+
+        compress_ressource(request_to_process, response);
+        process_range_request(request_to_process, response);
+    }
 
     // Set status last after we've had a chance to process ressource
 
@@ -279,6 +475,15 @@ http_resp get_http_response_from_request(http_req request_to_process){
                 return NULL;
         }
 
+    TRACE(response, request_to_process->URI, response->_return_code, response->_content_len);
+
+    // Lookups are done, sending the body only needs the snapshot alive, not the epoch
+    if(response->_holds_root_index){
+        response->_root_index_hold = root_index_hold();
+        root_index_exit();
+        response->_holds_root_index = false;
+    }
+
     return (response_formulated_successfully == 0) ? response : NULL;
 }
 
@@ -323,6 +528,10 @@ static void http_resp_status_code_to_str(int status_code, char *buff){
         case OK:
             strncpy(buff, "OK", 30);
             break;
+
+        case PARTIAL_CONTENT:
+            strncpy(buff, "Partial Content", 30);
+            break;
         
         case BAD_REQUEST:
             strncpy(buff, "Bad Request", 30);
@@ -336,6 +545,14 @@ static void http_resp_status_code_to_str(int status_code, char *buff){
             strncpy(buff, "Not Found", 30);
             break;
 
+        case RANGE_NOT_SATISFIABLE:
+            strncpy(buff, "Range Not Satisfiable", 30);
+            break;
+
+        case TOO_MANY_REQUESTS:
+            strncpy(buff, "Too Many Requests", 30);
+            break;
+
         case NOT_IMPLEMENTED:
             strncpy(buff, "Not Implemented", 30);  
             break;
@@ -388,18 +605,80 @@ static int formulate_full_response(http_req request_to_process, http_resp respon
 
     // Populate headers
     // TODO Need to clean this up - maybe a macro? 
+
+    if(response->_return_code == RANGE_NOT_SATISFIABLE){
+        snprintf(response->headers, MAX_RESP_HEADERS_LEN, "Content-Range: bytes */%ld\r\n\r\n", response->_ressource_len);
+        return 0;
+    }
     
-    if(response->_return_code != OK){
+    else if(response->_return_code != OK && response->_return_code != PARTIAL_CONTENT){
         // For a bad request we don't need headers
         return 0;
     }
 
-    if(get_ressource_content_type(request_to_process, response) != 0){
-        response->_return_code = INTERNAL_ERROR;
-        return 0;
+    char last_modified[MAX_HTTP_DATE_LEN];
+    format_http_date(response->_last_modified, last_modified, MAX_HTTP_DATE_LEN);
+
+    int headers_len = 0;
+
+    // Compressed while sending, so the length is only known once the connection is closed
+    if(response->_stream_coding == CODING_IDENTITY){
+        headers_len += snprintf(response->headers + headers_len, 
+                                MAX_RESP_HEADERS_LEN - headers_len, 
+                                "Content-length: %ld\r\n", 
+                                response->_content_len);
     }
 
-    snprintf(response->headers, MAX_RESP_HEADERS_LEN, "Content-length: %ld\r\nContent-type: %s\r\n\r\n", response->_content_len, response->_content_type);
+    // Ranges are only served from the ressource as it's stored on disk
+    if(!response->_compressed_on_the_fly){
+        headers_len += snprintf(response->headers + headers_len, 
+                                MAX_RESP_HEADERS_LEN - headers_len, 
+                                "Accept-Ranges: bytes\r\n");
+    }
+
+    headers_len += snprintf(response->headers + headers_len, 
+                            MAX_RESP_HEADERS_LEN - headers_len, 
+                            "Last-Modified: %s\r\nETag: %s\r\n", 
+                            last_modified,
+                            response->_etag);
+
+    if(response->_return_code == OK || response->_num_ranges == 1){
+        headers_len += snprintf(response->headers + headers_len, 
+                                MAX_RESP_HEADERS_LEN - headers_len, 
+                                "Content-type: %s\r\n", 
+                                response->_content_type);
+    }
+    
+    else {
+        headers_len += snprintf(response->headers + headers_len, 
+                                MAX_RESP_HEADERS_LEN - headers_len, 
+                                "Content-type: multipart/byteranges; boundary=%s\r\n", 
+                                response->_boundary);
+    }
+
+    if(response->_content_coding != CODING_IDENTITY){
+        headers_len += snprintf(response->headers + headers_len, 
+                                MAX_RESP_HEADERS_LEN - headers_len, 
+                                "Content-Encoding: %s\r\n", 
+                                content_coding_token(response->_content_coding));
+    }
+
+    if(response->_vary_encoding){
+        headers_len += snprintf(response->headers + headers_len, 
+                                MAX_RESP_HEADERS_LEN - headers_len, 
+                                "Vary: Accept-Encoding\r\n");
+    }
+
+    if(response->_return_code == PARTIAL_CONTENT && response->_num_ranges == 1){
+        headers_len += snprintf(response->headers + headers_len, 
+                                MAX_RESP_HEADERS_LEN - headers_len, 
+                                "Content-Range: bytes %ld-%ld/%ld\r\n", 
+                                response->_ranges[0].offset,
+                                response->_ranges[0].offset + response->_ranges[0].length - 1,
+                                response->_ressource_len);
+    }
+
+    snprintf(response->headers + headers_len, MAX_RESP_HEADERS_LEN - headers_len, "\r\n");
     LOG(DEBUG, "%s", response->headers);
     return 0;
 }
@@ -477,6 +756,36 @@ static void validate_http_uri(http_req request_to_process, http_resp response)
     
     LOG(DEBUG,"Ressource full path: %s\n", request_to_process->_ressource_abs_path);
 
+    if(response->_holds_root_index){
+        bool authoritative;
+        const char *uri = request_to_process->_ressource_abs_path + strlen(server_root_location);
+
+        response->_index_entry = root_index_lookup(uri, &authoritative);
+
+        if(response->_index_entry && !response->_index_entry->data && response->_index_entry->fd == -1){
+            LOG(ERROR,"Bad permissions for requested ressource %s\n", request_to_process->_ressource_abs_path);
+            response->_return_code = UNAUTHORIZED;
+            return;
+        }
+
+        else if(response->_index_entry){
+            return;
+        }
+
+        else if(authoritative){
+            LOG(ERROR,"%s isn't in the snapshot\n", request_to_process->_ressource_abs_path);
+            response->_return_code = FILE_NOT_FOUND;
+            return;
+        }
+
+        // Not in an incomplete snapshot, look it up on the filesystem
+    }
+
+    if(io_pool_enabled()){
+        lookup_ressource(request_to_process, response);
+        return;
+    }
+
     if(access(request_to_process->_ressource_abs_path, F_OK) != 0){
         LOG(ERROR,"Could not access %s\n", request_to_process->_ressource_abs_path);
         response->_return_code = FILE_NOT_FOUND;
@@ -491,6 +800,42 @@ static void validate_http_uri(http_req request_to_process, http_resp response)
 }
 
 
+/**
+ * @brief Open the ressource through the I/O pool, the pool version of the access checks.
+ *        The fd and metadata are kept for get_ressource_size.
+ * 
+ * @param request Request to process.
+ * @param response Response being updated.
+ */
+static void lookup_ressource(http_req request, http_resp response)
+{
+    io_lookup lookup;
+
+    if(io_pool_lookup(request->_ressource_abs_path, &lookup) == 0){
+        response->ressource_fd = lookup.fd;
+        response->_owns_ressource_fd = true;
+        response->_lookup_info = lookup.info;
+        response->_looked_up = true;
+        return;
+    }
+
+    else if(lookup.error == EACCES || lookup.error == EPERM){
+        LOG(ERROR,"Bad permissions for requested ressource %s\n", request->_ressource_abs_path);
+        response->_return_code = UNAUTHORIZED;
+    }
+
+    else if(lookup.error == ENOENT || lookup.error == ENOTDIR || lookup.error == ENAMETOOLONG || lookup.error == ELOOP){
+        LOG(ERROR,"Could not access %s\n", request->_ressource_abs_path);
+        response->_return_code = FILE_NOT_FOUND;
+    }
+
+    else {
+        LOG(ERROR,"Failed to look up %s: %s\n", request->_ressource_abs_path, strerror(lookup.error));
+        response->_return_code = INTERNAL_ERROR;
+    }
+}
+
+
 /**
  * @brief Validate that the request_to_process has a valid http version
  * 
@@ -557,22 +902,59 @@ static void get_ressource_size(http_req request, http_resp response)
     int ressource_fd;
     int stat_result;
 
-    ressource_fd = open(request->_ressource_abs_path, O_RDONLY);
+    if(response->_index_entry){
+        use_indexed_ressource(request, response);
+        return;
+    }
 
-    if(!ressource_fd){
-        LOG(ERROR,"Failed to get file descriptor for requested ressource %s\n", request->_ressource_abs_path);
-        goto clean_up;
+    memset(&ressource_info, 0, sizeof(struct stat));
+
+    if(response->_looked_up){
+        // Opened by the I/O pool while validating the uri
+        ressource_fd = response->ressource_fd;
+        ressource_info = response->_lookup_info;
     }
 
-    stat_result = fstat(ressource_fd, &ressource_info); 
-    
-    if(stat_result == -1){
-        LOG(ERROR,"Failed to get %s metadata\n", request->_ressource_abs_path);
-        goto clean_up;
+    else if(open_known_sibling(request, response)){
+        return;
     }
 
-    response->ressource_fd = ressource_fd;
-    response->_content_len = ressource_info.st_size;
+    else {
+        ressource_fd = open(request->_ressource_abs_path, O_RDONLY);
+
+        if(ressource_fd == -1){
+            LOG(ERROR,"Failed to get file descriptor for requested ressource %s\n", request->_ressource_abs_path);
+            response->_return_code = INTERNAL_ERROR;
+            return;
+        }
+
+        stat_result = fstat(ressource_fd, &ressource_info); 
+        
+        if(stat_result == -1){
+            LOG(ERROR,"Failed to get %s metadata\n", request->_ressource_abs_path);
+            response->_return_code = INTERNAL_ERROR;
+            goto clean_up;
+        }
+    }
+
+    set_ressource_info(response, ressource_fd, &ressource_info, CODING_IDENTITY);
+    response->_owns_ressource_fd = true;
+
+    if(response->response_type != FULL){
+        // Simple responses have no headers to advertise a Content-Encoding
+        return;
+    }
+
+    unsigned int available_codings = get_precompressed_codings(request->_ressource_abs_path, &ressource_info);
+    unsigned int accepted_codings = parse_accept_encoding(request->_accept_encoding);
+
+    response->_vary_encoding = available_codings != 0;
+
+    content_coding coding = select_content_coding(accepted_codings, available_codings);
+
+    if(coding != CODING_IDENTITY && open_precompressed_ressource(request, response, coding)){
+        close(ressource_fd);
+    }
 
     return;
 
@@ -582,49 +964,278 @@ static void get_ressource_size(http_req request, http_resp response)
 
 
 /**
- * @brief Provide the content type needed in the response based on the provided request.
+ * @brief Attach an opened ressource to the response, along with its size and validators.
  * 
- * @param request request which contains ressource absolute path.
- * @param ressource_type_result buffer to store the ressource type.
+ * @param response Response being updated.
+ * @param ressource_fd fd of the (possibly precompressed) ressource.
+ * @param ressource_info metadata of ressource_fd.
+ * @param coding coding of the bytes in ressource_fd.
  */
-static int get_ressource_content_type(http_req request, http_resp response)
+static void set_ressource_info(http_resp response, int ressource_fd, const struct stat *ressource_info, content_coding coding)
 {
-    ext_map recognized_ext_mappings[NUM_RECOGNIZED_EXT_MAPPINGS] = {{.extension = ".html",
-                                                                     .content_type = "text/html"},
-                                                                    
-                                                                     {.extension = ".jpeg",
-                                                                     .content_type = "image/jpeg"},
-                                                                    
-                                                                     {.extension = ".jpg",
-                                                                     .content_type = "image/jpeg"}};
+    response->ressource_fd = ressource_fd;
+    response->_content_coding = coding;
+    response->_content_len = ressource_info->st_size;
+    response->_ressource_len = ressource_info->st_size;
+    response->_last_modified = ressource_info->st_mtime;
+    response->_ressource_ino = ressource_info->st_ino;
+
+    // Each coding is a different representation, so needs its own entity tag
+    snprintf(response->_etag, 
+             MAX_ETAG_LEN, 
+             "\"%lx-%lx-%lx%s%s\"", 
+             (unsigned long) ressource_info->st_ino, 
+             (unsigned long) ressource_info->st_size, 
+             (unsigned long) ressource_info->st_mtime,
+             coding == CODING_IDENTITY ? "" : "-",
+             coding == CODING_IDENTITY ? "" : content_coding_token(coding));
+}
 
-    const char *default_content_type = "text/plain";
 
+/**
+ * @brief Open a ressource read only and get its metadata, through the I/O pool when it's enabled.
+ * 
+ * @param path path of the ressource.
+ * @param ressource_info reference to store the metadata in.
+ * @return int fd of the ressource, -1 on failure.
+ */
+static int open_ressource(const char *path, struct stat *ressource_info)
+{
+    io_lookup lookup;
+    int ressource_fd;
 
-    if(!request || !response){
-        LOG(ERROR,"Invalid input for getting ressource type!\n");
+    if(io_pool_enabled()){
+        if(io_pool_lookup(path, &lookup) != 0){
+            return -1;
+        }
+
+        *ressource_info = lookup.info;
+        return lookup.fd;
+    }
+
+    ressource_fd = open(path, O_RDONLY);
+
+    if(ressource_fd != -1 && fstat(ressource_fd, ressource_info) == -1){
+        close(ressource_fd);
         return -1;
     }
 
-    char *requested_ressource_extension_start = strstr(request->_ressource_abs_path, ".");
+    return ressource_fd;
+}
+
+
+/**
+ * @brief Attach the precompressed sibling of the ressource to the response, in place
+ *        of whatever was attached. The response is left untouched if the sibling can't be opened.
+ * 
+ * @param request Request to process.
+ * @param response Response being updated.
+ * @param coding coding of the sibling to send.
+ * @return true if the sibling is attached, otherwise false.
+ */
+static bool open_precompressed_ressource(http_req request, http_resp response, content_coding coding)
+{
+    char sibling_path[MAX_SERVER_ROOT_LEN + MAX_URI_LEN + MAX_CODING_NAME_LEN];
+    struct stat sibling_info;
+    int sibling_fd;
+
+    memset(&sibling_info, 0, sizeof(struct stat));
+    snprintf(sibling_path, sizeof(sibling_path), "%s%s", request->_ressource_abs_path, content_coding_extension(coding));
 
-    for(int i = 0; i < NUM_RECOGNIZED_EXT_MAPPINGS; i++){
+    sibling_fd = open_ressource(sibling_path, &sibling_info);
+
+    if(sibling_fd == -1){
+        LOG(WARNING,"Failed to open %s... sending uncompressed ressource\n", sibling_path);
+        return false;
+    }
+
+    LOG(DEBUG,"Sending %s in place of %s\n", sibling_path, request->_ressource_abs_path);
+    set_ressource_info(response, sibling_fd, &sibling_info, coding);
+    return true;
+}
+
+
+/**
+ * @brief Send the precompressed sibling a previous request found for the ressource,
+ *        without opening the ressource itself. A stat is enough to check the
+ *        sibling is still up to date.
+ * 
+ * @param request Request to process.
+ * @param response Response being updated.
+ * @return true if the sibling is attached, false if the ressource has to be opened.
+ */
+static bool open_known_sibling(http_req request, http_resp response)
+{
+    struct stat ressource_info;
+    unsigned int accepted_codings;
+    unsigned int available_codings;
+    content_coding coding;
 
-        if(strncmp(requested_ressource_extension_start, recognized_ext_mappings[i].extension, MAX_RES_EXT_LEN) !=0){
-            continue;    
+    if(response->response_type != FULL){
+        return false;
+    }
+
+    accepted_codings = parse_accept_encoding(request->_accept_encoding);
+
+    if(!(accepted_codings & peek_precompressed_codings(request->_ressource_abs_path)) ||
+       stat(request->_ressource_abs_path, &ressource_info) != 0){
+        return false;
+    }
+
+    available_codings = get_precompressed_codings(request->_ressource_abs_path, &ressource_info);
+    coding = select_content_coding(accepted_codings, available_codings);
+
+    if(coding == CODING_IDENTITY || !open_precompressed_ressource(request, response, coding)){
+        return false;
+    }
+
+    response->_owns_ressource_fd = true;
+    response->_vary_encoding = true;
+    return true;
+}
+
+
+/**
+ * @brief Populate the response from the snapshot entry found while validating the uri,
+ *        the snapshot version of get_ressource_size.
+ * 
+ * @param request Request to process.
+ * @param response Response being updated.
+ */
+static void use_indexed_ressource(http_req request, http_resp response)
+{
+    const root_index_entry *entry = response->_index_entry;
+
+    set_ressource_info(response, entry->fd, &(entry->info), CODING_IDENTITY);
+    response->_mapped_body = entry->data;
+
+    if(response->response_type != FULL){
+        return;
+    }
+
+    unsigned int accepted_codings = parse_accept_encoding(request->_accept_encoding);
+
+    response->_vary_encoding = entry->precompressed != 0;
+
+    content_coding coding = select_content_coding(accepted_codings, entry->precompressed);
+
+    if(coding != CODING_IDENTITY){
+        use_indexed_precompressed_ressource(request, response, coding);
+    }
+}
+
+
+/**
+ * @brief Swap the indexed ressource attached to the response for its indexed precompressed sibling.
+ * 
+ * @param request Request to process.
+ * @param response Response being updated.
+ * @param coding coding of the sibling to send.
+ */
+static void use_indexed_precompressed_ressource(http_req request, http_resp response, content_coding coding)
+{
+    char sibling_uri[MAX_URI_LEN + MAX_CODING_NAME_LEN];
+
+    snprintf(sibling_uri, sizeof(sibling_uri), "%s%s", response->_index_entry->uri, content_coding_extension(coding));
+
+    const root_index_entry *sibling = root_index_lookup(sibling_uri, NULL);
+
+    if(!sibling){
+        LOG(WARNING,"%s isn't in the snapshot... sending uncompressed ressource\n", sibling_uri);
+        return;
+    }
+
+    set_ressource_info(response, sibling->fd, &(sibling->info), coding);
+    response->_mapped_body = sibling->data;
+}
+
+
+/**
+ * @brief Compress the ressource on the fly when the client accepts it and there's no
+ *        precompressed sibling. Small enough ressources are compressed right away (or
+ *        taken from the compressed cache), bigger ones are compressed while being sent.
+ * 
+ * @note Requests with a Range header get the ressource as stored on disk.
+ *
+ * @param request Request to process.
+ * @param response Response being updated, its content type must already be set.
+ */
+static void compress_ressource(http_req request, http_resp response)
+{
+    const char *body;
+    size_t body_len;
+    struct stat ressource_info;
+
+    if(response->_content_coding != CODING_IDENTITY || strlen(request->_range) != 0){
+        return;
+    }
+
+    // Site packs carry their own compressed variants
+    else if(response->_mapped_body){
+        return;
+    }
+
+    else if(!compression_applies(response->_content_type, response->_ressource_len)){
+        return;
+    }
+
+    // Whether or not this client gets it compressed, the response depends on Accept-Encoding
+    response->_vary_encoding = true;
+
+    content_coding coding = select_content_coding(parse_accept_encoding(request->_accept_encoding), 
+                                                  compression_available_codings());
+
+    if(coding == CODING_IDENTITY){
+        return;
+    }
+
+    memset(&ressource_info, 0, sizeof(struct stat));
+    ressource_info.st_ino = response->_ressource_ino;
+    ressource_info.st_size = response->_ressource_len;
+    ressource_info.st_mtime = response->_last_modified;
+
+    if(compression_is_cacheable(response->_ressource_len)){
+        response->_body_entry = get_compressed_entry(request->_ressource_abs_path, response->ressource_fd, &ressource_info, coding);
+
+        if(!response->_body_entry || get_compressed_entry_data(response->_body_entry, &body, &body_len) != 0){
+            LOG(WARNING,"Failed to compress %s... sending uncompressed ressource\n", request->_ressource_abs_path);
+            release_compressed_entry(&(response->_body_entry));
+            return;
         }
 
-        strncpy(response->_content_type, recognized_ext_mappings[i].content_type, MAX_RES_TYPE_LEN-1);
-        LOG(DEBUG,"%s is of Content-Type: %s\n", request->_ressource_abs_path, recognized_ext_mappings[i].content_type);
-        return 0;
+        set_ressource_info(response, response->ressource_fd, &ressource_info, coding);
+        response->_content_len = body_len;
     }
 
-    LOG(WARNING,"Could not determine content type for requested ressource: %s... using default\n", request->_ressource_abs_path);
-    strncpy(response->_content_type, default_content_type, MAX_RES_TYPE_LEN -1);
-    return 0;
+    else {
+        set_ressource_info(response, response->ressource_fd, &ressource_info, coding);
+        response->_stream_coding = coding;
+    }
+
+    response->_compressed_on_the_fly = true;
 }
 
 
+/**
+ * @brief Provide the content type needed in the response based on the provided request.
+ * 
+ * @param request request which contains ressource absolute path.
+ * @param response response to store the ressource type in.
+ */
+static int get_ressource_content_type(http_req request, http_resp response)
+{
+    if(!request || !response){
+        LOG(ERROR,"Invalid input for getting ressource type!\n");
+        return -1;
+    }
+
+    const char *content_type = response->_index_entry ? response->_index_entry->content_type 
+                                                      : get_mime_type(request->_ressource_abs_path);
+
+    strncpy(response->_content_type, content_type ? content_type : DEFAULT_CONTENT_TYPE, MAX_RES_TYPE_LEN-1);
+    return 0;
+}
+
 
 static void parse_http_method(const char *in_buf, http_req request)
 {
@@ -680,7 +1291,8 @@ static void parse_http_uri(const char *in_buf, http_req request){
         goto clean_up;
     }
 
-    int uri_len = get_match_object_len(re_request_uri_result[0]);
+    // Without the space ending the uri
+    int uri_len = get_match_object_len(re_request_uri_result[0]) - 1;
     uri_len = uri_len > MAX_URL_LEN ? MAX_URL_LEN : uri_len;
 
     int ressource_loc_len = get_match_object_len(re_request_uri_result[ressource_location_match_group]);
@@ -735,6 +1347,288 @@ static void parse_http_version(const char *in_buf, size_t in_buf_len, http_req r
 }
 
 
+/**
+ * @brief Read the header lines following the request line, up to the empty line
+ *        that ends them, and keep the values of recognized_headers on the request.
+ * 
+ * @param in_parser rio_t instance positioned right after the request line.
+ * @param request request to store the recognized header values in.
+ */
+static void parse_http_headers(rio_t in_parser, http_req request)
+{
+    char line[MAX_HEADER_LINE_LEN];
+    ssize_t line_len;
+
+    for(int i = 0; i < MAX_NUM_HEADER_LINES; i++){
+        memset(line, 0, MAX_HEADER_LINE_LEN);
+        line_len = readline_b(in_parser, line, MAX_HEADER_LINE_LEN-1);
+
+        if(line_len <= 0 || strcmp(line, "\r\n") == 0 || strcmp(line, "\n") == 0){
+            // EOF, error or end of headers
+            return;
+        }
+
+        char *value = strchr(line, ':');
+
+        if(!value){
+            LOG(DEBUG,"Ignoring malformed header line: %s", line);
+            continue;
+        }
+
+        *value = '\0';
+        value++;
+
+        // Strip leading whitespace and trailing CRLF from the value
+        while(*value == ' ' || *value == '\t') value++;
+        value[strcspn(value, "\r\n")] = '\0';
+
+        for(int j = 0; j < LEN(recognized_headers); j++){
+            if(strcasecmp(line, recognized_headers[j].name) != 0){
+                continue;
+            }
+
+            char *dest = (char *) request + recognized_headers[j].offset;
+            strncpy(dest, value, MAX_HEADER_VALUE_LEN-1);
+            LOG(DEBUG,"Got header %s: %s\n", recognized_headers[j].name, dest);
+            break;
+        }
+    }
+
+    LOG(WARNING,"Request has more than %d header lines... ignoring the rest\n", MAX_NUM_HEADER_LINES);
+}
+
+
+/**
+ * @brief Narrow a 200 response down to the byte ranges asked for in the
+ *        request's Range header (RFC 7233).
+ * 
+ * @note The Range header is ignored (whole ressource is sent) when it's malformed, 
+ *       asks for more than MAX_BYTE_RANGES ranges or when If-Range doesn't match
+ *       the current version of the ressource. If none of the ranges overlap
+ *       the ressource, the response becomes a 416.
+ * 
+ * @param request request which contains the Range and If-Range headers.
+ * @param response response to update, expected to be a 200 for a GET.
+ */
+static void process_range_request(http_req request, http_resp response)
+{
+    int num_ranges;
+
+    if(request->method != GET || strlen(request->_range) == 0){
+        return;
+    }
+
+    else if(strlen(request->_if_range) != 0 && !if_range_matches(request, response)){
+        LOG(DEBUG,"If-Range doesn't match %s... sending the whole ressource\n", request->_ressource_abs_path);
+        return;
+    }
+
+    num_ranges = parse_byte_ranges(request->_range, response->_ressource_len, response->_ranges, MAX_BYTE_RANGES);
+
+    if(num_ranges == -1){
+        LOG(DEBUG,"Ignoring unusable Range header: %s\n", request->_range);
+        return;
+    }
+
+    else if(num_ranges == 0){
+        LOG(DEBUG,"No satisfiable range in %s for %s\n", request->_range, request->_ressource_abs_path);
+        response->_return_code = RANGE_NOT_SATISFIABLE;
+        response->_content_len = 0;
+        return;
+    }
+
+    response->_return_code = PARTIAL_CONTENT;
+    response->_num_ranges = num_ranges;
+
+    if(num_ranges == 1){
+        response->_content_len = response->_ranges[0].length;
+        return;
+    }
+
+    // Multipart body - content length accounts for the boundaries and part headers too
+    char part_headers[MAX_RANGE_PART_HEADERS_LEN];
+    snprintf(response->_boundary, MAX_BOUNDARY_LEN, "sws_%lx%lx", (unsigned long) time(NULL), (unsigned long) random());
+
+    response->_content_len = format_range_trailer(response, part_headers, MAX_RANGE_PART_HEADERS_LEN);
+
+    for(int i = 0; i < num_ranges; i++){
+        response->_content_len += format_range_part_headers(response, i, part_headers, MAX_RANGE_PART_HEADERS_LEN);
+        response->_content_len += response->_ranges[i].length;
+    }
+}
+
+
+/**
+ * @brief Parse a "bytes=" Range header value into ranges clamped to the ressource.
+ * 
+ * @note Supports first-last, first- and -suffix_length range specs. Ranges
+ *       starting past the end of the ressource are unsatisfiable and dropped.
+ * 
+ * @param range_header value of the Range header.
+ * @param ressource_len size of the ressource the ranges apply to.
+ * @param ranges array to store the satisfiable ranges.
+ * @param max_ranges number of elements in ranges.
+ * @return int number of satisfiable ranges, -1 if the header is malformed or has too many ranges.
+ */
+static int parse_byte_ranges(const char *range_header, off_t ressource_len, byte_range *ranges, int max_ranges)
+{
+    const char *units = "bytes=";
+    const char *cursor = range_header;
+    char *end;
+    int num_ranges = 0;
+    int num_specs = 0;
+
+    if(strncasecmp(cursor, units, strlen(units)) != 0){
+        return -1;
+    }
+
+    cursor += strlen(units);
+
+    while(*cursor){
+        long long first = -1;
+        long long last = -1;
+
+        while(*cursor == ' ' || *cursor == '\t') cursor++;
+
+        if(isdigit((unsigned char) *cursor)){
+            first = strtoll(cursor, &end, 10);
+            cursor = end;
+        }
+
+        if(*cursor != '-'){
+            return -1;
+        }
+
+        cursor++;
+
+        if(isdigit((unsigned char) *cursor)){
+            last = strtoll(cursor, &end, 10);
+            cursor = end;
+        }
+
+        while(*cursor == ' ' || *cursor == '\t') cursor++;
+
+        if(*cursor != ',' && *cursor != '\0'){
+            return -1;
+        }
+
+        else if(*cursor == ','){
+            cursor++;
+        }
+
+        if(++num_specs > max_ranges){
+            return -1;
+        }
+
+        if(first == -1 && last == -1){
+            return -1;
+        }
+
+        else if(first == -1){
+            // Suffix range: last N bytes of the ressource
+            if(last == 0) continue;
+            first = last > ressource_len ? 0 : ressource_len - last;
+            last = ressource_len - 1;
+        }
+
+        else if(last != -1 && last < first){
+            return -1;
+        }
+
+        if(first >= ressource_len){
+            continue; // Unsatisfiable
+        }
+
+        if(last == -1 || last >= ressource_len){
+            last = ressource_len - 1;
+        }
+
+        ranges[num_ranges].offset = first;
+        ranges[num_ranges].length = last - first + 1;
+        num_ranges++;
+    }
+
+    return num_specs == 0 ? -1 : num_ranges;
+}
+
+
+/**
+ * @brief Check whether the request's If-Range validator matches the ressource
+ *        being served, either as an entity tag or as a Last-Modified date.
+ * 
+ * @param request request which contains the If-Range header.
+ * @param response response which contains the ressource's validators.
+ * @return true if the Range header should be honoured, otherwise false.
+ */
+static bool if_range_matches(http_req request, http_resp response)
+{
+    char last_modified[MAX_HTTP_DATE_LEN];
+
+    if(request->_if_range[0] == '"' || strncmp(request->_if_range, "W/", 2) == 0){
+        // Weak entity tags never match for If-Range
+        return strcmp(request->_if_range, response->_etag) == 0;
+    }
+
+    format_http_date(response->_last_modified, last_modified, MAX_HTTP_DATE_LEN);
+    return strcmp(request->_if_range, last_modified) == 0;
+}
+
+
+/**
+ * @brief Format a timestamp as an HTTP date (eg: Sun, 06 Nov 1994 08:49:37 GMT).
+ */
+static void format_http_date(time_t timestamp, char *buff, size_t max_len)
+{
+    struct tm gmt;
+
+    if(!gmtime_r(&timestamp, &gmt) || strftime(buff, max_len, "%a, %d %b %Y %H:%M:%S GMT", &gmt) == 0){
+        buff[0] = '\0';
+    }
+}
+
+
+/**
+ * @brief Format the boundary delimiter and headers that precede a range
+ *        in a multipart/byteranges body. Single ranges have no part headers.
+ * 
+ * @return int number of characters in the part headers, -1 on error.
+ */
+static int format_range_part_headers(http_resp response, int range_idx, char *buff, size_t max_len)
+{
+    if(response->_num_ranges <= 1){
+        buff[0] = '\0';
+        return 0;
+    }
+
+    return snprintf(buff, 
+                    max_len, 
+                    "%s--%s\r\nContent-type: %s\r\nContent-Range: bytes %ld-%ld/%ld\r\n\r\n",
+                    range_idx == 0 ? "" : "\r\n",
+                    response->_boundary,
+                    response->_content_type,
+                    response->_ranges[range_idx].offset,
+                    response->_ranges[range_idx].offset + response->_ranges[range_idx].length - 1,
+                    response->_ressource_len);
+}
+
+
+/**
+ * @brief Format the closing boundary delimiter of a multipart/byteranges body.
+ *        Single ranges have no trailer.
+ * 
+ * @return int number of characters in the trailer, -1 on error.
+ */
+static int format_range_trailer(http_resp response, char *buff, size_t max_len)
+{
+    if(response->_num_ranges <= 1){
+        buff[0] = '\0';
+        return 0;
+    }
+
+    return snprintf(buff, max_len, "\r\n--%s--\r\n", response->_boundary);
+}
+
+
 static void process_requested_ressource(http_req request_to_process, http_resp response);
 
 
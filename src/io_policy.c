@@ -0,0 +1,141 @@
+#define _GNU_SOURCE // readahead
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "io_policy.h"
+#include "log.h"
+
+static unsigned long count_resident_bytes(int fd, off_t offset, size_t length);
+
+static io_policy_config config;
+
+static _Atomic unsigned long sequential_hints = 0;
+static _Atomic unsigned long readahead_bytes = 0;
+static _Atomic unsigned long readahead_calls = 0;
+static _Atomic unsigned long sampled_bytes = 0;
+static _Atomic unsigned long resident_bytes = 0;
+static _Atomic unsigned long dontneed_hints = 0;
+static _Atomic unsigned long dontneed_bytes = 0;
+static _Atomic unsigned long hugepage_mappings = 0;
+static _Atomic unsigned long hugepage_failures = 0;
+
+
+int io_policy_init(const io_policy_config *io_config){
+    if(!io_config || io_config->sequential_min_size < 0 || io_config->readahead_size < 0 || io_config->dontneed_min_size < 0 || io_config->residency_sample_rate < 0){
+        LOG(ERROR, "Invalid I/O policy config!\n");
+        return -1;
+    }
+
+    config = *io_config;
+
+    LOG(INFO, "I/O policy: sequential from %ldB (readahead %ldB), drop from page cache from %ldB, huge pages %s\n",
+              config.sequential_min_size,
+              config.readahead_size,
+              config.dontneed_min_size,
+              config.hugepages ? "on" : "off");
+    return 0;
+}
+
+
+void io_policy_before_send(int fd, off_t offset, off_t length){
+    if(fd == -1 || config.sequential_min_size == 0 || length < config.sequential_min_size){
+        return;
+    }
+
+    posix_fadvise(fd, offset, length, POSIX_FADV_SEQUENTIAL);
+    atomic_fetch_add(&sequential_hints, 1);
+
+    if(config.readahead_size == 0){
+        return;
+    }
+
+    size_t readahead_len = length < config.readahead_size ? length : config.readahead_size;
+
+    // Measured first, what's already cached shows how often the hint saves nothing.
+    // Mapping the region costs a few syscalls, a sample tells as much
+    if(config.residency_sample_rate != 0 && atomic_fetch_add(&readahead_calls, 1) % config.residency_sample_rate == 0){
+        atomic_fetch_add(&sampled_bytes, readahead_len);
+        atomic_fetch_add(&resident_bytes, count_resident_bytes(fd, offset, readahead_len));
+    }
+
+    if(readahead(fd, offset, readahead_len) == 0){
+        atomic_fetch_add(&readahead_bytes, readahead_len);
+    }
+}
+
+
+void io_policy_after_send(int fd, off_t offset, off_t length){
+    if(fd == -1 || config.dontneed_min_size == 0 || length < config.dontneed_min_size){
+        return;
+    }
+
+    if(posix_fadvise(fd, offset, length, POSIX_FADV_DONTNEED) == 0){
+        atomic_fetch_add(&dontneed_hints, 1);
+        atomic_fetch_add(&dontneed_bytes, length);
+    }
+}
+
+
+void io_policy_map(void *addr, size_t length){
+    if(!config.hugepages || !addr || length == 0){
+        return;
+    }
+
+    if(madvise(addr, length, MADV_HUGEPAGE) == 0){
+        atomic_fetch_add(&hugepage_mappings, 1);
+    }
+
+    else {
+        LOG(DEBUG, "Huge pages refused for a %luB mapping\n", length);
+        atomic_fetch_add(&hugepage_failures, 1);
+    }
+}
+
+
+void get_io_policy_counters(io_policy_counters *counters){
+    if(!counters) return;
+
+    counters->sequential_hints = atomic_load(&sequential_hints);
+    counters->readahead_bytes = atomic_load(&readahead_bytes);
+    counters->sampled_bytes = atomic_load(&sampled_bytes);
+    counters->resident_bytes = atomic_load(&resident_bytes);
+    counters->dontneed_hints = atomic_load(&dontneed_hints);
+    counters->dontneed_bytes = atomic_load(&dontneed_bytes);
+    counters->hugepage_mappings = atomic_load(&hugepage_mappings);
+    counters->hugepage_failures = atomic_load(&hugepage_failures);
+}
+
+
+// HELPERS //
+
+/**
+ * @brief Count how many bytes of a file region are in the page cache.
+ */
+static unsigned long count_resident_bytes(int fd, off_t offset, size_t length){
+    long page_size = sysconf(_SC_PAGESIZE);
+    off_t map_offset = offset - offset % page_size;
+    size_t map_len = length + (offset - map_offset);
+    size_t num_pages = (map_len + page_size - 1) / page_size;
+    unsigned long num_resident = 0;
+    unsigned char *residency = (unsigned char *) malloc(num_pages);
+    void *map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, map_offset);
+
+    if(map != MAP_FAILED && residency && mincore(map, map_len, residency) == 0){
+        for(size_t i = 0; i < num_pages; i++){
+            num_resident += residency[i] & 1;
+        }
+    }
+
+    if(map != MAP_FAILED){
+        munmap(map, map_len);
+    }
+
+    free(residency);
+
+    // The first and last pages may only partially belong to the region
+    return num_resident * page_size < length ? num_resident * page_size : length;
+}
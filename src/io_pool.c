@@ -0,0 +1,401 @@
+#define _GNU_SOURCE // preadv2, AT_EMPTY_PATH
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#ifdef SYS_openat2
+#include <linux/openat2.h>
+#endif
+#include "io_pool_private.h"
+#include "log.h"
+
+static int lookup_cached(const char *path, io_lookup *result);
+static int open_cached(const char *path);
+static bool first_page_cached(int fd, const struct stat *info);
+static void lookup_blocking(io_request *request, bool first_read);
+static void *run_io_thread(void *args);
+static io_request *find_lookup(io_request *list, const char *path);
+static void complete_lookup(io_request *request);
+static void create_completion_key();
+static void close_completion_fd(void *stored_fd);
+static int get_completion_fd();
+
+static pthread_t threads[MAX_IO_THREADS];
+static int num_threads = 0;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_not_empty = PTHREAD_COND_INITIALIZER;
+static io_request *queue_head = NULL; // FIFO of cold lookups, protected by queue_lock
+static io_request *queue_tail = NULL;
+static io_request *in_progress = NULL; // Lookups picked up by an I/O thread, protected by queue_lock
+static bool accepting = false;        // Protected by queue_lock
+static _Atomic bool enabled = false;
+static _Atomic bool cached_open_supported = true;
+static pthread_once_t completion_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t completion_key;  // Each worker waits on its own eventfd
+
+static _Atomic unsigned long cached_lookups = 0;
+static _Atomic unsigned long offloaded_lookups = 0;
+static _Atomic unsigned long coalesced_lookups = 0;
+static _Atomic unsigned long first_reads = 0;
+
+
+int io_pool_init(int num_io_threads){
+    if(num_io_threads <= 0 || num_io_threads > MAX_IO_THREADS){
+        LOG(ERROR, "Invalid number of I/O threads %d!\n", num_io_threads);
+        return -1;
+    }
+
+    pthread_once(&completion_key_once, create_completion_key);
+
+    pthread_mutex_lock(&queue_lock);
+    accepting = true;
+    pthread_mutex_unlock(&queue_lock);
+
+    for(num_threads = 0; num_threads < num_io_threads; num_threads++){
+        if(pthread_create(&threads[num_threads], NULL, run_io_thread, NULL) != 0){
+            LOG(ERROR, "Failed to start I/O thread %d\n", num_threads);
+            io_pool_destroy();
+            return -1;
+        }
+    }
+
+    atomic_store(&enabled, true);
+    LOG(DEBUG, "Started %d I/O threads\n", num_threads);
+    return 0;
+}
+
+
+bool io_pool_enabled(){
+    return atomic_load(&enabled);
+}
+
+
+int io_pool_lookup(const char *path, io_lookup *result){
+    uint64_t completions;
+    io_request request = {.path = path, .result = result, .completion_fd = -1, .followers = NULL, .next = NULL};
+
+    if(!path || !result){
+        return -1;
+    }
+
+    memset(result, 0, sizeof(io_lookup));
+    result->fd = -1;
+
+    if(!io_pool_enabled() || (request.completion_fd = get_completion_fd()) == -1){
+        lookup_blocking(&request, false);
+        return result->error == 0 ? 0 : -1;
+    }
+
+    else if(lookup_cached(path, result) == 0){
+        atomic_fetch_add(&cached_lookups, 1);
+        return result->error == 0 ? 0 : -1;
+    }
+
+    pthread_mutex_lock(&queue_lock);
+
+    if(!accepting){
+        // Shutting down, don't queue behind lookups that may never be picked up
+        pthread_mutex_unlock(&queue_lock);
+        lookup_blocking(&request, false);
+        return result->error == 0 ? 0 : -1;
+    }
+
+    io_request *leader = find_lookup(queue_head, path);
+
+    if(!leader){
+        leader = find_lookup(in_progress, path);
+    }
+
+    if(leader){
+        // Eg: a new release requested by many clients at once, only one of them hits the disk
+        request.next = leader->followers;
+        leader->followers = &request;
+        atomic_fetch_add(&coalesced_lookups, 1);
+    }
+
+    else {
+        if(queue_tail) queue_tail->next = &request;
+        else queue_head = &request;
+        queue_tail = &request;
+
+        pthread_cond_signal(&queue_not_empty);
+    }
+
+    pthread_mutex_unlock(&queue_lock);
+
+    atomic_fetch_add(&offloaded_lookups, 1);
+
+    // The request lives on this stack, so wait until an I/O thread is done with it
+    while(read(request.completion_fd, &completions, sizeof(completions)) == -1 && errno == EINTR);
+
+    return result->error == 0 ? 0 : -1;
+}
+
+
+void get_io_pool_counters(io_pool_counters *counters){
+    if(!counters) return;
+
+    counters->cached_lookups = atomic_load(&cached_lookups);
+    counters->offloaded_lookups = atomic_load(&offloaded_lookups);
+    counters->coalesced_lookups = atomic_load(&coalesced_lookups);
+    counters->first_reads = atomic_load(&first_reads);
+}
+
+
+void io_pool_destroy(){
+    atomic_store(&enabled, false);
+
+    pthread_mutex_lock(&queue_lock);
+    accepting = false;
+    pthread_cond_broadcast(&queue_not_empty);
+    pthread_mutex_unlock(&queue_lock);
+
+    // I/O threads only exit once the queue is empty, so no worker is left waiting
+    for(int i = 0; i < num_threads; i++){
+        pthread_join(threads[i], NULL);
+    }
+
+    num_threads = 0;
+}
+
+
+// HELPERS //
+
+/**
+ * @brief Try to resolve a lookup without blocking.
+ *
+ * @return int 0 when resolved (successfully or not), -1 when the rest would block.
+ *         result->fd is left open when only the first read is missing.
+ */
+static int lookup_cached(const char *path, io_lookup *result){
+    int fd = open_cached(path);
+
+    if(fd == -1 && errno == EAGAIN){
+        return -1;
+    }
+
+    else if(fd == -1){
+        result->error = errno;
+        return 0;
+    }
+
+    // The inode was just brought in by the path walk, so this doesn't block
+    if(fstatat(fd, "", &(result->info), AT_EMPTY_PATH) != 0){
+        result->error = errno;
+        close(fd);
+        return 0;
+    }
+
+    result->fd = fd;
+    return first_page_cached(fd, &(result->info)) ? 0 : -1;
+}
+
+
+/**
+ * @brief Open path read only if it can be done from the dentry cache.
+ *
+ * @return int fd on success, -1 with errno set to EAGAIN if it would need I/O.
+ */
+static int open_cached(const char *path){
+#ifdef RESOLVE_CACHED
+    if(atomic_load(&cached_open_supported)){
+        struct open_how how = {.flags = O_RDONLY | O_CLOEXEC, .resolve = RESOLVE_CACHED};
+        int fd = syscall(SYS_openat2, AT_FDCWD, path, &how, sizeof(how));
+
+        if(fd != -1 || (errno != ENOSYS && errno != EINVAL)){
+            return fd;
+        }
+
+        LOG(WARNING, "Kernel can't open from the dentry cache alone, every lookup goes through the I/O threads\n");
+        atomic_store(&cached_open_supported, false);
+    }
+#endif
+
+    errno = EAGAIN;
+    return -1;
+}
+
+
+static bool first_page_cached(int fd, const struct stat *info){
+    char first_byte;
+    struct iovec iov = {.iov_base = &first_byte, .iov_len = 1};
+
+    if(!S_ISREG(info->st_mode) || info->st_size == 0){
+        return true;
+    }
+
+    // Filesystems without RWF_NOWAIT support get EOPNOTSUPP, their first read is left to the sender
+    return preadv2(fd, &iov, 1, 0, RWF_NOWAIT) != -1 || errno != EAGAIN;
+}
+
+
+/**
+ * @brief Complete a lookup, blocking as long as needed.
+ *
+ * @param request lookup to complete, its fd is reused if already opened.
+ * @param first_read also read the start of the content into the page cache.
+ */
+static void lookup_blocking(io_request *request, bool first_read){
+    io_lookup *result = request->result;
+    char first_page[IO_POOL_FIRST_READ_SIZE];
+
+    if(result->fd == -1){
+        result->fd = openat(AT_FDCWD, request->path, O_RDONLY | O_CLOEXEC);
+
+        if(result->fd == -1 || fstatat(result->fd, "", &(result->info), AT_EMPTY_PATH) != 0){
+            result->error = errno;
+            if(result->fd != -1) close(result->fd);
+            result->fd = -1;
+            return;
+        }
+    }
+
+    if(first_read && S_ISREG(result->info.st_mode) && result->info.st_size != 0){
+        size_t first_read_len = result->info.st_size < IO_POOL_FIRST_READ_SIZE ? result->info.st_size : IO_POOL_FIRST_READ_SIZE;
+
+        // Only a hint, the sender reads it again anyway
+        if(pread(result->fd, first_page, first_read_len, 0) > 0){
+            atomic_fetch_add(&first_reads, 1);
+        }
+    }
+}
+
+
+static void *run_io_thread(void *args){
+    io_request *request;
+
+    while(1){
+        pthread_mutex_lock(&queue_lock);
+
+        while(!queue_head && accepting){
+            pthread_cond_wait(&queue_not_empty, &queue_lock);
+        }
+
+        request = queue_head;
+
+        if(request){
+            queue_head = request->next;
+            if(!queue_head) queue_tail = NULL;
+
+            request->next = in_progress;
+            in_progress = request;
+        }
+
+        pthread_mutex_unlock(&queue_lock);
+
+        if(!request){
+            break;
+        }
+
+        lookup_blocking(request, true);
+
+        pthread_mutex_lock(&queue_lock);
+        complete_lookup(request);
+        pthread_mutex_unlock(&queue_lock);
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Find a lookup of path that followers can still join. Queue lock must be held.
+ */
+static io_request *find_lookup(io_request *list, const char *path){
+    for(; list; list = list->next){
+        if(strcmp(list->path, path) == 0){
+            return list;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Share the result of a lookup with its followers and wake them all up. Queue lock must be held.
+ */
+static void complete_lookup(io_request *request){
+    io_request **link = &in_progress;
+    io_request *follower = request->followers;
+    uint64_t completion = 1;
+
+    while(*link != request){
+        link = &((*link)->next);
+    }
+    *link = request->next;
+
+    // Requests are gone as soon as their worker is woken up, so the leader goes last
+    while(follower){
+        io_request *next = follower->next;
+        io_lookup *result = follower->result;
+
+        if(result->fd != -1){
+            // Opened on its own, it only waited for the first read
+        }
+
+        else if(request->result->error != 0){
+            result->error = request->result->error;
+        }
+
+        else if((result->fd = fcntl(request->result->fd, F_DUPFD_CLOEXEC, 0)) == -1){
+            result->error = errno;
+        }
+
+        else {
+            result->info = request->result->info;
+        }
+
+        if(write(follower->completion_fd, &completion, sizeof(completion)) != sizeof(completion)){
+            LOG(ERROR, "Failed to wake up worker waiting on %s: %s\n", follower->path, strerror(errno));
+        }
+        follower = next;
+    }
+
+    if(write(request->completion_fd, &completion, sizeof(completion)) != sizeof(completion)){
+        LOG(ERROR, "Failed to wake up worker waiting on %s: %s\n", request->path, strerror(errno));
+    }
+}
+
+
+static void create_completion_key(){
+    pthread_key_create(&completion_key, close_completion_fd);
+}
+
+
+static void close_completion_fd(void *stored_fd){
+    close((int) ((intptr_t) stored_fd - 1));
+}
+
+
+/**
+ * @brief Get the calling thread's eventfd, created on first use.
+ *
+ * @return int eventfd, -1 if it can't be created.
+ */
+static int get_completion_fd(){
+    // Stored off by one, so that NULL means not created yet
+    intptr_t stored_fd = (intptr_t) pthread_getspecific(completion_key);
+
+    if(stored_fd != 0){
+        return (int) (stored_fd - 1);
+    }
+
+    int fd = eventfd(0, EFD_CLOEXEC);
+
+    if(fd == -1){
+        LOG(WARNING, "Failed to create eventfd, looking up inline: %s\n", strerror(errno));
+        return -1;
+    }
+
+    pthread_setspecific(completion_key, (void *) ((intptr_t) fd + 1));
+    return fd;
+}
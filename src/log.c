@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "log_private.h"
+#include "thread_registry.h"
+
+static void *run_log_thread(void *args);
+static log_ring *get_thread_ring();
+static size_t drain_rings();
+static void batch_append(log_batch *batch, const char *msg);
+static void batch_write(log_batch *batch);
+static bool timestamp_before(const struct timespec *a, const struct timespec *b);
+
+static pthread_t log_tid;
+static _Atomic bool running = false;
+static _Atomic(void *) ring_slots[MAX_LOG_RINGS];
+static thread_registry rings = THREAD_REGISTRY_INITIALIZER(ring_slots);
+static __thread log_ring *thread_ring = NULL;
+static __thread bool thread_ring_unavailable = false;
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER; // Only taken by the log thread (and log_flush)
+static log_batch out_batch = {.fd = STDOUT_FILENO};
+static log_batch err_batch = {.fd = STDERR_FILENO};
+
+
+int log_init(){
+    if(atomic_load(&running)){
+        return 0;
+    }
+
+    // stdio may still hold messages logged synchronously, they come first
+    fflush(stdout);
+    fflush(stderr);
+
+    atomic_store(&running, true);
+
+    if(pthread_create(&log_tid, NULL, run_log_thread, NULL) != 0){
+        atomic_store(&running, false);
+        LOG(ERROR, "Failed to start log thread, logging synchronously\n");
+        return -1;
+    }
+
+    atexit(log_flush);
+    return 0;
+}
+
+
+void log_message(log_level level, const char *level_name, const char *format, ...){
+    va_list args;
+    log_ring *ring = atomic_load(&running) ? get_thread_ring() : NULL;
+
+    if(!ring){
+        char msg[MAX_LOG_LEVEL_NAME_LEN + MAX_LOG_MSG_LEN];
+        int prefix_len = snprintf(msg, MAX_LOG_LEVEL_NAME_LEN, "%s:", level_name);
+
+        va_start(args, format);
+        vsnprintf(msg + prefix_len, MAX_LOG_MSG_LEN, format, args);
+        va_end(args);
+
+        fputs(msg, level <= INFO ? stdout : stderr);
+        return;
+    }
+
+    unsigned long tail = atomic_load_explicit(&(ring->tail), memory_order_relaxed);
+
+    // Never wait for the log thread, a full ring loses the message
+    if(tail - atomic_load_explicit(&(ring->head), memory_order_acquire) >= LOG_RING_SLOTS){
+        atomic_fetch_add(&(ring->num_dropped), 1);
+        return;
+    }
+
+    log_record *record = &(ring->records[tail & (LOG_RING_SLOTS - 1)]);
+    int prefix_len = snprintf(record->msg, MAX_LOG_LEVEL_NAME_LEN, "%s:", level_name);
+
+    clock_gettime(CLOCK_MONOTONIC, &(record->timestamp));
+    record->level = level;
+
+    va_start(args, format);
+    vsnprintf(record->msg + prefix_len, MAX_LOG_MSG_LEN, format, args);
+    va_end(args);
+
+    // Publish the record only once it's complete
+    atomic_store_explicit(&(ring->tail), tail + 1, memory_order_release);
+}
+
+
+void log_flush(){
+    if(atomic_exchange(&running, false)){
+        pthread_join(log_tid, NULL);
+    }
+
+    // Messages queued while the log thread was stopping
+    drain_rings();
+    fflush(stdout);
+    fflush(stderr);
+}
+
+
+// HELPERS //
+
+static void *run_log_thread(void *args){
+    struct timespec interval = {.tv_sec = 0, .tv_nsec = LOG_FLUSH_INTERVAL_MS * 1000000L};
+
+    while(atomic_load(&running)){
+        if(drain_rings() == 0){
+            nanosleep(&interval, NULL);
+        }
+    }
+
+    drain_rings();
+    return NULL;
+}
+
+
+/**
+ * @brief Get the calling thread's ring, allocated on first use.
+ *
+ * @return log_ring* the ring, NULL if the thread can't get one.
+ */
+static log_ring *get_thread_ring(){
+    if(thread_ring || thread_ring_unavailable){
+        return thread_ring;
+    }
+
+    int idx = thread_registry_claim(&rings);
+
+    if(idx == -1 || !(thread_ring = (log_ring *) calloc(1, sizeof(log_ring)))){
+        thread_ring_unavailable = true;
+        return NULL;
+    }
+
+    thread_registry_publish(&rings, idx, thread_ring);
+    return thread_ring;
+}
+
+
+/**
+ * @brief Write every message queued so far, merging the rings by timestamp.
+ *
+ * @return size_t number of messages written.
+ */
+static size_t drain_rings(){
+    log_ring *pass_rings[MAX_LOG_RINGS];
+    unsigned long heads[MAX_LOG_RINGS];
+    unsigned long tails[MAX_LOG_RINGS];
+    size_t num_written = 0;
+
+    pthread_mutex_lock(&drain_lock);
+
+    int rings_in_use = thread_registry_size(&rings);
+
+    // Only what was published when the pass started, so a busy thread can't starve the others
+    for(int i = 0; i < rings_in_use; i++){
+        pass_rings[i] = (log_ring *) thread_registry_get(&rings, i);
+        heads[i] = tails[i] = 0;
+
+        if(!pass_rings[i]){
+            continue;
+        }
+
+        heads[i] = atomic_load_explicit(&(pass_rings[i]->head), memory_order_relaxed);
+        tails[i] = atomic_load_explicit(&(pass_rings[i]->tail), memory_order_acquire);
+
+        unsigned long num_dropped = atomic_exchange(&(pass_rings[i]->num_dropped), 0);
+
+        if(num_dropped != 0){
+            char msg[MAX_LOG_LEVEL_NAME_LEN + MAX_LOG_MSG_LEN];
+            snprintf(msg, sizeof(msg), "WARNING:Dropped %lu log messages, the log thread can't keep up\n", num_dropped);
+            batch_append(&err_batch, msg);
+        }
+    }
+
+    while(1){
+        log_record *oldest = NULL;
+        int oldest_idx = -1;
+
+        for(int i = 0; i < rings_in_use; i++){
+            if(heads[i] == tails[i]) continue;
+
+            log_record *record = &(pass_rings[i]->records[heads[i] & (LOG_RING_SLOTS - 1)]);
+
+            if(!oldest || timestamp_before(&(record->timestamp), &(oldest->timestamp))){
+                oldest = record;
+                oldest_idx = i;
+            }
+        }
+
+        if(!oldest){
+            break;
+        }
+
+        batch_append(oldest->level <= INFO ? &out_batch : &err_batch, oldest->msg);
+
+        // The slot can be reused as soon as the message is copied to the batch
+        heads[oldest_idx]++;
+        atomic_store_explicit(&(pass_rings[oldest_idx]->head), heads[oldest_idx], memory_order_release);
+        num_written++;
+    }
+
+    batch_write(&out_batch);
+    batch_write(&err_batch);
+
+    pthread_mutex_unlock(&drain_lock);
+    return num_written;
+}
+
+
+static void batch_append(log_batch *batch, const char *msg){
+    size_t msg_len = strlen(msg);
+
+    if(batch->len + msg_len > LOG_BATCH_SIZE){
+        batch_write(batch);
+    }
+
+    memcpy(batch->data + batch->len, msg, msg_len);
+    batch->len += msg_len;
+}
+
+
+static void batch_write(log_batch *batch){
+    size_t written = 0;
+
+    while(written < batch->len){
+        ssize_t rc = write(batch->fd, batch->data + written, batch->len - written);
+
+        if(rc == -1 && errno == EINTR){
+            continue;
+        }
+
+        else if(rc == -1){
+            break; // Nowhere left to report it
+        }
+
+        written += rc;
+    }
+
+    batch->len = 0;
+}
+
+
+static bool timestamp_before(const struct timespec *a, const struct timespec *b){
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
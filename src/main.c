@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <time.h>
 #include <semaphore.h>
@@ -11,20 +12,38 @@
 #include <stdbool.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
 
 #include "command_line.h"
 #include "rio.h"
 #include "http.h"
+#include "connection.h"
+#include "compression.h"
+#include "mime.h"
+#include "root_index.h"
+#include "sender.h"
+#include "receiver.h"
+#include "io_policy.h"
+#include "io_pool.h"
+#include "prewarm.h"
+#include "access_log.h"
+#include "metrics.h"
+#include "rate_limit.h"
 #include "bbuf.h"
 #include "log.h"
+#include "trace.h"
 
 #define BUFF_SIZE 100 // TODO need to optimize this
 #define MAX_BBUFF_LEN 25
 #define MAX_SERVER_HOSTNAME_LEN 25
 #define NUM_WORKER_THREADS 5
-#define NUM_RECOGNIZED_SIGS 2
+#define NUM_SENDER_THREADS 2
+#define NUM_RECEIVER_THREADS 1
+#define NUM_RECOGNIZED_SIGS 4
 #define NANOSEC_IN_SEC 1000000000⁠
 #define MAX_SERVER_SHUTDOWN_TIME 10
+#define MAX_TRACKED_CONNECTIONS (1024 * 1024) // Client fds from this one up aren't in the connection table
 
 sig_atomic_t g_server_running = 0; // Used to coordinate server event loop shutdown
 
@@ -39,16 +58,24 @@ typedef struct _server_context_t {
 } server_context_t;
 
 
+// Indexed by client fd. An entry is written
+// before the fd goes in the bounded buffer and read by the worker that takes it out.
+static connection_t *connections = NULL;
+static int max_connections = 0;
+
+
 
 static void run_server(struct cli *cli_in);
 static bool set_up_monit_thread(server_context_t *worker_data);
 static bool set_up_worker_pool(server_context_t *worker_data);
 static int bind_server_port(int server_port, int *svr_fd, char *server_ip);
-static int parse_request(int client_fd, http_req *result);
 static void *process_incoming_request(void *args);
 static void *handle_controlled_shutdown_req(void *args);
 static bool populate_sigset(sigset_t *set_to_populate);
 static bool prevent_controlled_shutdown();
+static void log_io_policy_counters();
+static bool set_up_connection_table();
+static void reject_client(int client_fd, rate_limit_verdict verdict);
 
 
 /**
@@ -74,8 +101,38 @@ static void run_server(struct cli *cli_in){
         goto exit_on_failure;
     }
 
+    // From here on, workers don't write logs themselves
+    log_init();
+
     LOG(INFO, "Initializing server with root directory: %s\n", cli_in->server_root);
 
+    // A missing mime.types isn't fatal, common types are always registered
+    mime_registry_init(cli_in->mime_types);
+
+    compression_config compression = {.enabled = cli_in->gzip_enabled,
+                                      .level = cli_in->gzip_level,
+                                      .min_size = cli_in->gzip_min_size,
+                                      .cache_size = cli_in->gzip_cache_size,
+                                      .types = cli_in->gzip_types};
+
+    io_policy_config io_policy = {.sequential_min_size = cli_in->io_sequential_min_size,
+                                  .readahead_size = cli_in->io_readahead_size,
+                                  .dontneed_min_size = cli_in->io_dontneed_min_size,
+                                  .residency_sample_rate = DEFAULT_IO_RESIDENCY_SAMPLE_RATE,
+                                  .hugepages = cli_in->hugepages};
+
+    if(compression_init(&compression) != 0 || io_policy_init(&io_policy) != 0){
+        goto exit_on_failure;
+    }
+
+    else if(strlen(cli_in->pack_path) != 0 && root_index_load_pack(cli_in->pack_path) == -1){
+        goto exit_on_failure;
+    }
+
+    else if(strlen(cli_in->pack_path) == 0 && cli_in->snapshot_root && root_index_build(cli_in->server_root) == -1){
+        goto exit_on_failure;
+    }
+
     // Set up bounded buffer and worker pool
     bbuf_t bbuf = bbuf_init();
 
@@ -90,7 +147,41 @@ static void run_server(struct cli *cli_in){
     // survives for the lifeftime of the program.
     worker_data.bbuf = bbuf;
 
-    if(!set_up_worker_pool(&worker_data)){
+    // Clients that go away mid transfer are handled as write errors
+    signal(SIGPIPE, SIG_IGN);
+
+    receiver_config receiver = {.num_threads = NUM_RECEIVER_THREADS, .bbuf = bbuf};
+
+    if(sender_pool_init(NUM_SENDER_THREADS) != 0){
+        goto exit_on_failure;
+    }
+
+    else if(receiver_pool_init(&receiver) != 0){
+        goto exit_on_failure;
+    }
+
+    else if(cli_in->io_threads != 0 && io_pool_init(cli_in->io_threads) != 0){
+        goto exit_on_failure;
+    }
+
+    else if(strlen(cli_in->access_log) != 0 && access_log_open(cli_in->access_log) != 0){
+        goto exit_on_failure;
+    }
+
+    else if(!set_up_connection_table()){
+        goto exit_on_failure;
+    }
+
+    rate_limit_config rate_limit = {.requests_per_sec = cli_in->rate_limit,
+                                    .burst = cli_in->rate_limit_burst,
+                                    .max_connections = cli_in->max_client_connections,
+                                    .max_fds = max_connections};
+
+    if(rate_limit_init(&rate_limit) != 0){
+        goto exit_on_failure;
+    }
+
+    else if(!set_up_worker_pool(&worker_data)){
         goto exit_on_failure;
     }
 
@@ -101,10 +192,33 @@ static void run_server(struct cli *cli_in){
 
     worker_data.server_fd = server_fd;
 
+    if(cli_in->metrics_port != 0){
+        metrics_config metrics = {.address = cli_in->metrics_address,
+                                  .port = cli_in->metrics_port,
+                                  .bbuf = bbuf,
+                                  .num_workers = NUM_WORKER_THREADS};
+
+        if(metrics_start(&metrics) != 0){
+            goto exit_on_failure;
+        }
+    }
+
     if(!set_up_monit_thread(&worker_data)){
         goto exit_on_failure;
     }
 
+    // Clients are already accepted while the caches warm up
+    if(strlen(cli_in->prewarm_source) != 0){
+        prewarm_config prewarm = {.source = cli_in->prewarm_source,
+                                  .server_root = cli_in->server_root,
+                                  .top = cli_in->prewarm_top,
+                                  .budget = cli_in->prewarm_budget};
+
+        if(prewarm_start(&prewarm) != 0){
+            LOG(WARNING, "Starting with cold caches\n");
+        }
+    }
+
     LOG(INFO,"Successfully initialized server at %s:%d\n" \
              "Enter CTRL+C to kill the server...\n", host_name, cli_in->port);
     
@@ -129,6 +243,8 @@ static void run_server(struct cli *cli_in){
             goto exit_on_failure;
         }
 
+        metrics_count_connection(true);
+
         // Get human readable conversion of client connection info
         got_info = getnameinfo((struct sockaddr*)&client_con, client_con_size, client_addr, BUFF_SIZE, NULL, 0, NI_NUMERICHOST);
         if (got_info != 0){
@@ -136,13 +252,36 @@ static void run_server(struct cli *cli_in){
             goto exit_on_failure;
         }
 
-        LOG(INFO,"Successfully established connection with %s!\n", client_addr);
+        LOG(DEBUG,"Successfully established connection with %s!\n", client_addr);
+        TRACE(accept, client_fd, client_addr);
+
+        if(client_fd < max_connections){
+            connections[client_fd].accepted_ns = metrics_now_ns();
+            snprintf(connections[client_fd].client_addr, INET6_ADDRSTRLEN, "%.*s", INET6_ADDRSTRLEN - 1, client_addr);
+        }
+
+        // Clients over their limits don't get to take a slot of the bounded buffer
+        rate_limit_verdict verdict = rate_limit_admit(client_fd, (struct sockaddr*) &client_con);
 
-        // Add the client FD to bounded buffer so it can be handled by one of workers
-        if (bbuf_insert(bbuf, client_fd) != 0){
+        if(verdict != RATE_LIMIT_ALLOW){
+            LOG(DEBUG, "Rejecting connection from %s, over its %s limit\n", client_addr,
+                       verdict == RATE_LIMIT_TOO_MANY_REQUESTS ? "request" : "connection");
+            reject_client(client_fd, verdict);
+            continue;
+        }
+
+        // Connections wait for their request in a receiver thread, then go to the bounded buffer
+        // for one of the workers. Once the receivers are stopped they go to the buffer directly
+        if (receiver_submit(client_fd) != 0 && bbuf_insert(bbuf, client_fd) != 0){
             LOG(ERROR,"WARNING: Failed to insert client connection into buffer...\n");
+
+            // Nobody is going to serve it, give back its slot with the rate limiter
+            rate_limit_release(client_fd);
+            close(client_fd);
+            metrics_count_connection(false);
+            TRACE(close, client_fd, 0);
             continue;
-        };
+        }
     }
 
     // If we made it to here, the monit thread is handling
@@ -263,13 +402,7 @@ static int bind_server_port(int server_port, int *svr_fd, char *server_ip){
  */
 static void *process_incoming_request(void *args){
     int client_fd;
-    int ressource_fd;
-    char status[MAX_RESP_STATUS_LEN];
-    char resp_headers[MAX_RESP_HEADERS_LEN];
-    off_t content_size;
-    http_req request = NULL;
-    http_resp response = NULL;
-    ssize_t bytes_written;
+    connection_t connection;
 
     if(!args){
         LOG(ERROR,"No worker thread data provided!\n");
@@ -285,60 +418,19 @@ static void *process_incoming_request(void *args){
         // or the server is shutdown
         bbuf_remove(buff, &client_fd); 
 
-        LOG(INFO,"Processing client request fd %d\n", client_fd);
-
-        // Prevent cancellation while handling request
-        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-
-        if(parse_request(client_fd, &request) != 0){
-            LOG(ERROR,"Something went wrong parsing HTTP Request\n");
-            goto clean_up;
-        }
-
-        LOG(INFO,"Formulating HTTP response...\n");
-
-        response = get_http_response_from_request(request);
+        LOG(DEBUG,"Processing client request fd %d\n", client_fd);
 
-        if (!response){
-            LOG(ERROR,"Something went wrong processing HTTP request\n");
-            goto clean_up;
-        }
+        // The fd can be handed off (and reused) before the access is logged
+        memset(&connection, 0, sizeof(connection_t));
 
-        // Log the response for debugging...
-        get_http_response_status(response, status, MAX_RESP_STATUS_LEN);
-        get_http_response_headers(response, resp_headers, MAX_RESP_HEADERS_LEN);
-        get_http_response_content_size(response, &content_size);
-        get_http_response_ressource_fd(response, &ressource_fd);
-        
-        LOG(DEBUG, "Sending the HTTP response back to the client...\n");
-        shutdown(client_fd, SHUT_RD);
-        bytes_written = writen_b(client_fd, status, strlen(status));
-        
-        if(bytes_written == -1){
-            goto clean_up;
+        if(client_fd < max_connections){
+            connection = connections[client_fd];
         }
 
-        bytes_written = writen_b(client_fd, resp_headers, strlen(resp_headers));
-        
-        if(bytes_written == -1){
-            goto clean_up;
-        }
-        
-        if(content_size != 0){
-            // Only try to write from reessource fd if there is content to read
-            // content size will be 0 in case of errors
-            bytes_written = writen(client_fd, ressource_fd, content_size);
-            
-            if(bytes_written == -1){
-                goto clean_up;
-            }
-        }
+        // Prevent cancellation while handling request
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
-        clean_up:
-            shutdown(client_fd, SHUT_WR);
-            close(client_fd);
-            destroy_http_request(&request);
-            destroy_http_response(&response);
+        serve_connection(client_fd, &connection);
 
         // Re-enable cancellation now that request handling is done.
         // This will trigger thread shutdown if any signals were queued
@@ -349,43 +441,6 @@ static void *process_incoming_request(void *args){
 }
 
 
-static int parse_request(int client_fd, http_req *result){
-    http_req tmp_req;
-    http_method method;
-    char version[MAX_VER_LEN] = {0};
-    char uri[MAX_URI_LEN] = {0};
-
-    if(!result){
-        LOG(ERROR, "Invalid result reference provided!\n");
-        return -1;
-    }
-
-    if(client_fd < 0){
-        LOG(ERROR, "Bad client file descriptor provided!\n");
-        return -1;
-    }
-
-    tmp_req = init_http_request(client_fd);
-    
-    if(!tmp_req){
-        LOG(ERROR, "failed to parse request!\n");
-        return -1;
-    }
-    
-    get_http_request_method(tmp_req, &method);
-    get_http_request_uri(tmp_req, uri);
-    get_http_request_version(tmp_req, version);
-
-    LOG(DEBUG, "Got the following request:\n \
-    METHOD:   %s\n \
-    URI:      %s\n \
-    HTTP VER: %s\n", http_method_strings[method], uri, version);
-
-    *result = tmp_req;
-    return 0;
-}
-
-
 /**
  * @brief Initialize the worker threads that will handle incoming requests.
  * 
@@ -441,7 +496,9 @@ static bool set_up_monit_thread(server_context_t *worker_data){
 
 
 /**
- * @brief Wait for SIGINT/SIGTERM and cancel/join all worker threads
+ * @brief Wait for SIGINT/SIGTERM and cancel/join all worker threads.
+ *        SIGHUP reloads the snapshot (server root or site pack, when enabled) and
+ *        SIGUSR1 reopens the access log in the meantime.
  * 
  * @param args contains struct with worker thread IDs
  */
@@ -452,9 +509,7 @@ static void *handle_controlled_shutdown_req(void *args){
     int client_fd;
     void *thread_result;
     struct timespec thread_shutdown_timeout;
-    ssize_t bytes_written;
-    char status[MAX_RESP_STATUS_LEN];
-    char resp_headers[MAX_RESP_HEADERS_LEN];
+    struct timespec sender_drain_deadline;
     http_resp response = NULL;
     
     server_context_t *server_data = (server_context_t *) args;
@@ -464,15 +519,51 @@ static void *handle_controlled_shutdown_req(void *args){
 
     populate_sigset(&set);
 
-    // Block on "handled" signals defined in 'set'
-    sigwait(&set, &received_sig);
+    // Block on "handled" signals defined in 'set', SIGHUP only reports counters and refreshes the snapshot,
+    // SIGUSR1 only reopens the access log (once it was moved away to be rotated)
+    while(sigwait(&set, &received_sig) == 0 && (received_sig == SIGHUP || received_sig == SIGUSR1)){
+        if(received_sig == SIGUSR1){
+            if(!access_log_enabled()){
+                LOG(INFO, "Ignoring SIGUSR1, accesses aren't logged\n");
+            }
+
+            else if(access_log_reopen() == 0){
+                LOG(INFO, "Reopened access log\n");
+            }
+
+            continue;
+        }
+
+        log_io_policy_counters();
+
+        if(!root_index_enabled()){
+            LOG(INFO, "Ignoring SIGHUP, the server root isn't snapshotted\n");
+            continue;
+        }
+
+        LOG(INFO, "Reloading snapshot\n");
+
+        if(root_index_reload() == -1){
+            LOG(ERROR, "Failed to rebuild snapshot, still serving the previous one\n");
+        }
+    }
 
     LOG(DEBUG, "\n\nHandling signal: %s\n", received_sig == SIGINT ? "SIGINT" : "SIGTERM");
 
+    // In flight responses drain within the shutdown time, not after the worker joins
+    clock_gettime(CLOCK_MONOTONIC, &sender_drain_deadline);
+    sender_drain_deadline.tv_sec += MAX_SERVER_SHUTDOWN_TIME - (MAX_SERVER_SHUTDOWN_TIME / 10);
+
     // Stop accepting new requests on server fd
     shutdown(server_data->server_fd, SHUT_RD);
     g_server_running = 0;
 
+    // Don't keep reading ahead for a server that's going away
+    prewarm_stop();
+
+    // Connections still waiting for their request are closed, the workers take care of the rest
+    receiver_pool_destroy();
+
     // Shut down all worker threads
     for(int i=0; i<NUM_WORKER_THREADS; i++){
         LOG(DEBUG, "Shutting down worker thread %lu\n", server_data->worker_tids[i]);
@@ -532,24 +623,11 @@ static void *handle_controlled_shutdown_req(void *args){
             response = get_server_shutting_down_response();
         }
 
-        // TODO: Move all of this logic to a helper since it's duplicated again in normal path
         LOG(DEBUG, "Sending shutting down response back to the client fd %d\n", client_fd);
         shutdown(client_fd, SHUT_RD);
-        get_http_response_status(response, status, MAX_RESP_STATUS_LEN);
-        get_http_response_headers(response, resp_headers, MAX_RESP_HEADERS_LEN);
-        
-        bytes_written = writen_b(client_fd, status, strlen(status));
-        
-        if(bytes_written == -1){
-            LOG(ERROR, "Failed to write status line back to client on fd %d\n", client_fd);
-            server_data->shutdown_was_clean = false;
-            goto cleanup_response;
-        }
-
-        bytes_written = writen_b(client_fd, resp_headers, strlen(resp_headers));
         
-        if(bytes_written == -1){
-            LOG(ERROR, "Failed to write headers back to client on fd %d\n", client_fd);
+        if(send_http_response(client_fd, response) != 0){
+            LOG(ERROR, "Failed to write shutting down response back to client on fd %d\n", client_fd);
             server_data->shutdown_was_clean = false;
             goto cleanup_response;
         }
@@ -558,10 +636,21 @@ static void *handle_controlled_shutdown_req(void *args){
         shutdown(client_fd, SHUT_WR);
 
         cleanup_response:
+            rate_limit_release(client_fd);
             close(client_fd);
+            metrics_count_connection(false);
             destroy_http_response(&response);
     }
 
+    // Workers are gone, nothing gets handed off anymore
+    LOG(DEBUG, "Waiting for sender threads to finish in flight responses...\n");
+    sender_pool_destroy_by(&sender_drain_deadline);
+    io_pool_destroy();
+    rate_limit_destroy();
+    access_log_close();
+    metrics_stop();
+    log_io_policy_counters();
+
     shutdown(server_data->server_fd, SHUT_WR);
     close(server_data->server_fd);
 
@@ -573,7 +662,98 @@ static void *handle_controlled_shutdown_req(void *args){
 
 
 /**
- * @brief Set up calling thread to block SIGINT and SIGTERM
+ * @brief Report what the I/O policies did so far.
+ */
+static void log_io_policy_counters(){
+    io_policy_counters counters;
+
+    get_io_policy_counters(&counters);
+
+    LOG(INFO, "I/O policy: %lu sequential transfers, %luB read ahead (%luB of %luB sampled already cached), " \
+              "%lu transfers (%luB) dropped from page cache, %lu/%lu mappings on huge pages\n",
+              counters.sequential_hints,
+              counters.readahead_bytes,
+              counters.resident_bytes,
+              counters.sampled_bytes,
+              counters.dontneed_hints,
+              counters.dontneed_bytes,
+              counters.hugepage_mappings,
+              counters.hugepage_mappings + counters.hugepage_failures);
+
+    io_pool_counters pool_counters;
+
+    get_io_pool_counters(&pool_counters);
+
+    if(pool_counters.cached_lookups + pool_counters.offloaded_lookups != 0){
+        LOG(INFO, "I/O pool: %lu lookups resolved from cache, %lu offloaded (%lu coalesced, %lu first pages read in)\n",
+                  pool_counters.cached_lookups,
+                  pool_counters.offloaded_lookups,
+                  pool_counters.coalesced_lookups,
+                  pool_counters.first_reads);
+    }
+}
+
+
+/**
+ * @brief Allocate the connection table workers take client addresses and accept
+ *        times from, with an entry for every fd the process can open.
+ *
+ * @note Entries are only touched once their fd is used, untouched pages cost nothing.
+ *
+ * @return true on success, otherwise false.
+ */
+static bool set_up_connection_table(){
+    struct rlimit fd_limit;
+
+    if(getrlimit(RLIMIT_NOFILE, &fd_limit) != 0 || fd_limit.rlim_cur > MAX_TRACKED_CONNECTIONS){
+        fd_limit.rlim_cur = MAX_TRACKED_CONNECTIONS;
+    }
+
+    connections = (connection_t *) calloc(fd_limit.rlim_cur, sizeof(connection_t));
+
+    if(!connections){
+        LOG(ERROR, "Failed to allocate the connection table\n");
+        return false;
+    }
+
+    max_connections = (int) fd_limit.rlim_cur;
+    return true;
+}
+
+
+/**
+ * @brief Turn away a client over its limits, right from the accept loop.
+ *
+ * @note Clients over their request rate get a 429, the request is discarded
+ *       unread. Clients with too many connections open are closed at once.
+ *
+ * @param client_fd socket of the rejected connection, closed on return.
+ * @param verdict limit the client went over.
+ */
+static void reject_client(int client_fd, rate_limit_verdict verdict){
+    char discard[BUFF_SIZE];
+    http_resp response;
+
+    if(verdict == RATE_LIMIT_TOO_MANY_REQUESTS && (response = get_too_many_requests_response())){
+        if(send_http_response(client_fd, response) == 0){
+            metrics_count_request(TOO_MANY_REQUESTS, 0, 0);
+        }
+
+        destroy_http_response(&response);
+
+        // Closing with the request unread would reset the connection, maybe before the client read the response
+        shutdown(client_fd, SHUT_WR);
+        while(recv(client_fd, discard, BUFF_SIZE, MSG_DONTWAIT) > 0);
+    }
+
+    close(client_fd);
+    metrics_count_connection(false);
+    TRACE(close, client_fd, 0);
+}
+
+
+/**
+ * @brief Set up calling thread to block SIGINT, SIGTERM, SIGHUP and SIGUSR1
 */
 static bool prevent_controlled_shutdown(){
     sigset_t set;
@@ -598,7 +778,7 @@ static bool prevent_controlled_shutdown(){
  * @return true if signal set initialized successfully, else false.
  */
 static bool populate_sigset(sigset_t *set_to_populate){
-    int signals_to_mask[NUM_RECOGNIZED_SIGS] = {SIGINT, SIGTERM};
+    int signals_to_mask[NUM_RECOGNIZED_SIGS] = {SIGINT, SIGTERM, SIGHUP, SIGUSR1};
 
     if(sigemptyset(set_to_populate) != 0){
         LOG(ERROR, "Failed in initializing server datastructures - aborting launch...");
@@ -0,0 +1,483 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "metrics_private.h"
+#include "thread_registry.h"
+#include "http.h"
+#include "io_pool.h"
+#include "rio.h"
+#include "log.h"
+
+static void *run_metrics_thread(void *args);
+static metrics_shard *get_thread_shard();
+static void shard_add(metrics_shard *shard, _Atomic unsigned long *counter, unsigned long value);
+static int status_code_idx(int status_code);
+static bool is_metrics_request(const char *request);
+static void append_duration(char *buff, size_t *len, size_t max_len, const char *name, const char *stage, const char *quantile, unsigned long ns);
+static void append_metrics(char *buff, size_t *len, size_t max_len, const char *format, ...) __attribute__((format(printf, 4, 5)));
+
+const int metrics_status_codes[NUM_METRICS_STATUS_CODES] = {OK, PARTIAL_CONTENT, BAD_REQUEST, UNAUTHORIZED, FILE_NOT_FOUND,
+                                                            RANGE_NOT_SATISFIABLE, TOO_MANY_REQUESTS, INTERNAL_ERROR, NOT_IMPLEMENTED,
+                                                            SERVICE_UNAVAILABLE, UNSUPPORTED_VER};
+
+#define METRICS_STAGE_NAME_GEN(ENUM, NAME) NAME,
+const char *metrics_stage_names[NUM_METRICS_STAGES] = {FOREACH_METRICS_STAGE(METRICS_STAGE_NAME_GEN)};
+const double metrics_quantiles[NUM_METRICS_QUANTILES] = {0.5, 0.9, 0.99, 0.999};
+
+static _Atomic(void *) shard_slots[MAX_METRICS_SHARDS];
+static thread_registry shards = THREAD_REGISTRY_INITIALIZER(shard_slots);
+static metrics_shard shared_shard;  // For threads past MAX_METRICS_SHARDS
+static __thread metrics_shard *thread_shard = NULL;
+static metrics_config config;
+static int listen_fd = -1;
+static pthread_t metrics_tid;
+static _Atomic bool serving = false;
+
+
+int metrics_start(const metrics_config *metrics){
+    struct sockaddr_in addr = {.sin_family = AF_INET,
+                               .sin_port = htons(metrics->port)};
+    const char *address = metrics->address ? metrics->address : DEFAULT_METRICS_ADDRESS;
+    int reuse = 1;
+
+    if(inet_pton(AF_INET, address, &(addr.sin_addr)) != 1){
+        LOG(ERROR, "Invalid metrics address %s\n", address);
+        return -1;
+    }
+
+    config = *metrics;
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if(listen_fd == -1){
+        LOG(ERROR, "Failed to create metrics socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    if(bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(listen_fd, 16) != 0){
+        LOG(ERROR, "Failed to serve metrics on %s:%d: %s\n", address, metrics->port, strerror(errno));
+        goto clean_up;
+    }
+
+    atomic_store(&serving, true);
+
+    if(pthread_create(&metrics_tid, NULL, run_metrics_thread, NULL) != 0){
+        LOG(ERROR, "Failed to start metrics thread\n");
+        atomic_store(&serving, false);
+        goto clean_up;
+    }
+
+    LOG(INFO, "Serving metrics at %s:%d%s\n", address, metrics->port, METRICS_PATH);
+    return 0;
+
+    clean_up:
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+}
+
+
+void metrics_stop(){
+    if(!atomic_exchange(&serving, false)){
+        return;
+    }
+
+    // Wakes the metrics thread up from accept
+    shutdown(listen_fd, SHUT_RDWR);
+    pthread_join(metrics_tid, NULL);
+    close(listen_fd);
+    listen_fd = -1;
+}
+
+
+void metrics_count_request(int status_code, off_t bytes_sent, long busy_us){
+    metrics_shard *shard = get_thread_shard();
+
+    shard_add(shard, &(shard->requests[status_code_idx(status_code)]), 1);
+    shard_add(shard, &(shard->sent_bytes), bytes_sent);
+    shard_add(shard, &(shard->busy_us), busy_us);
+}
+
+
+unsigned long metrics_now_ns(){
+    struct timespec now;
+
+    // A vDSO call, the coarse clocks tick every few milliseconds which is about as long as a whole request
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+
+void metrics_record_stage(metrics_stage stage, unsigned long started_ns){
+    unsigned long now_ns = metrics_now_ns();
+    unsigned long ns = now_ns > started_ns ? now_ns - started_ns : 0;
+    metrics_shard *shard = get_thread_shard();
+    metrics_histogram *histogram = &(shard->stages[stage]);
+
+    shard_add(shard, &(histogram->buckets[metrics_bucket_idx(ns)]), 1);
+    shard_add(shard, &(histogram->sum_ns), ns);
+}
+
+
+void metrics_count_connection(bool opened){
+    metrics_shard *shard = get_thread_shard();
+
+    shard_add(shard, opened ? &(shard->connections_opened) : &(shard->connections_closed), 1);
+}
+
+
+void metrics_count_cache_lookup(bool hit){
+    metrics_shard *shard = get_thread_shard();
+
+    shard_add(shard, hit ? &(shard->cache_hits) : &(shard->cache_misses), 1);
+}
+
+
+void get_metrics_totals(metrics_totals *totals){
+    int shards_in_use = thread_registry_size(&shards);
+
+    memset(totals, 0, sizeof(metrics_totals));
+
+    for(int i = -1; i < shards_in_use; i++){
+        metrics_shard *shard = i == -1 ? &shared_shard : (metrics_shard *) thread_registry_get(&shards, i);
+
+        if(!shard){
+            continue;
+        }
+
+        for(int j = 0; j <= NUM_METRICS_STATUS_CODES; j++){
+            totals->requests[j] += atomic_load_explicit(&(shard->requests[j]), memory_order_relaxed);
+        }
+
+        totals->sent_bytes += atomic_load_explicit(&(shard->sent_bytes), memory_order_relaxed);
+        totals->busy_us += atomic_load_explicit(&(shard->busy_us), memory_order_relaxed);
+        totals->connections_opened += atomic_load_explicit(&(shard->connections_opened), memory_order_relaxed);
+        totals->connections_closed += atomic_load_explicit(&(shard->connections_closed), memory_order_relaxed);
+        totals->cache_hits += atomic_load_explicit(&(shard->cache_hits), memory_order_relaxed);
+        totals->cache_misses += atomic_load_explicit(&(shard->cache_misses), memory_order_relaxed);
+
+        for(int j = 0; j < NUM_METRICS_STAGES; j++){
+            totals->stages[j].sum_ns += atomic_load_explicit(&(shard->stages[j].sum_ns), memory_order_relaxed);
+
+            for(int k = 0; k < NUM_METRICS_BUCKETS; k++){
+                unsigned long bucket_count = atomic_load_explicit(&(shard->stages[j].buckets[k]), memory_order_relaxed);
+
+                totals->stages[j].buckets[k] += bucket_count;
+                totals->stages[j].count += bucket_count;
+            }
+        }
+    }
+}
+
+
+int metrics_bucket_idx(unsigned long ns){
+    if(ns < METRICS_SUB_BUCKETS){
+        return (int) ns;
+    }
+
+    int exponent = (63 - __builtin_clzl(ns)) - METRICS_SUB_BUCKET_BITS;
+
+    if(exponent > METRICS_MAX_EXPONENT){
+        return NUM_METRICS_BUCKETS - 1;
+    }
+
+    // ns >> exponent is in [METRICS_SUB_BUCKETS, 2 * METRICS_SUB_BUCKETS)
+    return exponent * METRICS_SUB_BUCKETS + (int) (ns >> exponent);
+}
+
+
+unsigned long metrics_bucket_max_ns(int idx){
+    if(idx < 2 * METRICS_SUB_BUCKETS){
+        return (unsigned long) idx;
+    }
+
+    int exponent = idx / METRICS_SUB_BUCKETS - 1;
+    unsigned long mantissa = idx % METRICS_SUB_BUCKETS + METRICS_SUB_BUCKETS;
+
+    return ((mantissa + 1) << exponent) - 1;
+}
+
+
+unsigned long get_metrics_percentile(const unsigned long *buckets, unsigned long count, double quantile){
+    unsigned long rank = (unsigned long) (quantile * count + 0.5);
+    unsigned long seen = 0;
+
+    if(count == 0){
+        return 0;
+    }
+
+    rank = rank == 0 ? 1 : rank;
+
+    for(int i = 0; i < NUM_METRICS_BUCKETS; i++){
+        seen += buckets[i];
+
+        if(seen >= rank){
+            return metrics_bucket_max_ns(i);
+        }
+    }
+
+    return metrics_bucket_max_ns(NUM_METRICS_BUCKETS - 1);
+}
+
+
+size_t render_metrics(const metrics_config *metrics, char *buff, size_t max_len){
+    metrics_totals *totals = malloc(sizeof(metrics_totals)); // Too big for the stack, with every histogram
+    size_t len = 0;
+
+    if(!totals){
+        buff[0] = '\0';
+        return 0;
+    }
+
+    get_metrics_totals(totals);
+
+    append_metrics(buff, &len, max_len, "# HELP sws_requests_total Responses sent, by status code.\n"
+                                        "# TYPE sws_requests_total counter\n");
+
+    for(int i = 0; i < NUM_METRICS_STATUS_CODES; i++){
+        append_metrics(buff, &len, max_len, "sws_requests_total{code=\"%d\"} %lu\n", metrics_status_codes[i], totals->requests[i]);
+    }
+
+    append_metrics(buff, &len, max_len, "sws_requests_total{code=\"other\"} %lu\n", totals->requests[NUM_METRICS_STATUS_CODES]);
+
+    append_metrics(buff, &len, max_len, "# HELP sws_sent_bytes_total Response body bytes sent.\n"
+                                        "# TYPE sws_sent_bytes_total counter\n"
+                                        "sws_sent_bytes_total %lu\n", totals->sent_bytes);
+
+    // Every connection is counted as opened before it can be closed, but not necessarily summed first
+    append_metrics(buff, &len, max_len, "# HELP sws_active_connections Client connections accepted and not closed yet.\n"
+                                        "# TYPE sws_active_connections gauge\n"
+                                        "sws_active_connections %lu\n",
+                                        totals->connections_opened > totals->connections_closed ? totals->connections_opened - totals->connections_closed : 0);
+
+    append_metrics(buff, &len, max_len, "# HELP sws_worker_busy_seconds_total Time workers spent handling requests.\n"
+                                        "# TYPE sws_worker_busy_seconds_total counter\n"
+                                        "sws_worker_busy_seconds_total %lu.%06lu\n", totals->busy_us / 1000000, totals->busy_us % 1000000);
+
+    append_metrics(buff, &len, max_len, "# HELP sws_compressed_cache_lookups_total Lookups of the compressed response cache.\n"
+                                        "# TYPE sws_compressed_cache_lookups_total counter\n"
+                                        "sws_compressed_cache_lookups_total{result=\"hit\"} %lu\n"
+                                        "sws_compressed_cache_lookups_total{result=\"miss\"} %lu\n", totals->cache_hits, totals->cache_misses);
+
+    if(io_pool_enabled()){
+        io_pool_counters pool_counters;
+        get_io_pool_counters(&pool_counters);
+
+        append_metrics(buff, &len, max_len, "# HELP sws_ressource_lookups_total Ressources opened, from the kernel caches or by the I/O pool.\n"
+                                            "# TYPE sws_ressource_lookups_total counter\n"
+                                            "sws_ressource_lookups_total{result=\"cached\"} %lu\n"
+                                            "sws_ressource_lookups_total{result=\"offloaded\"} %lu\n",
+                                            pool_counters.cached_lookups, pool_counters.offloaded_lookups);
+    }
+
+    append_metrics(buff, &len, max_len, "# HELP sws_stage_seconds Time spent in each stage of the request pipeline.\n"
+                                        "# TYPE sws_stage_seconds summary\n");
+
+    for(int i = 0; i < NUM_METRICS_STAGES; i++){
+        char quantile[16];
+
+        for(int j = 0; j < NUM_METRICS_QUANTILES; j++){
+            snprintf(quantile, sizeof(quantile), "%g", metrics_quantiles[j]);
+            append_duration(buff, &len, max_len, "sws_stage_seconds", metrics_stage_names[i], quantile,
+                            get_metrics_percentile(totals->stages[i].buckets, totals->stages[i].count, metrics_quantiles[j]));
+        }
+
+        append_duration(buff, &len, max_len, "sws_stage_seconds_sum", metrics_stage_names[i], NULL, totals->stages[i].sum_ns);
+        append_metrics(buff, &len, max_len, "sws_stage_seconds_count{stage=\"%s\"} %lu\n", metrics_stage_names[i], totals->stages[i].count);
+    }
+
+    if(metrics){
+        append_metrics(buff, &len, max_len, "# HELP sws_queue_depth Accepted connections waiting for a worker.\n"
+                                            "# TYPE sws_queue_depth gauge\n"
+                                            "sws_queue_depth %d\n", metrics->bbuf ? get_bbuf_items(metrics->bbuf) : 0);
+
+        append_metrics(buff, &len, max_len, "# HELP sws_workers Worker threads.\n"
+                                            "# TYPE sws_workers gauge\n"
+                                            "sws_workers %d\n", metrics->num_workers);
+    }
+
+    free(totals);
+    return len < max_len ? len : max_len - 1;
+}
+
+
+void serve_metrics_client(int client_fd){
+    char request[MAX_METRICS_REQUEST_LEN];
+    char *response = malloc(MAX_METRICS_RESPONSE_LEN);
+    struct timeval timeout = {.tv_sec = METRICS_CLIENT_TIMEOUT_SEC, .tv_usec = 0};
+    size_t request_len = 0;
+    size_t body_len;
+    int head_len;
+
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    if(!response){
+        goto clean_up;
+    }
+
+    // Only the request line matters
+    while(request_len < MAX_METRICS_REQUEST_LEN - 1){
+        ssize_t rc = read(client_fd, request + request_len, MAX_METRICS_REQUEST_LEN - 1 - request_len);
+
+        if(rc == -1 && errno == EINTR){
+            continue;
+        }
+
+        else if(rc <= 0){
+            break;
+        }
+
+        request_len += rc;
+        request[request_len] = '\0';
+
+        if(strstr(request, "\r\n") || strchr(request, '\n')){
+            break;
+        }
+    }
+
+    request[request_len] = '\0';
+
+    if(!is_metrics_request(request)){
+        const char *not_found = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        writen_b(client_fd, (void *) not_found, strlen(not_found));
+        goto clean_up;
+    }
+
+    // The head goes in front of the body, once the body's length is known
+    body_len = render_metrics(&config, response + MAX_RESP_HEADERS_LEN, MAX_METRICS_RESPONSE_LEN - MAX_RESP_HEADERS_LEN);
+    head_len = snprintf(request, sizeof(request), "HTTP/1.1 200 OK\r\n"
+                                                  "Content-Type: text/plain; version=0.0.4\r\n"
+                                                  "Content-Length: %lu\r\n"
+                                                  "Connection: close\r\n\r\n", body_len);
+
+    memcpy(response + MAX_RESP_HEADERS_LEN - head_len, request, head_len);
+    writen_b(client_fd, response + MAX_RESP_HEADERS_LEN - head_len, head_len + body_len);
+
+    clean_up:
+        shutdown(client_fd, SHUT_WR);
+        close(client_fd);
+        free(response);
+}
+
+
+// HELPERS //
+
+static void *run_metrics_thread(void *args){
+    while(atomic_load(&serving)){
+        int client_fd = accept(listen_fd, NULL, NULL);
+
+        if(client_fd == -1 && (errno == EINTR || errno == ECONNABORTED)){
+            continue;
+        }
+
+        else if(client_fd == -1){
+            break; // Shut down
+        }
+
+        serve_metrics_client(client_fd);
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Get the calling thread's shard, allocated on first use.
+ *
+ * @return metrics_shard* the shard, shared_shard if the thread can't get one.
+ */
+static metrics_shard *get_thread_shard(){
+    if(thread_shard){
+        return thread_shard;
+    }
+
+    int idx = thread_registry_claim(&shards);
+
+    if(idx == -1 || !(thread_shard = (metrics_shard *) aligned_alloc(METRICS_CACHE_LINE_SIZE, sizeof(metrics_shard)))){
+        thread_shard = &shared_shard;
+        return thread_shard;
+    }
+
+    memset(thread_shard, 0, sizeof(metrics_shard));
+    thread_registry_publish(&shards, idx, thread_shard);
+    return thread_shard;
+}
+
+
+/**
+ * @brief Add to a counter of shard. Only the owning thread writes a shard, so
+ *        a load and a store do, except for the shared shard.
+ */
+static void shard_add(metrics_shard *shard, _Atomic unsigned long *counter, unsigned long value){
+    if(shard == &shared_shard){
+        atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+        return;
+    }
+
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+
+static int status_code_idx(int status_code){
+    for(int i = 0; i < NUM_METRICS_STATUS_CODES; i++){
+        if(metrics_status_codes[i] == status_code){
+            return i;
+        }
+    }
+
+    return NUM_METRICS_STATUS_CODES;
+}
+
+
+static bool is_metrics_request(const char *request){
+    size_t path_len = strlen(METRICS_PATH);
+
+    if(strncmp(request, "GET ", 4) != 0 || strncmp(request + 4, METRICS_PATH, path_len) != 0){
+        return false;
+    }
+
+    char next = request[4 + path_len];
+    return next == ' ' || next == '?' || next == '\r' || next == '\n';
+}
+
+
+/**
+ * @brief Append a duration in seconds, with a quantile label unless quantile is NULL.
+ */
+static void append_duration(char *buff, size_t *len, size_t max_len, const char *name, const char *stage, const char *quantile, unsigned long ns){
+    if(quantile){
+        append_metrics(buff, len, max_len, "%s{stage=\"%s\",quantile=\"%s\"} %lu.%09lu\n", name, stage, quantile, ns / 1000000000, ns % 1000000000);
+    }
+
+    else {
+        append_metrics(buff, len, max_len, "%s{stage=\"%s\"} %lu.%09lu\n", name, stage, ns / 1000000000, ns % 1000000000);
+    }
+}
+
+
+/**
+ * @brief snprintf at the end of buff, what doesn't fit is dropped.
+ */
+static void append_metrics(char *buff, size_t *len, size_t max_len, const char *format, ...){
+    va_list args;
+
+    if(*len >= max_len){
+        return;
+    }
+
+    va_start(args, format);
+    *len += vsnprintf(buff + *len, max_len - *len, format, args);
+    va_end(args);
+}
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "mime_private.h"
+#include "fnv1a.h"
+#include "log.h"
+
+#define LEN(arr) sizeof(arr) / sizeof(arr[0])
+
+static uint32_t hash_extension(const char *extension, size_t len);
+static bool register_extension(const char *extension, const char *content_type);
+static int load_mime_types(const char *mime_types_path);
+
+// Registered on top of whatever the mime.types file provides
+static const ext_map builtin_ext_mappings[] = {{.extension = "html", .content_type = "text/html"},
+                                               {.extension = "htm",  .content_type = "text/html"},
+                                               {.extension = "css",  .content_type = "text/css"},
+                                               {.extension = "js",   .content_type = "application/javascript"},
+                                               {.extension = "json", .content_type = "application/json"},
+                                               {.extension = "txt",  .content_type = "text/plain"},
+                                               {.extension = "svg",  .content_type = "image/svg+xml"},
+                                               {.extension = "png",  .content_type = "image/png"},
+                                               {.extension = "gif",  .content_type = "image/gif"},
+                                               {.extension = "jpeg", .content_type = "image/jpeg"},
+                                               {.extension = "jpg",  .content_type = "image/jpeg"},
+                                               {.extension = "ico",  .content_type = "image/x-icon"}};
+
+static struct mime_registry registry;
+
+
+int mime_registry_init(const char *mime_types_path){
+    int loaded;
+
+    memset(&registry, 0, sizeof(registry));
+
+    loaded = load_mime_types(mime_types_path ? mime_types_path : DEFAULT_MIME_TYPES_PATH);
+
+    for(int i = 0; i < LEN(builtin_ext_mappings); i++){
+        register_extension(builtin_ext_mappings[i].extension, builtin_ext_mappings[i].content_type);
+    }
+
+    LOG(INFO, "Registered %d content types\n", registry.num_entries);
+    return loaded == -1 ? -1 : registry.num_entries;
+}
+
+
+const char *get_mime_type(const char *path){
+    const char *basename;
+    const char *extension;
+    size_t extension_len;
+
+    if(!path){
+        return NULL;
+    }
+
+    basename = strrchr(path, '/');
+    extension = strrchr(basename ? basename : path, '.');
+
+    if(!extension){
+        return NULL;
+    }
+
+    extension++;
+    extension_len = strlen(extension);
+
+    if(extension_len == 0 || extension_len >= MAX_RES_EXT_LEN){
+        return NULL;
+    }
+
+    uint32_t slot = hash_extension(extension, extension_len);
+
+    for(int probes = 0; probes < MIME_REGISTRY_SIZE; probes++, slot++){
+        const mime_entry *entry = &registry.entries[slot & (MIME_REGISTRY_SIZE - 1)];
+
+        if(entry->extension[0] == '\0'){
+            return NULL;
+        }
+
+        else if(strncasecmp(entry->extension, extension, MAX_RES_EXT_LEN) == 0){
+            return entry->content_type;
+        }
+    }
+
+    return NULL;
+}
+
+
+// HELPERS //
+
+/**
+ * @brief FNV-1a hash of a lowercased extension.
+ */
+static uint32_t hash_extension(const char *extension, size_t len){
+    uint32_t hash = FNV1A_OFFSET_BASIS;
+
+    for(size_t i = 0; i < len; i++){
+        hash = fnv1a_add(hash, (unsigned char) tolower((unsigned char) extension[i]));
+    }
+
+    return hash;
+}
+
+
+/**
+ * @brief Map an extension to a content type. The first mapping for an extension wins.
+ *
+ * @return true if the extension is registered (now or already), false if it can't be.
+ */
+static bool register_extension(const char *extension, const char *content_type){
+    size_t extension_len = strlen(extension);
+
+    if(extension_len == 0 || extension_len >= MAX_RES_EXT_LEN || strlen(content_type) >= MAX_RES_TYPE_LEN){
+        return false;
+    }
+
+    else if(registry.num_entries >= MAX_MIME_REGISTRY_LOAD){
+        return false;
+    }
+
+    uint32_t slot = hash_extension(extension, extension_len);
+
+    for(;; slot++){
+        mime_entry *entry = &registry.entries[slot & (MIME_REGISTRY_SIZE - 1)];
+
+        if(entry->extension[0] == '\0'){
+            for(size_t i = 0; i < extension_len; i++){
+                entry->extension[i] = tolower((unsigned char) extension[i]);
+            }
+            strcpy(entry->content_type, content_type);
+            registry.num_entries++;
+            return true;
+        }
+
+        else if(strncasecmp(entry->extension, extension, MAX_RES_EXT_LEN) == 0){
+            return true;
+        }
+    }
+}
+
+
+/**
+ * @brief Register every mapping of a mime.types file, eg:
+ *
+ *   # comment
+ *   text/html                  html htm shtml
+ *
+ * @return int number of extensions that were skipped (too long, table full), -1 if the file can't be read.
+ */
+static int load_mime_types(const char *mime_types_path){
+    char line[MAX_MIME_LINE_LEN];
+    char *save_ptr;
+    int num_skipped = 0;
+    FILE *mime_types = fopen(mime_types_path, "r");
+
+    if(!mime_types){
+        LOG(WARNING, "Could not read %s... only common content types are recognized\n", mime_types_path);
+        return -1;
+    }
+
+    while(fgets(line, MAX_MIME_LINE_LEN, mime_types)){
+        char *comment = strchr(line, '#');
+
+        if(comment){
+            *comment = '\0';
+        }
+
+        char *content_type = strtok_r(line, " \t\r\n", &save_ptr);
+
+        if(!content_type){
+            continue;
+        }
+
+        for(char *extension = strtok_r(NULL, " \t\r\n", &save_ptr); extension; extension = strtok_r(NULL, " \t\r\n", &save_ptr)){
+            if(!register_extension(extension, content_type)){
+                num_skipped++;
+            }
+        }
+    }
+
+    fclose(mime_types);
+
+    if(num_skipped != 0){
+        LOG(DEBUG, "Skipped %d extensions from %s\n", num_skipped, mime_types_path);
+    }
+
+    return num_skipped;
+}
@@ -0,0 +1,418 @@
+#define _GNU_SOURCE // readahead, AT_EMPTY_PATH
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "prewarm_private.h"
+#include "fnv1a.h"
+#include "root_index.h"
+#include "compression.h"
+#include "mime.h"
+#include "log.h"
+
+static void *run_prewarm_thread(void *args);
+static int count_path(prewarm_path **table, size_t *capacity, size_t *num_paths, const char *uri, unsigned long line_num);
+static int compare_hits(const void *a, const void *b);
+static int warm_path(const prewarm_config *config, const char *uri, const struct timespec *start, prewarm_stats *stats);
+static int warm_indexed_path(const prewarm_config *config, const root_index_entry *entry, const char *abs_path, const struct timespec *start, prewarm_stats *stats);
+static void read_ahead(int fd, const char *data, off_t size, long budget, const struct timespec *start, prewarm_stats *stats);
+static void warm_compressed(const char *abs_path, int fd, const struct stat *info, const char *content_type, prewarm_stats *stats);
+static void pace(const struct timespec *start, unsigned long bytes, long budget);
+static long elapsed_ms(const struct timespec *since);
+
+static pthread_t prewarm_tid;
+static bool prewarm_started = false;
+static _Atomic bool stop_requested = false;
+static prewarm_config thread_config;
+static char thread_source[MAX_SERVER_ROOT_LEN];
+static char thread_server_root[MAX_SERVER_ROOT_LEN];
+
+
+int prewarm_start(const prewarm_config *config){
+    if(!config || !config->source || !config->server_root || config->top < 0 || config->budget < 0){
+        LOG(ERROR, "Invalid pre-warm config!\n");
+        return -1;
+    }
+
+    snprintf(thread_source, MAX_SERVER_ROOT_LEN, "%s", config->source);
+    snprintf(thread_server_root, MAX_SERVER_ROOT_LEN, "%s", config->server_root);
+
+    thread_config = *config;
+    thread_config.source = thread_source;
+    thread_config.server_root = thread_server_root;
+
+    atomic_store(&stop_requested, false);
+
+    if(pthread_create(&prewarm_tid, NULL, run_prewarm_thread, &thread_config) != 0){
+        LOG(ERROR, "Failed to start pre-warm thread\n");
+        return -1;
+    }
+
+    prewarm_started = true;
+    return 0;
+}
+
+
+int prewarm_run(const prewarm_config *config, prewarm_stats *stats){
+    prewarm_stats run_stats = {0};
+    prewarm_path *paths;
+    struct timespec start;
+    int num_paths;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    num_paths = select_prewarm_paths(config->source, config->top, &paths);
+
+    if(num_paths == -1){
+        return -1;
+    }
+
+    run_stats.num_paths = num_paths;
+
+    for(int i = 0; i < num_paths && !atomic_load(&stop_requested); i++){
+        if(warm_path(config, paths[i].uri, &start, &run_stats) == -1){
+            LOG(DEBUG, "Nothing to pre-warm for %s\n", paths[i].uri);
+            continue;
+        }
+
+        run_stats.num_warmed++;
+    }
+
+    LOG(INFO, "Pre-warmed %lu of %lu paths from %s (%luB read ahead, %lu compressed) in %ldms\n",
+              run_stats.num_warmed,
+              run_stats.num_paths,
+              config->source,
+              run_stats.bytes,
+              run_stats.num_compressed,
+              elapsed_ms(&start));
+
+    if(stats){
+        *stats = run_stats;
+    }
+
+    free(paths);
+    return 0;
+}
+
+
+void prewarm_stop(){
+    if(!prewarm_started){
+        return;
+    }
+
+    atomic_store(&stop_requested, true);
+    pthread_join(prewarm_tid, NULL);
+    prewarm_started = false;
+}
+
+
+int parse_prewarm_line(const char *line, char *uri){
+    const char *start = line;
+    size_t uri_len;
+
+    while(*start == ' ' || *start == '\t') start++;
+
+    // Access log: 127.0.0.1 - - [10/Oct/2000:13:55:36 -0700] "GET /index.html HTTP/1.0" 200 2326
+    const char *request_line = strchr(start, '"');
+
+    if(request_line){
+        if(strncmp(request_line + 1, "GET ", strlen("GET ")) != 0){
+            return -1;
+        }
+        start = request_line + 1 + strlen("GET ");
+    }
+
+    // Manifest: one uri per line, # for comments
+    if(*start != '/'){
+        return -1;
+    }
+
+    uri_len = strcspn(start, "?# \t\r\n\"");
+
+    if(uri_len >= MAX_URI_LEN){
+        return -1;
+    }
+
+    memcpy(uri, start, uri_len);
+    uri[uri_len] = '\0';
+    return 0;
+}
+
+
+int select_prewarm_paths(const char *source, int top, prewarm_path **paths){
+    char line[MAX_PREWARM_LINE_LEN];
+    char uri[MAX_URI_LEN];
+    unsigned long line_num = 0;
+    size_t capacity = 1024;
+    size_t num_paths = 0;
+    size_t num_selected = 0;
+    bool table_full = false;
+    prewarm_path *table;
+    FILE *source_file = fopen(source, "r");
+
+    if(!source_file){
+        LOG(ERROR, "Failed to open pre-warm source %s\n", source);
+        return -1;
+    }
+
+    table = (prewarm_path *) calloc(capacity, sizeof(prewarm_path));
+
+    if(!table){
+        fclose(source_file);
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), source_file)){
+        line_num++;
+
+        if(parse_prewarm_line(line, uri) == 0 && count_path(&table, &capacity, &num_paths, uri, line_num) == -1 && !table_full){
+            LOG(WARNING, "Only the first %lu distinct paths of %s are counted\n", num_paths, source);
+            table_full = true;
+        }
+    }
+
+    fclose(source_file);
+
+    // Compact the used slots, then the most requested come first
+    for(size_t i = 0; i < capacity; i++){
+        if(table[i].hits != 0){
+            table[num_selected++] = table[i];
+        }
+    }
+
+    qsort(table, num_selected, sizeof(prewarm_path), compare_hits);
+
+    *paths = table;
+    return num_selected < (size_t) top ? (int) num_selected : top;
+}
+
+
+// HELPERS //
+
+static void *run_prewarm_thread(void *args){
+    prewarm_config *config = (prewarm_config *) args;
+
+    if(prewarm_run(config, NULL) == -1){
+        LOG(WARNING, "Starting with cold caches\n");
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Count one more hit for uri, growing the table (open addressing, at most half full) as needed.
+ *
+ * @return int 0 on success, -1 if the table can't take another path.
+ */
+static int count_path(prewarm_path **table, size_t *capacity, size_t *num_paths, const char *uri, unsigned long line_num){
+    size_t slot = fnv1a(uri) & (*capacity - 1);
+
+    for(; (*table)[slot].hits != 0; slot = (slot + 1) & (*capacity - 1)){
+        if(strcmp((*table)[slot].uri, uri) == 0){
+            (*table)[slot].hits++;
+            return 0;
+        }
+    }
+
+    if(*num_paths >= MAX_PREWARM_PATHS){
+        return -1;
+    }
+
+    else if((*num_paths + 1) * 2 > *capacity){
+        size_t new_capacity = *capacity * 2;
+        prewarm_path *new_table = (prewarm_path *) calloc(new_capacity, sizeof(prewarm_path));
+
+        if(!new_table){
+            return -1;
+        }
+
+        for(size_t i = 0; i < *capacity; i++){
+            if((*table)[i].hits == 0) continue;
+
+            size_t new_slot = fnv1a((*table)[i].uri) & (new_capacity - 1);
+
+            while(new_table[new_slot].hits != 0){
+                new_slot = (new_slot + 1) & (new_capacity - 1);
+            }
+            new_table[new_slot] = (*table)[i];
+        }
+
+        free(*table);
+        *table = new_table;
+        *capacity = new_capacity;
+        return count_path(table, capacity, num_paths, uri, line_num);
+    }
+
+    strcpy((*table)[slot].uri, uri);
+    (*table)[slot].hits = 1;
+    (*table)[slot].first_seen = line_num;
+    (*num_paths)++;
+    return 0;
+}
+
+
+static int compare_hits(const void *a, const void *b){
+    const prewarm_path *path_a = (const prewarm_path *) a;
+    const prewarm_path *path_b = (const prewarm_path *) b;
+
+    if(path_a->hits != path_b->hits){
+        return path_a->hits > path_b->hits ? -1 : 1;
+    }
+
+    return path_a->first_seen < path_b->first_seen ? -1 : 1;
+}
+
+
+/**
+ * @brief Bring a path into the caches it's served from.
+ *
+ * @return int 0 on success, -1 if the path can't be served.
+ */
+static int warm_path(const prewarm_config *config, const char *uri, const struct timespec *start, prewarm_stats *stats){
+    char abs_path[MAX_SERVER_ROOT_LEN + MAX_URI_LEN];
+    struct stat info;
+    int rc = -1;
+    int fd;
+
+    if(strstr(uri, "..")){
+        return -1;
+    }
+
+    // Same mapping as validate_http_uri, so cache keys match the ones of real requests
+    snprintf(abs_path, sizeof(abs_path), "%s%s", config->server_root, strcmp(uri, "/") == 0 ? "/index.html" : uri);
+
+    if(root_index_enabled() && root_index_enter() == 0){
+        const root_index_entry *entry = root_index_lookup(abs_path + strlen(config->server_root), NULL);
+
+        // Reading ahead sleeps to stay under the budget, a reload must not wait on that
+        root_index_hold_t hold = entry ? root_index_hold() : NULL;
+
+        root_index_exit();
+
+        if(entry){
+            rc = warm_indexed_path(config, entry, abs_path, start, stats);
+            root_index_release(&hold);
+            return rc;
+        }
+    }
+
+    fd = openat(AT_FDCWD, abs_path, O_RDONLY | O_CLOEXEC);
+
+    if(fd == -1){
+        return -1;
+    }
+
+    else if(fstatat(fd, "", &info, AT_EMPTY_PATH) == 0 && S_ISREG(info.st_mode)){
+        read_ahead(fd, NULL, info.st_size, config->budget, start, stats);
+        warm_compressed(abs_path, fd, &info, get_mime_type(abs_path), stats);
+        rc = 0;
+    }
+
+    close(fd);
+    return rc;
+}
+
+
+static int warm_indexed_path(const prewarm_config *config, const root_index_entry *entry, const char *abs_path, const struct timespec *start, prewarm_stats *stats){
+    if(entry->data){
+        // Site packs are mapped, and carry their own compressed variants
+        read_ahead(-1, entry->data, entry->info.st_size, config->budget, start, stats);
+        return 0;
+    }
+
+    else if(entry->fd == -1){
+        return -1;
+    }
+
+    read_ahead(entry->fd, NULL, entry->info.st_size, config->budget, start, stats);
+    warm_compressed(abs_path, entry->fd, &(entry->info), entry->content_type, stats);
+    return 0;
+}
+
+
+/**
+ * @brief Read a ressource ahead (from fd, or its mapped data) a slice of the budget at a time,
+ *        so a big file doesn't go over the budget before the first pause.
+ */
+static void read_ahead(int fd, const char *data, off_t size, long budget, const struct timespec *start, prewarm_stats *stats){
+    long page_size = sysconf(_SC_PAGESIZE);
+    off_t chunk = size;
+
+    if(budget != 0){
+        chunk = budget / (1000 / PREWARM_PACE_SLICE_MS);
+        chunk = chunk < page_size ? page_size : chunk - chunk % page_size;
+    }
+
+    for(off_t offset = 0; offset < size && !atomic_load(&stop_requested); offset += chunk){
+        off_t len = size - offset < chunk ? size - offset : chunk;
+
+        if(data){
+            uintptr_t addr = (uintptr_t) (data + offset);
+            uintptr_t page = addr & ~((uintptr_t) page_size - 1);
+
+            madvise((void *) page, len + (addr - page), MADV_WILLNEED);
+        }
+
+        else {
+            readahead(fd, offset, len);
+        }
+
+        stats->bytes += len;
+        pace(start, stats->bytes, budget);
+    }
+}
+
+
+/**
+ * @brief Fill the compressed response cache with the gzip version of a ressource, if it'd be compressed on the fly.
+ */
+static void warm_compressed(const char *abs_path, int fd, const struct stat *info, const char *content_type, prewarm_stats *stats){
+    if(!compression_applies(content_type, info->st_size) || !compression_is_cacheable(info->st_size)){
+        return;
+    }
+
+    compressed_entry_t entry = get_compressed_entry(abs_path, fd, info, CODING_GZIP);
+
+    if(entry){
+        stats->num_compressed++;
+        release_compressed_entry(&entry);
+    }
+}
+
+
+/**
+ * @brief Sleep as long as needed to keep the bytes read ahead since start under budget per second.
+ */
+static void pace(const struct timespec *start, unsigned long bytes, long budget){
+    if(budget == 0){
+        return;
+    }
+
+    long target_ms = (long) (bytes / budget) * 1000 + (long) (bytes % budget) * 1000 / budget;
+
+    while(!atomic_load(&stop_requested)){
+        long ahead_ms = target_ms - elapsed_ms(start);
+
+        if(ahead_ms <= 0){
+            break;
+        }
+
+        ahead_ms = ahead_ms < PREWARM_PACE_SLICE_MS ? ahead_ms : PREWARM_PACE_SLICE_MS;
+        struct timespec pause = {.tv_sec = 0, .tv_nsec = ahead_ms * 1000000};
+        nanosleep(&pause, NULL);
+    }
+}
+
+
+static long elapsed_ms(const struct timespec *since){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
@@ -0,0 +1,316 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <netinet/in.h>
+#include "rate_limit.h"
+#include "log.h"
+
+#define RATE_LIMIT_SLOT_MASK (RATE_LIMIT_SHARD_SLOTS - 1)
+#define MILLI_TOKENS 1000               // A request takes this many, so a rate per second refills as many per ms
+#define BUCKET_TOKEN_BITS 24            // MAX_RATE_LIMIT_BURST * MILLI_TOKENS has to fit
+#define BUCKET_TOKEN_MASK ((1UL << BUCKET_TOKEN_BITS) - 1)
+#define FULL_BUCKET 0UL                 // What a new entry starts with
+
+
+/**
+ * This struct is for internal use only.
+ *
+ * bucket holds the milli-tokens left in its low BUCKET_TOKEN_BITS bits and the
+ * time they were counted at (ms since rate_limit_init, plus 1) in the others,
+ * so the bucket is refilled and drawn from with a single compare and swap.
+ */
+typedef struct _rate_limit_entry {
+    _Atomic uint64_t key;               /**< Hash of the client address, 0 for a free entry. */
+    _Atomic uint64_t bucket;
+    _Atomic int connections;
+} rate_limit_entry;
+
+/**
+ * This struct is for internal use only.
+ */
+typedef struct _rate_limit_shard {
+    rate_limit_entry entries[RATE_LIMIT_SHARD_SLOTS];
+} rate_limit_shard;
+
+/*Forward Declarations*/
+static rate_limit_entry *find_entry(uint64_t key, uint64_t now);
+static bool take_token(rate_limit_entry *entry, uint64_t now);
+static uint64_t tokens_at(uint64_t bucket, uint64_t now);
+static bool is_reusable(rate_limit_entry *entry, uint64_t now);
+static uint64_t hash_address(const struct sockaddr *addr);
+static uint64_t mix(uint64_t x);
+static uint64_t now_ms();
+
+static rate_limit_shard *shards = NULL;
+static _Atomic uint32_t *fd_entries = NULL;    // Entry index + 1 of the connection on each fd, 0 if not counted
+static _Atomic bool enabled = false;
+static int max_fds = 0;
+static uint64_t rate = 0;                      // Milli-tokens per ms
+static uint64_t capacity = 0;                  // Milli-tokens
+static int max_connections = 0;
+static struct timespec start;
+
+
+int rate_limit_init(const rate_limit_config *config){
+    if(!config || config->requests_per_sec < 0 || config->requests_per_sec > MAX_RATE_LIMIT_RATE ||
+       config->burst < 0 || config->burst > MAX_RATE_LIMIT_BURST || config->max_connections < 0 || config->max_fds < 0){
+        LOG(ERROR, "Invalid rate limits\n");
+        return -1;
+    }
+
+    if(config->requests_per_sec == 0 && config->max_connections == 0){
+        return 0;
+    }
+
+    if(!(shards = (rate_limit_shard *) calloc(RATE_LIMIT_SHARDS, sizeof(rate_limit_shard)))){
+        LOG(ERROR, "Failed to allocate the rate limit table\n");
+        return -1;
+    }
+
+    if(config->max_connections != 0 && config->max_fds != 0 &&
+       !(fd_entries = (_Atomic uint32_t *) calloc(config->max_fds, sizeof(_Atomic uint32_t)))){
+        LOG(ERROR, "Failed to allocate the rate limit table\n");
+        rate_limit_destroy();
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &start);
+    max_fds = fd_entries ? config->max_fds : 0;
+    rate = config->requests_per_sec;
+    capacity = (uint64_t) (config->burst != 0 ? config->burst : config->requests_per_sec) * MILLI_TOKENS;
+    max_connections = config->max_connections;
+
+    // Bursts default to the rate, which can be more than a bucket holds
+    if(rate != 0 && capacity > MAX_RATE_LIMIT_BURST * (uint64_t) MILLI_TOKENS){
+        capacity = MAX_RATE_LIMIT_BURST * (uint64_t) MILLI_TOKENS;
+    }
+
+    atomic_store(&enabled, true);
+    return 0;
+}
+
+
+bool rate_limit_enabled(){
+    return atomic_load(&enabled);
+}
+
+
+rate_limit_verdict rate_limit_admit(int client_fd, const struct sockaddr *addr){
+    rate_limit_entry *entry;
+    uint64_t key;
+    uint64_t now;
+    bool counted;
+
+    if(!atomic_load(&enabled) || !addr || (key = hash_address(addr)) == 0){
+        return RATE_LIMIT_ALLOW;
+    }
+
+    now = now_ms();
+
+    // Addresses without an entry aren't limited, the table is full of active clients
+    if(!(entry = find_entry(key, now))){
+        return RATE_LIMIT_ALLOW;
+    }
+
+    // Only connections that will be released are counted
+    counted = max_connections != 0 && client_fd >= 0 && client_fd < max_fds;
+
+    if(counted && atomic_fetch_add(&(entry->connections), 1) >= max_connections){
+        atomic_fetch_sub(&(entry->connections), 1);
+        return RATE_LIMIT_TOO_MANY_CONNECTIONS;
+    }
+
+    if(rate != 0 && !take_token(entry, now)){
+        if(counted){
+            atomic_fetch_sub(&(entry->connections), 1);
+        }
+
+        return RATE_LIMIT_TOO_MANY_REQUESTS;
+    }
+
+    if(counted){
+        uint32_t index = (uint32_t) (entry - &(shards[0].entries[0]));
+
+        atomic_store(&(fd_entries[client_fd]), index + 1);
+    }
+
+    return RATE_LIMIT_ALLOW;
+}
+
+
+void rate_limit_release(int client_fd){
+    uint32_t index;
+
+    if(!fd_entries || client_fd < 0 || client_fd >= max_fds){
+        return;
+    }
+
+    if((index = atomic_exchange(&(fd_entries[client_fd]), 0)) != 0){
+        index--;
+        atomic_fetch_sub(&(shards[index / RATE_LIMIT_SHARD_SLOTS].entries[index & RATE_LIMIT_SLOT_MASK].connections), 1);
+    }
+}
+
+
+void rate_limit_destroy(){
+    atomic_store(&enabled, false);
+
+    free(fd_entries);
+    free(shards);
+    fd_entries = NULL;
+    shards = NULL;
+    max_fds = 0;
+}
+
+
+// HELPERS //
+
+/**
+ * @brief Find the entry of a client address, claiming one if it has none.
+ *
+ * @note Looks at up to RATE_LIMIT_MAX_PROBES entries of the shard from the one
+ *       the key hashes to. A free entry is claimed first, otherwise one whose
+ *       client can't be told apart from a new one (no open connections, full bucket).
+ *
+ * @param key hash of the client address.
+ * @param now ms since rate_limit_init, plus 1.
+ * @return rate_limit_entry* entry of the address, NULL if none could be claimed.
+ */
+static rate_limit_entry *find_entry(uint64_t key, uint64_t now){
+    rate_limit_shard *shard = &(shards[key % RATE_LIMIT_SHARDS]);
+    uint64_t slot = key / RATE_LIMIT_SHARDS;
+    rate_limit_entry *reusable = NULL;
+    uint64_t reusable_key = 0;
+
+    for(int probe = 0; probe < RATE_LIMIT_MAX_PROBES; probe++){
+        rate_limit_entry *entry = &(shard->entries[(slot + probe) & RATE_LIMIT_SLOT_MASK]);
+        uint64_t entry_key = atomic_load(&(entry->key));
+
+        if(entry_key == key){
+            return entry;
+        }
+
+        else if(entry_key == 0){
+            if(atomic_compare_exchange_strong(&(entry->key), &entry_key, key) || entry_key == key){
+                return entry;
+            }
+        }
+
+        else if(!reusable && is_reusable(entry, now)){
+            reusable = entry;
+            reusable_key = entry_key;
+        }
+    }
+
+    if(!reusable || !atomic_compare_exchange_strong(&(reusable->key), &reusable_key, key)){
+        return NULL;
+    }
+
+    atomic_store(&(reusable->bucket), FULL_BUCKET);
+    return reusable;
+}
+
+
+/**
+ * @brief Refill a bucket for the time elapsed and take a request out of it.
+ *
+ * @return true if the bucket had a request left, otherwise false (it's left as is).
+ */
+static bool take_token(rate_limit_entry *entry, uint64_t now){
+    uint64_t bucket = atomic_load(&(entry->bucket));
+    uint64_t tokens;
+
+    do{
+        if((tokens = tokens_at(bucket, now)) < MILLI_TOKENS){
+            return false;
+        }
+    }while(!atomic_compare_exchange_weak(&(entry->bucket), &bucket, (now << BUCKET_TOKEN_BITS) | (tokens - MILLI_TOKENS)));
+
+    return true;
+}
+
+
+/**
+ * @brief Milli-tokens in a bucket at a given time, refilled lazily since they were counted.
+ */
+static uint64_t tokens_at(uint64_t bucket, uint64_t now){
+    uint64_t counted_at = bucket >> BUCKET_TOKEN_BITS;
+    uint64_t tokens = bucket & BUCKET_TOKEN_MASK;
+    uint64_t elapsed = now > counted_at ? now - counted_at : 0;
+
+    if(bucket == FULL_BUCKET || elapsed >= capacity / rate + 1){
+        return capacity;
+    }
+
+    tokens += elapsed * rate;
+    return tokens < capacity ? tokens : capacity;
+}
+
+
+static bool is_reusable(rate_limit_entry *entry, uint64_t now){
+    return atomic_load(&(entry->connections)) == 0 &&
+           (rate == 0 || tokens_at(atomic_load(&(entry->bucket)), now) == capacity);
+}
+
+
+/**
+ * @brief Hash a client address, IPv4 clients connecting over IPv6 hash as themselves.
+ *
+ * @return uint64_t the hash (never 0), 0 if the address isn't an IP address.
+ */
+static uint64_t hash_address(const struct sockaddr *addr){
+    uint64_t hash;
+
+    if(addr->sa_family == AF_INET){
+        hash = mix(((const struct sockaddr_in *) addr)->sin_addr.s_addr);
+    }
+
+    else if(addr->sa_family == AF_INET6){
+        const struct in6_addr *ip = &(((const struct sockaddr_in6 *) addr)->sin6_addr);
+        uint64_t high, low;
+
+        if(IN6_IS_ADDR_V4MAPPED(ip)){
+            uint32_t ipv4;
+
+            memcpy(&ipv4, &(ip->s6_addr[12]), sizeof(ipv4));
+            hash = mix(ipv4);
+        }
+
+        else{
+            memcpy(&high, &(ip->s6_addr[0]), sizeof(high));
+            memcpy(&low, &(ip->s6_addr[8]), sizeof(low));
+            hash = mix(high ^ mix(low));
+        }
+    }
+
+    else{
+        return 0;
+    }
+
+    return hash != 0 ? hash : 1;
+}
+
+
+/**
+ * @brief Finalizer of splitmix64, spreads every input bit over the whole hash.
+ */
+static uint64_t mix(uint64_t x){
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9UL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebUL;
+    return x ^ (x >> 31);
+}
+
+
+/**
+ * @brief Coarse monotonic time since rate_limit_init, plus 1 so no bucket looks full by its time alone.
+ */
+static uint64_t now_ms(){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return (uint64_t) ((int64_t) (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000 + 1);
+}
@@ -0,0 +1,419 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "receiver.h"
+#include "timer_wheel.h"
+#include "rio.h"
+#include "metrics.h"
+#include "rate_limit.h"
+#include "log.h"
+#include "trace.h"
+
+/**
+ * This struct is for internal use only.
+ */
+typedef struct pending_connection {
+    int fd;
+    wheel_timer timer;                  /**< Fires at the idle or header deadline, whichever comes first. */
+    unsigned long header_deadline_ms;
+    ssize_t peeked;                     /**< Bytes of the request seen so far. */
+    struct pending_connection *prev;    /**< Connections of the same receiver thread. */
+    struct pending_connection *next;
+} pending_connection;
+
+/**
+ * This struct is for internal use only.
+ */
+typedef struct receiver_thread {
+    pthread_t tid;
+    int epoll_fd;
+    int event_fd;                       /**< Signaled when connections are submitted. */
+    pthread_mutex_t lock;               /**< Protects submitted, connections are submitted by the accept loop. */
+    pending_connection *submitted;
+    bool stopped;                       /**< Set once the thread took its last submitted connections. */
+    pending_connection *waiting;        /**< Only used by the receiver thread, as the wheel. */
+    pending_connection *ready;          /**< Requests that arrived while the bounded buffer was full, oldest first (same). */
+    pending_connection *ready_tail;
+    timer_wheel_t wheel;
+} receiver_thread;
+
+/*Forward Declarations*/
+static void *run_receiver_thread(void *args);
+static void take_submitted(receiver_thread *thread, unsigned long now_ms);
+static bool receive(receiver_thread *thread, pending_connection *connection, uint32_t events, unsigned long now_ms);
+static void expire_connection(wheel_timer *timer, void *args);
+static void hand_over(receiver_thread *thread, pending_connection *connection, bool head_complete);
+static void hand_over_ready(receiver_thread *thread);
+static void drop_connection(receiver_thread *thread, pending_connection *connection);
+static void close_client(int client_fd);
+static void forget_connection(receiver_thread *thread, pending_connection *connection);
+static bool request_head_complete(const char *buf, size_t len);
+static unsigned long now_ms();
+
+static receiver_thread threads[MAX_RECEIVER_THREADS];
+static int num_threads = 0;
+static _Atomic unsigned int next_thread = 0;
+static _Atomic bool running = false;
+static bbuf_t bbuf = NULL;
+static int idle_timeout_ms;
+static int header_timeout_ms;
+
+
+int receiver_pool_init(const receiver_config *config){
+    if(!config || !config->bbuf || config->num_threads <= 0 || config->num_threads > MAX_RECEIVER_THREADS){
+        LOG(ERROR, "Invalid receiver configuration!\n");
+        return -1;
+    }
+
+    memset(threads, 0, sizeof(threads));
+    bbuf = config->bbuf;
+    idle_timeout_ms = config->idle_timeout_ms ? config->idle_timeout_ms : RECEIVER_IDLE_TIMEOUT_MS;
+    header_timeout_ms = config->header_timeout_ms ? config->header_timeout_ms : RECEIVER_HEADER_TIMEOUT_MS;
+    atomic_store(&running, true);
+
+    for(num_threads = 0; num_threads < config->num_threads; num_threads++){
+        receiver_thread *thread = &threads[num_threads];
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+
+        thread->epoll_fd = epoll_create1(0);
+        thread->event_fd = eventfd(0, EFD_NONBLOCK);
+        thread->wheel = timer_wheel_init(now_ms(), RECEIVER_TICK_MS);
+        pthread_mutex_init(&(thread->lock), NULL);
+
+        if(thread->epoll_fd == -1 || thread->event_fd == -1 || !thread->wheel ||
+           epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, thread->event_fd, &event) != 0 ||
+           pthread_create(&(thread->tid), NULL, run_receiver_thread, thread) != 0){
+            LOG(ERROR, "Failed to start receiver thread %d\n", num_threads);
+            if(thread->epoll_fd != -1) close(thread->epoll_fd);
+            if(thread->event_fd != -1) close(thread->event_fd);
+            timer_wheel_destroy(&(thread->wheel));
+            receiver_pool_destroy();
+            return -1;
+        }
+    }
+
+    LOG(DEBUG, "Started %d receiver threads\n", num_threads);
+    return 0;
+}
+
+
+bool receiver_pool_running(){
+    return atomic_load(&running) && num_threads != 0;
+}
+
+
+int receiver_submit(int client_fd){
+    uint64_t one = 1;
+
+    if(!receiver_pool_running()){
+        return -1;
+    }
+
+    receiver_thread *thread = &threads[atomic_fetch_add(&next_thread, 1) % num_threads];
+    pending_connection *connection = (pending_connection *) calloc(1, sizeof(pending_connection));
+
+    if(!connection){
+        return -1;
+    }
+
+    connection->fd = client_fd;
+    connection->timer.data = connection;
+    connection->header_deadline_ms = now_ms() + header_timeout_ms;
+
+    pthread_mutex_lock(&(thread->lock));
+
+    if(thread->stopped){
+        pthread_mutex_unlock(&(thread->lock));
+        free(connection);
+        return -1;
+    }
+
+    connection->next = thread->submitted;
+    thread->submitted = connection;
+    pthread_mutex_unlock(&(thread->lock));
+
+    (void) write(thread->event_fd, &one, sizeof(one));
+    return 0;
+}
+
+
+void receiver_pool_destroy(){
+    uint64_t one = 1;
+
+    atomic_store(&running, false);
+
+    for(int i = 0; i < num_threads; i++){
+        (void) write(threads[i].event_fd, &one, sizeof(one));
+        pthread_join(threads[i].tid, NULL);
+        close(threads[i].epoll_fd);
+        close(threads[i].event_fd);
+        timer_wheel_destroy(&(threads[i].wheel));
+        pthread_mutex_destroy(&(threads[i].lock));
+    }
+
+    num_threads = 0;
+}
+
+
+// HELPERS //
+
+static void *run_receiver_thread(void *args){
+    receiver_thread *thread = (receiver_thread *) args;
+    struct epoll_event events[RECEIVER_MAX_EVENTS];
+    uint64_t count;
+
+    while(atomic_load(&running)){
+        int timeout_ms = timer_wheel_next_timeout_ms(thread->wheel, now_ms());
+
+        if(timeout_ms == -1 || timeout_ms > RECEIVER_POLL_INTERVAL_MS){
+            timeout_ms = RECEIVER_POLL_INTERVAL_MS;
+        }
+
+        // Slots free up without notice, keep trying while requests wait for one
+        if(thread->ready && timeout_ms > RECEIVER_RETRY_INTERVAL_MS){
+            timeout_ms = RECEIVER_RETRY_INTERVAL_MS;
+        }
+
+        int num_events = epoll_wait(thread->epoll_fd, events, RECEIVER_MAX_EVENTS, timeout_ms);
+        unsigned long now = now_ms();
+
+        for(int i = 0; i < num_events; i++){
+            // Connections submitted in the meantime are taken below, whatever the count
+            if(!events[i].data.ptr){
+                (void) read(thread->event_fd, &count, sizeof(count));
+                continue;
+            }
+
+            receive(thread, (pending_connection *) events[i].data.ptr, events[i].events, now);
+        }
+
+        hand_over_ready(thread);
+        take_submitted(thread, now);
+        timer_wheel_advance(thread->wheel, now_ms(), expire_connection, thread);
+    }
+
+    // Nothing can be submitted anymore, close whatever is left
+    pthread_mutex_lock(&(thread->lock));
+    thread->stopped = true;
+    pthread_mutex_unlock(&(thread->lock));
+
+    take_submitted(thread, now_ms());
+
+    while(thread->waiting){
+        drop_connection(thread, thread->waiting);
+    }
+
+    // Whatever still doesn't fit isn't going to be served
+    hand_over_ready(thread);
+
+    while(thread->ready){
+        pending_connection *connection = thread->ready;
+
+        thread->ready = connection->next;
+        close_client(connection->fd);
+        free(connection);
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Start waiting on the connections submitted since the last call. Those
+ *        whose request already arrived are inserted in the bounded buffer right away.
+ */
+static void take_submitted(receiver_thread *thread, unsigned long now_ms){
+    pending_connection *connection;
+    pending_connection *next;
+
+    pthread_mutex_lock(&(thread->lock));
+    connection = thread->submitted;
+    thread->submitted = NULL;
+    pthread_mutex_unlock(&(thread->lock));
+
+    for(; connection; connection = next){
+        struct epoll_event event = {.events = EPOLLIN | EPOLLRDHUP | EPOLLET, .data.ptr = connection};
+
+        next = connection->next;
+        connection->prev = NULL;
+        connection->next = thread->waiting;
+        if(thread->waiting) thread->waiting->prev = connection;
+        thread->waiting = connection;
+
+        timer_wheel_arm(thread->wheel, &(connection->timer), min(now_ms + idle_timeout_ms, connection->header_deadline_ms));
+
+        // Most requests are already there
+        if(!receive(thread, connection, 0, now_ms)){
+            continue;
+        }
+
+        // Edge triggered, the request is only peeked at so it stays readable until a worker reads it
+        else if(epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, connection->fd, &event) != 0){
+            LOG(ERROR, "Failed to wait on fd %d\n", connection->fd);
+            drop_connection(thread, connection);
+        }
+    }
+}
+
+
+/**
+ * @brief Look at what arrived of a request, hand the connection over once its head is complete.
+ *
+ * @return bool true if the connection is still waiting, false if it was handed over or closed.
+ */
+static bool receive(receiver_thread *thread, pending_connection *connection, uint32_t events, unsigned long now_ms){
+    char head[RIO_BUFFSIZE];
+    ssize_t peeked = recv(connection->fd, head, sizeof(head), MSG_PEEK | MSG_DONTWAIT);
+
+    if(peeked == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)){
+        return true;
+    }
+
+    // Gone without a request, there is nothing to respond to
+    else if(peeked <= 0){
+        drop_connection(thread, connection);
+        return false;
+    }
+
+    // A head that doesn't fit is read by the worker as is, same for a client that stopped sending
+    else if(request_head_complete(head, peeked) || peeked == sizeof(head) || (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))){
+        hand_over(thread, connection, request_head_complete(head, peeked));
+        return false;
+    }
+
+    // Progress pushes the idle deadline back, never past the header deadline
+    if(peeked != connection->peeked){
+        unsigned long idle_deadline_ms = now_ms + idle_timeout_ms;
+
+        connection->peeked = peeked;
+        timer_wheel_arm(thread->wheel, &(connection->timer), min(idle_deadline_ms, connection->header_deadline_ms));
+    }
+
+    return true;
+}
+
+
+static void expire_connection(wheel_timer *timer, void *args){
+    pending_connection *connection = (pending_connection *) timer->data;
+
+    LOG(DEBUG, "fd %d timed out after sending %ldB of its request\n", connection->fd, connection->peeked);
+    drop_connection((receiver_thread *) args, connection);
+}
+
+
+/**
+ * @brief Insert a connection in the bounded buffer for a worker to serve, or queue it
+ *        behind the ones waiting for a slot. Never blocks, so timeouts keep firing.
+ */
+static void hand_over(receiver_thread *thread, pending_connection *connection, bool head_complete){
+    int client_fd = connection->fd;
+    struct timeval timeout = {.tv_sec = idle_timeout_ms / 1000, .tv_usec = (idle_timeout_ms % 1000) * 1000};
+
+    forget_connection(thread, connection);
+
+    // Reading the rest of an incomplete head can't take the worker longer than the idle timeout
+    if(!head_complete){
+        setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+
+    if(!thread->ready && bbuf_try_insert(bbuf, client_fd) == 0){
+        free(connection);
+        return;
+    }
+
+    connection->next = NULL;
+    if(thread->ready_tail) thread->ready_tail->next = connection;
+    else thread->ready = connection;
+    thread->ready_tail = connection;
+}
+
+
+/**
+ * @brief Insert as many of the connections waiting for a slot as the bounded buffer takes.
+ */
+static void hand_over_ready(receiver_thread *thread){
+    while(thread->ready && bbuf_try_insert(bbuf, thread->ready->fd) == 0){
+        pending_connection *connection = thread->ready;
+
+        thread->ready = connection->next;
+        if(!thread->ready) thread->ready_tail = NULL;
+        free(connection);
+    }
+}
+
+
+static void drop_connection(receiver_thread *thread, pending_connection *connection){
+    forget_connection(thread, connection);
+    close_client(connection->fd);
+    free(connection);
+}
+
+
+/**
+ * @brief Stop waiting on a connection, its fd is left open and it's left to the caller to free.
+ */
+static void forget_connection(receiver_thread *thread, pending_connection *connection){
+    epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+    timer_wheel_cancel(thread->wheel, &(connection->timer));
+
+    if(connection->prev) connection->prev->next = connection->next;
+    else thread->waiting = connection->next;
+    if(connection->next) connection->next->prev = connection->prev;
+}
+
+
+static void close_client(int client_fd){
+    rate_limit_release(client_fd);
+    close(client_fd);
+    metrics_count_connection(false);
+    TRACE(close, client_fd, 0);
+}
+
+
+/**
+ * @brief Check whether buf holds a whole request head: a simple request's line
+ *        (no version, no headers) or a full request's line and headers up to the empty line.
+ */
+static bool request_head_complete(const char *buf, size_t len){
+    const char *line_end = memchr(buf, '\n', len);
+
+    if(!line_end){
+        return false;
+    }
+
+    // Full requests have a version on their request line
+    bool has_version = false;
+
+    for(const char *c = buf; c + 5 <= line_end && !has_version; c++){
+        has_version = strncmp(c, "HTTP/", 5) == 0;
+    }
+
+    if(!has_version){
+        return true;
+    }
+
+    for(const char *c = line_end; c < buf + len - 1; c++){
+        if(c[0] == '\n' && (c[1] == '\n' || (c[1] == '\r' && c + 2 < buf + len && c[2] == '\n'))){
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+static unsigned long now_ms(){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000UL + now.tv_nsec / 1000000;
+}
@@ -5,6 +5,8 @@
 #include <string.h>
 #include <fcntl.h>
 #include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <poll.h>
 #include "rio.h"
 #include "log.h"
 
@@ -13,6 +15,7 @@
 
 // Intenal helper used amongst public APIs
 static ssize_t read_b(rio_t rp, char *userbuf, size_t num_to_read);
+static int wait_writable(int fd);
 
 
 /**
@@ -114,69 +117,138 @@ ssize_t readline_b(rio_t rp, void *userbuf, size_t maxlen){
 
 
 ssize_t writen_b(int fd, void *userbuf, size_t num_bytes){
-    int max_retries = 5, retry_num = 0, bytes_left = num_bytes;
+    size_t bytes_left = num_bytes;
     ssize_t bytes_written = 0;
     char *bufp = (char *)userbuf;
     
     // Retry the write until num_bytes has been transfered to fd
     // or we encounter write sys call explicitly fails
-    while (bytes_left > 0 && retry_num < max_retries){
-        bytes_written = write(fd, bufp, num_bytes);
+    while (bytes_left > 0){
+        bytes_written = write(fd, bufp, bytes_left);
         
-        if (bytes_written == -1){
-            LOG(ERROR, "Failed to write %ldB to fd %d...\n", num_bytes, fd);
-            return EXIT_FAILURE_RIO;
+        if (bytes_written == -1 && errno == EINTR){
+            LOG(DEBUG, "Encountered signal %d, retrying...\n", errno);
+            continue;
         }
 
-        else if (errno == EINTR){
-            LOG(DEBUG, "Encountered signal %d, retrying...\n", errno);
-            bytes_written = 0;
-            bufp = userbuf;
-            retry_num++;
+        else if (bytes_written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) && wait_writable(fd) == 0){
             continue;
         }
 
+        else if (bytes_written == -1){
+            LOG(ERROR, "Failed to write %ldB to fd %d...\n", bytes_left, fd);
+            return EXIT_FAILURE_RIO;
+        }
+
         bytes_left -= bytes_written;
         bufp += bytes_written;
     }
 
-    LOG(DEBUG, "Successfully wrote %ldB to fd %d...\n", bytes_written, fd);
+    LOG(DEBUG, "Successfully wrote %ldB to fd %d...\n", num_bytes, fd);
     return EXIT_SUCCESS;
 }
 
 
-ssize_t writen(int out_fd, int in_fd, size_t num_bytes){
-    int max_retries = 5;
-    int retry_num = 0;
-    size_t bytes_left = num_bytes;
-    ssize_t bytes_written = 0;
-    
-    // Retry the write until num_bytes has been transfered to fd
-    // or we encounter write sys call explicitly fails
-    while (bytes_left > 0 && retry_num < max_retries){
-        bytes_written = sendfile(out_fd, in_fd, NULL, num_bytes);
+ssize_t writev_b(int fd, struct iovec *iov, int iovcnt){
+    ssize_t bytes_written;
+
+    while(iovcnt > 0){
+        bytes_written = writev(fd, iov, iovcnt);
 
-        if (bytes_written == -1){
+        if(bytes_written == -1 && errno == EINTR){
+            continue;
+        }
 
-            if (errno == EINTR){
-                LOG(DEBUG, "Encountered signal %d, retrying...\n", errno);
-                bytes_written = 0;
-                retry_num++;
-                continue;
-            }
+        else if(bytes_written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) && wait_writable(fd) == 0){
+            continue;
+        }
 
-            LOG(ERROR, "Failed to write %ldB to fd %d...\n", num_bytes, out_fd);
+        else if(bytes_written == -1){
+            LOG(ERROR, "Failed to write %d buffers to fd %d...\n", iovcnt, fd);
             return EXIT_FAILURE_RIO;
         }
 
-        bytes_left -= bytes_written;
+        // Skip what was fully written, then resume within the partially written buffer
+        for(; iovcnt > 0 && bytes_written >= iov->iov_len; iov++, iovcnt--){
+            bytes_written -= iov->iov_len;
+        }
+
+        if(iovcnt > 0){
+            iov->iov_base = (char *) iov->iov_base + bytes_written;
+            iov->iov_len -= bytes_written;
+        }
     }
 
-    LOG(DEBUG, "Successfully wrote %ldB to fd %d...\n", bytes_written, out_fd);
     return EXIT_SUCCESS;
 }
 
 
+ssize_t writen(int out_fd, int in_fd, off_t offset, size_t num_bytes){
+    sendfile_op op;
+    sendfile_status status;
+
+    sendfile_op_init(&op, out_fd, in_fd, offset, num_bytes, SENDFILE_CHUNK_SIZE);
+
+    // Drive the transfer chunk by chunk, only waiting when the socket is full
+    while((status = sendfile_op_resume(&op)) != SENDFILE_DONE){
+        if(status == SENDFILE_ERROR){
+            return EXIT_FAILURE_RIO;
+        }
+
+        else if(status == SENDFILE_BLOCKED && wait_writable(out_fd) != 0){
+            LOG(ERROR, "Gave up on fd %d with %ldB left to write...\n", out_fd, op.remaining);
+            return EXIT_FAILURE_RIO;
+        }
+    }
+
+    LOG(DEBUG, "Successfully wrote %ldB to fd %d...\n", num_bytes, out_fd);
+    return EXIT_SUCCESS;
+}
+
+
+void sendfile_op_init(sendfile_op *op, int out_fd, int in_fd, off_t offset, size_t num_bytes, size_t chunk_size){
+    op->out_fd = out_fd;
+    op->in_fd = in_fd;
+    op->offset = offset;
+    op->remaining = num_bytes;
+    op->chunk_size = chunk_size ? chunk_size : SENDFILE_CHUNK_SIZE;
+}
+
+
+sendfile_status sendfile_op_resume(sendfile_op *op){
+    size_t chunk_left = min(op->chunk_size, op->remaining);
+    ssize_t bytes_written;
+
+    while(chunk_left > 0){
+        // sendfile advances offset by the number of bytes written
+        bytes_written = sendfile(op->out_fd, op->in_fd, &(op->offset), chunk_left);
+
+        if(bytes_written == -1 && errno == EINTR){
+            continue;
+        }
+
+        else if(bytes_written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+            return SENDFILE_BLOCKED;
+        }
+
+        else if(bytes_written == -1){
+            LOG(ERROR, "Failed to write %ldB to fd %d: %s\n", op->remaining, op->out_fd, strerror(errno));
+            return SENDFILE_ERROR;
+        }
+
+        else if(bytes_written == 0){
+            LOG(ERROR, "Reached end of fd %d with %ldB left to write...\n", op->in_fd, op->remaining);
+            return SENDFILE_ERROR;
+        }
+
+        chunk_left -= bytes_written;
+        op->remaining -= bytes_written;
+    }
+
+    return op->remaining == 0 ? SENDFILE_DONE : SENDFILE_PENDING;
+}
+
+
 /**
  * This function is just a buffered version of read(). It reads max
  * amount of data into internal rio_buf and then copies required amount
@@ -209,3 +281,22 @@ static ssize_t read_b(rio_t rp, char *userbuf, size_t num_to_read){
     return num_copied;
 
 }
+
+
+/**
+ * Block until a non-blocking fd can take more bytes, so a client that
+ * stopped reading can't hold on to the caller forever.
+ */
+static int wait_writable(int fd){
+    struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+    int rc;
+
+    while((rc = poll(&pfd, 1, RIO_WRITE_TIMEOUT_MS)) == -1 && errno == EINTR);
+
+    if(rc == 0){
+        LOG(ERROR, "fd %d wasn't writable for %dms...\n", fd, RIO_WRITE_TIMEOUT_MS);
+        return -1;
+    }
+
+    return rc == 1 && !(pfd.revents & (POLLERR | POLLNVAL)) ? 0 : -1;
+}
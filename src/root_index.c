@@ -0,0 +1,520 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "root_index_private.h"
+#include "fnv1a.h"
+#include "site_pack.h"
+#include "io_policy.h"
+#include "command_line.h"
+#include "content_coding.h"
+#include "mime.h"
+#include "log.h"
+
+static struct root_index *alloc_root_index(size_t capacity);
+static void free_root_index(struct root_index *index);
+static int walk_directory(struct root_index *index, int dir_fd, const char *uri_prefix, int depth);
+static root_index_entry *insert_entry(struct root_index *index, const char *uri);
+static const root_index_entry *find_entry(const struct root_index *index, const char *uri);
+static void link_precompressed_siblings(struct root_index *index);
+static int load_pack_entries(struct root_index *index, const char *pack, size_t pack_len);
+static int publish_root_index(struct root_index *index, const char *source, bool is_pack);
+static void wait_for_readers(unsigned long epoch);
+
+static _Atomic(struct root_index *) current_index = NULL;
+static _Atomic unsigned long current_epoch = 1;
+static root_index_reader readers[MAX_ROOT_INDEX_READERS];
+static _Atomic int num_readers = 0;
+static pthread_mutex_t build_lock = PTHREAD_MUTEX_INITIALIZER; // Only serializes builders
+static char index_source[MAX_SERVER_ROOT_LEN]; // What the current snapshot was built from
+static bool index_source_is_pack = false;
+
+static __thread int reader_idx = -1;
+static __thread struct root_index *entered_index = NULL;
+
+
+int root_index_build(const char *server_root){
+    struct root_index *index;
+    int root_fd;
+
+    if(!server_root){
+        LOG(ERROR, "Invalid server root provided for snapshot!\n");
+        return -1;
+    }
+
+    root_fd = openat(AT_FDCWD, server_root, O_RDONLY | O_DIRECTORY);
+
+    if(root_fd == -1){
+        LOG(ERROR, "Failed to open server root %s for snapshot\n", server_root);
+        return -1;
+    }
+
+    // Twice the max number of entries so probe sequences stay short
+    index = alloc_root_index(2 * MAX_ROOT_INDEX_ENTRIES);
+
+    if(!index){
+        close(root_fd);
+        return -1;
+    }
+
+    index->complete = true;
+
+    // walk_directory takes ownership of root_fd
+    if(walk_directory(index, root_fd, "", 0) != 0){
+        LOG(ERROR, "Failed to walk server root %s\n", server_root);
+        free_root_index(index);
+        return -1;
+    }
+
+    link_precompressed_siblings(index);
+
+    LOG(INFO, "Snapshot of %s holds %lu ressources%s\n",
+              server_root,
+              index->num_entries,
+              index->complete ? "" : " (incomplete, falling back on the filesystem for the rest)");
+
+    return publish_root_index(index, server_root, false);
+}
+
+
+int root_index_load_pack(const char *pack_path){
+    struct root_index *index;
+    off_t pack_len;
+    void *pack;
+    int pack_fd;
+
+    if(!pack_path){
+        LOG(ERROR, "Invalid site pack provided for snapshot!\n");
+        return -1;
+    }
+
+    pack_fd = openat(AT_FDCWD, pack_path, O_RDONLY);
+
+    // Size of the opened file, not whatever sits at pack_path by now
+    pack_len = pack_fd == -1 ? -1 : lseek(pack_fd, 0, SEEK_END);
+
+    if(pack_len < (off_t) sizeof(site_pack_header)){
+        LOG(ERROR, "Failed to open site pack %s\n", pack_path);
+        if(pack_fd != -1) close(pack_fd);
+        return -1;
+    }
+
+    // The mapping outlives the fd, the pack stays in the page cache rather than in our heap
+    pack = mmap(NULL, pack_len, PROT_READ, MAP_SHARED, pack_fd, 0);
+    close(pack_fd);
+
+    if(pack == MAP_FAILED){
+        LOG(ERROR, "Failed to map site pack %s\n", pack_path);
+        return -1;
+    }
+
+    io_policy_map(pack, pack_len);
+
+    const site_pack_header *header = (const site_pack_header *) pack;
+    size_t capacity = 2;
+
+    // Same load factor as a walked snapshot, the header is validated once the index exists
+    while(capacity < 2 * (size_t) header->num_entries && capacity < MAX_PACK_INDEX_CAPACITY){
+        capacity *= 2;
+    }
+
+    index = alloc_root_index(capacity);
+
+    if(!index){
+        munmap(pack, pack_len);
+        return -1;
+    }
+
+    index->pack = pack;
+    index->pack_len = pack_len;
+    index->complete = true;
+
+    if(load_pack_entries(index, pack, pack_len) != 0){
+        LOG(ERROR, "%s isn't a valid site pack\n", pack_path);
+        free_root_index(index);
+        return -1;
+    }
+
+    LOG(INFO, "Site pack %s holds %lu ressources%s\n",
+              pack_path,
+              index->num_entries,
+              index->complete ? "" : " (incomplete, falling back on the filesystem for the rest)");
+
+    return publish_root_index(index, pack_path, true);
+}
+
+
+int root_index_reload(){
+    char source[MAX_SERVER_ROOT_LEN];
+    bool is_pack;
+
+    pthread_mutex_lock(&build_lock);
+    strcpy(source, index_source);
+    is_pack = index_source_is_pack;
+    pthread_mutex_unlock(&build_lock);
+
+    if(source[0] == '\0'){
+        return -1;
+    }
+
+    return is_pack ? root_index_load_pack(source) : root_index_build(source);
+}
+
+
+bool root_index_enabled(){
+    return atomic_load(&current_index) != NULL;
+}
+
+
+int root_index_enter(){
+    if(reader_idx == -1){
+        int idx = atomic_load(&num_readers);
+
+        // Only claim a slot that exists, builders read num_readers
+        do{
+            if(idx >= MAX_ROOT_INDEX_READERS){
+                LOG(ERROR, "Too many threads reading the snapshot!\n");
+                return -1;
+            }
+        }while(!atomic_compare_exchange_weak(&num_readers, &idx, idx + 1));
+
+        reader_idx = idx;
+    }
+
+    // Announce first, then read the snapshot, so a concurrent builder either
+    // sees the announcement or we see its new snapshot
+    atomic_store(&readers[reader_idx].epoch, atomic_load(&current_epoch));
+    entered_index = atomic_load(&current_index);
+
+    if(!entered_index){
+        atomic_store(&readers[reader_idx].epoch, 0);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+void root_index_exit(){
+    if(reader_idx == -1 || !entered_index){
+        return;
+    }
+
+    entered_index = NULL;
+    atomic_store(&readers[reader_idx].epoch, 0);
+}
+
+
+root_index_hold_t root_index_hold(){
+    if(!entered_index){
+        return NULL;
+    }
+
+    // The builder drops its reference only once this reader left, so the snapshot is still alive
+    atomic_fetch_add(&(entered_index->refs), 1);
+    return entered_index;
+}
+
+
+void root_index_release(root_index_hold_t *hold){
+    if(!hold || !*hold) return;
+
+    if(atomic_fetch_sub(&((*hold)->refs), 1) == 1){
+        free_root_index(*hold);
+    }
+
+    *hold = NULL;
+}
+
+
+const root_index_entry *root_index_lookup(const char *uri, bool *authoritative){
+    if(authoritative){
+        *authoritative = entered_index ? entered_index->complete : false;
+    }
+
+    if(!entered_index || !uri){
+        return NULL;
+    }
+
+    return find_entry(entered_index, uri);
+}
+
+
+void root_index_destroy(){
+    pthread_mutex_lock(&build_lock);
+    struct root_index *old_index = atomic_exchange(&current_index, NULL);
+
+    wait_for_readers(atomic_fetch_add(&current_epoch, 1) + 1);
+    root_index_release(&old_index);
+    index_source[0] = '\0';
+    pthread_mutex_unlock(&build_lock);
+}
+
+
+// HELPERS //
+
+static struct root_index *alloc_root_index(size_t capacity){
+    struct root_index *index = (struct root_index *) calloc(1, sizeof(struct root_index));
+
+    if(!index){
+        return NULL;
+    }
+
+    index->entries = (root_index_entry *) calloc(capacity, sizeof(root_index_entry));
+
+    if(!index->entries){
+        free(index);
+        return NULL;
+    }
+
+    index->capacity = capacity;
+    atomic_init(&(index->refs), 1);
+    return index;
+}
+
+
+static void free_root_index(struct root_index *index){
+    if(!index) return;
+
+    for(size_t i = 0; i < index->capacity; i++){
+        if(index->entries[i].uri[0] != '\0' && index->entries[i].fd != -1){
+            close(index->entries[i].fd);
+        }
+    }
+
+    if(index->pack){
+        munmap(index->pack, index->pack_len);
+    }
+
+    free(index->entries);
+    free(index);
+}
+
+
+/**
+ * @brief Add every regular file under dir_fd to the index, recursing into subdirectories.
+ *
+ * @note Takes ownership of dir_fd. Ressources that can't be added (uri too long,
+ *       index full, ...) mark the index incomplete rather than failing the walk.
+ */
+static int walk_directory(struct root_index *index, int dir_fd, const char *uri_prefix, int depth){
+    char uri[MAX_URI_LEN];
+    struct stat info;
+    struct dirent *dir_entry;
+    DIR *dir = fdopendir(dir_fd);
+
+    if(!dir){
+        close(dir_fd);
+        return -1;
+    }
+
+    while((dir_entry = readdir(dir))){
+        if(strcmp(dir_entry->d_name, ".") == 0 || strcmp(dir_entry->d_name, "..") == 0){
+            continue;
+        }
+
+        else if(snprintf(uri, MAX_URI_LEN, "%s/%s", uri_prefix, dir_entry->d_name) >= MAX_URI_LEN){
+            index->complete = false;
+            continue;
+        }
+
+        else if(fstatat(dirfd(dir), dir_entry->d_name, &info, 0) != 0){
+            index->complete = false;
+            continue;
+        }
+
+        if(S_ISDIR(info.st_mode)){
+            int sub_dir_fd = depth + 1 < MAX_ROOT_INDEX_DEPTH ? openat(dirfd(dir), dir_entry->d_name, O_RDONLY | O_DIRECTORY) : -1;
+
+            if(sub_dir_fd == -1 || walk_directory(index, sub_dir_fd, uri, depth + 1) != 0){
+                LOG(WARNING, "Could not add %s to snapshot\n", uri);
+                index->complete = false;
+            }
+            continue;
+        }
+
+        else if(!S_ISREG(info.st_mode)){
+            continue;
+        }
+
+        root_index_entry *entry = insert_entry(index, uri);
+
+        if(!entry){
+            index->complete = false;
+            continue;
+        }
+
+        const char *content_type = get_mime_type(uri);
+
+        // Unreadable ressources are kept (with no fd) so they're still reported as such
+        entry->fd = openat(dirfd(dir), dir_entry->d_name, O_RDONLY);
+        entry->data = NULL;
+        entry->info = info;
+        strncpy(entry->content_type, content_type ? content_type : DEFAULT_CONTENT_TYPE, MAX_RES_TYPE_LEN-1);
+    }
+
+    closedir(dir);
+    return 0;
+}
+
+
+static root_index_entry *insert_entry(struct root_index *index, const char *uri){
+    if(index->num_entries >= index->capacity / 2){
+        return NULL;
+    }
+
+    for(uint32_t slot = fnv1a(uri); ; slot++){
+        root_index_entry *entry = &index->entries[slot & (index->capacity - 1)];
+
+        if(entry->uri[0] == '\0'){
+            strcpy(entry->uri, uri);
+            index->num_entries++;
+            return entry;
+        }
+    }
+}
+
+
+static const root_index_entry *find_entry(const struct root_index *index, const char *uri){
+    uint32_t slot = fnv1a(uri);
+
+    for(size_t probes = 0; probes < index->capacity; probes++, slot++){
+        const root_index_entry *entry = &index->entries[slot & (index->capacity - 1)];
+
+        if(entry->uri[0] == '\0'){
+            return NULL;
+        }
+
+        else if(strcmp(entry->uri, uri) == 0){
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Record which ressources have an up to date precompressed sibling in the snapshot.
+ */
+static void link_precompressed_siblings(struct root_index *index){
+    char sibling_uri[MAX_URI_LEN + MAX_CODING_NAME_LEN];
+
+    for(size_t i = 0; i < index->capacity; i++){
+        root_index_entry *entry = &index->entries[i];
+
+        if(entry->uri[0] == '\0'){
+            continue;
+        }
+
+        for(content_coding coding = CODING_IDENTITY + 1; coding < CODING_CONTENT_CODING_MAX; coding++){
+            if(strlen(content_coding_extension(coding)) == 0){
+                continue;
+            }
+
+            snprintf(sibling_uri, sizeof(sibling_uri), "%s%s", entry->uri, content_coding_extension(coding));
+            const root_index_entry *sibling = find_entry(index, sibling_uri);
+
+            if(sibling && sibling->fd != -1 && sibling->info.st_mtime >= entry->info.st_mtime){
+                entry->precompressed |= CODING_MASK(coding);
+            }
+        }
+    }
+}
+
+
+/**
+ * @brief Validate a mapped site pack and add its ressources to the index.
+ *
+ * @note Entries point into the pack, they have no fd of their own.
+ */
+static int load_pack_entries(struct root_index *index, const char *pack, size_t pack_len){
+    const site_pack_header *header = (const site_pack_header *) pack;
+
+    if(memcmp(header->magic, SITE_PACK_MAGIC, sizeof(SITE_PACK_MAGIC)) != 0 || header->version != SITE_PACK_VERSION){
+        return -1;
+    }
+
+    else if(header->pack_size != pack_len || header->index_offset > pack_len ||
+            header->num_entries > (pack_len - header->index_offset) / sizeof(site_pack_entry)){
+        return -1;
+    }
+
+    const site_pack_entry *pack_entries = (const site_pack_entry *) (pack + header->index_offset);
+
+    for(uint32_t i = 0; i < header->num_entries; i++){
+        const site_pack_entry *pack_entry = &pack_entries[i];
+
+        if(strnlen(pack_entry->uri, SITE_PACK_MAX_URI_LEN) == SITE_PACK_MAX_URI_LEN ||
+           strnlen(pack_entry->content_type, SITE_PACK_MAX_TYPE_LEN) == SITE_PACK_MAX_TYPE_LEN ||
+           pack_entry->offset > pack_len || pack_entry->size > pack_len - pack_entry->offset){
+            return -1;
+        }
+
+        root_index_entry *entry = strlen(pack_entry->uri) < MAX_URI_LEN ? insert_entry(index, pack_entry->uri) : NULL;
+
+        if(!entry){
+            index->complete = false;
+            continue;
+        }
+
+        entry->fd = -1;
+        entry->data = pack + pack_entry->offset;
+        entry->info.st_mode = S_IFREG | 0444;
+        entry->info.st_size = pack_entry->size;
+        entry->info.st_mtime = pack_entry->mtime;
+        entry->info.st_ino = pack_entry->ino;
+        entry->precompressed = pack_entry->precompressed;
+        strncpy(entry->content_type, pack_entry->content_type, MAX_RES_TYPE_LEN-1);
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Replace the current snapshot with index and remember where it came from.
+ *
+ * @return int number of ressources in the new snapshot.
+ */
+static int publish_root_index(struct root_index *index, const char *source, bool is_pack){
+    struct root_index *old_index;
+    int num_entries = (int) index->num_entries;
+
+    pthread_mutex_lock(&build_lock);
+    old_index = atomic_exchange(&current_index, index);
+
+    // Readers that entered before the exchange announced an older epoch, responses
+    // still sending from the old snapshot hold it and free it once they're done
+    wait_for_readers(atomic_fetch_add(&current_epoch, 1) + 1);
+    root_index_release(&old_index);
+
+    strncpy(index_source, source, MAX_SERVER_ROOT_LEN-1);
+    index_source_is_pack = is_pack;
+    pthread_mutex_unlock(&build_lock);
+
+    return num_entries;
+}
+
+
+/**
+ * @brief Wait until every reader is either idle or entered at (or after) epoch.
+ */
+static void wait_for_readers(unsigned long epoch){
+    int num_active_readers = atomic_load(&num_readers);
+
+    for(int i = 0; i < num_active_readers && i < MAX_ROOT_INDEX_READERS; i++){
+        unsigned long reader_epoch;
+
+        while((reader_epoch = atomic_load(&readers[i].epoch)) != 0 && reader_epoch < epoch){
+            usleep(ROOT_INDEX_GRACE_POLL_US);
+        }
+    }
+}
+
+
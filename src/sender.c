@@ -0,0 +1,401 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "sender_private.h"
+#include "io_policy.h"
+#include "metrics.h"
+#include "rate_limit.h"
+#include "log.h"
+#include "trace.h"
+
+static void *run_sender_thread(void *args);
+static void finish_job(sender_thread *thread, struct _send_job *job);
+static void arm_submitted_jobs(sender_thread *thread, unsigned long now_ms);
+static void expire_job(wheel_timer *timer, void *args);
+static void drop_jobs(sender_thread *thread);
+static void log_job_access(struct _send_job *job);
+static size_t bytes_left(const struct _send_job *job);
+static void release_file(int in_fd, root_index_hold_t *snapshot);
+static unsigned long now_ms();
+
+static sender_thread threads[MAX_SENDER_THREADS];
+static int num_threads = 0;
+static _Atomic unsigned int next_thread = 0;
+static _Atomic bool running = false;
+static unsigned long drain_deadline_ms;
+
+
+int sender_pool_init(int num_sender_threads){
+    if(num_sender_threads <= 0 || num_sender_threads > MAX_SENDER_THREADS){
+        LOG(ERROR, "Invalid number of sender threads %d!\n", num_sender_threads);
+        return -1;
+    }
+
+    memset(threads, 0, sizeof(threads));
+    atomic_store(&running, true);
+
+    for(num_threads = 0; num_threads < num_sender_threads; num_threads++){
+        sender_thread *thread = &threads[num_threads];
+
+        thread->epoll_fd = epoll_create1(0);
+        thread->wheel = timer_wheel_init(now_ms(), SENDER_TICK_MS);
+        pthread_mutex_init(&(thread->lock), NULL);
+
+        if(thread->epoll_fd == -1 || !thread->wheel || pthread_create(&(thread->tid), NULL, run_sender_thread, thread) != 0){
+            LOG(ERROR, "Failed to start sender thread %d\n", num_threads);
+            if(thread->epoll_fd != -1) close(thread->epoll_fd);
+            timer_wheel_destroy(&(thread->wheel));
+            sender_pool_destroy();
+            return -1;
+        }
+    }
+
+    LOG(DEBUG, "Started %d sender threads\n", num_threads);
+    return 0;
+}
+
+
+send_job_t send_job_create(int client_fd, const char *head, size_t head_len, int in_fd, off_t offset, size_t num_bytes, root_index_hold_t snapshot){
+    head_len = head ? head_len : 0;
+
+    // The head lives right after the job, one allocation per response
+    send_job_t job = (send_job_t) malloc(sizeof(struct _send_job) + head_len);
+
+    if(!job){
+        LOG(ERROR, "Failed to prepare send job for fd %d\n", client_fd);
+        release_file(in_fd, &snapshot);
+        return NULL;
+    }
+
+    memset(job, 0, sizeof(struct _send_job));
+    job->client_fd = client_fd;
+    job->head_len = head_len;
+    job->snapshot = snapshot;
+
+    if(head_len != 0){
+        memcpy(job->head, head, head_len);
+    }
+    job->file_len = in_fd == -1 ? 0 : num_bytes;
+    sendfile_op_init(&(job->file), client_fd, in_fd, offset, job->file_len, SENDFILE_CHUNK_SIZE);
+    io_policy_before_send(in_fd, offset, job->file_len);
+
+    return job;
+}
+
+
+void send_job_log_access(send_job_t job, const access_log_entry *entry, unsigned long picked_up_ns){
+    if(!job || !entry) return;
+
+    job->logs_access = true;
+    job->access = *entry;
+    job->picked_up_ns = picked_up_ns;
+
+    snprintf(job->client_addr, sizeof(job->client_addr), "%s", entry->client_addr ? entry->client_addr : "");
+    snprintf(job->uri, sizeof(job->uri), "%s", entry->uri ? entry->uri : "-");
+    snprintf(job->version, sizeof(job->version), "%s", entry->version ? entry->version : "-");
+    job->access.client_addr = job->client_addr;
+    job->access.uri = job->uri;
+    job->access.version = job->version;
+}
+
+
+sendfile_status send_job_resume(send_job_t job){
+    while(job->head_sent < job->head_len){
+        ssize_t bytes_written = send(job->client_fd, job->head + job->head_sent, job->head_len - job->head_sent, MSG_NOSIGNAL);
+
+        if(bytes_written == -1 && errno == EINTR){
+            continue;
+        }
+
+        else if(bytes_written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+            return SENDFILE_BLOCKED;
+        }
+
+        else if(bytes_written == -1){
+            LOG(ERROR, "Failed to send headers to fd %d: %s\n", job->client_fd, strerror(errno));
+            return SENDFILE_ERROR;
+        }
+
+        job->head_sent += bytes_written;
+    }
+
+    if(job->file.remaining == 0){
+        return SENDFILE_DONE;
+    }
+
+    sendfile_status status = sendfile_op_resume(&(job->file));
+
+    if(status == SENDFILE_DONE){
+        io_policy_after_send(job->file.in_fd, job->file.offset - job->file_len, job->file_len);
+    }
+
+    return status;
+}
+
+
+void send_job_destroy(send_job_t *job){
+    if(!job || !(*job)) return;
+
+    release_file((*job)->file.in_fd, &((*job)->snapshot));
+    free(*job);
+    *job = NULL;
+}
+
+
+bool sender_pool_running(){
+    return atomic_load(&running) && num_threads != 0;
+}
+
+
+int sender_submit(send_job_t job){
+    struct epoll_event event = {.events = EPOLLOUT | EPOLLONESHOT, .data.ptr = job};
+
+    if(!job || !sender_pool_running()){
+        return -1;
+    }
+
+    sender_thread *thread = &threads[atomic_fetch_add(&next_thread, 1) % num_threads];
+
+    // The sender thread arms the progress timers of submitted jobs under the lock
+    // before handling their events, so it can't see the job before it's fully submitted
+    pthread_mutex_lock(&(thread->lock));
+
+    if(epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, job->client_fd, &event) != 0){
+        pthread_mutex_unlock(&(thread->lock));
+        LOG(ERROR, "Failed to hand fd %d over to a sender thread\n", job->client_fd);
+        return -1;
+    }
+
+    job->prev = NULL;
+    job->next = thread->jobs;
+    if(thread->jobs) thread->jobs->prev = job;
+    thread->jobs = job;
+    thread->num_jobs++;
+    job->next_submitted = thread->submitted;
+    thread->submitted = job;
+    pthread_mutex_unlock(&(thread->lock));
+
+    return 0;
+}
+
+
+void sender_pool_destroy(){
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += SENDER_DRAIN_TIMEOUT_MS / 1000;
+    sender_pool_destroy_by(&deadline);
+}
+
+
+void sender_pool_destroy_by(const struct timespec *deadline){
+    unsigned long deadline_ms = deadline->tv_sec * 1000UL + deadline->tv_nsec / 1000000;
+
+    drain_deadline_ms = now_ms() + SENDER_DRAIN_TIMEOUT_MS;
+
+    if(deadline_ms < drain_deadline_ms){
+        drain_deadline_ms = deadline_ms;
+    }
+
+    atomic_store(&running, false);
+
+    for(int i = 0; i < num_threads; i++){
+        pthread_join(threads[i].tid, NULL);
+        close(threads[i].epoll_fd);
+        timer_wheel_destroy(&(threads[i].wheel));
+        pthread_mutex_destroy(&(threads[i].lock));
+    }
+
+    num_threads = 0;
+}
+
+
+// HELPERS //
+
+static void *run_sender_thread(void *args){
+    sender_thread *thread = (sender_thread *) args;
+    struct epoll_event events[SENDER_MAX_EVENTS];
+
+    while(1){
+        bool stopping = !atomic_load(&running);
+        int timeout_ms = timer_wheel_next_timeout_ms(thread->wheel, now_ms());
+
+        if(timeout_ms == -1 || timeout_ms > (stopping ? 100 : SENDER_POLL_INTERVAL_MS)){
+            timeout_ms = stopping ? 100 : SENDER_POLL_INTERVAL_MS;
+        }
+
+        int num_events = epoll_wait(thread->epoll_fd, events, SENDER_MAX_EVENTS, timeout_ms);
+        unsigned long now = now_ms();
+
+        arm_submitted_jobs(thread, now);
+
+        for(int i = 0; i < num_events; i++){
+            struct _send_job *job = (struct _send_job *) events[i].data.ptr;
+            size_t left = bytes_left(job);
+            sendfile_status status = send_job_resume(job);
+
+            if(status == SENDFILE_DONE || status == SENDFILE_ERROR){
+                finish_job(thread, job);
+                continue;
+            }
+
+            // Progress pushes the timeout back
+            if(bytes_left(job) != left){
+                timer_wheel_arm(thread->wheel, &(job->progress_timer), now + RIO_WRITE_TIMEOUT_MS);
+            }
+
+            // One chunk per turn, jobs that can take more get back in line behind the others
+            struct epoll_event event = {.events = EPOLLOUT | EPOLLONESHOT, .data.ptr = job};
+
+            if(epoll_ctl(thread->epoll_fd, EPOLL_CTL_MOD, job->client_fd, &event) != 0){
+                finish_job(thread, job);
+            }
+        }
+
+        if(stopping && now_ms() >= drain_deadline_ms){
+            drop_jobs(thread);
+        }
+
+        else {
+            timer_wheel_advance(thread->wheel, now_ms(), expire_job, thread);
+        }
+
+        pthread_mutex_lock(&(thread->lock));
+        bool idle = thread->num_jobs == 0;
+        pthread_mutex_unlock(&(thread->lock));
+
+        if(stopping && idle){
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Forget a job, close its client fd and free it.
+ */
+static void finish_job(sender_thread *thread, struct _send_job *job){
+    epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL, job->client_fd, NULL);
+    timer_wheel_cancel(thread->wheel, &(job->progress_timer));
+
+    pthread_mutex_lock(&(thread->lock));
+    if(job->prev) job->prev->next = job->next;
+    else thread->jobs = job->next;
+    if(job->next) job->next->prev = job->prev;
+    thread->num_jobs--;
+    pthread_mutex_unlock(&(thread->lock));
+
+    if(bytes_left(job) != 0){
+        LOG(WARNING, "Dropping fd %d with %luB left to send\n", job->client_fd, bytes_left(job));
+    }
+
+    shutdown(job->client_fd, SHUT_WR);
+    rate_limit_release(job->client_fd);
+    close(job->client_fd);
+    metrics_count_connection(false);
+    TRACE(close, job->client_fd, bytes_left(job));
+    log_job_access(job);
+    send_job_destroy(&job);
+}
+
+
+/**
+ * @brief Start the progress timeouts of the jobs submitted since the last call.
+ */
+static void arm_submitted_jobs(sender_thread *thread, unsigned long now_ms){
+    struct _send_job *job;
+
+    pthread_mutex_lock(&(thread->lock));
+
+    for(job = thread->submitted; job; job = job->next_submitted){
+        job->progress_timer.data = job;
+        timer_wheel_arm(thread->wheel, &(job->progress_timer), now_ms + RIO_WRITE_TIMEOUT_MS);
+    }
+
+    thread->submitted = NULL;
+    pthread_mutex_unlock(&(thread->lock));
+}
+
+
+/**
+ * @brief Drop the job of a client that stopped reading.
+ */
+static void expire_job(wheel_timer *timer, void *args){
+    struct _send_job *job = (struct _send_job *) timer->data;
+
+    LOG(ERROR, "fd %d didn't take anything for %dms...\n", job->client_fd, RIO_WRITE_TIMEOUT_MS);
+    finish_job((sender_thread *) args, job);
+}
+
+
+/**
+ * @brief Drop every job, once they had their time to drain.
+ */
+static void drop_jobs(sender_thread *thread){
+    struct _send_job *job;
+    struct _send_job *next;
+
+    arm_submitted_jobs(thread, now_ms());
+
+    pthread_mutex_lock(&(thread->lock));
+    job = thread->jobs;
+    pthread_mutex_unlock(&(thread->lock));
+
+    // Only this thread removes jobs, and new ones are pushed in front of the ones being dropped
+    for(; job; job = next){
+        pthread_mutex_lock(&(thread->lock));
+        next = job->next;
+        pthread_mutex_unlock(&(thread->lock));
+
+        finish_job(thread, job);
+    }
+}
+
+
+/**
+ * @brief Log a response a sender thread is done with, as far as it got.
+ */
+static void log_job_access(struct _send_job *job){
+    if(!job->logs_access || !access_log_enabled()){
+        return;
+    }
+
+    job->access.bytes_sent = job->file_len - job->file.remaining;
+    job->access.duration_us = (metrics_now_ns() - job->picked_up_ns) / 1000;
+    access_log_write(&(job->access));
+}
+
+
+static size_t bytes_left(const struct _send_job *job){
+    return job->file.remaining + job->head_len - job->head_sent;
+}
+
+
+/**
+ * @brief Release the file of a job, closing it unless it belongs to a snapshot.
+ */
+static void release_file(int in_fd, root_index_hold_t *snapshot){
+    if(*snapshot){
+        root_index_release(snapshot);
+    }
+
+    else if(in_fd != -1){
+        close(in_fd);
+    }
+}
+
+
+static unsigned long now_ms(){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000UL + now.tv_nsec / 1000000;
+}
@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "site_pack.h"
+#include "content_coding.h"
+#include "compression.h"
+#include "command_line.h"
+#include "mime.h"
+#include "rio.h"
+#include "log.h"
+
+#define MAX_PACK_DEPTH 16
+#define PACK_COPY_CHUNK_SIZE (64 * 1024)
+#define ALIGN_UP(value, alignment) (((value) + (alignment) - 1) / (alignment) * (alignment))
+
+typedef struct pack_item {
+    site_pack_entry entry;
+    char path[MAX_SERVER_ROOT_LEN + SITE_PACK_MAX_URI_LEN]; /**< File to copy the payload from, unused when data is set. */
+    char *data;                                             /**< Generated payload (eg: gzip variant). */
+} pack_item;
+
+typedef struct pack_items {
+    pack_item *items;
+    size_t num_items;
+    size_t capacity;
+} pack_items;
+
+static int collect_files(pack_items *items, const char *dir_path, const char *uri_prefix, int depth);
+static pack_item *add_item(pack_items *items, const char *uri);
+static int add_gzip_variants(pack_items *items);
+static void link_precompressed_siblings(pack_items *items);
+static pack_item *find_item(pack_items *items, const char *uri);
+static int compare_items(const void *a, const void *b);
+static int write_pack(pack_items *items, int pack_fd);
+static int copy_file(int pack_fd, const pack_item *item);
+static void free_items(pack_items *items);
+
+
+int site_pack_write(const char *server_root, const char *pack_path, bool gzip_variants){
+    char tmp_path[MAX_SERVER_ROOT_LEN + 10];
+    pack_items items = {0};
+    int pack_fd;
+    int num_entries;
+
+    if(!server_root || !pack_path || strlen(pack_path) >= MAX_SERVER_ROOT_LEN){
+        LOG(ERROR, "Invalid input for writing site pack!\n");
+        return -1;
+    }
+
+    else if(collect_files(&items, server_root, "", 0) != 0){
+        LOG(ERROR, "Failed to walk %s\n", server_root);
+        free_items(&items);
+        return -1;
+    }
+
+    qsort(items.items, items.num_items, sizeof(pack_item), compare_items);
+
+    if(gzip_variants && add_gzip_variants(&items) != 0){
+        free_items(&items);
+        return -1;
+    }
+
+    link_precompressed_siblings(&items);
+
+    // Write next to the destination and rename, so a server reloading the pack never sees it half written
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", pack_path);
+    pack_fd = openat(AT_FDCWD, tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if(pack_fd == -1){
+        LOG(ERROR, "Failed to create %s\n", tmp_path);
+        free_items(&items);
+        return -1;
+    }
+
+    if(write_pack(&items, pack_fd) != 0 || fsync(pack_fd) != 0 || rename(tmp_path, pack_path) != 0){
+        LOG(ERROR, "Failed to write %s\n", pack_path);
+        close(pack_fd);
+        unlink(tmp_path);
+        free_items(&items);
+        return -1;
+    }
+
+    close(pack_fd);
+    num_entries = (int) items.num_items;
+    free_items(&items);
+
+    LOG(INFO, "Packed %d ressources from %s into %s\n", num_entries, server_root, pack_path);
+    return num_entries;
+}
+
+
+// HELPERS //
+
+static int collect_files(pack_items *items, const char *dir_path, const char *uri_prefix, int depth){
+    char path[MAX_SERVER_ROOT_LEN + SITE_PACK_MAX_URI_LEN];
+    char uri[SITE_PACK_MAX_URI_LEN];
+    struct stat info;
+    struct dirent *dir_entry;
+    DIR *dir = opendir(dir_path);
+
+    if(!dir){
+        return -1;
+    }
+
+    while((dir_entry = readdir(dir))){
+        if(strcmp(dir_entry->d_name, ".") == 0 || strcmp(dir_entry->d_name, "..") == 0){
+            continue;
+        }
+
+        else if(snprintf(uri, sizeof(uri), "%s/%s", uri_prefix, dir_entry->d_name) >= sizeof(uri) ||
+                snprintf(path, sizeof(path), "%s/%s", dir_path, dir_entry->d_name) >= sizeof(path)){
+            LOG(WARNING, "Skipping %s/%s, its path is too long\n", uri_prefix, dir_entry->d_name);
+            continue;
+        }
+
+        else if(stat(path, &info) != 0){
+            LOG(WARNING, "Skipping %s, can't get its metadata\n", path);
+            continue;
+        }
+
+        if(S_ISDIR(info.st_mode)){
+            if(depth + 1 >= MAX_PACK_DEPTH || collect_files(items, path, uri, depth + 1) != 0){
+                LOG(WARNING, "Skipping %s\n", path);
+            }
+            continue;
+        }
+
+        else if(!S_ISREG(info.st_mode)){
+            continue;
+        }
+
+        pack_item *item = add_item(items, uri);
+
+        if(!item){
+            closedir(dir);
+            return -1;
+        }
+
+        const char *content_type = get_mime_type(uri);
+
+        strcpy(item->path, path);
+        strncpy(item->entry.content_type, content_type ? content_type : DEFAULT_CONTENT_TYPE, SITE_PACK_MAX_TYPE_LEN-1);
+        item->entry.size = info.st_size;
+        item->entry.mtime = info.st_mtime;
+        item->entry.ino = info.st_ino;
+    }
+
+    closedir(dir);
+    return 0;
+}
+
+
+static pack_item *add_item(pack_items *items, const char *uri){
+    if(items->num_items == items->capacity){
+        size_t capacity = items->capacity ? 2 * items->capacity : 64;
+        pack_item *tmp = (pack_item *) realloc(items->items, capacity * sizeof(pack_item));
+
+        if(!tmp){
+            LOG(ERROR, "Failed to allocate pack index\n");
+            return NULL;
+        }
+
+        items->items = tmp;
+        items->capacity = capacity;
+    }
+
+    pack_item *item = &items->items[items->num_items++];
+
+    memset(item, 0, sizeof(pack_item));
+    strncpy(item->entry.uri, uri, SITE_PACK_MAX_URI_LEN-1);
+    return item;
+}
+
+
+/**
+ * @brief Compress the ressources selected by the compression config that don't
+ *        have a gzip sibling yet. Items must be sorted, and are sorted again after.
+ */
+static int add_gzip_variants(pack_items *items){
+    char gzip_uri[SITE_PACK_MAX_URI_LEN + MAX_CODING_NAME_LEN];
+    size_t num_files = items->num_items;
+
+    for(size_t i = 0; i < num_files; i++){
+        pack_item file = items->items[i]; // Copy, add_item may move items around
+        char *data;
+        size_t data_len;
+
+        snprintf(gzip_uri, sizeof(gzip_uri), "%s%s", file.entry.uri, content_coding_extension(CODING_GZIP));
+
+        if(strlen(gzip_uri) >= SITE_PACK_MAX_URI_LEN || find_item(items, gzip_uri)){
+            continue;
+        }
+
+        else if(!compression_applies(file.entry.content_type, file.entry.size)){
+            continue;
+        }
+
+        int fd = openat(AT_FDCWD, file.path, O_RDONLY);
+
+        if(fd == -1 || compress_to_buffer(fd, file.entry.size, CODING_GZIP, &data, &data_len) != 0){
+            LOG(WARNING, "Failed to compress %s, packing it without a gzip variant\n", file.path);
+            if(fd != -1) close(fd);
+            continue;
+        }
+
+        close(fd);
+
+        pack_item *variant = add_item(items, gzip_uri);
+
+        if(!variant){
+            free(data);
+            return -1;
+        }
+
+        strcpy(variant->entry.content_type, file.entry.content_type);
+        variant->entry.size = data_len;
+        variant->entry.mtime = file.entry.mtime;
+        variant->entry.ino = file.entry.ino;
+        variant->data = data;
+    }
+
+    qsort(items->items, items->num_items, sizeof(pack_item), compare_items);
+    return 0;
+}
+
+
+static void link_precompressed_siblings(pack_items *items){
+    char sibling_uri[SITE_PACK_MAX_URI_LEN + MAX_CODING_NAME_LEN];
+
+    for(size_t i = 0; i < items->num_items; i++){
+        site_pack_entry *entry = &items->items[i].entry;
+
+        for(content_coding coding = CODING_IDENTITY + 1; coding < CODING_CONTENT_CODING_MAX; coding++){
+            if(strlen(content_coding_extension(coding)) == 0){
+                continue;
+            }
+
+            snprintf(sibling_uri, sizeof(sibling_uri), "%s%s", entry->uri, content_coding_extension(coding));
+            pack_item *sibling = find_item(items, sibling_uri);
+
+            if(sibling && sibling->entry.mtime >= entry->mtime){
+                entry->precompressed |= CODING_MASK(coding);
+            }
+        }
+    }
+}
+
+
+static pack_item *find_item(pack_items *items, const char *uri){
+    pack_item key;
+
+    if(strlen(uri) >= SITE_PACK_MAX_URI_LEN){
+        return NULL;
+    }
+
+    strcpy(key.entry.uri, uri);
+    return (pack_item *) bsearch(&key, items->items, items->num_items, sizeof(pack_item), compare_items);
+}
+
+
+static int compare_items(const void *a, const void *b){
+    return strcmp(((const pack_item *) a)->entry.uri, ((const pack_item *) b)->entry.uri);
+}
+
+
+static int write_pack(pack_items *items, int pack_fd){
+    site_pack_header header;
+    uint64_t offset = ALIGN_UP(sizeof(site_pack_header) + items->num_items * sizeof(site_pack_entry), SITE_PACK_ALIGNMENT);
+
+    for(size_t i = 0; i < items->num_items; i++){
+        site_pack_entry *entry = &items->items[i].entry;
+
+        entry->offset = offset;
+        offset = ALIGN_UP(offset + entry->size, SITE_PACK_ALIGNMENT);
+
+        if(pwrite(pack_fd, entry, sizeof(site_pack_entry), sizeof(site_pack_header) + i * sizeof(site_pack_entry)) != sizeof(site_pack_entry)){
+            return -1;
+        }
+
+        else if(items->items[i].data){
+            if(pwrite(pack_fd, items->items[i].data, entry->size, entry->offset) != entry->size){
+                return -1;
+            }
+        }
+
+        else if(copy_file(pack_fd, &items->items[i]) != 0){
+            return -1;
+        }
+    }
+
+    if(ftruncate(pack_fd, offset) != 0){
+        return -1;
+    }
+
+    // Header last, a pack without a valid header is never loaded
+    memset(&header, 0, sizeof(site_pack_header));
+    strcpy(header.magic, SITE_PACK_MAGIC);
+    header.version = SITE_PACK_VERSION;
+    header.num_entries = items->num_items;
+    header.index_offset = sizeof(site_pack_header);
+    header.pack_size = offset;
+
+    return pwrite(pack_fd, &header, sizeof(site_pack_header), 0) == sizeof(site_pack_header) ? 0 : -1;
+}
+
+
+static int copy_file(int pack_fd, const pack_item *item){
+    char buf[PACK_COPY_CHUNK_SIZE];
+    uint64_t copied = 0;
+    int fd = openat(AT_FDCWD, item->path, O_RDONLY);
+
+    if(fd == -1){
+        LOG(ERROR, "Failed to open %s\n", item->path);
+        return -1;
+    }
+
+    while(copied < item->entry.size){
+        ssize_t bytes_read = pread(fd, buf, min(PACK_COPY_CHUNK_SIZE, item->entry.size - copied), copied);
+
+        if(bytes_read <= 0 || pwrite(pack_fd, buf, bytes_read, item->entry.offset + copied) != bytes_read){
+            LOG(ERROR, "Failed to copy %s, did it change while packing?\n", item->path);
+            close(fd);
+            return -1;
+        }
+
+        copied += bytes_read;
+    }
+
+    close(fd);
+    return 0;
+}
+
+
+static void free_items(pack_items *items){
+    for(size_t i = 0; i < items->num_items; i++){
+        free(items->items[i].data);
+    }
+
+    free(items->items);
+    items->items = NULL;
+    items->num_items = items->capacity = 0;
+}
@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#include <limits.h>
+#include "timer_wheel.h"
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define MAX_TIMER_WHEEL_TICKS (1UL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+
+/**
+ * This struct is for internal use only.
+ */
+struct _timer_wheel {
+    unsigned long start_ms;     /**< Time of tick 0. */
+    unsigned int tick_ms;
+    unsigned long now;          /**< Next tick to process. */
+    size_t num_timers;
+    wheel_timer slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]; /**< Heads of circular lists of timers. */
+};
+
+/*Forward Declarations*/
+static void add_timer(timer_wheel_t wheel, wheel_timer *timer);
+static void cascade(timer_wheel_t wheel, int level, int slot);
+static void unlink_timer(wheel_timer *timer);
+static void init_list(wheel_timer *head);
+static bool list_empty(const wheel_timer *head);
+
+
+timer_wheel_t timer_wheel_init(unsigned long now_ms, unsigned int tick_ms){
+    timer_wheel_t wheel;
+
+    if(tick_ms == 0 || !(wheel = (timer_wheel_t) calloc(1, sizeof(struct _timer_wheel)))){
+        return NULL;
+    }
+
+    wheel->start_ms = now_ms;
+    wheel->tick_ms = tick_ms;
+
+    for(int level = 0; level < TIMER_WHEEL_LEVELS; level++){
+        for(int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++){
+            init_list(&(wheel->slots[level][slot]));
+        }
+    }
+
+    return wheel;
+}
+
+
+void timer_wheel_destroy(timer_wheel_t *wheel){
+    if(!wheel) return;
+
+    free(*wheel);
+    *wheel = NULL;
+}
+
+
+void timer_wheel_arm(timer_wheel_t wheel, wheel_timer *timer, unsigned long deadline_ms){
+    timer_wheel_cancel(wheel, timer);
+
+    // Rounded up, a timer may fire late but never early
+    timer->expires = deadline_ms <= wheel->start_ms ? 0 : (deadline_ms - wheel->start_ms + wheel->tick_ms - 1) / wheel->tick_ms;
+    add_timer(wheel, timer);
+    wheel->num_timers++;
+}
+
+
+void timer_wheel_cancel(timer_wheel_t wheel, wheel_timer *timer){
+    if(!timer_armed(timer)) return;
+
+    unlink_timer(timer);
+    wheel->num_timers--;
+}
+
+
+bool timer_armed(const wheel_timer *timer){
+    return timer->prev != NULL;
+}
+
+
+int timer_wheel_advance(timer_wheel_t wheel, unsigned long now_ms, timer_expired_fn on_expired, void *args){
+    unsigned long target = now_ms <= wheel->start_ms ? 0 : (now_ms - wheel->start_ms) / wheel->tick_ms;
+    wheel_timer expired;
+    int num_fired = 0;
+
+    while(wheel->now <= target){
+        // Nothing to cascade nor fire, skip straight to the target
+        if(wheel->num_timers == 0){
+            wheel->now = target + 1;
+            break;
+        }
+
+        int slot = wheel->now & TIMER_WHEEL_MASK;
+
+        // Once the lowest level wraps, bring the next slot of each level above down a level
+        for(int level = 1; slot == 0 && level < TIMER_WHEEL_LEVELS; level++){
+            int level_slot = (wheel->now >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+
+            cascade(wheel, level, level_slot);
+
+            if(level_slot != 0){
+                break;
+            }
+        }
+
+        // Take the whole slot first, timers re-armed by on_expired land in later ticks
+        init_list(&expired);
+
+        if(!list_empty(&(wheel->slots[0][slot]))){
+            expired.next = wheel->slots[0][slot].next;
+            expired.prev = wheel->slots[0][slot].prev;
+            expired.next->prev = &expired;
+            expired.prev->next = &expired;
+            init_list(&(wheel->slots[0][slot]));
+        }
+
+        wheel->now++;
+
+        while(!list_empty(&expired)){
+            wheel_timer *timer = expired.next;
+
+            unlink_timer(timer);
+            wheel->num_timers--;
+            num_fired++;
+            on_expired(timer, args);
+        }
+    }
+
+    return num_fired;
+}
+
+
+int timer_wheel_next_timeout_ms(timer_wheel_t wheel, unsigned long now_ms){
+    unsigned long tick = wheel->now;
+
+    if(wheel->num_timers == 0){
+        return -1;
+    }
+
+    // Look for the next timer due at the lowest level, up to where timers may cascade down
+    for(int i = 0; i < TIMER_WHEEL_SLOTS; i++, tick++){
+        if(list_empty(&(wheel->slots[0][tick & TIMER_WHEEL_MASK])) && (i == 0 || (tick & TIMER_WHEEL_MASK) != 0)){
+            continue;
+        }
+
+        break;
+    }
+
+    unsigned long due_ms = wheel->start_ms + tick * wheel->tick_ms;
+
+    if(due_ms <= now_ms){
+        return 0;
+    }
+
+    return due_ms - now_ms > INT_MAX ? INT_MAX : (int) (due_ms - now_ms);
+}
+
+
+size_t get_timer_wheel_size(timer_wheel_t wheel){
+    return wheel->num_timers;
+}
+
+
+// HELPERS //
+
+/**
+ * @brief Link a timer in the slot its expiry falls in, relative to the current tick.
+ */
+static void add_timer(timer_wheel_t wheel, wheel_timer *timer){
+    unsigned long expires = timer->expires;
+    unsigned long delta;
+    int level = 0;
+
+    // Passed deadlines fire on the next tick processed
+    if((long) (expires - wheel->now) < 0){
+        expires = wheel->now;
+    }
+
+    // Deadlines beyond the wheel wait in the highest level, they get placed again once cascaded
+    else if(expires - wheel->now >= MAX_TIMER_WHEEL_TICKS){
+        expires = wheel->now + MAX_TIMER_WHEEL_TICKS - 1;
+    }
+
+    delta = expires - wheel->now;
+
+    while(level < TIMER_WHEEL_LEVELS - 1 && delta >= 1UL << (TIMER_WHEEL_BITS * (level + 1))){
+        level++;
+    }
+
+    wheel_timer *head = &(wheel->slots[level][(expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK]);
+
+    timer->next = head;
+    timer->prev = head->prev;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+
+/**
+ * @brief Place the timers of a slot again, each lands in a lower level than the one it was in.
+ */
+static void cascade(timer_wheel_t wheel, int level, int slot){
+    wheel_timer *head = &(wheel->slots[level][slot]);
+
+    while(!list_empty(head)){
+        wheel_timer *timer = head->next;
+
+        unlink_timer(timer);
+        add_timer(wheel, timer);
+    }
+}
+
+
+static void unlink_timer(wheel_timer *timer){
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = NULL;
+    timer->next = NULL;
+}
+
+
+static void init_list(wheel_timer *head){
+    head->prev = head;
+    head->next = head;
+}
+
+
+static bool list_empty(const wheel_timer *head){
+    return head->next == head;
+}
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "pipeline_harness.h"
+#include "connection.h"
+#include "command_line.h"
+#include "mime.h"
+#include "rio.h"
+
+#define NANOSEC_IN_SEC 1000000000UL
+#define HARNESS_IO_STATS_PATH "/proc/thread-self/io"
+#define MAX_HARNESS_IO_STATS_LEN 512
+
+typedef struct harness_response {
+    int fd;
+    char head[MAX_HARNESS_RESPONSE_HEAD_LEN];
+    size_t head_len;
+    unsigned long received_bytes;
+} harness_response;
+
+typedef struct harness_snapshot {
+    unsigned long cpu_ns;
+    unsigned long wall_ns;
+    unsigned long read_syscalls;
+    unsigned long write_syscalls;
+} harness_snapshot;
+
+/*Forward Declarations*/
+static void *read_response(void *args);
+static void take_snapshot(int io_stats_fd, harness_snapshot *snapshot);
+static unsigned long clock_ns(clockid_t clock);
+
+
+int harness_create_root(char *root, size_t max_len, const harness_file *files, int num_files){
+    char path[MAX_SERVER_ROOT_LEN + MAX_URI_LEN];
+    char block[4096];
+
+    if(num_files > MAX_HARNESS_FILES || max_len > MAX_SERVER_ROOT_LEN){
+        return -1;
+    }
+
+    snprintf(root, max_len, "%s/sws_harness_XXXXXX", access("/dev/shm", W_OK) == 0 ? "/dev/shm" : "/tmp");
+
+    if(!mkdtemp(root)){
+        return -1;
+    }
+
+    for(size_t i = 0; i < sizeof(block); i++){
+        block[i] = 'a' + i % 26;
+    }
+
+    for(int i = 0; i < num_files; i++){
+        snprintf(path, sizeof(path), "%s/%s", root, files[i].name);
+        FILE *f = fopen(path, "w");
+
+        if(!f){
+            harness_remove_root(root, files, i);
+            return -1;
+        }
+
+        for(size_t written = 0; written < files[i].size; written += sizeof(block)){
+            fwrite(block, 1, files[i].size - written < sizeof(block) ? files[i].size - written : sizeof(block), f);
+        }
+
+        fclose(f);
+    }
+
+    strcpy(server_root_location, root);
+    mime_registry_init(NULL);
+    return 0;
+}
+
+
+void harness_remove_root(const char *root, const harness_file *files, int num_files){
+    char path[MAX_SERVER_ROOT_LEN + MAX_URI_LEN];
+
+    for(int i = 0; i < num_files; i++){
+        snprintf(path, sizeof(path), "%s/%s", root, files[i].name);
+        unlink(path);
+    }
+
+    rmdir(root);
+}
+
+
+int harness_run(const char *request, int expected_status, int num_requests, harness_stats *stats){
+    int io_stats_fd = openat(AT_FDCWD, HARNESS_IO_STATS_PATH, O_RDONLY);
+    harness_snapshot before;
+    harness_snapshot after;
+    harness_snapshot overhead;
+    connection_t connection = {0};
+    int rc = 0;
+
+    // Taking a snapshot reads the I/O stats, which is a syscall too
+    take_snapshot(io_stats_fd, &before);
+    take_snapshot(io_stats_fd, &overhead);
+    overhead.read_syscalls -= before.read_syscalls;
+
+    for(int i = 0; i < num_requests && rc == 0; i++){
+        int fds[2];
+        pthread_t reader;
+        harness_response response = {0};
+        int status_code = 0;
+
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0){
+            rc = -1;
+            break;
+        }
+
+        response.fd = fds[0];
+
+        if(writen_b(fds[0], (void *) request, strlen(request)) == -1 ||
+           pthread_create(&reader, NULL, read_response, &response) != 0){
+            close(fds[0]);
+            close(fds[1]);
+            rc = -1;
+            break;
+        }
+
+        take_snapshot(io_stats_fd, &before);
+        serve_connection(fds[1], &connection);
+        take_snapshot(io_stats_fd, &after);
+
+        pthread_join(reader, NULL);
+        close(fds[0]);
+
+        stats->requests++;
+        stats->received_bytes += response.received_bytes;
+        stats->cpu_ns += after.cpu_ns - before.cpu_ns;
+        stats->wall_ns += after.wall_ns - before.wall_ns;
+        stats->read_syscalls += after.read_syscalls - before.read_syscalls - overhead.read_syscalls;
+        stats->write_syscalls += after.write_syscalls - before.write_syscalls;
+
+        if(sscanf(response.head, "HTTP/%*d.%*d %d", &status_code) != 1){
+            rc = -1;
+        }
+
+        else if(status_code == expected_status){
+            stats->expected_responses++;
+        }
+    }
+
+    if(io_stats_fd != -1){
+        close(io_stats_fd);
+    }
+
+    return rc;
+}
+
+
+// HELPERS //
+
+/**
+ * @brief Read a whole response, keeping its beginning, until the server closes the connection.
+ */
+static void *read_response(void *args){
+    harness_response *response = (harness_response *) args;
+    char buff[RIO_BUFFSIZE];
+    ssize_t rc;
+
+    while((rc = read(response->fd, buff, sizeof(buff))) > 0){
+        size_t head_left = sizeof(response->head) - 1 - response->head_len;
+        size_t head_len = (size_t) rc < head_left ? (size_t) rc : head_left;
+
+        memcpy(response->head + response->head_len, buff, head_len);
+        response->head_len += head_len;
+        response->received_bytes += rc;
+    }
+
+    return NULL;
+}
+
+
+static void take_snapshot(int io_stats_fd, harness_snapshot *snapshot){
+    char io_stats[MAX_HARNESS_IO_STATS_LEN] = {0};
+    const char *syscr;
+    const char *syscw;
+
+    memset(snapshot, 0, sizeof(harness_snapshot));
+    snapshot->cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    snapshot->wall_ns = clock_ns(CLOCK_MONOTONIC);
+
+    if(io_stats_fd == -1 || pread(io_stats_fd, io_stats, sizeof(io_stats) - 1, 0) <= 0){
+        return;
+    }
+
+    syscr = strstr(io_stats, "syscr: ");
+    syscw = strstr(io_stats, "syscw: ");
+
+    snapshot->read_syscalls = syscr ? strtoul(syscr + 7, NULL, 10) : 0;
+    snapshot->write_syscalls = syscw ? strtoul(syscw + 7, NULL, 10) : 0;
+}
+
+
+static unsigned long clock_ns(clockid_t clock){
+    struct timespec now;
+
+    clock_gettime(clock, &now);
+    return now.tv_sec * NANOSEC_IN_SEC + now.tv_nsec;
+}
@@ -0,0 +1,65 @@
+/**
+ * @file pipeline_harness.h
+ * @brief File containing the APIs driving the request path in process.
+ *
+ * Requests are written to one end of a socketpair and served by serve_connection
+ * on the calling thread, the very function the workers run, while another thread
+ * reads the response off the other end. There is no listening port nor TCP,
+ * so what is measured is the server's own CPU time and syscalls.
+ *
+ */
+
+#ifndef _PIPELINE_HARNESS
+#define _PIPELINE_HARNESS
+
+#include <stddef.h>
+
+#define MAX_HARNESS_FILES 16
+#define MAX_HARNESS_RESPONSE_HEAD_LEN 4096
+
+typedef struct harness_file {
+    const char *name;   /**< Relative to the root, without directories. */
+    size_t size;
+} harness_file;
+
+typedef struct harness_stats {
+    unsigned long requests;
+    unsigned long expected_responses;   /**< Responses with the expected status code. */
+    unsigned long received_bytes;       /**< Status line, headers and body. */
+    unsigned long cpu_ns;               /**< CPU time of the thread serving the requests. */
+    unsigned long wall_ns;
+    unsigned long read_syscalls;        /**< Read syscalls of the serving thread, 0 without task I/O accounting. */
+    unsigned long write_syscalls;       /**< Write syscalls (sendfile included) of the serving thread. */
+} harness_stats;
+
+
+/**
+ * @brief Create a server root on tmpfs (/dev/shm when there is one) and serve requests from it.
+ *
+ * @param root buffer to store the path of the root in.
+ * @param max_len size of root.
+ * @param files files to create, filled with printable bytes.
+ * @param num_files number of files, up to MAX_HARNESS_FILES.
+ * @return int 0 on success, otherwise -1.
+ */
+int harness_create_root(char *root, size_t max_len, const harness_file *files, int num_files);
+
+
+/**
+ * @brief Remove a root made by harness_create_root.
+ */
+void harness_remove_root(const char *root, const harness_file *files, int num_files);
+
+
+/**
+ * @brief Serve the same request num_requests times, each on a new socketpair.
+ *
+ * @param request raw request, with its blank line.
+ * @param expected_status status code responses are expected to have.
+ * @param num_requests how many times to serve it.
+ * @param stats reference to add the counts to. Only time spent in serve_connection is counted.
+ * @return int 0 if every request got a response, otherwise -1.
+ */
+int harness_run(const char *request, int expected_status, int num_requests, harness_stats *stats);
+
+#endif
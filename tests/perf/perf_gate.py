@@ -0,0 +1,148 @@
+#!/usr/bin/python3
+"""
+Throughput/latency regression gate, run by ctest with the perf label.
+
+Starts sws on a loopback port over a generated server root, drives it with
+sws_bench and compares requests/s and p99 latency with a stored baseline.
+Baselines depend on the machine, so a missing one is recorded rather than
+failed on, and --update-baseline records it again (eg: after a speedup).
+
+eg: perf_gate.py --sws build/sws --bench build/sws_bench --baseline perf.json --size small
+"""
+import argparse
+import json
+import os
+import random
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+FILE_SIZES = {
+    "small": 2 * 1024,
+    "medium": 64 * 1024,
+    "large": 1024 * 1024,
+}
+MIN_PORT = 1500
+MAX_PORT = 10000
+SERVER_START_TIMEOUT_SEC = 5
+
+
+def free_port() -> int:
+    # sws only takes ports from 1500 to 10000, so the kernel can't pick one for us
+    for _ in range(100):
+        port = random.randint(MIN_PORT, MAX_PORT)
+        with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
+            try:
+                s.bind(("127.0.0.1", port))
+            except OSError:
+                continue
+        return port
+    raise RuntimeError("no free port")
+
+
+def create_root(root: str) -> None:
+    block = bytes(ord("a") + i % 26 for i in range(4096))
+    for size_name, size in FILE_SIZES.items():
+        with open(os.path.join(root, f"{size_name}.html"), "wb") as f:
+            for written in range(0, size, len(block)):
+                f.write(block[:size - written])
+
+
+def wait_for_server(server: subprocess.Popen, port: int) -> None:
+    deadline = time.monotonic() + SERVER_START_TIMEOUT_SEC
+    while time.monotonic() < deadline:
+        if server.poll() is not None:
+            raise RuntimeError(f"sws exited with {server.returncode}")
+        try:
+            socket.create_connection(("127.0.0.1", port), timeout=1).close()
+            return
+        except OSError:
+            time.sleep(0.05)
+    raise RuntimeError("sws didn't start listening")
+
+
+def run_bench(args, port: int) -> dict:
+    cmd = [args.bench, f"http://127.0.0.1:{port}/{args.size}.html",
+           "--connections", str(args.connections), "--threads", str(args.threads),
+           "--duration", str(args.duration), "--json"]
+    out = subprocess.run(cmd, stdout=subprocess.PIPE, check=True, text=True).stdout
+    return json.loads(out)
+
+
+def load_baselines(path: str) -> dict:
+    try:
+        with open(path) as f:
+            return json.load(f)
+    except FileNotFoundError:
+        return {}
+
+
+def save_baseline(path: str, size_name: str, result: dict) -> None:
+    baselines = load_baselines(path)
+    baselines[size_name] = {"requests_per_sec": result["requests_per_sec"], "p99_ms": result["p99_ms"]}
+    with open(path, "w") as f:
+        json.dump(baselines, f, indent=2, sort_keys=True)
+        f.write("\n")
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--sws", required=True, help="server binary")
+    parser.add_argument("--bench", required=True, help="sws_bench binary")
+    parser.add_argument("--baseline", required=True, help="JSON file the baselines are kept in")
+    parser.add_argument("--size", required=True, choices=FILE_SIZES.keys())
+    parser.add_argument("--tolerance", type=float, default=0.2,
+                        help="fraction throughput may drop or p99 may rise by (default: 0.2)")
+    parser.add_argument("--duration", type=int, default=5)
+    parser.add_argument("--connections", type=int, default=32)
+    parser.add_argument("--threads", type=int, default=2)
+    parser.add_argument("--update-baseline", action="store_true")
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory(prefix="sws_perf_") as root:
+        create_root(root)
+        port = free_port()
+        server = subprocess.Popen([args.sws, str(port), root],
+                                  stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        try:
+            wait_for_server(server, port)
+            result = run_bench(args, port)
+        finally:
+            server.terminate()
+            try:
+                server.wait(timeout=SERVER_START_TIMEOUT_SEC)
+            except subprocess.TimeoutExpired:
+                server.kill()
+
+    print(f"{args.size}: {result['requests_per_sec']:.1f} requests/s, p99 {result['p99_ms']:.3f}ms, "
+          f"{result['errors']} errors, {result['status_other']} non 2xx")
+
+    if result["errors"] or result["status_other"] or not result["requests"]:
+        print("FAIL: requests didn't all succeed")
+        return 1
+
+    baseline = load_baselines(args.baseline).get(args.size)
+    if baseline is None or args.update_baseline:
+        save_baseline(args.baseline, args.size, result)
+        print(f"recorded baseline in {args.baseline}")
+        return 0
+
+    min_throughput = baseline["requests_per_sec"] * (1 - args.tolerance)
+    max_p99 = baseline["p99_ms"] * (1 + args.tolerance)
+    print(f"baseline: {baseline['requests_per_sec']:.1f} requests/s, p99 {baseline['p99_ms']:.3f}ms, "
+          f"tolerance {args.tolerance:.0%}")
+
+    failed = False
+    if result["requests_per_sec"] < min_throughput:
+        print(f"FAIL: throughput below {min_throughput:.1f} requests/s")
+        failed = True
+    if result["p99_ms"] > max_p99:
+        print(f"FAIL: p99 above {max_p99:.3f}ms")
+        failed = True
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
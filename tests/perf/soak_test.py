@@ -0,0 +1,320 @@
+#!/usr/bin/python3
+"""
+C10K soak test: thousands of idle and slowloris connections next to a few fast clients.
+
+Starts sws on a loopback port over a generated server root, then holds open:
+  - idle connections, which connect and never send a byte,
+  - slow connections, which trickle a request line one byte at a time and
+    never end it (what readline_b waits on),
+  - fast clients, which send whole requests back to back and time them.
+
+Idle and slow connections the server closes are opened again, so the pressure
+stays on for the whole run. Fails when the fast clients' p99 latency goes over
+its bound, any of their requests times out, or the server's resident memory
+goes over its budget.
+
+eg: soak_test.py --sws build/sws --idle 5000 --slow 5000 --duration 30
+"""
+import argparse
+import errno
+import os
+import random
+import resource
+import selectors
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+MIN_PORT = 1500
+MAX_PORT = 10000
+SERVER_START_TIMEOUT_SEC = 5
+FAST_FILE_NAME = "index.html"
+FAST_FILE_LEN = 2048
+SLOW_REQUEST_LINE = b"GET /index.html?" + b"a" * 4096
+CONNECTS_PER_TICK = 256
+TICK_SEC = 0.01
+MEMORY_SAMPLE_SEC = 0.5
+FD_MARGIN = 64
+
+IDLE = "idle"
+SLOW = "slow"
+FAST = "fast"
+
+
+class Client:
+    def __init__(self, kind: str, sock: socket.socket):
+        self.kind = kind
+        self.sock = sock
+        self.connected = False
+        self.started = time.monotonic()
+        self.sent = 0           # bytes of the request line (slow) or request (fast) sent
+        self.next_send = 0.0    # when a slow client sends its next byte
+        self.head = b""
+
+
+def free_port() -> int:
+    # sws only takes ports from 1500 to 10000, so the kernel can't pick one for us
+    for _ in range(100):
+        port = random.randint(MIN_PORT, MAX_PORT)
+        with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
+            try:
+                s.bind(("127.0.0.1", port))
+            except OSError:
+                continue
+        return port
+    raise RuntimeError("no free port")
+
+
+def raise_fd_limit(needed: int) -> None:
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    if hard != resource.RLIM_INFINITY and hard < needed:
+        raise RuntimeError(f"{needed} file descriptors needed, the hard limit is {hard}")
+    if soft != resource.RLIM_INFINITY and soft < needed:
+        resource.setrlimit(resource.RLIMIT_NOFILE, (needed, hard))
+
+
+def wait_for_server(server: subprocess.Popen, port: int) -> None:
+    deadline = time.monotonic() + SERVER_START_TIMEOUT_SEC
+    while time.monotonic() < deadline:
+        if server.poll() is not None:
+            raise RuntimeError(f"sws exited with {server.returncode}")
+        try:
+            socket.create_connection(("127.0.0.1", port), timeout=1).close()
+            return
+        except OSError:
+            time.sleep(0.05)
+    raise RuntimeError("sws didn't start listening")
+
+
+def resident_kb(pid: int) -> int:
+    try:
+        with open(f"/proc/{pid}/status") as f:
+            for line in f:
+                if line.startswith("VmRSS:"):
+                    return int(line.split()[1])
+    except FileNotFoundError:
+        pass
+    return 0
+
+
+def percentile(sorted_values: list, q: float) -> float:
+    if not sorted_values:
+        return 0.0
+    return sorted_values[min(len(sorted_values) - 1, int(q * len(sorted_values)))]
+
+
+class Soak:
+    def __init__(self, args, port: int, server_pid: int):
+        self.args = args
+        self.addr = ("127.0.0.1", port)
+        self.server_pid = server_pid
+        self.selector = selectors.DefaultSelector()
+        self.fast_request = f"GET /{FAST_FILE_NAME} HTTP/1.1\r\nHost: localhost\r\n\r\n".encode()
+        self.wanted = {IDLE: args.idle, SLOW: args.slow, FAST: args.fast}
+        self.open = {IDLE: 0, SLOW: 0, FAST: 0}
+        self.established = {IDLE: 0, SLOW: 0, FAST: 0}
+        self.closed_by_server = {IDLE: 0, SLOW: 0}
+        self.connect_errors = 0
+        self.latencies_ms = []
+        self.fast_errors = 0
+        self.fast_timeouts = 0
+        self.peak_rss_kb = 0
+        self.clients = set()
+
+    def open_client(self, kind: str) -> None:
+        sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        sock.setblocking(False)
+        rc = sock.connect_ex(self.addr)
+        if rc not in (0, errno.EINPROGRESS):
+            sock.close()
+            self.connect_errors += 1
+            return
+        client = Client(kind, sock)
+        self.clients.add(client)
+        self.open[kind] += 1
+        self.selector.register(sock, selectors.EVENT_WRITE, client)
+
+    def close_client(self, client: Client) -> None:
+        self.selector.unregister(client.sock)
+        client.sock.close()
+        self.clients.discard(client)
+        self.open[client.kind] -= 1
+
+    def on_connected(self, client: Client, now: float) -> None:
+        err = client.sock.getsockopt(socket.SOL_SOCKET, socket.SO_ERROR)
+        if err:
+            self.connect_errors += 1
+            if client.kind == FAST:
+                self.finish_fast(client, now, False)
+            else:
+                self.close_client(client)
+            return
+        client.connected = True
+        self.established[client.kind] += 1
+        if client.kind == FAST:
+            self.send_fast(client, now)
+        else:
+            # Idle and slow clients only wait for the server to close them
+            client.next_send = now
+            self.selector.modify(client.sock, selectors.EVENT_READ, client)
+
+    def send_fast(self, client: Client, now: float) -> None:
+        try:
+            client.sent += client.sock.send(self.fast_request[client.sent:])
+        except BlockingIOError:
+            pass
+        except OSError:
+            self.finish_fast(client, now, False)
+            return
+        events = selectors.EVENT_READ if client.sent == len(self.fast_request) else selectors.EVENT_WRITE
+        self.selector.modify(client.sock, events, client)
+
+    def read(self, client: Client, now: float) -> None:
+        try:
+            data = client.sock.recv(65536)
+        except BlockingIOError:
+            return
+        except OSError:
+            data = None
+        if client.kind != FAST:
+            # Whatever the server sends, it closes the connection after it
+            if not data:
+                self.closed_by_server[client.kind] += 1
+                self.close_client(client)
+            return
+        if data:
+            client.head = (client.head + data)[:64]
+            return
+        self.finish_fast(client, now, client.head.startswith(b"HTTP/1.") and client.head[9:12] == b"200")
+
+    def finish_fast(self, client: Client, now: float, ok: bool) -> None:
+        self.latencies_ms.append((now - client.started) * 1000)
+        if not ok:
+            self.fast_errors += 1
+        self.close_client(client)
+
+    def trickle(self, now: float) -> None:
+        for client in list(self.clients):
+            if client.kind == SLOW and client.connected and client.next_send <= now:
+                try:
+                    client.sock.send(SLOW_REQUEST_LINE[client.sent % len(SLOW_REQUEST_LINE):][:1])
+                    client.sent += 1
+                except BlockingIOError:
+                    pass
+                except OSError:
+                    self.closed_by_server[SLOW] += 1
+                    self.close_client(client)
+                    continue
+                client.next_send = now + self.args.slow_interval
+
+    def expire_fast(self, now: float) -> None:
+        for client in list(self.clients):
+            if client.kind == FAST and now - client.started > self.args.fast_timeout:
+                self.fast_timeouts += 1
+                self.finish_fast(client, now, False)
+
+    def top_up(self) -> None:
+        budget = CONNECTS_PER_TICK
+        for kind in (FAST, IDLE, SLOW):
+            while self.open[kind] < self.wanted[kind] and budget > 0:
+                self.open_client(kind)
+                budget -= 1
+
+    def run(self) -> None:
+        start = time.monotonic()
+        next_sample = start
+        next_trickle = start
+        now = start
+
+        while now - start < self.args.duration:
+            self.top_up()
+            for key, events in self.selector.select(TICK_SEC):
+                client = key.data
+                if client not in self.clients:
+                    continue
+                if not client.connected:
+                    self.on_connected(client, now)
+                elif events & selectors.EVENT_WRITE:
+                    self.send_fast(client, now)
+                else:
+                    self.read(client, now)
+            now = time.monotonic()
+            if now >= next_trickle:
+                self.trickle(now)
+                self.expire_fast(now)
+                next_trickle = now + TICK_SEC * 10
+            if now >= next_sample:
+                self.peak_rss_kb = max(self.peak_rss_kb, resident_kb(self.server_pid))
+                next_sample = now + MEMORY_SAMPLE_SEC
+
+        for client in list(self.clients):
+            self.close_client(client)
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--sws", required=True, help="server binary")
+    parser.add_argument("--idle", type=int, default=5000, help="idle connections (default: 5000)")
+    parser.add_argument("--slow", type=int, default=5000, help="slowloris connections (default: 5000)")
+    parser.add_argument("--fast", type=int, default=8, help="concurrent fast clients (default: 8)")
+    parser.add_argument("--duration", type=float, default=30)
+    parser.add_argument("--slow-interval", type=float, default=1.0, help="seconds between the bytes of slow clients")
+    parser.add_argument("--fast-timeout", type=float, default=5.0, help="seconds a fast request may take at most")
+    parser.add_argument("--max-p99-ms", type=float, default=500.0, help="bound on the fast clients' p99 latency")
+    parser.add_argument("--memory-budget-mb", type=float, default=256.0, help="bound on the server's resident memory")
+    args = parser.parse_args()
+
+    needed_fds = args.idle + args.slow + args.fast + FD_MARGIN
+    raise_fd_limit(needed_fds)
+
+    with tempfile.TemporaryDirectory(prefix="sws_soak_") as root:
+        with open(os.path.join(root, FAST_FILE_NAME), "wb") as f:
+            f.write(b"a" * FAST_FILE_LEN)
+
+        port = free_port()
+        server = subprocess.Popen([args.sws, str(port), root],
+                                  stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        try:
+            wait_for_server(server, port)
+            soak = Soak(args, port, server.pid)
+            soak.run()
+            server_exited = server.poll() is not None
+        finally:
+            server.terminate()
+            try:
+                server.wait(timeout=SERVER_START_TIMEOUT_SEC)
+            except subprocess.TimeoutExpired:
+                server.kill()
+
+    latencies = sorted(soak.latencies_ms)
+    p50 = percentile(latencies, 0.5)
+    p99 = percentile(latencies, 0.99)
+    peak_rss_mb = soak.peak_rss_kb / 1024
+
+    print(f"connections established: {soak.established[IDLE]} idle, {soak.established[SLOW]} slow, "
+          f"{soak.established[FAST]} fast, {soak.connect_errors} connect errors")
+    print(f"closed by the server: {soak.closed_by_server[IDLE]} idle, {soak.closed_by_server[SLOW]} slow")
+    print(f"fast requests: {len(latencies)}, {soak.fast_errors} failed ({soak.fast_timeouts} timed out), "
+          f"p50 {p50:.1f}ms, p99 {p99:.1f}ms, max {latencies[-1] if latencies else 0:.1f}ms")
+    print(f"server peak resident memory: {peak_rss_mb:.1f}MB")
+
+    failed = False
+    if server_exited:
+        print("FAIL: the server exited")
+        failed = True
+    if not latencies or soak.fast_errors:
+        print("FAIL: fast requests didn't all succeed")
+        failed = True
+    if p99 > args.max_p99_ms:
+        print(f"FAIL: fast p99 above {args.max_p99_ms:.1f}ms")
+        failed = True
+    if peak_rss_mb > args.memory_budget_mb:
+        print(f"FAIL: resident memory above {args.memory_budget_mb:.1f}MB")
+        failed = True
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,168 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "access_log_private.h"
+
+#define UNUSED (void)
+#define TEST_TIMESTAMP "10/Oct/2000:13:55:36 -0700"
+
+
+typedef struct _test_context_t {
+    char dir[64];
+    char path[128];
+    char rotated_path[128];
+} test_context_t;
+
+
+static int setup_log_dir(void **state){
+    test_context_t *ctx = calloc(1, sizeof(test_context_t));
+
+    strcpy(ctx->dir, "/tmp/sws_access_log_XXXXXX");
+    assert_non_null(mkdtemp(ctx->dir));
+    snprintf(ctx->path, sizeof(ctx->path), "%s/access.log", ctx->dir);
+    snprintf(ctx->rotated_path, sizeof(ctx->rotated_path), "%s/access.log.1", ctx->dir);
+
+    *state = ctx;
+    return 0;
+}
+
+static int destroy_log_dir(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+
+    access_log_close();
+    unlink(ctx->path);
+    unlink(ctx->rotated_path);
+    rmdir(ctx->dir);
+    free(ctx);
+    return 0;
+}
+
+static char *read_log(const char *path){
+    FILE *f = fopen(path, "r");
+    char *content = calloc(1, 64 * 1024);
+
+    assert_non_null(f);
+    fread(content, 1, 64 * 1024 - 1, f);
+    fclose(f);
+    return content;
+}
+
+static void log_uri(const char *uri){
+    access_log_entry entry = {.client_addr = "127.0.0.1",
+                              .method = "GET",
+                              .uri = uri,
+                              .version = "1.1",
+                              .status_code = 200,
+                              .bytes_sent = 25};
+
+    access_log_write(&entry);
+}
+
+
+static void test_format_line(void **state){
+    UNUSED state;
+    char line[MAX_ACCESS_LOG_LINE_LEN];
+    access_log_entry entry = {.client_addr = "127.0.0.1",
+                              .method = "GET",
+                              .uri = "/index.html",
+                              .version = "1.1",
+                              .status_code = 200,
+                              .bytes_sent = 2326,
+                              .duration_us = 153,
+                              .queue_wait_us = 12};
+    const char *expected = "127.0.0.1 - - [" TEST_TIMESTAMP "] \"GET /index.html HTTP/1.1\" 200 2326 153 12\n";
+
+    assert_int_equal(format_access_log_line(&entry, TEST_TIMESTAMP, line, sizeof(line)), strlen(expected));
+    assert_string_equal(line, expected);
+
+    // Empty bodies and unknown clients are logged as "-"
+    entry.client_addr = "";
+    entry.status_code = 404;
+    entry.bytes_sent = 0;
+    format_access_log_line(&entry, TEST_TIMESTAMP, line, sizeof(line));
+    assert_string_equal(line, "- - - [" TEST_TIMESTAMP "] \"GET /index.html HTTP/1.1\" 404 - 153 12\n");
+}
+
+
+static void test_format_escapes_uri(void **state){
+    UNUSED state;
+    char line[MAX_ACCESS_LOG_LINE_LEN];
+    access_log_entry entry = {.client_addr = "127.0.0.1",
+                              .method = "GET",
+                              .uri = "/a\" 200 1\n\\b",
+                              .version = "1.0",
+                              .status_code = 404};
+
+    format_access_log_line(&entry, TEST_TIMESTAMP, line, sizeof(line));
+    assert_string_equal(line, "127.0.0.1 - - [" TEST_TIMESTAMP "] \"GET /a\\x22 200 1\\x0A\\x5Cb HTTP/1.0\" 404 - 0 0\n");
+
+    // Lines cut short still end with a newline
+    assert_int_equal(format_access_log_line(&entry, TEST_TIMESTAMP, line, 20), 19);
+    assert_int_equal(line[18], '\n');
+}
+
+
+static void test_lines_written_on_close(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+
+    assert_int_equal(access_log_open(ctx->path), 0);
+    assert_true(access_log_enabled());
+
+    log_uri("/a");
+    log_uri("/b");
+    access_log_close();
+    assert_false(access_log_enabled());
+
+    char *content = read_log(ctx->path);
+    char *second_line = strchr(content, '\n') + 1;
+
+    assert_non_null(strstr(content, "\"GET /a HTTP/1.1\" 200 25 0 0\n"));
+    assert_true(strstr(content, "\"GET /a HTTP/1.1\"") < strstr(content, "\"GET /b HTTP/1.1\""));
+    assert_int_equal(strncmp(second_line, "127.0.0.1 - - [", 15), 0);
+    free(content);
+}
+
+
+static void test_reopen_after_rotation(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+
+    assert_int_equal(access_log_open(ctx->path), 0);
+
+    log_uri("/before");
+    assert_int_equal(rename(ctx->path, ctx->rotated_path), 0);
+    assert_int_equal(access_log_reopen(), 0);
+
+    log_uri("/after");
+    access_log_close();
+
+    char *rotated = read_log(ctx->rotated_path);
+    char *current = read_log(ctx->path);
+
+    // Lines buffered before the reopen belong to the rotated file
+    assert_non_null(strstr(rotated, "/before"));
+    assert_null(strstr(rotated, "/after"));
+    assert_non_null(strstr(current, "/after"));
+    assert_null(strstr(current, "/before"));
+
+    free(rotated);
+    free(current);
+}
+
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_format_line),
+        cmocka_unit_test(test_format_escapes_uri),
+        cmocka_unit_test_setup_teardown(test_lines_written_on_close, setup_log_dir, destroy_log_dir),
+        cmocka_unit_test_setup_teardown(test_reopen_after_rotation, setup_log_dir, destroy_log_dir),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
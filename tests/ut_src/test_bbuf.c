@@ -90,6 +90,23 @@ static void test_bbuf_insert_null_buff_reference(void **state){
 }
 
 
+static void test_bbuf_try_insert_full_buffer(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    int dummy_fd = 50;
+
+    for(int i = 0; i < BBUF_SIZE; i++){
+        assert_int_equal(bbuf_try_insert(ctx->buff, dummy_fd + i), 0);
+    }
+
+    // Full, fails right away instead of waiting for a slot
+    assert_int_equal(bbuf_try_insert(ctx->buff, dummy_fd), -1);
+    assert_int_equal(get_bbuf_items(ctx->buff), BBUF_SIZE);
+
+    assert_int_equal(bbuf_remove(ctx->buff, NULL), 0);
+    assert_int_equal(bbuf_try_insert(ctx->buff, dummy_fd), 0);
+    assert_int_equal(get_bbuf_slots(ctx->buff), 0);
+}
+
 static void test_bbuf_remove(void **state){
     test_context_t *ctx = (test_context_t *) *state;
     int dummy_fd = 50;
@@ -161,6 +178,7 @@ int main(void) {
         cmocka_unit_test_setup_teardown(test_bbuf_insert_new_buffer, init_empty_bbuf, destroy_bbuf),
         cmocka_unit_test_setup_teardown(test_bbuf_several_sequential_inserts, init_empty_bbuf, destroy_bbuf),
         cmocka_unit_test(test_bbuf_insert_null_buff_reference),
+        cmocka_unit_test_setup_teardown(test_bbuf_try_insert_full_buffer, init_empty_bbuf, destroy_bbuf),
         cmocka_unit_test_setup_teardown(test_bbuf_remove, init_empty_bbuf, destroy_bbuf),
         cmocka_unit_test_setup_teardown(test_bbuf_remove_multiple_removes, init_empty_bbuf, destroy_bbuf),
         cmocka_unit_test(test_bbuf_remove_null_buff_reference),
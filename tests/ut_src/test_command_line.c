@@ -14,7 +14,7 @@
 
 typedef struct {
     int argc;
-    char *argv[5];
+    char *argv[8];
     struct cli test_cli;
 } command_line_t;
 
@@ -171,6 +171,90 @@ static void test_valid_cli_input(void **state) {
 }
 
 
+static void test_gzip_options(void **state) {
+    char port[10];
+    command_line_t *cmd_line = *state;
+
+    sprintf(port, "%d", PORT_MIN+1);
+
+    cmd_line->argc = 8;
+    cmd_line->argv[0] = "sws";
+    cmd_line->argv[1] = port;
+    cmd_line->argv[2] = "valid_server_root";
+    cmd_line->argv[3] = "--gzip";
+    cmd_line->argv[4] = "--gzip-level";
+    cmd_line->argv[5] = "9";
+    cmd_line->argv[6] = "--gzip-types";
+    cmd_line->argv[7] = "text/html,application/json";
+
+    will_return_always(__wrap_access, 0);
+    expect_string_count(__wrap_access, __name, "valid_server_root", -1);
+    expect_any_always(__wrap_access, __type);
+
+    bool result = parse_cli(cmd_line->argc, cmd_line->argv, &(cmd_line->test_cli));
+
+    assert_true(result);
+    assert_true(cmd_line->test_cli.gzip_enabled);
+    assert_int_equal(cmd_line->test_cli.gzip_level, 9);
+    assert_int_equal(cmd_line->test_cli.gzip_min_size, DEFAULT_GZIP_MIN_SIZE);
+    assert_string_equal(cmd_line->test_cli.gzip_types, "text/html,application/json");
+}
+
+static void test_invalid_gzip_level(void **state) {
+    char port[10];
+    command_line_t *cmd_line = *state;
+
+    sprintf(port, "%d", PORT_MIN+1);
+
+    cmd_line->argc = 5;
+    cmd_line->argv[0] = "sws";
+    cmd_line->argv[1] = port;
+    cmd_line->argv[2] = "valid_server_root";
+    cmd_line->argv[3] = "--gzip-level";
+    cmd_line->argv[4] = "10";
+
+    // Options are validated before the server root, so no access mocks needed
+    bool result = parse_cli(cmd_line->argc, cmd_line->argv, &(cmd_line->test_cli));
+
+    assert_false(result);
+}
+
+static void test_invalid_metrics_address(void **state) {
+    char port[10];
+    command_line_t *cmd_line = *state;
+
+    sprintf(port, "%d", PORT_MIN+1);
+
+    cmd_line->argc = 5;
+    cmd_line->argv[0] = "sws";
+    cmd_line->argv[1] = port;
+    cmd_line->argv[2] = "valid_server_root";
+    cmd_line->argv[3] = "--metrics-address";
+    cmd_line->argv[4] = "localhost";
+
+    // Options are validated before the server root, so no access mocks needed
+    bool result = parse_cli(cmd_line->argc, cmd_line->argv, &(cmd_line->test_cli));
+
+    assert_false(result);
+}
+
+static void test_missing_option_value(void **state) {
+    char port[10];
+    command_line_t *cmd_line = *state;
+
+    sprintf(port, "%d", PORT_MIN+1);
+
+    cmd_line->argc = 4;
+    cmd_line->argv[0] = "sws";
+    cmd_line->argv[1] = port;
+    cmd_line->argv[2] = "valid_server_root";
+    cmd_line->argv[3] = "--gzip-min-size";
+
+    bool result = parse_cli(cmd_line->argc, cmd_line->argv, &(cmd_line->test_cli));
+
+    assert_false(result);
+}
+
 
 int main(void) {
     const struct CMUnitTest tests[] = {
@@ -182,6 +266,10 @@ int main(void) {
         cmocka_unit_test(test_server_root_thats_too_long),
         cmocka_unit_test(test_server_root_thats_not_readable),
         cmocka_unit_test(test_valid_cli_input),
+        cmocka_unit_test(test_gzip_options),
+        cmocka_unit_test(test_invalid_gzip_level),
+        cmocka_unit_test(test_invalid_metrics_address),
+        cmocka_unit_test(test_missing_option_value),
     };
 
     return cmocka_run_group_tests(tests, setup, teardown);
@@ -0,0 +1,321 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "compression_private.h"
+
+#define UNUSED (void)
+#define TEST_RESSOURCE_LEN (200 * 1024) // Spans a few compression chunks
+#define TEST_CACHE_SIZE (1024 * 1024)
+#define GZIP_WINDOW_BITS (15 + 16)
+#define ZLIB_WINDOW_BITS 15
+#define TEST_NUM_WORKERS 8
+
+
+typedef struct _test_context_t {
+    char path[64];
+    int fd;
+    struct stat info;
+    char *content;
+} test_context_t;
+
+
+static void configure_compression(bool enabled, long cache_size){
+    compression_config config = {.enabled = enabled,
+                                 .level = 6,
+                                 .min_size = 100,
+                                 .cache_size = cache_size,
+                                 .types = "text/*,application/json"};
+
+    assert_int_equal(compression_init(&config), 0);
+}
+
+/**
+ * @brief Inflate data and check it matches the expected content.
+ */
+static void assert_inflates_to(const char *data, size_t data_len, int window_bits, const char *expected, size_t expected_len){
+    z_stream stream;
+    char *out = malloc(expected_len + 1);
+
+    memset(&stream, 0, sizeof(z_stream));
+    assert_int_equal(inflateInit2(&stream, window_bits), Z_OK);
+
+    stream.next_in = (Bytef *) data;
+    stream.avail_in = data_len;
+    stream.next_out = (Bytef *) out;
+    stream.avail_out = expected_len + 1;
+
+    assert_int_equal(inflate(&stream, Z_FINISH), Z_STREAM_END);
+    assert_int_equal(stream.total_out, expected_len);
+    assert_memory_equal(out, expected, expected_len);
+
+    inflateEnd(&stream);
+    free(out);
+}
+
+static int setup_ressource(void **state){
+    test_context_t *ctx = calloc(1, sizeof(test_context_t));
+    FILE *f;
+
+    strcpy(ctx->path, "/tmp/sws_compression_XXXXXX");
+    ctx->fd = mkstemp(ctx->path);
+    assert_true(ctx->fd != -1);
+
+    // Random text only compresses so much, so entries take a fair share of the cache
+    ctx->content = malloc(TEST_RESSOURCE_LEN);
+    srand(0);
+    for(int i = 0; i < TEST_RESSOURCE_LEN; i++){
+        ctx->content[i] = "abcdefghijklmnop"[rand() % 16];
+    }
+
+    f = fdopen(dup(ctx->fd), "w");
+    assert_int_equal(fwrite(ctx->content, 1, TEST_RESSOURCE_LEN, f), TEST_RESSOURCE_LEN);
+    fclose(f);
+
+    assert_int_equal(stat(ctx->path, &(ctx->info)), 0);
+
+    configure_compression(true, TEST_CACHE_SIZE);
+    clear_compressed_cache();
+    *state = ctx;
+    return 0;
+}
+
+static int destroy_ressource(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+
+    clear_compressed_cache();
+    close(ctx->fd);
+    unlink(ctx->path);
+    free(ctx->content);
+    free(ctx);
+    return 0;
+}
+
+
+static void test_compression_applies(void **state){
+    UNUSED state;
+    configure_compression(true, TEST_CACHE_SIZE);
+
+    assert_true(compression_applies("text/html", 1000));
+    assert_true(compression_applies("text/css; charset=utf-8", 1000));
+    assert_true(compression_applies("application/json", 1000));
+    assert_false(compression_applies("application/jsonp", 1000));
+    assert_false(compression_applies("image/jpeg", 1000));
+    assert_false(compression_applies("text/html", 99)); // Below min size
+}
+
+static void test_compression_disabled(void **state){
+    UNUSED state;
+    configure_compression(false, TEST_CACHE_SIZE);
+
+    assert_false(compression_applies("text/html", 1000));
+    assert_int_equal(compression_available_codings(), 0);
+}
+
+static void test_invalid_compression_level(void **state){
+    UNUSED state;
+    compression_config config = {.enabled = true, .level = 10, .types = "text/*"};
+
+    assert_int_equal(compression_init(&config), -1);
+}
+
+static void test_get_compressed_entry_gzip(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    const char *data;
+    size_t data_len;
+
+    compressed_entry_t entry = get_compressed_entry(ctx->path, ctx->fd, &(ctx->info), CODING_GZIP);
+
+    assert_non_null(entry);
+    assert_int_equal(get_compressed_entry_data(entry, &data, &data_len), 0);
+    assert_true(data_len < TEST_RESSOURCE_LEN);
+    assert_inflates_to(data, data_len, GZIP_WINDOW_BITS, ctx->content, TEST_RESSOURCE_LEN);
+
+    release_compressed_entry(&entry);
+    assert_null(entry);
+}
+
+static void test_get_compressed_entry_deflate(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    const char *data;
+    size_t data_len;
+
+    compressed_entry_t entry = get_compressed_entry(ctx->path, ctx->fd, &(ctx->info), CODING_DEFLATE);
+
+    assert_non_null(entry);
+    assert_int_equal(get_compressed_entry_data(entry, &data, &data_len), 0);
+    assert_inflates_to(data, data_len, ZLIB_WINDOW_BITS, ctx->content, TEST_RESSOURCE_LEN);
+
+    release_compressed_entry(&entry);
+}
+
+static void test_get_compressed_entry_is_cached(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+
+    compressed_entry_t first = get_compressed_entry(ctx->path, ctx->fd, &(ctx->info), CODING_GZIP);
+    size_t usage = get_compressed_cache_usage();
+    compressed_entry_t second = get_compressed_entry(ctx->path, ctx->fd, &(ctx->info), CODING_GZIP);
+
+    assert_non_null(first);
+    assert_ptr_equal(first, second);
+    assert_true(usage > 0);
+    assert_int_equal(get_compressed_cache_usage(), usage);
+
+    release_compressed_entry(&first);
+    release_compressed_entry(&second);
+}
+
+static void test_new_version_replaces_cached_entry(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    const char *data;
+    size_t data_len;
+
+    compressed_entry_t old_version = get_compressed_entry(ctx->path, ctx->fd, &(ctx->info), CODING_GZIP);
+    size_t usage = get_compressed_cache_usage();
+
+    ctx->info.st_mtime += 10;
+    compressed_entry_t new_version = get_compressed_entry(ctx->path, ctx->fd, &(ctx->info), CODING_GZIP);
+
+    assert_non_null(new_version);
+    assert_true(old_version != new_version);
+    assert_int_equal(get_compressed_cache_usage(), usage); // Old version was dropped
+
+    // Still usable by whoever holds it
+    assert_int_equal(get_compressed_entry_data(old_version, &data, &data_len), 0);
+    assert_inflates_to(data, data_len, GZIP_WINDOW_BITS, ctx->content, TEST_RESSOURCE_LEN);
+
+    release_compressed_entry(&old_version);
+    release_compressed_entry(&new_version);
+}
+
+static void test_cache_is_bounded(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    compressed_entry_t entry;
+    char path[80];
+    int num_entries = 12;
+
+    // Same ressource cached under different paths, more than the cache can hold
+    for(int i = 0; i < num_entries; i++){
+        snprintf(path, sizeof(path), "%s_%d", ctx->path, i);
+        entry = get_compressed_entry(path, ctx->fd, &(ctx->info), CODING_GZIP);
+
+        assert_non_null(entry);
+        assert_true(get_compressed_cache_usage() <= TEST_CACHE_SIZE);
+        release_compressed_entry(&entry);
+    }
+
+    // Least recently used entries were evicted, but the most recent one is still cached
+    size_t usage = get_compressed_cache_usage();
+    entry = get_compressed_entry(path, ctx->fd, &(ctx->info), CODING_GZIP);
+    assert_int_equal(get_compressed_cache_usage(), usage);
+    release_compressed_entry(&entry);
+}
+
+static void test_too_big_to_cache(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+
+    configure_compression(true, TEST_RESSOURCE_LEN);
+
+    assert_false(compression_is_cacheable(ctx->info.st_size));
+    assert_null(get_compressed_entry(ctx->path, ctx->fd, &(ctx->info), CODING_GZIP));
+}
+
+typedef struct _test_worker_t {
+    test_context_t *ctx;
+    pthread_barrier_t *start;
+    compressed_entry_t entry;
+} test_worker_t;
+
+static void *get_entry_after_barrier(void *args){
+    test_worker_t *worker = (test_worker_t *) args;
+
+    pthread_barrier_wait(worker->start);
+    worker->entry = get_compressed_entry(worker->ctx->path, worker->ctx->fd, &(worker->ctx->info), CODING_GZIP);
+    return NULL;
+}
+
+static void test_concurrent_misses_are_coalesced(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    pthread_t tids[TEST_NUM_WORKERS];
+    test_worker_t workers[TEST_NUM_WORKERS];
+    pthread_barrier_t start;
+    const char *data;
+    size_t data_len;
+
+    pthread_barrier_init(&start, NULL, TEST_NUM_WORKERS);
+
+    for(int i = 0; i < TEST_NUM_WORKERS; i++){
+        workers[i] = (test_worker_t) {.ctx = ctx, .start = &start, .entry = NULL};
+        assert_int_equal(pthread_create(&tids[i], NULL, get_entry_after_barrier, &workers[i]), 0);
+    }
+
+    for(int i = 0; i < TEST_NUM_WORKERS; i++){
+        pthread_join(tids[i], NULL);
+    }
+
+    // Whether they waited on the compression or found it cached, everyone shares one entry
+    for(int i = 0; i < TEST_NUM_WORKERS; i++){
+        assert_non_null(workers[i].entry);
+        assert_ptr_equal(workers[i].entry, workers[0].entry);
+    }
+
+    assert_int_equal(get_compressed_entry_data(workers[0].entry, &data, &data_len), 0);
+    assert_int_equal(get_compressed_cache_usage(), data_len);
+    assert_inflates_to(data, data_len, GZIP_WINDOW_BITS, ctx->content, TEST_RESSOURCE_LEN);
+
+    for(int i = 0; i < TEST_NUM_WORKERS; i++){
+        release_compressed_entry(&(workers[i].entry));
+    }
+
+    pthread_barrier_destroy(&start);
+}
+
+
+static void test_compress_stream(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    char out_path[] = "/tmp/sws_compressed_XXXXXX";
+    int out_fd = mkstemp(out_path);
+    struct stat out_info;
+    off_t bytes_written;
+
+    assert_true(out_fd != -1);
+    assert_int_equal(compress_stream(out_fd, ctx->fd, TEST_RESSOURCE_LEN, CODING_GZIP, &bytes_written), 0);
+    assert_int_equal(stat(out_path, &out_info), 0); // fstat is mocked
+    assert_int_equal(bytes_written, out_info.st_size);
+
+    char *data = malloc(out_info.st_size);
+    assert_int_equal(pread(out_fd, data, out_info.st_size, 0), out_info.st_size);
+    assert_inflates_to(data, out_info.st_size, GZIP_WINDOW_BITS, ctx->content, TEST_RESSOURCE_LEN);
+
+    free(data);
+    close(out_fd);
+    unlink(out_path);
+}
+
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_compression_applies),
+        cmocka_unit_test(test_compression_disabled),
+        cmocka_unit_test(test_invalid_compression_level),
+        cmocka_unit_test_setup_teardown(test_get_compressed_entry_gzip, setup_ressource, destroy_ressource),
+        cmocka_unit_test_setup_teardown(test_get_compressed_entry_deflate, setup_ressource, destroy_ressource),
+        cmocka_unit_test_setup_teardown(test_get_compressed_entry_is_cached, setup_ressource, destroy_ressource),
+        cmocka_unit_test_setup_teardown(test_new_version_replaces_cached_entry, setup_ressource, destroy_ressource),
+        cmocka_unit_test_setup_teardown(test_cache_is_bounded, setup_ressource, destroy_ressource),
+        cmocka_unit_test_setup_teardown(test_too_big_to_cache, setup_ressource, destroy_ressource),
+        cmocka_unit_test_setup_teardown(test_concurrent_misses_are_coalesced, setup_ressource, destroy_ressource),
+        cmocka_unit_test_setup_teardown(test_compress_stream, setup_ressource, destroy_ressource),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,181 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+#include "content_coding_private.h"
+
+#define UNUSED (void)
+
+
+typedef struct _test_context_t {
+    char root[64];
+    char ressource[128];
+} test_context_t;
+
+
+static void write_file(const char *path){
+    FILE *f = fopen(path, "w");
+    assert_non_null(f);
+    fputs("content", f);
+    fclose(f);
+}
+
+static void set_mtime(const char *path, time_t mtime){
+    struct utimbuf times = {.actime = mtime, .modtime = mtime};
+    assert_int_equal(utime(path, &times), 0);
+}
+
+static int setup_ressource_dir(void **state){
+    test_context_t *ctx = calloc(1, sizeof(test_context_t));
+    strcpy(ctx->root, "/tmp/sws_coding_XXXXXX");
+    assert_non_null(mkdtemp(ctx->root));
+
+    snprintf(ctx->ressource, sizeof(ctx->ressource), "%s/app.js", ctx->root);
+    write_file(ctx->ressource);
+
+    clear_precompressed_cache();
+    *state = ctx;
+    return 0;
+}
+
+static int destroy_ressource_dir(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    char cmd[128];
+
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", ctx->root);
+    assert_int_equal(system(cmd), 0);
+    free(ctx);
+    return 0;
+}
+
+
+static void test_parse_accept_encoding_typical_browser(void **state){
+    UNUSED state;
+    unsigned int accepted = parse_accept_encoding("gzip, deflate, br");
+
+    assert_true(accepted & CODING_MASK(CODING_GZIP));
+    assert_true(accepted & CODING_MASK(CODING_BROTLI));
+}
+
+static void test_parse_accept_encoding_zero_quality(void **state){
+    UNUSED state;
+    unsigned int accepted = parse_accept_encoding("br;q=0, gzip;q=0.5");
+
+    assert_true(accepted & CODING_MASK(CODING_GZIP));
+    assert_false(accepted & CODING_MASK(CODING_BROTLI));
+}
+
+static void test_parse_accept_encoding_wildcard(void **state){
+    UNUSED state;
+    unsigned int accepted = parse_accept_encoding("*");
+
+    assert_true(accepted & CODING_MASK(CODING_GZIP));
+    assert_true(accepted & CODING_MASK(CODING_BROTLI));
+}
+
+static void test_parse_accept_encoding_wildcard_after_refusal(void **state){
+    UNUSED state;
+    unsigned int accepted = parse_accept_encoding("gzip;q=0, *");
+
+    // The wildcard only covers codings that aren't listed
+    assert_false(accepted & CODING_MASK(CODING_GZIP));
+    assert_true(accepted & CODING_MASK(CODING_BROTLI));
+    assert_true(accepted & CODING_MASK(CODING_DEFLATE));
+
+    assert_false(parse_accept_encoding("*;q=0, br") & CODING_MASK(CODING_GZIP));
+}
+
+static void test_parse_accept_encoding_empty(void **state){
+    UNUSED state;
+
+    assert_int_equal(parse_accept_encoding(""), 0);
+    assert_int_equal(parse_accept_encoding("identity"), 0);
+    assert_int_equal(parse_accept_encoding(NULL), 0);
+}
+
+static void test_select_content_coding_prefers_brotli(void **state){
+    UNUSED state;
+    unsigned int both = CODING_MASK(CODING_GZIP) | CODING_MASK(CODING_BROTLI);
+
+    assert_int_equal(select_content_coding(both, both), CODING_BROTLI);
+    assert_int_equal(select_content_coding(CODING_MASK(CODING_GZIP), both), CODING_GZIP);
+    assert_int_equal(select_content_coding(CODING_MASK(CODING_BROTLI), CODING_MASK(CODING_GZIP)), CODING_IDENTITY);
+}
+
+static void test_get_precompressed_codings_no_siblings(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    struct stat info;
+
+    assert_int_equal(stat(ctx->ressource, &info), 0);
+    assert_int_equal(get_precompressed_codings(ctx->ressource, &info), 0);
+}
+
+static void test_get_precompressed_codings_finds_siblings(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    char sibling[160];
+    struct stat info;
+
+    snprintf(sibling, sizeof(sibling), "%s.gz", ctx->ressource);
+    write_file(sibling);
+
+    assert_int_equal(stat(ctx->ressource, &info), 0);
+    assert_int_equal(get_precompressed_codings(ctx->ressource, &info), CODING_MASK(CODING_GZIP));
+}
+
+static void test_get_precompressed_codings_is_cached(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    char sibling[160];
+    struct stat info;
+
+    assert_int_equal(stat(ctx->ressource, &info), 0);
+    assert_int_equal(get_precompressed_codings(ctx->ressource, &info), 0);
+
+    // Sibling appears but the ressource itself didn't change, so the lookup isn't redone
+    snprintf(sibling, sizeof(sibling), "%s.br", ctx->ressource);
+    write_file(sibling);
+    assert_int_equal(get_precompressed_codings(ctx->ressource, &info), 0);
+
+    // New version of the ressource invalidates the cached lookup
+    set_mtime(ctx->ressource, info.st_mtime - 10);
+    assert_int_equal(stat(ctx->ressource, &info), 0);
+    assert_int_equal(get_precompressed_codings(ctx->ressource, &info), CODING_MASK(CODING_BROTLI));
+}
+
+static void test_get_precompressed_codings_ignores_stale_siblings(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    char sibling[160];
+    struct stat info;
+
+    snprintf(sibling, sizeof(sibling), "%s.gz", ctx->ressource);
+    write_file(sibling);
+    set_mtime(sibling, 1000);
+
+    assert_int_equal(stat(ctx->ressource, &info), 0);
+    assert_int_equal(get_precompressed_codings(ctx->ressource, &info), 0);
+}
+
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_parse_accept_encoding_typical_browser),
+        cmocka_unit_test(test_parse_accept_encoding_zero_quality),
+        cmocka_unit_test(test_parse_accept_encoding_wildcard),
+        cmocka_unit_test(test_parse_accept_encoding_wildcard_after_refusal),
+        cmocka_unit_test(test_parse_accept_encoding_empty),
+        cmocka_unit_test(test_select_content_coding_prefers_brotli),
+        cmocka_unit_test_setup_teardown(test_get_precompressed_codings_no_siblings, setup_ressource_dir, destroy_ressource_dir),
+        cmocka_unit_test_setup_teardown(test_get_precompressed_codings_finds_siblings, setup_ressource_dir, destroy_ressource_dir),
+        cmocka_unit_test_setup_teardown(test_get_precompressed_codings_is_cached, setup_ressource_dir, destroy_ressource_dir),
+        cmocka_unit_test_setup_teardown(test_get_precompressed_codings_ignores_stale_siblings, setup_ressource_dir, destroy_ressource_dir),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -12,12 +12,18 @@
 #include <assert.h>
 #include "http_private.h"
 #include "command_line_private.h"
+#include "mime.h"
 
 
 typedef struct _http_test_t {
     http_req request;
 } http_test_t;
 
+static int setup_mime_registry(void **state){
+    mime_registry_init(NULL);
+    return 0;
+}
+
 static int setup_standard_request(void **state){
     http_test_t *test_data = calloc(1, sizeof(http_test_t)); 
     *state = test_data;
@@ -63,6 +69,28 @@ static void mock_valid_ressource(http_req request){
 }
 
 
+/**
+ * @brief Mock the syscalls made to open and size a valid ressource.
+ * 
+ * @param request request containing ressource that needs to be mocked.
+ * @param ressource_fd fd returned when opening the ressource.
+ * @param content_len size of the ressource.
+ */
+static void mock_valid_ressource_with_size(http_req request, int ressource_fd, int content_len){
+    mock_valid_ressource(request);
+
+    // Mock ressource size
+    expect_value(__wrap_fstat, __fd, ressource_fd);
+    will_return(__wrap_fstat, content_len);
+    will_return(__wrap_fstat, 0);
+
+    // Mock ressource fd creation
+    expect_string(__wrap_open, __file, request->_ressource_name);
+    expect_value(__wrap_open, __oflag, O_RDONLY);
+    will_return(__wrap_open, ressource_fd);
+}
+
+
 static void test_get_http_response_from_request_bad_request_version(void **state){    
     http_test_t *test_data = (http_test_t*) *state;
     strcpy(test_data->request->version, "0.0"); // 0.0 is invalid request version
@@ -262,6 +290,152 @@ static void test_get_http_response_from_request_valid_full_request(void **state)
     assert_int_equal(response->_content_len, content_len);
 }
 
+static void test_get_http_response_from_request_single_range(void **state){
+    int content_len = 1000;
+    int response_status_code;
+    int num_ranges;
+    off_t content_size;
+    off_t range_offset;
+    off_t range_len;
+    char headers[MAX_RESP_HEADERS_LEN];
+    char part_headers[MAX_RANGE_PART_HEADERS_LEN];
+
+    http_test_t *test_data = (http_test_t*) *state;
+    strcpy(test_data->request->_range, "bytes=100-199");
+
+    mock_valid_ressource_with_size(test_data->request, 5, content_len);
+
+    http_resp response = get_http_response_from_request(test_data->request);
+
+    assert_ptr_not_equal(response, NULL);
+
+    assert_int_equal(0, get_http_response_status_code(response, &response_status_code));
+    assert_int_equal(response_status_code, PARTIAL_CONTENT);
+
+    assert_int_equal(0, get_http_response_content_size(response, &content_size));
+    assert_int_equal(content_size, 100);
+
+    assert_int_equal(0, get_http_response_num_ranges(response, &num_ranges));
+    assert_int_equal(num_ranges, 1);
+
+    assert_int_equal(0, get_http_response_range(response, 0, &range_offset, &range_len, part_headers, MAX_RANGE_PART_HEADERS_LEN));
+    assert_int_equal(range_offset, 100);
+    assert_int_equal(range_len, 100);
+    assert_string_equal(part_headers, "");
+
+    get_http_response_headers(response, headers, MAX_RESP_HEADERS_LEN);
+    assert_non_null(strstr(headers, "Content-Range: bytes 100-199/1000"));
+    assert_non_null(strstr(headers, "Content-length: 100"));
+}
+
+static void test_get_http_response_from_request_suffix_and_open_ended_ranges(void **state){
+    int content_len = 1000;
+    int num_ranges;
+    off_t content_size;
+    off_t range_offset;
+    off_t range_len;
+    char headers[MAX_RESP_HEADERS_LEN];
+    char part_headers[MAX_RANGE_PART_HEADERS_LEN];
+    char trailer[MAX_RANGE_PART_HEADERS_LEN];
+
+    http_test_t *test_data = (http_test_t*) *state;
+    strcpy(test_data->request->_range, "bytes=-10, 990-");
+
+    mock_valid_ressource_with_size(test_data->request, 5, content_len);
+
+    http_resp response = get_http_response_from_request(test_data->request);
+
+    assert_ptr_not_equal(response, NULL);
+
+    assert_int_equal(0, get_http_response_num_ranges(response, &num_ranges));
+    assert_int_equal(num_ranges, 2);
+
+    get_http_response_headers(response, headers, MAX_RESP_HEADERS_LEN);
+    assert_non_null(strstr(headers, "Content-type: multipart/byteranges; boundary="));
+
+    // Content length must account for every part header and the closing boundary
+    off_t expected_len = 0;
+    for(int i = 0; i < num_ranges; i++){
+        assert_int_equal(0, get_http_response_range(response, i, &range_offset, &range_len, part_headers, MAX_RANGE_PART_HEADERS_LEN));
+        assert_int_equal(range_offset, 990);
+        assert_int_equal(range_len, 10);
+        assert_non_null(strstr(part_headers, "Content-Range: bytes 990-999/1000"));
+        expected_len += strlen(part_headers) + range_len;
+    }
+
+    assert_int_equal(0, get_http_response_range_trailer(response, trailer, MAX_RANGE_PART_HEADERS_LEN));
+    expected_len += strlen(trailer);
+
+    assert_int_equal(0, get_http_response_content_size(response, &content_size));
+    assert_int_equal(content_size, expected_len);
+}
+
+static void test_get_http_response_from_request_unsatisfiable_range(void **state){
+    int response_status_code;
+    off_t content_size;
+    char headers[MAX_RESP_HEADERS_LEN];
+
+    http_test_t *test_data = (http_test_t*) *state;
+    strcpy(test_data->request->_range, "bytes=1000-");
+
+    mock_valid_ressource_with_size(test_data->request, 5, 1000);
+
+    http_resp response = get_http_response_from_request(test_data->request);
+
+    assert_ptr_not_equal(response, NULL);
+
+    assert_int_equal(0, get_http_response_status_code(response, &response_status_code));
+    assert_int_equal(response_status_code, RANGE_NOT_SATISFIABLE);
+
+    assert_int_equal(0, get_http_response_content_size(response, &content_size));
+    assert_int_equal(content_size, 0);
+
+    get_http_response_headers(response, headers, MAX_RESP_HEADERS_LEN);
+    assert_non_null(strstr(headers, "Content-Range: bytes */1000"));
+}
+
+static void test_get_http_response_from_request_malformed_range_is_ignored(void **state){
+    int response_status_code;
+    off_t content_size;
+
+    http_test_t *test_data = (http_test_t*) *state;
+    strcpy(test_data->request->_range, "bytes=20-10");
+
+    mock_valid_ressource_with_size(test_data->request, 5, 1000);
+
+    http_resp response = get_http_response_from_request(test_data->request);
+
+    assert_ptr_not_equal(response, NULL);
+
+    assert_int_equal(0, get_http_response_status_code(response, &response_status_code));
+    assert_int_equal(response_status_code, OK);
+
+    assert_int_equal(0, get_http_response_content_size(response, &content_size));
+    assert_int_equal(content_size, 1000);
+}
+
+static void test_get_http_response_from_request_if_range_mismatch(void **state){
+    int response_status_code;
+    off_t content_size;
+
+    http_test_t *test_data = (http_test_t*) *state;
+    strcpy(test_data->request->_range, "bytes=0-9");
+    strcpy(test_data->request->_if_range, "\"stale-etag\"");
+
+    mock_valid_ressource_with_size(test_data->request, 5, 1000);
+
+    http_resp response = get_http_response_from_request(test_data->request);
+
+    assert_ptr_not_equal(response, NULL);
+
+    // Ressource changed since the client cached it, so the whole thing is sent
+    assert_int_equal(0, get_http_response_status_code(response, &response_status_code));
+    assert_int_equal(response_status_code, OK);
+
+    assert_int_equal(0, get_http_response_content_size(response, &content_size));
+    assert_int_equal(content_size, 1000);
+}
+
 static void test_get_http_response_from_request_valid_post_request(void **state){
     http_req dummy_request;
     alloc_http_request(&dummy_request);
@@ -294,6 +468,45 @@ static void test_get_http_response_from_request_valid_head_request(void **state)
     assert_int_equal(response->_return_code, 200);
 }
 
+static void test_get_http_response_from_request_compressed_while_sending(void **state){
+    off_t content_size;
+    content_coding stream_coding;
+    const char *body;
+    size_t body_len;
+    char headers[MAX_RESP_HEADERS_LEN];
+
+    // Cache too small to hold the ressource, so it's compressed while being sent
+    compression_config config = {.enabled = true, .level = 6, .min_size = 100, .cache_size = 1000, .types = "text/*"};
+    assert_int_equal(0, compression_init(&config));
+
+    http_test_t *test_data = (http_test_t*) *state;
+    strcpy(test_data->request->_accept_encoding, "gzip, deflate");
+
+    mock_valid_ressource_with_size(test_data->request, 5, 1000);
+
+    http_resp response = get_http_response_from_request(test_data->request);
+
+    assert_ptr_not_equal(response, NULL);
+
+    assert_int_equal(0, get_http_response_stream_coding(response, &stream_coding));
+    assert_int_equal(stream_coding, CODING_GZIP);
+
+    assert_int_equal(0, get_http_response_body(response, &body, &body_len));
+    assert_null(body);
+
+    assert_int_equal(0, get_http_response_content_size(response, &content_size));
+    assert_int_equal(content_size, 1000);
+
+    get_http_response_headers(response, headers, MAX_RESP_HEADERS_LEN);
+    assert_non_null(strstr(headers, "Content-Encoding: gzip"));
+    assert_non_null(strstr(headers, "Vary: Accept-Encoding"));
+    assert_null(strstr(headers, "Content-length"));
+    assert_null(strstr(headers, "Accept-Ranges"));
+
+    config.enabled = false;
+    compression_init(&config);
+}
+
 int main(void) {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test_setup_teardown(test_get_http_response_from_request_bad_request_version, setup_standard_request, destroy_standard_request),
@@ -303,9 +516,15 @@ int main(void) {
         cmocka_unit_test_setup_teardown(test_get_http_response_from_request_valid_full_request_invalid_ressource_permissions, setup_standard_request, destroy_standard_request),
         cmocka_unit_test_setup_teardown(test_get_http_response_from_request_valid_full_request_correct_content_type_for_image, setup_standard_request, destroy_standard_request),
         cmocka_unit_test_setup_teardown(test_get_http_response_from_request_valid_full_request, setup_standard_request, destroy_standard_request),
+        cmocka_unit_test_setup_teardown(test_get_http_response_from_request_single_range, setup_standard_request, destroy_standard_request),
+        cmocka_unit_test_setup_teardown(test_get_http_response_from_request_suffix_and_open_ended_ranges, setup_standard_request, destroy_standard_request),
+        cmocka_unit_test_setup_teardown(test_get_http_response_from_request_unsatisfiable_range, setup_standard_request, destroy_standard_request),
+        cmocka_unit_test_setup_teardown(test_get_http_response_from_request_malformed_range_is_ignored, setup_standard_request, destroy_standard_request),
+        cmocka_unit_test_setup_teardown(test_get_http_response_from_request_if_range_mismatch, setup_standard_request, destroy_standard_request),
+        cmocka_unit_test_setup_teardown(test_get_http_response_from_request_compressed_while_sending, setup_standard_request, destroy_standard_request),
         // cmocka_unit_test_setup_teardown(test_get_http_response_from_request_valid_post_request, setup_standard_request, destroy_standard_request),
         // cmocka_unit_test_setup_teardown(test_get_http_response_from_request_valid_head_request, setup_standard_request, destroy_standard_request),
     };
 
-    return cmocka_run_group_tests(tests, NULL, NULL);
+    return cmocka_run_group_tests(tests, setup_mime_registry, NULL);
 }
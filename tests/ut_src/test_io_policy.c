@@ -0,0 +1,188 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "io_policy.h"
+
+#define UNUSED (void)
+#define TEST_FILE_LEN (512 * 1024)
+#define TEST_READAHEAD_LEN (128 * 1024)
+
+
+typedef struct _test_context_t {
+    char path[64];
+    int fd;
+} test_context_t;
+
+
+static void configure_io_policy(long sequential_min_size, long dontneed_min_size, bool hugepages){
+    io_policy_config config = {.sequential_min_size = sequential_min_size,
+                               .readahead_size = TEST_READAHEAD_LEN,
+                               .dontneed_min_size = dontneed_min_size,
+                               .residency_sample_rate = 1,
+                               .hugepages = hugepages};
+
+    assert_int_equal(io_policy_init(&config), 0);
+}
+
+static int setup_file(void **state){
+    test_context_t *ctx = calloc(1, sizeof(test_context_t));
+    char *content = calloc(1, TEST_FILE_LEN);
+
+    strcpy(ctx->path, "/tmp/sws_io_policy_XXXXXX");
+    ctx->fd = mkstemp(ctx->path);
+    assert_true(ctx->fd != -1);
+    assert_int_equal(pwrite(ctx->fd, content, TEST_FILE_LEN, 0), TEST_FILE_LEN);
+
+    free(content);
+    *state = ctx;
+    return 0;
+}
+
+static int destroy_file(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+
+    close(ctx->fd);
+    unlink(ctx->path);
+    free(ctx);
+    return 0;
+}
+
+
+static void test_invalid_io_policy(void **state){
+    UNUSED state;
+    io_policy_config config = {.sequential_min_size = -1};
+
+    assert_int_equal(io_policy_init(&config), -1);
+    assert_int_equal(io_policy_init(NULL), -1);
+}
+
+static void test_large_transfer_is_read_ahead(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    io_policy_counters before;
+    io_policy_counters after;
+
+    configure_io_policy(TEST_FILE_LEN / 2, 0, false);
+    get_io_policy_counters(&before);
+
+    io_policy_before_send(ctx->fd, 0, TEST_FILE_LEN);
+    get_io_policy_counters(&after);
+
+    assert_int_equal(after.sequential_hints, before.sequential_hints + 1);
+    assert_int_equal(after.readahead_bytes, before.readahead_bytes + TEST_READAHEAD_LEN);
+
+    // Just written, so it's all in the page cache already
+    assert_int_equal(after.sampled_bytes, before.sampled_bytes + TEST_READAHEAD_LEN);
+    assert_int_equal(after.resident_bytes, before.resident_bytes + TEST_READAHEAD_LEN);
+}
+
+static void test_residency_sampled(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    io_policy_counters before;
+    io_policy_counters after;
+    io_policy_config config = {.sequential_min_size = TEST_FILE_LEN / 2,
+                               .readahead_size = TEST_READAHEAD_LEN,
+                               .residency_sample_rate = 4};
+
+    assert_int_equal(io_policy_init(&config), 0);
+    get_io_policy_counters(&before);
+
+    for(int i = 0; i < 8; i++){
+        io_policy_before_send(ctx->fd, 0, TEST_FILE_LEN);
+    }
+
+    get_io_policy_counters(&after);
+    assert_int_equal(after.readahead_bytes, before.readahead_bytes + 8 * TEST_READAHEAD_LEN);
+    assert_int_equal(after.sampled_bytes, before.sampled_bytes + 2 * TEST_READAHEAD_LEN);
+
+    // Never checked once disabled
+    config.residency_sample_rate = 0;
+    assert_int_equal(io_policy_init(&config), 0);
+    io_policy_before_send(ctx->fd, 0, TEST_FILE_LEN);
+    get_io_policy_counters(&before);
+    assert_int_equal(before.sampled_bytes, after.sampled_bytes);
+}
+
+static void test_small_transfer_is_left_alone(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    io_policy_counters before;
+    io_policy_counters after;
+
+    configure_io_policy(TEST_FILE_LEN / 2, TEST_FILE_LEN / 2, false);
+    get_io_policy_counters(&before);
+
+    io_policy_before_send(ctx->fd, 100, TEST_FILE_LEN / 4);
+    io_policy_after_send(ctx->fd, 100, TEST_FILE_LEN / 4);
+    get_io_policy_counters(&after);
+
+    assert_memory_equal(&before, &after, sizeof(io_policy_counters));
+}
+
+static void test_very_large_transfer_is_dropped(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    io_policy_counters before;
+    io_policy_counters after;
+
+    configure_io_policy(TEST_FILE_LEN / 2, TEST_FILE_LEN, false);
+    get_io_policy_counters(&before);
+
+    io_policy_after_send(ctx->fd, 0, TEST_FILE_LEN);
+    get_io_policy_counters(&after);
+
+    assert_int_equal(after.dontneed_hints, before.dontneed_hints + 1);
+    assert_int_equal(after.dontneed_bytes, before.dontneed_bytes + TEST_FILE_LEN);
+
+    // Disabled by default
+    io_policy_counters disabled;
+
+    configure_io_policy(TEST_FILE_LEN / 2, DEFAULT_IO_DONTNEED_MIN_SIZE, false);
+    io_policy_after_send(ctx->fd, 0, TEST_FILE_LEN);
+    get_io_policy_counters(&disabled);
+    assert_int_equal(disabled.dontneed_hints, after.dontneed_hints);
+}
+
+static void test_hugepage_mapping(void **state){
+    UNUSED state;
+    io_policy_counters before;
+    io_policy_counters after;
+    size_t map_len = 4 * 1024 * 1024;
+    void *map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    assert_true(map != MAP_FAILED);
+
+    configure_io_policy(0, 0, false);
+    get_io_policy_counters(&before);
+    io_policy_map(map, map_len);
+    get_io_policy_counters(&after);
+    assert_memory_equal(&before, &after, sizeof(io_policy_counters));
+
+    // Whether THP is available depends on the kernel, but the attempt is counted
+    configure_io_policy(0, 0, true);
+    io_policy_map(map, map_len);
+    get_io_policy_counters(&after);
+    assert_int_equal(after.hugepage_mappings + after.hugepage_failures,
+                     before.hugepage_mappings + before.hugepage_failures + 1);
+
+    munmap(map, map_len);
+}
+
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_invalid_io_policy),
+        cmocka_unit_test_setup_teardown(test_large_transfer_is_read_ahead, setup_file, destroy_file),
+        cmocka_unit_test_setup_teardown(test_residency_sampled, setup_file, destroy_file),
+        cmocka_unit_test_setup_teardown(test_small_transfer_is_left_alone, setup_file, destroy_file),
+        cmocka_unit_test_setup_teardown(test_very_large_transfer_is_dropped, setup_file, destroy_file),
+        cmocka_unit_test(test_hugepage_mapping),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,171 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "io_pool.h"
+
+#define UNUSED (void)
+#define TEST_FILE_LEN (256 * 1024)
+#define TEST_NUM_WORKERS 8
+#define TEST_LOOKUPS_PER_WORKER 50
+
+
+typedef struct _test_context_t {
+    char path[64];
+    int fd;
+} test_context_t;
+
+
+static int setup_file(void **state){
+    test_context_t *ctx = calloc(1, sizeof(test_context_t));
+    char *content = calloc(1, TEST_FILE_LEN);
+
+    strcpy(ctx->path, "/tmp/sws_io_pool_XXXXXX");
+    ctx->fd = mkstemp(ctx->path);
+    assert_true(ctx->fd != -1);
+    assert_int_equal(pwrite(ctx->fd, content, TEST_FILE_LEN, 0), TEST_FILE_LEN);
+
+    free(content);
+    *state = ctx;
+    return 0;
+}
+
+static int destroy_file(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+
+    io_pool_destroy();
+    close(ctx->fd);
+    unlink(ctx->path);
+    free(ctx);
+    return 0;
+}
+
+static unsigned long total_lookups(){
+    io_pool_counters counters;
+
+    get_io_pool_counters(&counters);
+    return counters.cached_lookups + counters.offloaded_lookups;
+}
+
+static void *lookup_repeatedly(void *args){
+    test_context_t *ctx = (test_context_t *) args;
+    io_lookup lookup;
+    long num_failures = 0;
+
+    for(int i = 0; i < TEST_LOOKUPS_PER_WORKER; i++){
+        if(io_pool_lookup(ctx->path, &lookup) != 0 || lookup.info.st_size != TEST_FILE_LEN){
+            num_failures++;
+        }
+
+        if(lookup.fd != -1) close(lookup.fd);
+    }
+
+    return (void *) num_failures;
+}
+
+
+static void test_invalid_io_pool(void **state){
+    UNUSED state;
+
+    assert_int_equal(io_pool_init(0), -1);
+    assert_int_equal(io_pool_init(MAX_IO_THREADS + 1), -1);
+    assert_false(io_pool_enabled());
+}
+
+
+static void test_lookup_without_pool(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    unsigned long lookups_before = total_lookups();
+    io_lookup lookup;
+
+    assert_false(io_pool_enabled());
+    assert_int_equal(io_pool_lookup(ctx->path, &lookup), 0);
+    assert_int_equal(lookup.error, 0);
+    assert_true(lookup.fd != -1);
+    assert_int_equal(lookup.info.st_size, TEST_FILE_LEN);
+
+    // Done inline, the pool never saw it
+    assert_int_equal(total_lookups(), lookups_before);
+    close(lookup.fd);
+}
+
+
+static void test_lookup_through_pool(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    unsigned long lookups_before = total_lookups();
+    io_lookup lookup;
+
+    assert_int_equal(io_pool_init(2), 0);
+    assert_true(io_pool_enabled());
+
+    // Cold or not, the lookup is resolved one way or the other
+    posix_fadvise(ctx->fd, 0, TEST_FILE_LEN, POSIX_FADV_DONTNEED);
+    assert_int_equal(io_pool_lookup(ctx->path, &lookup), 0);
+    assert_true(lookup.fd != -1);
+    assert_int_equal(lookup.info.st_size, TEST_FILE_LEN);
+    assert_int_equal(total_lookups(), lookups_before + 1);
+    close(lookup.fd);
+
+    io_pool_destroy();
+    assert_false(io_pool_enabled());
+}
+
+
+static void test_failed_lookups(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    char missing_path[sizeof(ctx->path) + 16];
+    io_lookup lookup;
+
+    snprintf(missing_path, sizeof(missing_path), "%s/missing", ctx->path);
+
+    assert_int_equal(io_pool_init(1), 0);
+
+    assert_int_equal(io_pool_lookup("/tmp/sws_io_pool_missing", &lookup), -1);
+    assert_int_equal(lookup.error, ENOENT);
+    assert_int_equal(lookup.fd, -1);
+
+    assert_int_equal(io_pool_lookup(missing_path, &lookup), -1);
+    assert_int_equal(lookup.error, ENOTDIR);
+    assert_int_equal(lookup.fd, -1);
+}
+
+
+static void test_concurrent_lookups(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    pthread_t workers[TEST_NUM_WORKERS];
+    void *num_failures;
+
+    // More workers than I/O threads, every one of them must still be woken up
+    assert_int_equal(io_pool_init(1), 0);
+
+    for(int i = 0; i < TEST_NUM_WORKERS; i++){
+        assert_int_equal(pthread_create(&workers[i], NULL, lookup_repeatedly, ctx), 0);
+    }
+
+    for(int i = 0; i < TEST_NUM_WORKERS; i++){
+        pthread_join(workers[i], &num_failures);
+        assert_int_equal((long) num_failures, 0);
+    }
+}
+
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_invalid_io_pool),
+        cmocka_unit_test_setup_teardown(test_lookup_without_pool, setup_file, destroy_file),
+        cmocka_unit_test_setup_teardown(test_lookup_through_pool, setup_file, destroy_file),
+        cmocka_unit_test_setup_teardown(test_failed_lookups, setup_file, destroy_file),
+        cmocka_unit_test_setup_teardown(test_concurrent_lookups, setup_file, destroy_file),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
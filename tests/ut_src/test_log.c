@@ -0,0 +1,197 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "log_private.h"
+
+#define UNUSED (void)
+#define TEST_NUM_THREADS 4
+#define TEST_MSGS_PER_THREAD 100
+
+
+typedef struct _test_context_t {
+    char out_path[64];
+    char err_path[64];
+    int saved_stdout;
+    int saved_stderr;
+} test_context_t;
+
+
+static int redirect_output(void **state){
+    test_context_t *ctx = calloc(1, sizeof(test_context_t));
+    int out_fd;
+    int err_fd;
+
+    strcpy(ctx->out_path, "/tmp/sws_log_out_XXXXXX");
+    strcpy(ctx->err_path, "/tmp/sws_log_err_XXXXXX");
+    out_fd = mkstemp(ctx->out_path);
+    err_fd = mkstemp(ctx->err_path);
+
+    fflush(stdout);
+    fflush(stderr);
+    ctx->saved_stdout = dup(STDOUT_FILENO);
+    ctx->saved_stderr = dup(STDERR_FILENO);
+    dup2(out_fd, STDOUT_FILENO);
+    dup2(err_fd, STDERR_FILENO);
+    close(out_fd);
+    close(err_fd);
+
+    *state = ctx;
+    return 0;
+}
+
+static int restore_output(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(ctx->saved_stdout, STDOUT_FILENO);
+    dup2(ctx->saved_stderr, STDERR_FILENO);
+    close(ctx->saved_stdout);
+    close(ctx->saved_stderr);
+    unlink(ctx->out_path);
+    unlink(ctx->err_path);
+    free(ctx);
+    return 0;
+}
+
+static char *read_output(const char *path){
+    FILE *f = fopen(path, "r");
+    char *content = calloc(1, 1024 * 1024);
+
+    assert_non_null(f);
+    fread(content, 1, 1024 * 1024 - 1, f);
+    fclose(f);
+    return content;
+}
+
+static void *log_numbered_messages(void *args){
+    long thread_num = (long) args;
+
+    for(int i = 0; i < TEST_MSGS_PER_THREAD; i++){
+        LOG(INFO, "thread %ld message %d\n", thread_num, i);
+    }
+
+    return NULL;
+}
+
+
+static int count_evaluations(int *num_evaluations){
+    return ++(*num_evaluations);
+}
+
+
+static void test_filtered_levels_skip_their_arguments(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    int num_evaluations = 0;
+
+    user_provided_log_level = WARNING;
+
+    LOG(INFO, "filtered out %d\n", count_evaluations(&num_evaluations));
+    LOG(MAX_LEVEL, "not a level %d\n", count_evaluations(&num_evaluations));
+    assert_int_equal(num_evaluations, 0);
+
+    LOG(WARNING, "written %d\n", count_evaluations(&num_evaluations));
+    assert_int_equal(num_evaluations, 1);
+    fflush(stderr);
+
+    char *err = read_output(ctx->err_path);
+    assert_string_equal(err, "WARNING:written 1\n");
+    free(err);
+
+    user_provided_log_level = DEFAULT;
+}
+
+
+static void test_log_levels_go_to_their_stream(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+
+    user_provided_log_level = INFO;
+    assert_int_equal(log_init(), 0);
+
+    LOG(DEBUG, "filtered out\n");
+    LOG(INFO, "to stdout %d\n", 1);
+    LOG(ERROR, "to stderr %s\n", "too");
+    log_flush();
+
+    char *out = read_output(ctx->out_path);
+    char *err = read_output(ctx->err_path);
+
+    assert_string_equal(out, "INFO:to stdout 1\n");
+    assert_string_equal(err, "ERROR:to stderr too\n");
+
+    free(out);
+    free(err);
+}
+
+
+static void test_concurrent_threads_keep_their_order(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    pthread_t threads[TEST_NUM_THREADS];
+    int next_msg[TEST_NUM_THREADS] = {0};
+    char *save_ptr;
+
+    assert_int_equal(log_init(), 0);
+
+    for(long i = 0; i < TEST_NUM_THREADS; i++){
+        assert_int_equal(pthread_create(&threads[i], NULL, log_numbered_messages, (void *) i), 0);
+    }
+
+    for(int i = 0; i < TEST_NUM_THREADS; i++){
+        pthread_join(threads[i], NULL);
+    }
+
+    log_flush();
+
+    // Rings can overflow under such a burst, but whatever is written stays in order
+    char *out = read_output(ctx->out_path);
+    int num_lines = 0;
+
+    for(char *line = strtok_r(out, "\n", &save_ptr); line; line = strtok_r(NULL, "\n", &save_ptr)){
+        long thread_num;
+        int msg_num;
+
+        assert_int_equal(sscanf(line, "INFO:thread %ld message %d", &thread_num, &msg_num), 2);
+        assert_true(msg_num >= next_msg[thread_num]);
+        next_msg[thread_num] = msg_num + 1;
+        num_lines++;
+    }
+
+    assert_true(num_lines > 0);
+    free(out);
+}
+
+
+static void test_synchronous_after_flush(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+
+    assert_int_equal(log_init(), 0);
+    log_flush();
+
+    LOG(WARNING, "written right away\n");
+    fflush(stderr);
+
+    char *err = read_output(ctx->err_path);
+    assert_string_equal(err, "WARNING:written right away\n");
+    free(err);
+}
+
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_filtered_levels_skip_their_arguments, redirect_output, restore_output),
+        cmocka_unit_test_setup_teardown(test_log_levels_go_to_their_stream, redirect_output, restore_output),
+        cmocka_unit_test_setup_teardown(test_concurrent_threads_keep_their_order, redirect_output, restore_output),
+        cmocka_unit_test_setup_teardown(test_synchronous_after_flush, redirect_output, restore_output),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,233 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "metrics_private.h"
+#include "http.h"
+
+#define UNUSED (void)
+#define TEST_NUM_THREADS 4
+#define TEST_REQUESTS_PER_THREAD 1000
+
+
+static void *count_requests(void *args){
+    UNUSED args;
+
+    for(int i = 0; i < TEST_REQUESTS_PER_THREAD; i++){
+        metrics_count_connection(true);
+        metrics_count_request(OK, 100, 2);
+        metrics_count_connection(false);
+    }
+
+    return NULL;
+}
+
+static void *time_stages(void *args){
+    UNUSED args;
+
+    for(int i = 0; i < TEST_REQUESTS_PER_THREAD; i++){
+        metrics_record_stage(STAGE_PARSE, metrics_now_ns() - 1000);
+    }
+
+    return NULL;
+}
+
+static char *scrape(const char *request){
+    int fds[2];
+    char *response = calloc(1, MAX_METRICS_RESPONSE_LEN);
+    size_t len = 0;
+    ssize_t rc;
+
+    assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    assert_int_equal(write(fds[0], request, strlen(request)), strlen(request));
+
+    serve_metrics_client(fds[1]);
+
+    while((rc = read(fds[0], response + len, MAX_METRICS_RESPONSE_LEN - 1 - len)) > 0){
+        len += rc;
+    }
+
+    close(fds[0]);
+    return response;
+}
+
+
+static void test_counters_add_up_across_threads(void **state){
+    UNUSED state;
+    pthread_t threads[TEST_NUM_THREADS];
+    metrics_totals before;
+    metrics_totals after;
+
+    get_metrics_totals(&before);
+
+    for(int i = 0; i < TEST_NUM_THREADS; i++){
+        assert_int_equal(pthread_create(&threads[i], NULL, count_requests, NULL), 0);
+    }
+
+    for(int i = 0; i < TEST_NUM_THREADS; i++){
+        pthread_join(threads[i], NULL);
+    }
+
+    get_metrics_totals(&after);
+
+    // metrics_status_codes starts with 200
+    assert_int_equal(after.requests[0] - before.requests[0], TEST_NUM_THREADS * TEST_REQUESTS_PER_THREAD);
+    assert_int_equal(after.sent_bytes - before.sent_bytes, TEST_NUM_THREADS * TEST_REQUESTS_PER_THREAD * 100);
+    assert_int_equal(after.busy_us - before.busy_us, TEST_NUM_THREADS * TEST_REQUESTS_PER_THREAD * 2);
+    assert_int_equal(after.connections_opened - before.connections_opened, TEST_NUM_THREADS * TEST_REQUESTS_PER_THREAD);
+    assert_int_equal(after.connections_closed - before.connections_closed, TEST_NUM_THREADS * TEST_REQUESTS_PER_THREAD);
+}
+
+
+static void test_unknown_status_counted_as_other(void **state){
+    UNUSED state;
+    metrics_totals before;
+    metrics_totals after;
+
+    get_metrics_totals(&before);
+    metrics_count_request(FILE_NOT_FOUND, 0, 1);
+    metrics_count_request(302, 0, 1);
+    metrics_count_cache_lookup(true);
+    metrics_count_cache_lookup(false);
+    get_metrics_totals(&after);
+
+    assert_int_equal(after.requests[4] - before.requests[4], 1);
+    assert_int_equal(after.requests[NUM_METRICS_STATUS_CODES] - before.requests[NUM_METRICS_STATUS_CODES], 1);
+    assert_int_equal(after.cache_hits - before.cache_hits, 1);
+    assert_int_equal(after.cache_misses - before.cache_misses, 1);
+}
+
+
+static void test_histogram_buckets(void **state){
+    UNUSED state;
+
+    // Exact below 2 * METRICS_SUB_BUCKETS, then within 1/16th
+    assert_int_equal(metrics_bucket_idx(0), 0);
+    assert_int_equal(metrics_bucket_idx(31), 31);
+    assert_int_equal(metrics_bucket_idx(32), metrics_bucket_idx(33));
+    assert_int_not_equal(metrics_bucket_idx(33), metrics_bucket_idx(34));
+    assert_int_equal(metrics_bucket_max_ns(metrics_bucket_idx(31)), 31);
+    assert_int_equal(metrics_bucket_max_ns(metrics_bucket_idx(1000000)), 1015807);
+
+    for(unsigned long ns = 1; ns < (1UL << 40); ns = ns * 3 + 1){
+        int idx = metrics_bucket_idx(ns);
+
+        assert_true(idx < NUM_METRICS_BUCKETS);
+        assert_true(metrics_bucket_max_ns(idx) >= ns);
+        assert_true(metrics_bucket_max_ns(idx) - ns <= ns / METRICS_SUB_BUCKETS);
+        assert_true(idx == 0 || metrics_bucket_max_ns(idx - 1) < ns);
+    }
+
+    // Longer than the histogram goes is still counted
+    assert_int_equal(metrics_bucket_idx(1UL << 50), NUM_METRICS_BUCKETS - 1);
+}
+
+
+static void test_percentiles(void **state){
+    UNUSED state;
+    unsigned long buckets[NUM_METRICS_BUCKETS] = {0};
+
+    assert_int_equal(get_metrics_percentile(buckets, 0, 0.99), 0);
+
+    // 98 fast requests, 2 slow ones
+    buckets[metrics_bucket_idx(10)] = 98;
+    buckets[metrics_bucket_idx(1000000)] = 2;
+
+    assert_int_equal(get_metrics_percentile(buckets, 100, 0.5), 10);
+    assert_int_equal(get_metrics_percentile(buckets, 100, 0.98), 10);
+    assert_int_equal(get_metrics_percentile(buckets, 100, 0.99), metrics_bucket_max_ns(metrics_bucket_idx(1000000)));
+    assert_int_equal(get_metrics_percentile(buckets, 100, 1), metrics_bucket_max_ns(metrics_bucket_idx(1000000)));
+}
+
+
+static void test_stages_merge_across_threads(void **state){
+    UNUSED state;
+    pthread_t threads[TEST_NUM_THREADS];
+    metrics_totals *before = malloc(sizeof(metrics_totals));
+    metrics_totals *after = malloc(sizeof(metrics_totals));
+
+    get_metrics_totals(before);
+
+    for(int i = 0; i < TEST_NUM_THREADS; i++){
+        assert_int_equal(pthread_create(&threads[i], NULL, time_stages, NULL), 0);
+    }
+
+    for(int i = 0; i < TEST_NUM_THREADS; i++){
+        pthread_join(threads[i], NULL);
+    }
+
+    get_metrics_totals(after);
+
+    assert_int_equal(after->stages[STAGE_PARSE].count - before->stages[STAGE_PARSE].count, TEST_NUM_THREADS * TEST_REQUESTS_PER_THREAD);
+    assert_int_equal(after->stages[STAGE_SEND].count - before->stages[STAGE_SEND].count, 0);
+    assert_true(after->stages[STAGE_PARSE].sum_ns > before->stages[STAGE_PARSE].sum_ns);
+
+    free(before);
+    free(after);
+}
+
+
+static void test_render(void **state){
+    UNUSED state;
+    metrics_config config = {.port = 0, .bbuf = NULL, .num_workers = 5};
+    char *metrics = calloc(1, MAX_METRICS_RESPONSE_LEN);
+
+    render_metrics(&config, metrics, MAX_METRICS_RESPONSE_LEN);
+
+    assert_non_null(strstr(metrics, "# TYPE sws_requests_total counter\nsws_requests_total{code=\"200\"} "));
+    assert_non_null(strstr(metrics, "\nsws_requests_total{code=\"other\"} "));
+    assert_non_null(strstr(metrics, "\nsws_active_connections "));
+    assert_non_null(strstr(metrics, "\nsws_queue_depth 0\n"));
+    assert_non_null(strstr(metrics, "\nsws_workers 5\n"));
+    assert_non_null(strstr(metrics, "# TYPE sws_stage_seconds summary\nsws_stage_seconds{stage=\"queue_wait\",quantile=\"0.5\"} "));
+    assert_non_null(strstr(metrics, "\nsws_stage_seconds{stage=\"send\",quantile=\"0.999\"} "));
+    assert_non_null(strstr(metrics, "\nsws_stage_seconds_count{stage=\"lookup\"} "));
+
+    // Cut short rather than overflowing
+    assert_int_equal(render_metrics(&config, metrics, 64), 63);
+    assert_int_equal(strlen(metrics), 63);
+
+    free(metrics);
+}
+
+
+static void test_scrape(void **state){
+    UNUSED state;
+    char *response = scrape("GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+
+    assert_int_equal(strncmp(response, "HTTP/1.1 200 OK\r\n", 17), 0);
+    assert_non_null(strstr(response, "Content-Type: text/plain; version=0.0.4\r\n"));
+    assert_non_null(strstr(response, "\r\n\r\n# HELP sws_requests_total"));
+    free(response);
+
+    response = scrape("GET /index.html HTTP/1.1\r\n\r\n");
+    assert_int_equal(strncmp(response, "HTTP/1.1 404 Not Found\r\n", 24), 0);
+    free(response);
+
+    response = scrape("GET /metricsfoo HTTP/1.1\r\n\r\n");
+    assert_int_equal(strncmp(response, "HTTP/1.1 404 Not Found\r\n", 24), 0);
+    free(response);
+}
+
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_counters_add_up_across_threads),
+        cmocka_unit_test(test_unknown_status_counted_as_other),
+        cmocka_unit_test(test_histogram_buckets),
+        cmocka_unit_test(test_percentiles),
+        cmocka_unit_test(test_stages_merge_across_threads),
+        cmocka_unit_test(test_render),
+        cmocka_unit_test(test_scrape),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,100 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mime_private.h"
+
+#define UNUSED (void)
+
+
+static int setup_mime_types_file(void **state){
+    char *path = calloc(1, 64);
+    FILE *f;
+
+    strcpy(path, "/tmp/sws_mime_XXXXXX");
+    int fd = mkstemp(path);
+    assert_true(fd != -1);
+
+    f = fdopen(fd, "w");
+    fputs("# MIME type          Extensions\n"
+          "text/css             css\n"
+          "\n"
+          "application/wasm     wasm\n"
+          "text/x-custom        cst   CST2 # trailing comment\n"
+          "text/html            html htm\n"
+          "application/x-ignored waytoolongextension\n", f);
+    fclose(f);
+
+    assert_true(mime_registry_init(path) > 0);
+    *state = path;
+    return 0;
+}
+
+static int destroy_mime_types_file(void **state){
+    unlink((char *) *state);
+    free(*state);
+    return 0;
+}
+
+
+static void test_get_mime_type_from_file(void **state){
+    UNUSED state;
+
+    assert_string_equal(get_mime_type("/srv/app.wasm"), "application/wasm");
+    assert_string_equal(get_mime_type("/srv/a.cst"), "text/x-custom");
+    assert_string_equal(get_mime_type("/srv/a.cst2"), "text/x-custom");
+}
+
+static void test_get_mime_type_uses_last_extension(void **state){
+    UNUSED state;
+
+    assert_string_equal(get_mime_type("./root/a.b/c.css"), "text/css");
+    assert_string_equal(get_mime_type("/srv/archive.tar.css"), "text/css");
+    assert_null(get_mime_type("./root/a.css/readme"));
+}
+
+static void test_get_mime_type_is_case_insensitive(void **state){
+    UNUSED state;
+
+    assert_string_equal(get_mime_type("/srv/INDEX.HTML"), "text/html");
+    assert_string_equal(get_mime_type("/srv/a.CsS"), "text/css");
+}
+
+static void test_get_mime_type_unknown(void **state){
+    UNUSED state;
+
+    assert_null(get_mime_type("/srv/data.bin"));
+    assert_null(get_mime_type("/srv/noextension"));
+    assert_null(get_mime_type("/srv/trailingdot."));
+    assert_null(get_mime_type("/srv/a.waytoolongextension"));
+    assert_null(get_mime_type(NULL));
+}
+
+static void test_builtin_types_without_file(void **state){
+    UNUSED state;
+
+    assert_int_equal(mime_registry_init("/non/existent/mime.types"), -1);
+
+    assert_string_equal(get_mime_type("/srv/index.html"), "text/html");
+    assert_string_equal(get_mime_type("/srv/photo.jpg"), "image/jpeg");
+    assert_null(get_mime_type("/srv/app.wasm"));
+}
+
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_get_mime_type_from_file),
+        cmocka_unit_test(test_get_mime_type_uses_last_extension),
+        cmocka_unit_test(test_get_mime_type_is_case_insensitive),
+        cmocka_unit_test(test_get_mime_type_unknown),
+        cmocka_unit_test(test_builtin_types_without_file),
+    };
+
+    return cmocka_run_group_tests(tests, setup_mime_types_file, destroy_mime_types_file);
+}
@@ -0,0 +1,89 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipeline_harness.h"
+#include "command_line.h"
+
+#define UNUSED (void)
+#define TEST_REQUESTS 20
+#define TEST_SMALL_FILE_LEN 2048
+#define TEST_LARGE_FILE_LEN (1024 * 1024)   // More than a socketpair holds, the response is read while it's sent
+#define MAX_TEST_WRITE_SYSCALLS 4           // Status line and headers, then the body
+
+
+static const harness_file test_files[] = {
+    {"index.html", TEST_SMALL_FILE_LEN},
+    {"large.bin", TEST_LARGE_FILE_LEN},
+};
+
+static char root[MAX_SERVER_ROOT_LEN];
+
+
+static int setup_root(void **state){
+    UNUSED state;
+    return harness_create_root(root, sizeof(root), test_files, 2);
+}
+
+static int destroy_root(void **state){
+    UNUSED state;
+    harness_remove_root(root, test_files, 2);
+    return 0;
+}
+
+
+static void test_serves_file(void **state){
+    UNUSED state;
+    harness_stats stats = {0};
+
+    assert_int_equal(harness_run("GET /index.html HTTP/1.1\r\nHost: localhost\r\n\r\n", 200, TEST_REQUESTS, &stats), 0);
+
+    assert_int_equal(stats.requests, TEST_REQUESTS);
+    assert_int_equal(stats.expected_responses, TEST_REQUESTS);
+    assert_true(stats.received_bytes > TEST_REQUESTS * TEST_SMALL_FILE_LEN);
+    assert_true(stats.cpu_ns > 0);
+    assert_true(stats.wall_ns >= stats.cpu_ns);
+
+    // Without task I/O accounting there is nothing to check
+    if(stats.write_syscalls != 0){
+        assert_true(stats.write_syscalls <= TEST_REQUESTS * MAX_TEST_WRITE_SYSCALLS);
+        assert_true(stats.read_syscalls >= TEST_REQUESTS);
+    }
+}
+
+
+static void test_large_file_read_while_sent(void **state){
+    UNUSED state;
+    harness_stats stats = {0};
+
+    assert_int_equal(harness_run("GET /large.bin HTTP/1.1\r\n\r\n", 200, 2, &stats), 0);
+
+    assert_int_equal(stats.expected_responses, 2);
+    assert_true(stats.received_bytes > 2 * TEST_LARGE_FILE_LEN);
+}
+
+
+static void test_missing_file(void **state){
+    UNUSED state;
+    harness_stats stats = {0};
+
+    assert_int_equal(harness_run("GET /missing.html HTTP/1.1\r\n\r\n", 404, TEST_REQUESTS, &stats), 0);
+
+    assert_int_equal(stats.expected_responses, TEST_REQUESTS);
+}
+
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_serves_file),
+        cmocka_unit_test(test_large_file_read_while_sent),
+        cmocka_unit_test(test_missing_file),
+    };
+
+    return cmocka_run_group_tests(tests, setup_root, destroy_root);
+}
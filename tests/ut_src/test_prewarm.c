@@ -0,0 +1,207 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "prewarm_private.h"
+#include "compression_private.h"
+#include "mime.h"
+
+#define UNUSED (void)
+#define TEST_PAGE_LEN (16 * 1024)
+#define TEST_IMAGE_LEN 4096
+
+
+typedef struct _test_context_t {
+    char root[64];
+    char source[128];
+} test_context_t;
+
+
+static void write_test_file(const char *dir, const char *name, const char *content, size_t len){
+    char path[256];
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    f = fopen(path, "w");
+    assert_non_null(f);
+    assert_int_equal(fwrite(content, 1, len, f), len);
+    fclose(f);
+}
+
+static int setup_root(void **state){
+    test_context_t *ctx = calloc(1, sizeof(test_context_t));
+    char *content = malloc(TEST_PAGE_LEN);
+    compression_config compression = {.enabled = true,
+                                      .level = 6,
+                                      .min_size = 100,
+                                      .cache_size = 1024 * 1024,
+                                      .types = "text/*"};
+
+    memset(content, 'a', TEST_PAGE_LEN);
+
+    strcpy(ctx->root, "/tmp/sws_prewarm_XXXXXX");
+    assert_non_null(mkdtemp(ctx->root));
+    snprintf(ctx->source, sizeof(ctx->source), "%s/paths.log", ctx->root);
+
+    write_test_file(ctx->root, "index.html", content, TEST_PAGE_LEN);
+    write_test_file(ctx->root, "logo.png", content, TEST_IMAGE_LEN);
+
+    mime_registry_init(NULL);
+    assert_int_equal(compression_init(&compression), 0);
+    clear_compressed_cache();
+
+    free(content);
+    *state = ctx;
+    return 0;
+}
+
+static int destroy_root(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    char path[256];
+
+    clear_compressed_cache();
+
+    snprintf(path, sizeof(path), "%s/index.html", ctx->root);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/logo.png", ctx->root);
+    unlink(path);
+    unlink(ctx->source);
+    rmdir(ctx->root);
+    free(ctx);
+    return 0;
+}
+
+
+static void test_parse_manifest_lines(void **state){
+    UNUSED state;
+    char uri[MAX_URI_LEN];
+
+    assert_int_equal(parse_prewarm_line("/index.html\n", uri), 0);
+    assert_string_equal(uri, "/index.html");
+
+    assert_int_equal(parse_prewarm_line("  /css/site.css?v=3\n", uri), 0);
+    assert_string_equal(uri, "/css/site.css");
+
+    assert_int_equal(parse_prewarm_line("# Most requested pages\n", uri), -1);
+    assert_int_equal(parse_prewarm_line("\n", uri), -1);
+    assert_int_equal(parse_prewarm_line("index.html\n", uri), -1);
+}
+
+
+static void test_parse_access_log_lines(void **state){
+    UNUSED state;
+    char uri[MAX_URI_LEN];
+
+    assert_int_equal(parse_prewarm_line("127.0.0.1 - - [10/Oct/2000:13:55:36 -0700] \"GET /logo.png HTTP/1.0\" 200 2326\n", uri), 0);
+    assert_string_equal(uri, "/logo.png");
+
+    assert_int_equal(parse_prewarm_line("127.0.0.1 - - [10/Oct/2000:13:55:36 -0700] \"GET / HTTP/1.1\" 200 25\n", uri), 0);
+    assert_string_equal(uri, "/");
+
+    // Only what's served from the server root is worth warming
+    assert_int_equal(parse_prewarm_line("127.0.0.1 - - [10/Oct/2000:13:55:36 -0700] \"POST /form HTTP/1.0\" 400 0\n", uri), -1);
+    assert_int_equal(parse_prewarm_line("127.0.0.1 - - [10/Oct/2000:13:55:36 -0700] \"-\" 400 0\n", uri), -1);
+}
+
+
+static void test_select_most_requested(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    const char *log = "1.2.3.4 - - [10/Oct/2000:13:55:36 -0700] \"GET /b HTTP/1.0\" 200 1\n"
+                      "1.2.3.4 - - [10/Oct/2000:13:55:36 -0700] \"GET /a HTTP/1.0\" 200 1\n"
+                      "1.2.3.4 - - [10/Oct/2000:13:55:36 -0700] \"GET /c HTTP/1.0\" 200 1\n"
+                      "1.2.3.4 - - [10/Oct/2000:13:55:36 -0700] \"GET /a?x=1 HTTP/1.0\" 200 1\n"
+                      "1.2.3.4 - - [10/Oct/2000:13:55:36 -0700] \"GET /c HTTP/1.0\" 200 1\n"
+                      "1.2.3.4 - - [10/Oct/2000:13:55:36 -0700] \"GET /a HTTP/1.0\" 200 1\n";
+    prewarm_path *paths;
+
+    write_test_file(ctx->root, "paths.log", log, strlen(log));
+
+    assert_int_equal(select_prewarm_paths(ctx->source, 2, &paths), 2);
+    assert_string_equal(paths[0].uri, "/a");
+    assert_int_equal(paths[0].hits, 3);
+    assert_string_equal(paths[1].uri, "/c");
+    assert_int_equal(paths[1].hits, 2);
+    free(paths);
+
+    assert_int_equal(select_prewarm_paths(ctx->source, 10, &paths), 3);
+    assert_string_equal(paths[2].uri, "/b");
+    free(paths);
+
+    assert_int_equal(select_prewarm_paths("/tmp/sws_prewarm_missing.log", 10, &paths), -1);
+}
+
+
+static void test_manifest_keeps_its_order(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    const char *manifest = "/c\n/a\n# Not a path\n/b\n";
+    prewarm_path *paths;
+
+    write_test_file(ctx->root, "paths.log", manifest, strlen(manifest));
+
+    assert_int_equal(select_prewarm_paths(ctx->source, 10, &paths), 3);
+    assert_string_equal(paths[0].uri, "/c");
+    assert_string_equal(paths[1].uri, "/a");
+    assert_string_equal(paths[2].uri, "/b");
+    free(paths);
+}
+
+
+static void test_prewarm_run(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    const char *manifest = "/\n/logo.png\n/missing.html\n/../etc/passwd\n";
+    prewarm_config config = {.source = ctx->source, .server_root = ctx->root, .top = 10, .budget = 0};
+    prewarm_stats stats;
+
+    write_test_file(ctx->root, "paths.log", manifest, strlen(manifest));
+
+    assert_int_equal(prewarm_run(&config, &stats), 0);
+    assert_int_equal(stats.num_paths, 4);
+    assert_int_equal(stats.num_warmed, 2);
+    assert_int_equal(stats.bytes, TEST_PAGE_LEN + TEST_IMAGE_LEN);
+
+    // Only the page is compressible, it's now in the compressed response cache
+    assert_int_equal(stats.num_compressed, 1);
+    assert_true(get_compressed_cache_usage() > 0);
+}
+
+
+static void test_prewarm_run_paced(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    const char *manifest = "/\n/logo.png\n";
+    prewarm_config config = {.source = ctx->source, .server_root = ctx->root, .top = 10, .budget = TEST_PAGE_LEN * 2};
+    prewarm_stats stats;
+    struct timespec start;
+    struct timespec end;
+
+    write_test_file(ctx->root, "paths.log", manifest, strlen(manifest));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    assert_int_equal(prewarm_run(&config, &stats), 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // The page alone is half the budget, the image is read after a pause
+    assert_int_equal(stats.bytes, TEST_PAGE_LEN + TEST_IMAGE_LEN);
+    assert_true((end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000 >= 500);
+}
+
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_parse_manifest_lines),
+        cmocka_unit_test(test_parse_access_log_lines),
+        cmocka_unit_test_setup_teardown(test_select_most_requested, setup_root, destroy_root),
+        cmocka_unit_test_setup_teardown(test_manifest_keeps_its_order, setup_root, destroy_root),
+        cmocka_unit_test_setup_teardown(test_prewarm_run, setup_root, destroy_root),
+        cmocka_unit_test_setup_teardown(test_prewarm_run_paced, setup_root, destroy_root),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,181 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "rate_limit.h"
+
+#define UNUSED (void)
+#define TEST_MAX_FDS 64
+#define NUM_TEST_CLIENTS (RATE_LIMIT_SHARDS * RATE_LIMIT_SHARD_SLOTS * 2)
+
+
+static void sleep_ms(long ms){
+    struct timespec duration = {.tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000};
+    nanosleep(&duration, NULL);
+}
+
+static struct sockaddr_in ipv4_address(uint32_t ip){
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(40000)};
+
+    addr.sin_addr.s_addr = htonl(ip);
+    return addr;
+}
+
+static void start_limiting(int requests_per_sec, int burst, int max_connections){
+    rate_limit_config config = {.requests_per_sec = requests_per_sec,
+                                .burst = burst,
+                                .max_connections = max_connections,
+                                .max_fds = TEST_MAX_FDS};
+
+    assert_int_equal(rate_limit_init(&config), 0);
+    assert_true(rate_limit_enabled());
+}
+
+static int stop_limiting(void **state){
+    UNUSED state;
+
+    rate_limit_destroy();
+    assert_false(rate_limit_enabled());
+    return 0;
+}
+
+
+static void test_disabled_allows_everything(void **state){
+    UNUSED state;
+    rate_limit_config config = {.max_fds = TEST_MAX_FDS};
+    struct sockaddr_in client = ipv4_address(0x0a000001);
+
+    assert_int_equal(rate_limit_init(&config), 0);
+    assert_false(rate_limit_enabled());
+
+    for(int i = 0; i < 100; i++){
+        assert_int_equal(rate_limit_admit(i % TEST_MAX_FDS, (struct sockaddr *) &client), RATE_LIMIT_ALLOW);
+    }
+
+    config.requests_per_sec = -1;
+    assert_int_equal(rate_limit_init(&config), -1);
+}
+
+
+static void test_burst_then_refill(void **state){
+    UNUSED state;
+    struct sockaddr_in client = ipv4_address(0x0a000001);
+
+    start_limiting(10, 5, 0);
+
+    for(int i = 0; i < 5; i++){
+        assert_int_equal(rate_limit_admit(i, (struct sockaddr *) &client), RATE_LIMIT_ALLOW);
+    }
+
+    assert_int_equal(rate_limit_admit(5, (struct sockaddr *) &client), RATE_LIMIT_TOO_MANY_REQUESTS);
+
+    // A request every 100ms comes back
+    sleep_ms(250);
+    assert_int_equal(rate_limit_admit(6, (struct sockaddr *) &client), RATE_LIMIT_ALLOW);
+    assert_int_equal(rate_limit_admit(7, (struct sockaddr *) &client), RATE_LIMIT_ALLOW);
+    assert_int_equal(rate_limit_admit(8, (struct sockaddr *) &client), RATE_LIMIT_TOO_MANY_REQUESTS);
+}
+
+
+static void test_clients_limited_separately(void **state){
+    UNUSED state;
+    struct sockaddr_in greedy = ipv4_address(0x0a000001);
+    struct sockaddr_in polite = ipv4_address(0x0a000002);
+    struct sockaddr_in6 greedy_mapped = {.sin6_family = AF_INET6};
+
+    start_limiting(1, 2, 0);
+
+    assert_int_equal(rate_limit_admit(1, (struct sockaddr *) &greedy), RATE_LIMIT_ALLOW);
+    assert_int_equal(rate_limit_admit(2, (struct sockaddr *) &greedy), RATE_LIMIT_ALLOW);
+    assert_int_equal(rate_limit_admit(3, (struct sockaddr *) &greedy), RATE_LIMIT_TOO_MANY_REQUESTS);
+
+    assert_int_equal(rate_limit_admit(4, (struct sockaddr *) &polite), RATE_LIMIT_ALLOW);
+
+    // The same client connecting over IPv6 shares its bucket
+    assert_int_equal(inet_pton(AF_INET6, "::ffff:10.0.0.1", &(greedy_mapped.sin6_addr)), 1);
+    assert_int_equal(rate_limit_admit(5, (struct sockaddr *) &greedy_mapped), RATE_LIMIT_TOO_MANY_REQUESTS);
+}
+
+
+static void test_connection_limit(void **state){
+    UNUSED state;
+    struct sockaddr_in client = ipv4_address(0x0a000001);
+
+    start_limiting(0, 0, 2);
+
+    assert_int_equal(rate_limit_admit(10, (struct sockaddr *) &client), RATE_LIMIT_ALLOW);
+    assert_int_equal(rate_limit_admit(11, (struct sockaddr *) &client), RATE_LIMIT_ALLOW);
+    assert_int_equal(rate_limit_admit(12, (struct sockaddr *) &client), RATE_LIMIT_TOO_MANY_CONNECTIONS);
+
+    // Released twice as a close site would never do, only counted once
+    rate_limit_release(10);
+    rate_limit_release(10);
+    rate_limit_release(12);
+
+    assert_int_equal(rate_limit_admit(12, (struct sockaddr *) &client), RATE_LIMIT_ALLOW);
+    assert_int_equal(rate_limit_admit(13, (struct sockaddr *) &client), RATE_LIMIT_TOO_MANY_CONNECTIONS);
+}
+
+
+static void test_rejected_request_keeps_connection_free(void **state){
+    UNUSED state;
+    struct sockaddr_in client = ipv4_address(0x0a000001);
+
+    start_limiting(1, 1, 1);
+
+    assert_int_equal(rate_limit_admit(1, (struct sockaddr *) &client), RATE_LIMIT_ALLOW);
+    rate_limit_release(1);
+
+    // Out of requests, the connection wasn't counted
+    assert_int_equal(rate_limit_admit(2, (struct sockaddr *) &client), RATE_LIMIT_TOO_MANY_REQUESTS);
+
+    sleep_ms(1100);
+    assert_int_equal(rate_limit_admit(3, (struct sockaddr *) &client), RATE_LIMIT_ALLOW);
+    assert_int_equal(rate_limit_admit(4, (struct sockaddr *) &client), RATE_LIMIT_TOO_MANY_CONNECTIONS);
+}
+
+
+static void test_more_clients_than_entries(void **state){
+    UNUSED state;
+    struct sockaddr_in client;
+    int limited = 0;
+
+    start_limiting(1, 1, 0);
+
+    // Clients without an entry left for them aren't limited
+    for(uint32_t i = 0; i < NUM_TEST_CLIENTS; i++){
+        client = ipv4_address(0x0b000000 + i);
+        assert_int_equal(rate_limit_admit(-1, (struct sockaddr *) &client), RATE_LIMIT_ALLOW);
+    }
+
+    // Most of them still have their entry
+    for(uint32_t i = 0; i < NUM_TEST_CLIENTS; i++){
+        client = ipv4_address(0x0b000000 + i);
+        limited += rate_limit_admit(-1, (struct sockaddr *) &client) == RATE_LIMIT_TOO_MANY_REQUESTS;
+    }
+
+    assert_true(limited > RATE_LIMIT_SHARDS * RATE_LIMIT_SHARD_SLOTS / 2);
+    assert_true(limited <= RATE_LIMIT_SHARDS * RATE_LIMIT_SHARD_SLOTS);
+}
+
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_teardown(test_disabled_allows_everything, stop_limiting),
+        cmocka_unit_test_teardown(test_burst_then_refill, stop_limiting),
+        cmocka_unit_test_teardown(test_clients_limited_separately, stop_limiting),
+        cmocka_unit_test_teardown(test_connection_limit, stop_limiting),
+        cmocka_unit_test_teardown(test_rejected_request_keeps_connection_free, stop_limiting),
+        cmocka_unit_test_teardown(test_more_clients_than_entries, stop_limiting),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,228 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "receiver.h"
+
+#define TEST_IDLE_TIMEOUT_MS 300
+#define TEST_HEADER_TIMEOUT_MS 800
+#define TEST_WAIT_MS 2000
+
+
+typedef struct _test_context_t {
+    bbuf_t bbuf;
+    int sockets[2];     /**< Client end, then the end submitted to the receivers. */
+} test_context_t;
+
+
+static void sleep_ms(long ms){
+    struct timespec duration = {.tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000};
+    nanosleep(&duration, NULL);
+}
+
+/**
+ * @brief Wait for a connection to show up in the bounded buffer.
+ */
+static bool wait_for_insert(bbuf_t bbuf, long max_ms){
+    for(long waited = 0; waited < max_ms; waited += 10){
+        if(get_bbuf_items(bbuf) > 0){
+            return true;
+        }
+
+        sleep_ms(10);
+    }
+
+    return get_bbuf_items(bbuf) > 0;
+}
+
+/**
+ * @brief Wait for the receivers to close their end of a connection, reset if they didn't read everything.
+ */
+static bool wait_for_close(int client_fd, long max_ms){
+    struct pollfd pfd = {.fd = client_fd, .events = POLLIN};
+    char c;
+
+    return poll(&pfd, 1, max_ms) == 1 && read(client_fd, &c, 1) <= 0;
+}
+
+static int setup_receiver_pool(void **state){
+    test_context_t *ctx = calloc(1, sizeof(test_context_t));
+    receiver_config config = {.num_threads = 2,
+                              .idle_timeout_ms = TEST_IDLE_TIMEOUT_MS,
+                              .header_timeout_ms = TEST_HEADER_TIMEOUT_MS};
+
+    ctx->bbuf = bbuf_init();
+    config.bbuf = ctx->bbuf;
+    assert_int_equal(receiver_pool_init(&config), 0);
+    assert_true(receiver_pool_running());
+    assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, ctx->sockets), 0);
+
+    *state = ctx;
+    return 0;
+}
+
+static int destroy_receiver_pool(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    int fd;
+
+    receiver_pool_destroy();
+    assert_false(receiver_pool_running());
+
+    while(get_bbuf_items(ctx->bbuf) > 0){
+        bbuf_remove(ctx->bbuf, &fd);
+        close(fd);
+    }
+
+    close(ctx->sockets[0]);
+    bbuf_destroy(ctx->bbuf);
+    free(ctx);
+    return 0;
+}
+
+
+static void test_complete_request_inserted(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    const char *request = "GET /index.html HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    int fd;
+
+    assert_int_equal(write(ctx->sockets[0], request, strlen(request)), strlen(request));
+    assert_int_equal(receiver_submit(ctx->sockets[1]), 0);
+
+    assert_true(wait_for_insert(ctx->bbuf, TEST_WAIT_MS));
+    assert_int_equal(bbuf_remove(ctx->bbuf, &fd), 0);
+    assert_int_equal(fd, ctx->sockets[1]);
+    close(fd);
+}
+
+
+static void test_simple_request_inserted(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+
+    assert_int_equal(receiver_submit(ctx->sockets[1]), 0);
+    sleep_ms(50);
+
+    // Simple requests end with their request line
+    assert_int_equal(write(ctx->sockets[0], "GET /\r\n", 7), 7);
+    assert_true(wait_for_insert(ctx->bbuf, TEST_WAIT_MS));
+}
+
+
+static void test_request_arriving_in_parts(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    const char *request_line = "GET /index.html HTTP/1.1\r\n";
+    const char *headers = "Host: localhost\r\n\r\n";
+
+    assert_int_equal(receiver_submit(ctx->sockets[1]), 0);
+    assert_int_equal(write(ctx->sockets[0], request_line, strlen(request_line)), strlen(request_line));
+    sleep_ms(100);
+    assert_int_equal(get_bbuf_items(ctx->bbuf), 0);
+
+    assert_int_equal(write(ctx->sockets[0], headers, strlen(headers)), strlen(headers));
+    assert_true(wait_for_insert(ctx->bbuf, TEST_WAIT_MS));
+}
+
+
+static void test_idle_connection_closed(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+
+    assert_int_equal(receiver_submit(ctx->sockets[1]), 0);
+
+    assert_true(wait_for_close(ctx->sockets[0], TEST_WAIT_MS));
+    assert_int_equal(get_bbuf_items(ctx->bbuf), 0);
+}
+
+
+static void test_trickled_request_closed(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    struct pollfd pfd = {.fd = ctx->sockets[0], .events = POLLIN};
+    int bytes_sent = 0;
+
+    assert_int_equal(receiver_submit(ctx->sockets[1]), 0);
+
+    // Each byte comes before the idle timeout, the header timeout still closes the connection
+    while(bytes_sent * 100 < TEST_WAIT_MS && poll(&pfd, 1, 100) == 0){
+        assert_int_equal(write(ctx->sockets[0], "G", 1), 1);
+        bytes_sent++;
+    }
+
+    assert_true(wait_for_close(ctx->sockets[0], 0));
+    assert_true(bytes_sent * 100 >= TEST_HEADER_TIMEOUT_MS - 100);
+    assert_int_equal(get_bbuf_items(ctx->bbuf), 0);
+}
+
+
+static void test_waiting_connection_closed_on_destroy(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+
+    assert_int_equal(receiver_submit(ctx->sockets[1]), 0);
+    sleep_ms(50);
+    receiver_pool_destroy();
+
+    assert_true(wait_for_close(ctx->sockets[0], 0));
+    assert_int_equal(receiver_submit(ctx->sockets[0]), -1);
+}
+
+static void test_full_buffer_keeps_timers_running(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    const char *request = "GET /index.html HTTP/1.1\r\n\r\n";
+    receiver_config config = {.bbuf = ctx->bbuf,
+                              .num_threads = 1,
+                              .idle_timeout_ms = TEST_IDLE_TIMEOUT_MS,
+                              .header_timeout_ms = TEST_HEADER_TIMEOUT_MS};
+    int idle_sockets[2];
+    int fd = -1;
+
+    // A single receiver thread, so a blocked hand over would stall every timer
+    receiver_pool_destroy();
+    assert_int_equal(receiver_pool_init(&config), 0);
+
+    while(get_bbuf_slots(ctx->bbuf) > 0){
+        assert_int_equal(bbuf_insert(ctx->bbuf, -1), 0);
+    }
+
+    assert_int_equal(write(ctx->sockets[0], request, strlen(request)), strlen(request));
+    assert_int_equal(receiver_submit(ctx->sockets[1]), 0);
+
+    assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, idle_sockets), 0);
+    assert_int_equal(receiver_submit(idle_sockets[1]), 0);
+    assert_true(wait_for_close(idle_sockets[0], TEST_WAIT_MS));
+    close(idle_sockets[0]);
+
+    // The request goes in as soon as a slot frees up
+    assert_int_equal(bbuf_remove(ctx->bbuf, NULL), 0);
+
+    for(long waited = 0; waited < TEST_WAIT_MS && get_bbuf_slots(ctx->bbuf) > 0; waited += 10){
+        sleep_ms(10);
+    }
+
+    while(get_bbuf_items(ctx->bbuf) > 0 && fd == -1){
+        bbuf_remove(ctx->bbuf, &fd);
+    }
+
+    assert_int_equal(fd, ctx->sockets[1]);
+    close(fd);
+}
+
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_complete_request_inserted, setup_receiver_pool, destroy_receiver_pool),
+        cmocka_unit_test_setup_teardown(test_simple_request_inserted, setup_receiver_pool, destroy_receiver_pool),
+        cmocka_unit_test_setup_teardown(test_request_arriving_in_parts, setup_receiver_pool, destroy_receiver_pool),
+        cmocka_unit_test_setup_teardown(test_idle_connection_closed, setup_receiver_pool, destroy_receiver_pool),
+        cmocka_unit_test_setup_teardown(test_trickled_request_closed, setup_receiver_pool, destroy_receiver_pool),
+        cmocka_unit_test_setup_teardown(test_waiting_connection_closed_on_destroy, setup_receiver_pool, destroy_receiver_pool),
+        cmocka_unit_test_setup_teardown(test_full_buffer_keeps_timers_running, setup_receiver_pool, destroy_receiver_pool),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
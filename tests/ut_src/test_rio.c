@@ -0,0 +1,161 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "rio.h"
+
+#define TEST_FILE_LEN (1024 * 1024) // Way more than a socket buffer holds
+#define TEST_CHUNK_SIZE (16 * 1024)
+
+
+typedef struct _test_context_t {
+    char path[64];
+    int file_fd;
+    int sockets[2];  // Server writes to 0, client reads from 1
+    char *content;
+} test_context_t;
+
+
+static size_t drain(int fd, char *buf, size_t max_len){
+    size_t total = 0;
+    ssize_t bytes_read;
+
+    while(total < max_len && (bytes_read = read(fd, buf + total, max_len - total)) > 0){
+        total += bytes_read;
+    }
+
+    return total;
+}
+
+static int setup_transfer(void **state){
+    test_context_t *ctx = calloc(1, sizeof(test_context_t));
+
+    strcpy(ctx->path, "/tmp/sws_rio_XXXXXX");
+    ctx->file_fd = mkstemp(ctx->path);
+    assert_true(ctx->file_fd != -1);
+
+    ctx->content = malloc(TEST_FILE_LEN);
+    for(int i = 0; i < TEST_FILE_LEN; i++){
+        ctx->content[i] = 'a' + i % 26;
+    }
+    assert_int_equal(pwrite(ctx->file_fd, ctx->content, TEST_FILE_LEN, 0), TEST_FILE_LEN);
+
+    assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, ctx->sockets), 0);
+    fcntl(ctx->sockets[0], F_SETFL, O_NONBLOCK);
+    fcntl(ctx->sockets[1], F_SETFL, O_NONBLOCK);
+
+    *state = ctx;
+    return 0;
+}
+
+static int destroy_transfer(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+
+    close(ctx->sockets[0]);
+    close(ctx->sockets[1]);
+    close(ctx->file_fd);
+    unlink(ctx->path);
+    free(ctx->content);
+    free(ctx);
+    return 0;
+}
+
+
+static void test_sendfile_op_yields_when_blocked(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    char *received = malloc(TEST_FILE_LEN);
+    size_t num_received = 0;
+    sendfile_op op;
+    sendfile_status status;
+    bool was_blocked = false;
+
+    sendfile_op_init(&op, ctx->sockets[0], ctx->file_fd, 0, TEST_FILE_LEN, TEST_CHUNK_SIZE);
+
+    while((status = sendfile_op_resume(&op)) != SENDFILE_DONE){
+        assert_int_not_equal(status, SENDFILE_ERROR);
+
+        if(status == SENDFILE_BLOCKED){
+            was_blocked = true;
+            num_received += drain(ctx->sockets[1], received + num_received, TEST_FILE_LEN - num_received);
+        }
+    }
+
+    num_received += drain(ctx->sockets[1], received + num_received, TEST_FILE_LEN - num_received);
+
+    assert_true(was_blocked);
+    assert_int_equal(op.remaining, 0);
+    assert_int_equal(num_received, TEST_FILE_LEN);
+    assert_memory_equal(received, ctx->content, TEST_FILE_LEN);
+    free(received);
+}
+
+static void test_sendfile_op_sends_one_chunk_at_a_time(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    char received[TEST_CHUNK_SIZE];
+    sendfile_op op;
+
+    // Starts at an offset, and the file offset isn't used
+    sendfile_op_init(&op, ctx->sockets[0], ctx->file_fd, 100, 3 * TEST_CHUNK_SIZE, TEST_CHUNK_SIZE);
+
+    assert_int_equal(sendfile_op_resume(&op), SENDFILE_PENDING);
+    assert_int_equal(op.remaining, 2 * TEST_CHUNK_SIZE);
+    assert_int_equal(op.offset, 100 + TEST_CHUNK_SIZE);
+    assert_int_equal(lseek(ctx->file_fd, 0, SEEK_CUR), 0);
+
+    assert_int_equal(drain(ctx->sockets[1], received, TEST_CHUNK_SIZE), TEST_CHUNK_SIZE);
+    assert_memory_equal(received, ctx->content + 100, TEST_CHUNK_SIZE);
+}
+
+static void test_sendfile_op_past_end_of_file(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    sendfile_op op;
+
+    sendfile_op_init(&op, ctx->sockets[0], ctx->file_fd, TEST_FILE_LEN - 10, 20, 0);
+
+    assert_int_equal(sendfile_op_resume(&op), SENDFILE_ERROR);
+    assert_int_equal(op.remaining, 10);
+}
+
+static void test_writen_b_waits_for_slow_reader(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    char *received = malloc(TEST_FILE_LEN);
+    size_t num_received = 0;
+
+    // The reader only catches up after writen_b filled the socket
+    if(fork() == 0){
+        usleep(50000);
+        while(num_received < TEST_FILE_LEN){
+            num_received += drain(ctx->sockets[1], received + num_received, TEST_FILE_LEN - num_received);
+        }
+        _exit(memcmp(received, ctx->content, TEST_FILE_LEN) == 0 ? 0 : 1);
+    }
+
+    assert_int_equal(writen_b(ctx->sockets[0], ctx->content, TEST_FILE_LEN), 0);
+
+    int child_status;
+    wait(&child_status);
+    assert_int_equal(WEXITSTATUS(child_status), 0);
+    free(received);
+}
+
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_sendfile_op_yields_when_blocked, setup_transfer, destroy_transfer),
+        cmocka_unit_test_setup_teardown(test_sendfile_op_sends_one_chunk_at_a_time, setup_transfer, destroy_transfer),
+        cmocka_unit_test_setup_teardown(test_sendfile_op_past_end_of_file, setup_transfer, destroy_transfer),
+        cmocka_unit_test_setup_teardown(test_writen_b_waits_for_slow_reader, setup_transfer, destroy_transfer),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,202 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "root_index_private.h"
+#include "mime.h"
+
+#define UNUSED (void)
+
+
+typedef struct _test_context_t {
+    char root[64];
+    volatile bool rebuilt;
+} test_context_t;
+
+
+static void write_file(const char *root, const char *uri, const char *content){
+    char path[160];
+    snprintf(path, sizeof(path), "%s%s", root, uri);
+
+    FILE *f = fopen(path, "w");
+    assert_non_null(f);
+    fputs(content, f);
+    fclose(f);
+}
+
+static int setup_server_root(void **state){
+    test_context_t *ctx = calloc(1, sizeof(test_context_t));
+    char path[160];
+
+    strcpy(ctx->root, "/tmp/sws_root_XXXXXX");
+    assert_non_null(mkdtemp(ctx->root));
+
+    snprintf(path, sizeof(path), "%s/css", ctx->root);
+    assert_int_equal(mkdir(path, 0755), 0);
+
+    write_file(ctx->root, "/index.html", "<html></html>");
+    write_file(ctx->root, "/css/site.css", "body {}");
+    write_file(ctx->root, "/app.js", "let a = 1;");
+    write_file(ctx->root, "/app.js.gz", "not really gzip");
+
+    mime_registry_init(NULL);
+    assert_int_equal(root_index_build(ctx->root), 4);
+
+    *state = ctx;
+    return 0;
+}
+
+static int destroy_server_root(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    char cmd[128];
+
+    root_index_destroy();
+
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", ctx->root);
+    assert_int_equal(system(cmd), 0);
+    free(ctx);
+    return 0;
+}
+
+
+static void test_root_index_lookup(void **state){
+    UNUSED state;
+    bool authoritative;
+
+    assert_true(root_index_enabled());
+    assert_int_equal(root_index_enter(), 0);
+
+    const root_index_entry *entry = root_index_lookup("/css/site.css", &authoritative);
+
+    assert_non_null(entry);
+    assert_true(authoritative);
+    assert_true(entry->fd != -1);
+    assert_int_equal(entry->info.st_size, strlen("body {}"));
+    assert_string_equal(entry->content_type, "text/css");
+
+    root_index_exit();
+}
+
+static void test_root_index_miss_is_authoritative(void **state){
+    UNUSED state;
+    bool authoritative = false;
+
+    assert_int_equal(root_index_enter(), 0);
+
+    assert_null(root_index_lookup("/missing.html", &authoritative));
+    assert_true(authoritative);
+
+    // Directories aren't ressources
+    assert_null(root_index_lookup("/css", &authoritative));
+
+    root_index_exit();
+}
+
+static void test_root_index_links_precompressed_siblings(void **state){
+    UNUSED state;
+
+    assert_int_equal(root_index_enter(), 0);
+
+    assert_int_equal(root_index_lookup("/app.js", NULL)->precompressed, CODING_MASK(CODING_GZIP));
+    assert_int_equal(root_index_lookup("/index.html", NULL)->precompressed, 0);
+
+    root_index_exit();
+}
+
+static void test_root_index_lookup_requires_enter(void **state){
+    UNUSED state;
+    bool authoritative = true;
+
+    assert_null(root_index_lookup("/index.html", &authoritative));
+    assert_false(authoritative);
+}
+
+static void *rebuild_root_index(void *args){
+    test_context_t *ctx = (test_context_t *) args;
+
+    assert_int_equal(root_index_build(ctx->root), 5);
+    ctx->rebuilt = true;
+    return NULL;
+}
+
+static void test_root_index_rebuild_waits_for_readers(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    pthread_t builder;
+    char content[32] = {0};
+
+    assert_int_equal(root_index_enter(), 0);
+    const root_index_entry *old_entry = root_index_lookup("/index.html", NULL);
+
+    write_file(ctx->root, "/new.html", "new");
+    assert_int_equal(pthread_create(&builder, NULL, rebuild_root_index, ctx), 0);
+
+    // The old snapshot (and its fds) can't go away while we use it
+    usleep(50 * 1000);
+    assert_false(ctx->rebuilt);
+    assert_int_equal(pread(old_entry->fd, content, sizeof(content) - 1, 0), strlen("<html></html>"));
+    assert_null(root_index_lookup("/new.html", NULL));
+
+    root_index_exit();
+    assert_int_equal(pthread_join(builder, NULL), 0);
+    assert_true(ctx->rebuilt);
+
+    assert_int_equal(root_index_enter(), 0);
+    assert_non_null(root_index_lookup("/new.html", NULL));
+    root_index_exit();
+}
+
+static void test_root_index_hold_outlives_rebuild(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    char content[32] = {0};
+
+    assert_int_equal(root_index_enter(), 0);
+    const root_index_entry *old_entry = root_index_lookup("/index.html", NULL);
+    root_index_hold_t hold = root_index_hold();
+
+    assert_non_null(hold);
+    root_index_exit();
+
+    // A response still sending from the old snapshot doesn't hold back the rebuild
+    write_file(ctx->root, "/new.html", "new");
+    rebuild_root_index(ctx);
+    assert_true(ctx->rebuilt);
+
+    assert_int_equal(pread(old_entry->fd, content, sizeof(content) - 1, 0), strlen("<html></html>"));
+    root_index_release(&hold);
+    assert_null(hold);
+
+    assert_null(root_index_hold());
+}
+
+static void test_root_index_destroy(void **state){
+    UNUSED state;
+
+    root_index_destroy();
+
+    assert_false(root_index_enabled());
+    assert_int_equal(root_index_enter(), -1);
+}
+
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_root_index_lookup, setup_server_root, destroy_server_root),
+        cmocka_unit_test_setup_teardown(test_root_index_miss_is_authoritative, setup_server_root, destroy_server_root),
+        cmocka_unit_test_setup_teardown(test_root_index_links_precompressed_siblings, setup_server_root, destroy_server_root),
+        cmocka_unit_test_setup_teardown(test_root_index_lookup_requires_enter, setup_server_root, destroy_server_root),
+        cmocka_unit_test_setup_teardown(test_root_index_rebuild_waits_for_readers, setup_server_root, destroy_server_root),
+        cmocka_unit_test_setup_teardown(test_root_index_hold_outlives_rebuild, setup_server_root, destroy_server_root),
+        cmocka_unit_test_setup_teardown(test_root_index_destroy, setup_server_root, destroy_server_root),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
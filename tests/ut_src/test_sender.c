@@ -0,0 +1,244 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "sender_private.h"
+#include "metrics.h"
+
+#define TEST_FILE_LEN (2 * 1024 * 1024) // Way more than a socket buffer holds
+#define TEST_HEAD "HTTP/1.0 200 OK\r\n\r\n"
+#define NUM_CLIENTS 4
+
+
+typedef struct _test_context_t {
+    char path[64];
+    int file_fd;
+    char *content;
+} test_context_t;
+
+
+/**
+ * @brief Read everything until the sender closes its end of the socket.
+ */
+static size_t read_until_eof(int fd, char *buf, size_t max_len){
+    size_t total = 0;
+    ssize_t bytes_read;
+
+    while(total < max_len && (bytes_read = read(fd, buf + total, max_len - total)) > 0){
+        total += bytes_read;
+    }
+
+    return total;
+}
+
+static int setup_sender_pool(void **state){
+    test_context_t *ctx = calloc(1, sizeof(test_context_t));
+
+    strcpy(ctx->path, "/tmp/sws_sender_XXXXXX");
+    ctx->file_fd = mkstemp(ctx->path);
+    assert_true(ctx->file_fd != -1);
+
+    ctx->content = malloc(TEST_FILE_LEN);
+    for(int i = 0; i < TEST_FILE_LEN; i++){
+        ctx->content[i] = 'a' + i % 26;
+    }
+    assert_int_equal(pwrite(ctx->file_fd, ctx->content, TEST_FILE_LEN, 0), TEST_FILE_LEN);
+
+    assert_int_equal(sender_pool_init(2), 0);
+    *state = ctx;
+    return 0;
+}
+
+static int destroy_sender_pool(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+
+    sender_pool_destroy();
+    assert_false(sender_pool_running());
+
+    close(ctx->file_fd);
+    unlink(ctx->path);
+    free(ctx->content);
+    free(ctx);
+    return 0;
+}
+
+
+static void test_small_response_sent_inline(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    int sockets[2];
+    char received[100];
+
+    assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    fcntl(sockets[0], F_SETFL, O_NONBLOCK);
+
+    send_job_t job = send_job_create(sockets[0], TEST_HEAD, strlen(TEST_HEAD), dup(ctx->file_fd), 10, 50, NULL);
+
+    assert_non_null(job);
+    assert_int_equal(send_job_resume(job), SENDFILE_DONE);
+    send_job_destroy(&job);
+    assert_null(job);
+
+    close(sockets[0]);
+    assert_int_equal(read_until_eof(sockets[1], received, sizeof(received)), strlen(TEST_HEAD) + 50);
+    assert_memory_equal(received, TEST_HEAD, strlen(TEST_HEAD));
+    assert_memory_equal(received + strlen(TEST_HEAD), ctx->content + 10, 50);
+    close(sockets[1]);
+}
+
+static void test_submitted_jobs_complete(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    size_t response_len = strlen(TEST_HEAD) + TEST_FILE_LEN;
+    char *received = malloc(response_len);
+    int sockets[NUM_CLIENTS][2];
+
+    assert_true(sender_pool_running());
+
+    // Nobody reads until every job was submitted, so each one needs a sender thread to finish it
+    for(int i = 0; i < NUM_CLIENTS; i++){
+        assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets[i]), 0);
+        fcntl(sockets[i][0], F_SETFL, O_NONBLOCK);
+
+        send_job_t job = send_job_create(sockets[i][0], TEST_HEAD, strlen(TEST_HEAD), dup(ctx->file_fd), 0, TEST_FILE_LEN, NULL);
+
+        assert_non_null(job);
+        sendfile_status status = send_job_resume(job);
+
+        assert_true(status == SENDFILE_PENDING || status == SENDFILE_BLOCKED);
+        assert_int_equal(sender_submit(job), 0);
+    }
+
+    // Each job sends from its own fd, closed once the job is done
+    for(int i = 0; i < NUM_CLIENTS; i++){
+        memset(received, 0, response_len);
+
+        assert_int_equal(read_until_eof(sockets[i][1], received, response_len), response_len);
+        assert_memory_equal(received, TEST_HEAD, strlen(TEST_HEAD));
+        assert_memory_equal(received + strlen(TEST_HEAD), ctx->content, TEST_FILE_LEN);
+        close(sockets[i][1]);
+    }
+
+    free(received);
+}
+
+static void test_job_with_closed_client(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    int sockets[2];
+
+    assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    fcntl(sockets[0], F_SETFL, O_NONBLOCK);
+    close(sockets[1]);
+
+    send_job_t job = send_job_create(sockets[0], TEST_HEAD, strlen(TEST_HEAD), dup(ctx->file_fd), 0, TEST_FILE_LEN, NULL);
+
+    assert_non_null(job);
+    assert_int_equal(send_job_resume(job), SENDFILE_ERROR); // No SIGPIPE
+    send_job_destroy(&job);
+    close(sockets[0]);
+}
+
+static void test_submit_after_destroy(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    int sockets[2];
+
+    assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    sender_pool_destroy();
+
+    send_job_t job = send_job_create(sockets[0], NULL, 0, dup(ctx->file_fd), 0, TEST_FILE_LEN, NULL);
+
+    assert_int_equal(sender_submit(job), -1);
+    send_job_destroy(&job);
+    close(sockets[0]);
+    close(sockets[1]);
+}
+
+static void test_drain_ends_at_deadline(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    struct timespec deadline;
+    struct timespec stopped;
+    char received[100];
+    int sockets[2];
+
+    assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    fcntl(sockets[0], F_SETFL, O_NONBLOCK);
+
+    // Nobody reads, the job can't be done before the deadline
+    send_job_t job = send_job_create(sockets[0], TEST_HEAD, strlen(TEST_HEAD), dup(ctx->file_fd), 0, TEST_FILE_LEN, NULL);
+
+    assert_non_null(job);
+    send_job_resume(job);
+    assert_int_equal(sender_submit(job), 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    sender_pool_destroy_by(&deadline);
+    clock_gettime(CLOCK_MONOTONIC, &stopped);
+
+    assert_true(stopped.tv_sec - deadline.tv_sec < SENDER_DRAIN_TIMEOUT_MS / 1000);
+    assert_false(sender_pool_running());
+
+    // The job was dropped, its client fd closed
+    while(read(sockets[1], received, sizeof(received)) > 0);
+    close(sockets[1]);
+}
+
+static void test_handed_off_job_logged(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    char log_path[64];
+    char line[MAX_ACCESS_LOG_LINE_LEN] = {0};
+    size_t response_len = strlen(TEST_HEAD) + TEST_FILE_LEN;
+    char *received = malloc(response_len);
+    access_log_entry entry = {.client_addr = "127.0.0.1", .method = "GET", .uri = "/big.bin", .version = "1.0", .status_code = 200};
+    int sockets[2];
+    FILE *log_file;
+
+    snprintf(log_path, sizeof(log_path), "%s.log", ctx->path);
+    assert_int_equal(access_log_open(log_path), 0);
+    assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    fcntl(sockets[0], F_SETFL, O_NONBLOCK);
+
+    send_job_t job = send_job_create(sockets[0], TEST_HEAD, strlen(TEST_HEAD), dup(ctx->file_fd), 0, TEST_FILE_LEN, NULL);
+
+    assert_non_null(job);
+    send_job_log_access(job, &entry, metrics_now_ns());
+    assert_int_not_equal(send_job_resume(job), SENDFILE_DONE);
+    assert_int_equal(sender_submit(job), 0);
+
+    assert_int_equal(read_until_eof(sockets[1], received, response_len), response_len);
+    close(sockets[1]);
+
+    // Logged by the sender thread, with the whole body
+    sender_pool_destroy();
+    access_log_close();
+
+    log_file = fopen(log_path, "r");
+    assert_non_null(log_file);
+    assert_non_null(fgets(line, sizeof(line), log_file));
+    assert_non_null(strstr(line, "\"GET /big.bin HTTP/1.0\" 200 2097152 "));
+    assert_null(fgets(line, sizeof(line), log_file));
+
+    fclose(log_file);
+    unlink(log_path);
+    free(received);
+}
+
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_small_response_sent_inline, setup_sender_pool, destroy_sender_pool),
+        cmocka_unit_test_setup_teardown(test_submitted_jobs_complete, setup_sender_pool, destroy_sender_pool),
+        cmocka_unit_test_setup_teardown(test_job_with_closed_client, setup_sender_pool, destroy_sender_pool),
+        cmocka_unit_test_setup_teardown(test_submit_after_destroy, setup_sender_pool, destroy_sender_pool),
+        cmocka_unit_test_setup_teardown(test_drain_ends_at_deadline, setup_sender_pool, destroy_sender_pool),
+        cmocka_unit_test_setup_teardown(test_handed_off_job_logged, setup_sender_pool, destroy_sender_pool),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,206 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "site_pack.h"
+#include "root_index.h"
+#include "compression.h"
+#include "mime.h"
+
+#define UNUSED (void)
+#define CSS_LEN 2000
+#define GZIP_WINDOW_BITS (15 + 16)
+
+
+typedef struct _test_context_t {
+    char root[64];
+    char pack_path[80];
+    char css[CSS_LEN + 1];
+} test_context_t;
+
+
+static void write_file(const char *root, const char *uri, const char *content){
+    char path[160];
+    snprintf(path, sizeof(path), "%s%s", root, uri);
+
+    FILE *f = fopen(path, "w");
+    assert_non_null(f);
+    fputs(content, f);
+    fclose(f);
+}
+
+static int setup_site_pack(void **state){
+    test_context_t *ctx = calloc(1, sizeof(test_context_t));
+    compression_config compression = {.enabled = true, .level = 9, .min_size = 100, .types = "text/*"};
+    char path[160];
+
+    strcpy(ctx->root, "/tmp/sws_pack_root_XXXXXX");
+    assert_non_null(mkdtemp(ctx->root));
+    snprintf(ctx->pack_path, sizeof(ctx->pack_path), "%s.pack", ctx->root);
+
+    snprintf(path, sizeof(path), "%s/css", ctx->root);
+    assert_int_equal(mkdir(path, 0755), 0);
+
+    for(int i = 0; i < CSS_LEN; i++){
+        ctx->css[i] = "body {}\n"[i % 8];
+    }
+
+    write_file(ctx->root, "/index.html", "<html></html>"); // Too small to get a gzip variant
+    write_file(ctx->root, "/css/site.css", ctx->css);
+    write_file(ctx->root, "/logo.png", "not really a png");
+
+    mime_registry_init(NULL);
+    assert_int_equal(compression_init(&compression), 0);
+
+    // 3 ressources and the generated gzip variant of site.css
+    assert_int_equal(site_pack_write(ctx->root, ctx->pack_path, true), 4);
+    assert_int_equal(root_index_load_pack(ctx->pack_path), 4);
+
+    *state = ctx;
+    return 0;
+}
+
+static int destroy_site_pack(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    char cmd[128];
+
+    root_index_destroy();
+
+    snprintf(cmd, sizeof(cmd), "rm -rf %s %s", ctx->root, ctx->pack_path);
+    assert_int_equal(system(cmd), 0);
+    free(ctx);
+    return 0;
+}
+
+
+static void test_site_pack_lookup(void **state){
+    UNUSED state;
+    bool authoritative;
+
+    assert_int_equal(root_index_enter(), 0);
+
+    const root_index_entry *entry = root_index_lookup("/index.html", &authoritative);
+
+    assert_non_null(entry);
+    assert_true(authoritative);
+    assert_int_equal(entry->fd, -1);
+    assert_int_equal(entry->info.st_size, strlen("<html></html>"));
+    assert_memory_equal(entry->data, "<html></html>", entry->info.st_size);
+    assert_string_equal(entry->content_type, "text/html");
+    assert_int_equal(entry->precompressed, 0);
+
+    entry = root_index_lookup("/logo.png", NULL);
+
+    assert_non_null(entry);
+    assert_string_equal(entry->content_type, "image/png");
+
+    assert_null(root_index_lookup("/missing.html", &authoritative));
+    assert_true(authoritative);
+
+    root_index_exit();
+}
+
+static void test_site_pack_payloads_are_aligned(void **state){
+    UNUSED state;
+    const char *uris[] = {"/index.html", "/css/site.css", "/css/site.css.gz", "/logo.png"};
+
+    assert_int_equal(root_index_enter(), 0);
+
+    const char *first = root_index_lookup(uris[0], NULL)->data;
+
+    for(int i = 0; i < 4; i++){
+        const root_index_entry *entry = root_index_lookup(uris[i], NULL);
+
+        assert_non_null(entry);
+        assert_int_equal((entry->data - first) % SITE_PACK_ALIGNMENT, 0);
+    }
+
+    root_index_exit();
+}
+
+static void test_site_pack_gzip_variant(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+    z_stream stream;
+    char out[CSS_LEN + 1];
+
+    assert_int_equal(root_index_enter(), 0);
+
+    const root_index_entry *entry = root_index_lookup("/css/site.css", NULL);
+    const root_index_entry *variant = root_index_lookup("/css/site.css.gz", NULL);
+
+    assert_non_null(entry);
+    assert_non_null(variant);
+    assert_true(entry->precompressed & CODING_MASK(CODING_GZIP));
+    assert_string_equal(variant->content_type, "text/css");
+    assert_true(variant->info.st_size < CSS_LEN);
+
+    memset(&stream, 0, sizeof(z_stream));
+    assert_int_equal(inflateInit2(&stream, GZIP_WINDOW_BITS), Z_OK);
+
+    stream.next_in = (Bytef *) variant->data;
+    stream.avail_in = variant->info.st_size;
+    stream.next_out = (Bytef *) out;
+    stream.avail_out = sizeof(out);
+
+    assert_int_equal(inflate(&stream, Z_FINISH), Z_STREAM_END);
+    assert_int_equal(stream.total_out, CSS_LEN);
+    assert_memory_equal(out, ctx->css, CSS_LEN);
+    inflateEnd(&stream);
+
+    root_index_exit();
+}
+
+static void test_site_pack_reload(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+
+    write_file(ctx->root, "/new.html", "<html>new</html>");
+    assert_int_equal(site_pack_write(ctx->root, ctx->pack_path, false), 4); // No gzip variant this time
+
+    // Reloads the pack, not the server root it was made from
+    assert_int_equal(root_index_reload(), 4);
+    assert_int_equal(root_index_enter(), 0);
+
+    const root_index_entry *entry = root_index_lookup("/new.html", NULL);
+
+    assert_non_null(entry);
+    assert_memory_equal(entry->data, "<html>new</html>", entry->info.st_size);
+    assert_null(root_index_lookup("/css/site.css.gz", NULL));
+    assert_int_equal(root_index_lookup("/css/site.css", NULL)->precompressed, 0);
+
+    root_index_exit();
+}
+
+static void test_invalid_site_pack(void **state){
+    test_context_t *ctx = (test_context_t *) *state;
+
+    // Truncated pack is rejected and the current snapshot kept
+    assert_int_equal(truncate(ctx->pack_path, 4096), 0);
+    assert_int_equal(root_index_load_pack(ctx->pack_path), -1);
+
+    assert_int_equal(root_index_enter(), 0);
+    assert_non_null(root_index_lookup("/index.html", NULL));
+    root_index_exit();
+
+    assert_int_equal(root_index_load_pack(ctx->root), -1);
+}
+
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_site_pack_lookup, setup_site_pack, destroy_site_pack),
+        cmocka_unit_test_setup_teardown(test_site_pack_payloads_are_aligned, setup_site_pack, destroy_site_pack),
+        cmocka_unit_test_setup_teardown(test_site_pack_gzip_variant, setup_site_pack, destroy_site_pack),
+        cmocka_unit_test_setup_teardown(test_site_pack_reload, setup_site_pack, destroy_site_pack),
+        cmocka_unit_test_setup_teardown(test_invalid_site_pack, setup_site_pack, destroy_site_pack),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
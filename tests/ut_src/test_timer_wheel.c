@@ -0,0 +1,181 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timer_wheel.h"
+
+#define UNUSED (void)
+#define TEST_START_MS 1000000UL
+#define TEST_TICK_MS 10
+#define NUM_TEST_TIMERS 4096
+
+
+typedef struct _fired_t {
+    int count;
+    unsigned long last_ms;      /**< Time the wheel was advanced to when the last timer fired. */
+    unsigned long now_ms;
+    bool late;                  /**< Set if a timer fired more than a tick after its deadline. */
+    bool early;                 /**< Set if a timer fired before its deadline. */
+} fired_t;
+
+/**
+ * @brief Timers carry their deadline as data.
+ */
+static void count_expired(wheel_timer *timer, void *args){
+    fired_t *fired = (fired_t *) args;
+    unsigned long deadline_ms = (unsigned long) timer->data;
+
+    fired->count++;
+    fired->last_ms = fired->now_ms;
+    fired->early |= fired->now_ms < deadline_ms;
+    fired->late |= fired->now_ms >= deadline_ms + TEST_TICK_MS;
+}
+
+/**
+ * @brief Advance one millisecond at a time, as a busy event loop would.
+ */
+static void advance_to(timer_wheel_t wheel, fired_t *fired, unsigned long until_ms){
+    while(fired->now_ms < until_ms){
+        fired->now_ms++;
+        timer_wheel_advance(wheel, fired->now_ms, count_expired, fired);
+    }
+}
+
+static void arm(timer_wheel_t wheel, wheel_timer *timer, unsigned long deadline_ms){
+    timer->data = (void *) deadline_ms;
+    timer_wheel_arm(wheel, timer, deadline_ms);
+}
+
+
+static void test_fires_on_time(void **state){
+    UNUSED state;
+    timer_wheel_t wheel = timer_wheel_init(TEST_START_MS, TEST_TICK_MS);
+    fired_t fired = {.now_ms = TEST_START_MS};
+    wheel_timer timer = {0};
+
+    assert_non_null(wheel);
+    assert_false(timer_armed(&timer));
+    assert_int_equal(timer_wheel_next_timeout_ms(wheel, TEST_START_MS), -1);
+
+    arm(wheel, &timer, TEST_START_MS + 25);
+    assert_true(timer_armed(&timer));
+    assert_int_equal(get_timer_wheel_size(wheel), 1);
+    assert_int_equal(timer_wheel_next_timeout_ms(wheel, TEST_START_MS), 30);
+
+    advance_to(wheel, &fired, TEST_START_MS + 24);
+    assert_int_equal(fired.count, 0);
+
+    advance_to(wheel, &fired, TEST_START_MS + 40);
+    assert_int_equal(fired.count, 1);
+    assert_int_equal(fired.last_ms, TEST_START_MS + 30);
+    assert_false(timer_armed(&timer));
+    assert_int_equal(get_timer_wheel_size(wheel), 0);
+
+    timer_wheel_destroy(&wheel);
+    assert_null(wheel);
+}
+
+
+static void test_rearm_and_cancel(void **state){
+    UNUSED state;
+    timer_wheel_t wheel = timer_wheel_init(TEST_START_MS, TEST_TICK_MS);
+    fired_t fired = {.now_ms = TEST_START_MS};
+    wheel_timer pushed_back = {0};
+    wheel_timer cancelled = {0};
+
+    arm(wheel, &pushed_back, TEST_START_MS + 100);
+    arm(wheel, &cancelled, TEST_START_MS + 100);
+
+    // Progress pushes the deadline back before it's reached
+    advance_to(wheel, &fired, TEST_START_MS + 90);
+    arm(wheel, &pushed_back, TEST_START_MS + 5000);
+    timer_wheel_cancel(wheel, &cancelled);
+    timer_wheel_cancel(wheel, &cancelled);
+    assert_int_equal(get_timer_wheel_size(wheel), 1);
+
+    advance_to(wheel, &fired, TEST_START_MS + 4990);
+    assert_int_equal(fired.count, 0);
+
+    advance_to(wheel, &fired, TEST_START_MS + 5010);
+    assert_int_equal(fired.count, 1);
+    assert_false(fired.early);
+    assert_false(fired.late);
+
+    timer_wheel_destroy(&wheel);
+}
+
+
+static void test_cascades_across_levels(void **state){
+    UNUSED state;
+    timer_wheel_t wheel = timer_wheel_init(TEST_START_MS, TEST_TICK_MS);
+    fired_t fired = {.now_ms = TEST_START_MS};
+    wheel_timer *timers = calloc(NUM_TEST_TIMERS, sizeof(wheel_timer));
+    unsigned long last_deadline_ms = 0;
+
+    // Deadlines from a few ms to several minutes, spread over every level
+    srand(42);
+    for(int i = 0; i < NUM_TEST_TIMERS; i++){
+        unsigned long deadline_ms = TEST_START_MS + 1 + rand() % (TEST_TICK_MS * TIMER_WHEEL_SLOTS * TIMER_WHEEL_SLOTS * 8);
+
+        arm(wheel, &timers[i], deadline_ms);
+        last_deadline_ms = deadline_ms > last_deadline_ms ? deadline_ms : last_deadline_ms;
+    }
+
+    assert_int_equal(get_timer_wheel_size(wheel), NUM_TEST_TIMERS);
+
+    advance_to(wheel, &fired, last_deadline_ms + TEST_TICK_MS);
+    assert_int_equal(fired.count, NUM_TEST_TIMERS);
+    assert_false(fired.early);
+    assert_false(fired.late);
+    assert_int_equal(get_timer_wheel_size(wheel), 0);
+
+    free(timers);
+    timer_wheel_destroy(&wheel);
+}
+
+
+static void test_late_advance(void **state){
+    UNUSED state;
+    timer_wheel_t wheel = timer_wheel_init(TEST_START_MS, TEST_TICK_MS);
+    fired_t fired = {.now_ms = TEST_START_MS};
+    wheel_timer soon = {0};
+    wheel_timer later = {0};
+    wheel_timer passed = {0};
+
+    arm(wheel, &soon, TEST_START_MS + 50);
+    arm(wheel, &later, TEST_START_MS + 3600 * 1000);
+
+    // A loop that was busy for a while catches up in one go
+    fired.now_ms = TEST_START_MS + 60 * 1000;
+    assert_int_equal(timer_wheel_next_timeout_ms(wheel, fired.now_ms), 0);
+    assert_int_equal(timer_wheel_advance(wheel, fired.now_ms, count_expired, &fired), 1);
+    assert_true(timer_armed(&later));
+
+    // Deadlines already passed fire on the next tick
+    arm(wheel, &passed, TEST_START_MS);
+    assert_true(timer_wheel_next_timeout_ms(wheel, fired.now_ms) <= TEST_TICK_MS);
+    assert_int_equal(timer_wheel_advance(wheel, fired.now_ms + TEST_TICK_MS, count_expired, &fired), 1);
+
+    advance_to(wheel, &fired, TEST_START_MS + 3600 * 1000 + TEST_TICK_MS);
+    assert_int_equal(fired.count, 3);
+    assert_false(fired.early);
+
+    timer_wheel_destroy(&wheel);
+}
+
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_fires_on_time),
+        cmocka_unit_test(test_rearm_and_cancel),
+        cmocka_unit_test(test_cascades_across_levels),
+        cmocka_unit_test(test_late_advance),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,757 @@
+/**
+ * @file sws_bench.c
+ * @brief HTTP load generator to compare builds of the server.
+ *
+ * Usage: sws_bench URL... [--connections N] [--threads N] [--duration SEC] [--rate N]
+ *                         [--keep-alive] [--pipeline N] [--urls FILE] [--json]
+ *
+ * Every thread drives its share of the connections with epoll. Closed loop
+ * (the default), each connection sends a new request as soon as it gets a
+ * response. Open loop (--rate), requests are scheduled at a fixed rate and their
+ * latency counts from when they were due rather than from when they could be
+ * sent, so a stalled server isn't hidden by the load generator backing off
+ * (coordinated omission).
+ *
+ * Latencies go in the same log-linear histograms as the server metrics.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include "metrics_private.h"
+
+#define MAX_BENCH_THREADS 64
+#define MAX_BENCH_CONNECTIONS 16384
+#define MAX_BENCH_PIPELINE 16
+#define MAX_BENCH_URLS 4096
+#define MAX_BENCH_HOST_LEN 256
+#define MAX_BENCH_PORT_LEN 8
+#define MAX_BENCH_REQUEST_LEN 1024
+#define BENCH_READ_BUFF_LEN (16 * 1024)  // Holds the headers of a response, bodies are read through it
+#define BENCH_MAX_EVENTS 256
+#define BENCH_IDLE_WAIT_MS 100           // Longest epoll_wait, so the end of the run is noticed
+#define DEFAULT_BENCH_CONNECTIONS 16
+#define DEFAULT_BENCH_THREADS 1
+#define DEFAULT_BENCH_DURATION_SEC 10
+#define NANOSEC_IN_SEC 1000000000UL
+#define MIN_BENCH_RATE 0.001             // Requests per second, slower than that isn't a benchmark
+#define HEADERS_PENDING -1               // body_left while the headers aren't all in
+#define BODY_UNTIL_CLOSE -2              // body_left of responses without a Content-Length
+
+
+typedef struct bench_config {
+    char host[MAX_BENCH_HOST_LEN];
+    char port[MAX_BENCH_PORT_LEN];
+    struct addrinfo *addr;
+    char *paths[MAX_BENCH_URLS];
+    char *requests[MAX_BENCH_URLS];      /**< Request sent for each path, in turn. */
+    size_t request_lens[MAX_BENCH_URLS];
+    int num_urls;
+    int num_connections;
+    int num_threads;
+    int duration_sec;
+    double rate;                         /**< Requests per second in total, 0 for a closed loop. */
+    bool keep_alive;
+    int pipeline;
+    bool json;                           /**< Print the results as a JSON object, for scripts. */
+} bench_config;
+
+typedef struct bench_conn {
+    int fd;
+    bool connected;
+    int next_url;
+    char out[MAX_BENCH_PIPELINE * MAX_BENCH_REQUEST_LEN];
+    size_t out_len;
+    size_t out_sent;
+    unsigned long started_ns[MAX_BENCH_PIPELINE]; /**< Ring of the requests waiting for a response. */
+    int urls[MAX_BENCH_PIPELINE];        /**< Url of each request of the ring, sent again as is on reconnect. */
+    int first_outstanding;
+    int num_outstanding;
+    int num_sent;                        /**< Requests sent on the current connection. */
+    unsigned long next_due_ns;           /**< Open loop only, when the next request is due. */
+    char in[BENCH_READ_BUFF_LEN];
+    size_t in_len;
+    long body_left;
+    int status_code;
+} bench_conn;
+
+typedef struct bench_stats {
+    unsigned long buckets[NUM_METRICS_BUCKETS];
+    unsigned long completed;
+    unsigned long sum_ns;
+    unsigned long received_bytes;
+    unsigned long status_classes[6];     /**< Indexed by status code / 100. */
+    unsigned long errors;
+    unsigned long reconnects;
+} bench_stats;
+
+typedef struct bench_thread {
+    pthread_t tid;
+    int epoll_fd;
+    bench_conn *conns;
+    int num_conns;
+    unsigned long interval_ns;           /**< Open loop only, between two requests of a connection. */
+    unsigned long end_ns;
+    bench_stats stats;
+} bench_thread;
+
+
+static bench_config config;
+
+
+static void print_usage(){
+    printf("Usage: sws_bench URL... [OPTIONS]\n\n" \
+           "    --connections N    connections kept open (default: %d)\n" \
+           "    --threads N        threads driving them (default: %d)\n" \
+           "    --duration SEC     how long to run (default: %d)\n" \
+           "    --rate N           open loop: send N requests per second in total (default: closed loop)\n" \
+           "    --keep-alive       send several requests per connection, reconnecting if the server closes it\n" \
+           "    --pipeline N       requests sent without waiting for their response (default: 1, needs --keep-alive)\n" \
+           "    --urls FILE        more urls or paths, one per line\n" \
+           "    --json             print the results as a JSON object\n",
+           DEFAULT_BENCH_CONNECTIONS, DEFAULT_BENCH_THREADS, DEFAULT_BENCH_DURATION_SEC);
+}
+
+
+static unsigned long now_ns(){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NANOSEC_IN_SEC + now.tv_nsec;
+}
+
+
+/**
+ * @brief Add url (http://HOST:PORT/PATH or /PATH) to the config.
+ *
+ * @return int 0 on success, -1 if the url is invalid or on another server.
+ */
+static int add_url(const char *url){
+    const char *path = url;
+
+    if(config.num_urls == MAX_BENCH_URLS){
+        fprintf(stderr, "More than %d urls\n", MAX_BENCH_URLS);
+        return -1;
+    }
+
+    if(strncmp(url, "http://", 7) == 0){
+        const char *authority = url + 7;
+        size_t authority_len = strcspn(authority, "/");
+        const char *port_start = memchr(authority, ':', authority_len);
+        size_t host_len = port_start ? (size_t)(port_start - authority) : authority_len;
+        size_t port_len = port_start ? authority_len - host_len - 1 : 2;
+        char host[MAX_BENCH_HOST_LEN] = {0};
+        char port[MAX_BENCH_PORT_LEN] = "80";
+
+        if(host_len == 0 || host_len >= MAX_BENCH_HOST_LEN || port_len == 0 || port_len >= MAX_BENCH_PORT_LEN){
+            fprintf(stderr, "Invalid url %s\n", url);
+            return -1;
+        }
+
+        memcpy(host, authority, host_len);
+        if(port_start) snprintf(port, sizeof(port), "%.*s", (int) port_len, port_start + 1);
+        path = authority[authority_len] ? authority + authority_len : "/";
+
+        if(strlen(config.host) == 0){
+            strcpy(config.host, host);
+            strcpy(config.port, port);
+        }
+
+        else if(strcmp(config.host, host) != 0 || strcmp(config.port, port) != 0){
+            fprintf(stderr, "All urls must be on %s:%s\n", config.host, config.port);
+            return -1;
+        }
+    }
+
+    else if(path[0] != '/'){
+        fprintf(stderr, "Invalid url %s\n", url);
+        return -1;
+    }
+
+    config.paths[config.num_urls++] = strdup(path);
+    return 0;
+}
+
+
+/**
+ * @brief Add a url for every non empty line of path.
+ */
+static int add_url_file(const char *path){
+    char line[MAX_BENCH_REQUEST_LEN];
+    FILE *f = fopen(path, "r");
+
+    if(!f){
+        fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), f)){
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if(strlen(line) != 0 && add_url(line) != 0){
+            fclose(f);
+            return -1;
+        }
+    }
+
+    fclose(f);
+    return 0;
+}
+
+
+/**
+ * @brief Format the request sent for every url, once all the options are known.
+ */
+static int build_requests(){
+    char request[MAX_BENCH_REQUEST_LEN];
+
+    for(int i = 0; i < config.num_urls; i++){
+        int len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\n%s\r\n",
+                           config.paths[i], config.host, config.keep_alive ? "" : "Connection: close\r\n");
+
+        if(len < 0 || len >= MAX_BENCH_REQUEST_LEN){
+            fprintf(stderr, "Url too long %s\n", config.paths[i]);
+            return -1;
+        }
+
+        config.requests[i] = strdup(request);
+        config.request_lens[i] = len;
+    }
+
+    return 0;
+}
+
+
+static int parse_int_arg(const char *value, int min, int max, int *out){
+    char *end;
+    long parsed = strtol(value, &end, 10);
+
+    if(*end != '\0' || parsed < min || parsed > max){
+        return -1;
+    }
+
+    *out = (int) parsed;
+    return 0;
+}
+
+
+static int parse_rate_arg(const char *value, double *out){
+    char *end;
+    double parsed = strtod(value, &end);
+
+    // At most one request per nanosecond, and the interval between requests has to fit
+    if(end == value || *end != '\0' || !(parsed >= MIN_BENCH_RATE && parsed <= NANOSEC_IN_SEC)){
+        return -1;
+    }
+
+    *out = parsed;
+    return 0;
+}
+
+
+static int parse_args(int argc, char *argv[]){
+    config.num_connections = DEFAULT_BENCH_CONNECTIONS;
+    config.num_threads = DEFAULT_BENCH_THREADS;
+    config.duration_sec = DEFAULT_BENCH_DURATION_SEC;
+    config.pipeline = 1;
+
+    for(int i = 1; i < argc; i++){
+        bool has_value = i + 1 < argc;
+
+        if(strncmp(argv[i], "--", 2) != 0){
+            if(add_url(argv[i]) != 0) return -1;
+        }
+
+        else if(strcmp(argv[i], "--keep-alive") == 0){
+            config.keep_alive = true;
+        }
+
+        else if(strcmp(argv[i], "--json") == 0){
+            config.json = true;
+        }
+
+        else if(strcmp(argv[i], "--connections") == 0 && has_value){
+            if(parse_int_arg(argv[++i], 1, MAX_BENCH_CONNECTIONS, &config.num_connections) != 0) return -1;
+        }
+
+        else if(strcmp(argv[i], "--threads") == 0 && has_value){
+            if(parse_int_arg(argv[++i], 1, MAX_BENCH_THREADS, &config.num_threads) != 0) return -1;
+        }
+
+        else if(strcmp(argv[i], "--duration") == 0 && has_value){
+            if(parse_int_arg(argv[++i], 1, 24 * 3600, &config.duration_sec) != 0) return -1;
+        }
+
+        else if(strcmp(argv[i], "--pipeline") == 0 && has_value){
+            if(parse_int_arg(argv[++i], 1, MAX_BENCH_PIPELINE, &config.pipeline) != 0) return -1;
+        }
+
+        else if(strcmp(argv[i], "--rate") == 0 && has_value){
+            if(parse_rate_arg(argv[++i], &config.rate) != 0) return -1;
+        }
+
+        else if(strcmp(argv[i], "--urls") == 0 && has_value){
+            if(add_url_file(argv[++i]) != 0) return -1;
+        }
+
+        else {
+            return -1;
+        }
+    }
+
+    if(strlen(config.host) == 0){
+        fprintf(stderr, "At least one url must be absolute (http://HOST:PORT/PATH)\n");
+        return -1;
+    }
+
+    else if(config.pipeline > 1 && !config.keep_alive){
+        fprintf(stderr, "--pipeline needs --keep-alive\n");
+        return -1;
+    }
+
+    else if(config.num_threads > config.num_connections){
+        config.num_threads = config.num_connections;
+    }
+
+    return build_requests();
+}
+
+
+/**
+ * @brief Open a new connection for conn, its outstanding requests are sent again.
+ */
+static int open_connection(bench_thread *thread, bench_conn *conn){
+    struct epoll_event event = {.events = EPOLLIN | EPOLLOUT | EPOLLET, .data.ptr = conn};
+
+    conn->fd = socket(config.addr->ai_family, SOCK_STREAM, 0);
+
+    if(conn->fd == -1){
+        return -1;
+    }
+
+    fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+
+    if(connect(conn->fd, config.addr->ai_addr, config.addr->ai_addrlen) != 0 && errno != EINPROGRESS){
+        close(conn->fd);
+        conn->fd = -1;
+        return -1;
+    }
+
+    conn->connected = false;
+    conn->out_len = 0;
+    conn->out_sent = 0;
+    conn->in_len = 0;
+    conn->body_left = HEADERS_PENDING;
+    conn->num_sent = 0;
+
+    for(int i = 0; i < conn->num_outstanding; i++){
+        int url = conn->urls[(conn->first_outstanding + i) % MAX_BENCH_PIPELINE];
+
+        memcpy(conn->out + conn->out_len, config.requests[url], config.request_lens[url]);
+        conn->out_len += config.request_lens[url];
+        conn->num_sent++;
+    }
+
+    return epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, conn->fd, &event);
+}
+
+
+static void close_connection(bench_conn *conn){
+    if(conn->fd != -1){
+        close(conn->fd);
+        conn->fd = -1;
+    }
+}
+
+
+/**
+ * @brief Queue the requests conn can send now.
+ *
+ * @return unsigned long when the next request is due, 0 if it doesn't depend on time.
+ */
+static unsigned long queue_requests(bench_thread *thread, bench_conn *conn, unsigned long now){
+    // Without keep-alive the server answers a single request per connection
+    int window = config.keep_alive ? config.pipeline : 1 - conn->num_sent;
+
+    while(conn->num_outstanding < window && (config.rate == 0 || conn->next_due_ns <= now)){
+        int slot = (conn->first_outstanding + conn->num_outstanding) % MAX_BENCH_PIPELINE;
+
+        // Late requests still count from when they were due
+        conn->started_ns[slot] = config.rate == 0 ? now : conn->next_due_ns;
+        conn->urls[slot] = conn->next_url;
+        conn->next_due_ns += thread->interval_ns;
+        conn->num_outstanding++;
+        window -= config.keep_alive ? 0 : 1;
+
+        if(conn->out_sent == conn->out_len){
+            conn->out_len = 0;
+            conn->out_sent = 0;
+        }
+
+        memcpy(conn->out + conn->out_len, config.requests[conn->next_url], config.request_lens[conn->next_url]);
+        conn->out_len += config.request_lens[conn->next_url];
+        conn->next_url = (conn->next_url + 1) % config.num_urls;
+        conn->num_sent++;
+    }
+
+    return config.rate == 0 ? 0 : conn->next_due_ns;
+}
+
+
+static int flush_requests(bench_conn *conn){
+    while(conn->connected && conn->out_sent < conn->out_len){
+        ssize_t rc = send(conn->fd, conn->out + conn->out_sent, conn->out_len - conn->out_sent, MSG_NOSIGNAL);
+
+        if(rc == -1){
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+
+        conn->out_sent += rc;
+    }
+
+    return 0;
+}
+
+
+static void complete_response(bench_thread *thread, bench_conn *conn){
+    unsigned long latency_ns = now_ns() - conn->started_ns[conn->first_outstanding];
+    int status_class = conn->status_code / 100;
+
+    thread->stats.buckets[metrics_bucket_idx(latency_ns)]++;
+    thread->stats.sum_ns += latency_ns;
+    thread->stats.completed++;
+    thread->stats.status_classes[status_class >= 1 && status_class <= 5 ? status_class : 0]++;
+
+    conn->first_outstanding = (conn->first_outstanding + 1) % MAX_BENCH_PIPELINE;
+    conn->num_outstanding--;
+    conn->body_left = HEADERS_PENDING;
+}
+
+
+/**
+ * @brief Consume the responses in the input buffer of conn.
+ *
+ * @return int 0 on success, -1 if a response is malformed.
+ */
+static int read_responses(bench_thread *thread, bench_conn *conn){
+    while(conn->in_len > 0 && conn->num_outstanding > 0){
+        if(conn->body_left == HEADERS_PENDING){
+            char *headers_end;
+            char *content_length;
+
+            conn->in[conn->in_len] = '\0';
+            headers_end = strstr(conn->in, "\r\n\r\n");
+
+            if(!headers_end){
+                return conn->in_len >= BENCH_READ_BUFF_LEN - 1 ? -1 : 0;
+            }
+
+            *headers_end = '\0';
+
+            if(sscanf(conn->in, "HTTP/%*d.%*d %d", &conn->status_code) != 1){
+                return -1;
+            }
+
+            conn->body_left = BODY_UNTIL_CLOSE;
+
+            for(content_length = strchr(conn->in, '\n'); content_length; content_length = strchr(content_length, '\n')){
+                content_length++;
+
+                if(strncasecmp(content_length, "Content-Length:", 15) == 0){
+                    conn->body_left = strtol(content_length + 15, NULL, 10);
+                }
+            }
+
+            size_t headers_len = headers_end + 4 - conn->in;
+            memmove(conn->in, conn->in + headers_len, conn->in_len - headers_len);
+            conn->in_len -= headers_len;
+        }
+
+        if(conn->body_left == BODY_UNTIL_CLOSE){
+            conn->in_len = 0;
+            return 0;
+        }
+
+        size_t body_len = conn->in_len < (size_t) conn->body_left ? conn->in_len : (size_t) conn->body_left;
+
+        memmove(conn->in, conn->in + body_len, conn->in_len - body_len);
+        conn->in_len -= body_len;
+        conn->body_left -= body_len;
+
+        if(conn->body_left == 0){
+            complete_response(thread, conn);
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Handle an epoll event of conn.
+ *
+ * @return int 0 while the connection can be used, -1 once it's closed.
+ */
+static int handle_event(bench_thread *thread, bench_conn *conn, uint32_t events){
+    int error = 0;
+    socklen_t error_len = sizeof(error);
+    ssize_t rc;
+
+    if(!conn->connected){
+        if(getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &error_len) != 0 || error != 0){
+            return -1;
+        }
+
+        conn->connected = events & (EPOLLOUT | EPOLLIN);
+    }
+
+    if(flush_requests(conn) != 0){
+        return -1;
+    }
+
+    while(events & (EPOLLIN | EPOLLHUP | EPOLLERR)){
+        rc = recv(conn->fd, conn->in + conn->in_len, BENCH_READ_BUFF_LEN - 1 - conn->in_len, 0);
+
+        if(rc == -1){
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+
+        // The end of a response without Content-Length, or of a bare status line (HTTP/1.0 errors)
+        if(rc == 0){
+            conn->in[conn->in_len] = '\0';
+
+            if(conn->num_outstanding > 0 && (conn->body_left == BODY_UNTIL_CLOSE ||
+               (conn->body_left == HEADERS_PENDING && sscanf(conn->in, "HTTP/%*d.%*d %d", &conn->status_code) == 1))){
+                complete_response(thread, conn);
+            }
+
+            return -1;
+        }
+
+        thread->stats.received_bytes += rc;
+        conn->in_len += rc;
+
+        if(read_responses(thread, conn) != 0){
+            return -1;
+        }
+
+        // Don't wait for the server to close a connection that is done
+        else if(!config.keep_alive && conn->num_outstanding == 0){
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static void *run_bench_thread(void *args){
+    bench_thread *thread = (bench_thread *) args;
+    struct epoll_event events[BENCH_MAX_EVENTS];
+    unsigned long now = now_ns();
+
+    for(int i = 0; i < thread->num_conns; i++){
+        // Spread the arrivals of the connections over an interval
+        thread->conns[i].next_due_ns = now + thread->interval_ns * i / thread->num_conns;
+        thread->conns[i].next_url = i % config.num_urls;
+        thread->conns[i].fd = -1;
+    }
+
+    while((now = now_ns()) < thread->end_ns){
+        unsigned long next_due_ns = thread->end_ns;
+
+        for(int i = 0; i < thread->num_conns; i++){
+            bench_conn *conn = &thread->conns[i];
+            unsigned long due_ns;
+
+            if(conn->fd == -1 && (config.rate == 0 || conn->num_outstanding > 0 || conn->next_due_ns <= now)){
+                if(open_connection(thread, conn) != 0){
+                    thread->stats.errors += conn->num_outstanding;
+                    conn->num_outstanding = 0;
+                    close_connection(conn);
+                    continue;
+                }
+            }
+
+            due_ns = queue_requests(thread, conn, now);
+
+            if(due_ns != 0 && due_ns < next_due_ns){
+                next_due_ns = due_ns;
+            }
+
+            if(flush_requests(conn) != 0){
+                close_connection(conn);
+            }
+        }
+
+        int timeout_ms = config.rate == 0 ? BENCH_IDLE_WAIT_MS : (next_due_ns - now + 999999) / 1000000;
+        int num_events = epoll_wait(thread->epoll_fd, events, BENCH_MAX_EVENTS, timeout_ms < BENCH_IDLE_WAIT_MS ? timeout_ms : BENCH_IDLE_WAIT_MS);
+
+        for(int i = 0; i < num_events; i++){
+            bench_conn *conn = (bench_conn *) events[i].data.ptr;
+
+            if(conn->fd == -1 || handle_event(thread, conn, events[i].events) == 0){
+                continue;
+            }
+
+            close_connection(conn);
+
+            // The server can close a keep-alive connection after answering some of its
+            // requests, the others are sent again on a new one
+            if(conn->num_sent > conn->num_outstanding){
+                thread->stats.reconnects += config.keep_alive;
+            }
+
+            else {
+                thread->stats.errors += conn->num_outstanding;
+                conn->num_outstanding = 0;
+            }
+        }
+    }
+
+    for(int i = 0; i < thread->num_conns; i++){
+        close_connection(&thread->conns[i]);
+    }
+
+    return NULL;
+}
+
+
+static double to_ms(unsigned long ns){
+    return ns / 1e6;
+}
+
+
+static void print_results(const bench_stats *totals, double elapsed_sec){
+    unsigned long max_ns = 0;
+    const double quantiles[] = {0.5, 0.75, 0.9, 0.99, 0.999, 0.9999};
+
+    for(int i = 0; i < NUM_METRICS_BUCKETS; i++){
+        if(totals->buckets[i] != 0) max_ns = metrics_bucket_max_ns(i);
+    }
+
+    if(config.json){
+        printf("{\"requests\": %lu, \"seconds\": %.3f, \"requests_per_sec\": %.1f, \"received_bytes\": %lu, "
+               "\"status_2xx\": %lu, \"status_other\": %lu, \"errors\": %lu, \"reconnects\": %lu, "
+               "\"mean_ms\": %.3f, \"max_ms\": %.3f",
+               totals->completed, elapsed_sec, totals->completed / elapsed_sec, totals->received_bytes,
+               totals->status_classes[2], totals->completed - totals->status_classes[2], totals->errors, totals->reconnects,
+               totals->completed ? to_ms(totals->sum_ns / totals->completed) : 0, to_ms(max_ns));
+
+        for(size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++){
+            printf(", \"p%g_ms\": %.3f", quantiles[i] * 100, to_ms(get_metrics_percentile(totals->buckets, totals->completed, quantiles[i])));
+        }
+
+        printf("}\n");
+        return;
+    }
+
+    printf("  Requests:   %lu in %.2fs, %.1f/s\n", totals->completed, elapsed_sec, totals->completed / elapsed_sec);
+    printf("  Transfer:   %.2f MB, %.2f MB/s\n", totals->received_bytes / 1e6, totals->received_bytes / 1e6 / elapsed_sec);
+    printf("  Responses:  1xx %lu, 2xx %lu, 3xx %lu, 4xx %lu, 5xx %lu, other %lu\n",
+           totals->status_classes[1], totals->status_classes[2], totals->status_classes[3],
+           totals->status_classes[4], totals->status_classes[5], totals->status_classes[0]);
+    printf("  Errors:     %lu, reconnects %lu\n", totals->errors, totals->reconnects);
+    printf("  Latency:    mean %.3fms, max %.3fms\n", totals->completed ? to_ms(totals->sum_ns / totals->completed) : 0, to_ms(max_ns));
+
+    for(size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++){
+        printf("    p%-8g %.3fms\n", quantiles[i] * 100, to_ms(get_metrics_percentile(totals->buckets, totals->completed, quantiles[i])));
+    }
+}
+
+
+int main(int argc, char *argv[]){
+    bench_thread *threads;
+    bench_conn *conns;
+    bench_stats *totals;
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    int rc;
+
+    if(argc < 2 || parse_args(argc, argv) != 0){
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    if((rc = getaddrinfo(config.host, config.port, &hints, &config.addr)) != 0){
+        fprintf(stderr, "Could not resolve %s: %s\n", config.host, gai_strerror(rc));
+        return EXIT_FAILURE;
+    }
+
+    threads = calloc(config.num_threads, sizeof(bench_thread));
+    conns = calloc(config.num_connections, sizeof(bench_conn));
+    totals = calloc(1, sizeof(bench_stats));
+
+    if(!threads || !conns || !totals){
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    fprintf(config.json ? stderr : stdout, "Running %ds %s loop test @ %s:%s, %d urls\n" \
+            "  %d threads, %d connections, keep-alive %s, pipeline %d",
+            config.duration_sec, config.rate ? "open" : "closed", config.host, config.port, config.num_urls,
+            config.num_threads, config.num_connections, config.keep_alive ? "on" : "off", config.pipeline);
+
+    if(config.rate){
+        fprintf(config.json ? stderr : stdout, ", %.1f requests/s", config.rate);
+    }
+
+    fprintf(config.json ? stderr : stdout, "\n");
+
+    unsigned long start_ns = now_ns();
+
+    for(int i = 0, first_conn = 0; i < config.num_threads; i++){
+        bench_thread *thread = &threads[i];
+
+        thread->num_conns = config.num_connections / config.num_threads + (i < config.num_connections % config.num_threads);
+        thread->conns = conns + first_conn;
+        thread->end_ns = start_ns + config.duration_sec * NANOSEC_IN_SEC;
+        thread->interval_ns = config.rate ? config.num_connections * NANOSEC_IN_SEC / config.rate : 0;
+        thread->epoll_fd = epoll_create1(0);
+        first_conn += thread->num_conns;
+
+        if(thread->epoll_fd == -1 || pthread_create(&thread->tid, NULL, run_bench_thread, thread) != 0){
+            fprintf(stderr, "Failed to start thread %d\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    for(int i = 0; i < config.num_threads; i++){
+        pthread_join(threads[i].tid, NULL);
+        close(threads[i].epoll_fd);
+
+        for(int j = 0; j < NUM_METRICS_BUCKETS; j++){
+            totals->buckets[j] += threads[i].stats.buckets[j];
+        }
+
+        totals->completed += threads[i].stats.completed;
+        totals->sum_ns += threads[i].stats.sum_ns;
+        totals->received_bytes += threads[i].stats.received_bytes;
+        totals->errors += threads[i].stats.errors;
+        totals->reconnects += threads[i].stats.reconnects;
+
+        for(int j = 0; j < 6; j++){
+            totals->status_classes[j] += threads[i].stats.status_classes[j];
+        }
+    }
+
+    print_results(totals, (now_ns() - start_ns) / 1e9);
+    rc = totals->completed > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    freeaddrinfo(config.addr);
+    free(threads);
+    free(conns);
+    free(totals);
+    return rc;
+}
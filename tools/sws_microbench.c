@@ -0,0 +1,460 @@
+/**
+ * @file sws_microbench.c
+ * @brief Microbenchmarks of the bounded buffer, rio, the HTTP pipeline and LOG.
+ *
+ * Usage: sws_microbench [--repetitions N] [--filter NAME] [--output FILE]
+ *
+ * The serve_* benchmarks go through the whole request path, as a worker does,
+ * over socketpairs (see pipeline_harness.h) and also report the CPU time and
+ * syscalls it takes per request.
+ *
+ * Every benchmark runs a fixed amount of work N times and reports the median,
+ * fastest and slowest run as JSON, so results of two commits can be diffed.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include "bbuf.h"
+#include "rio.h"
+#include "http.h"
+#include "command_line.h"
+#include "log.h"
+#include "pipeline_harness.h"
+
+#define MAX_MICROBENCH_REPETITIONS 101
+#define DEFAULT_MICROBENCH_REPETITIONS 5
+#define MAX_MICROBENCH_THREADS 64
+#define BBUF_BENCH_OPS 200000
+#define RIO_BENCH_BYTES (64 * 1024 * 1024)
+#define RIO_BENCH_LINE_LEN 64
+#define RIO_BENCH_CHUNK_LEN 4096
+#define HTTP_BENCH_REQUESTS 20000
+#define HTTP_BENCH_BODY_LEN 2048
+#define SERVE_BENCH_REQUESTS 5000
+#define SERVE_BENCH_LARGE_REQUESTS 200
+#define SERVE_BENCH_LARGE_BODY_LEN (1024 * 1024)
+#define MAX_MICROBENCH_EXTRA_LEN 256
+#define LOG_BENCH_MESSAGES 1000000
+#define LOG_BENCH_QUEUED_MESSAGES 20000
+#define LOG_BENCH_BURST (LOG_RING_SLOTS / 2)   // Messages queued before letting the log thread drain the ring
+#define NANOSEC_IN_SEC 1000000000UL
+
+
+typedef struct microbench {
+    const char *name;
+    const char *unit;               /**< What ops counts: "ops", "bytes" or "requests". */
+    unsigned long ops;              /**< Done by every run. */
+    int (*run)(int num_threads);    /**< Does ops once, -1 on failure. */
+    bool threaded;                  /**< Run with 1 to MAX_MICROBENCH_THREADS threads. */
+} microbench;
+
+typedef struct bbuf_bench_args {
+    bbuf_t bbuf;
+    unsigned long ops;
+} bbuf_bench_args;
+
+
+static int run_bbuf(int num_threads);
+static int run_readline_b(int num_threads);
+static int run_readn_b(int num_threads);
+static int run_http_pipeline(int num_threads);
+static int run_serve_small(int num_threads);
+static int run_serve_large(int num_threads);
+static int run_log_filtered(int num_threads);
+static int run_log_queued(int num_threads);
+
+static const microbench benchmarks[] = {
+    {"bbuf_insert_remove", "ops", BBUF_BENCH_OPS, run_bbuf, true},
+    {"readline_b", "bytes", RIO_BENCH_BYTES, run_readline_b, false},
+    {"readn_b", "bytes", RIO_BENCH_BYTES, run_readn_b, false},
+    {"http_pipeline", "requests", HTTP_BENCH_REQUESTS, run_http_pipeline, false},
+    {"serve_small", "requests", SERVE_BENCH_REQUESTS, run_serve_small, false},
+    {"serve_large", "requests", SERVE_BENCH_LARGE_REQUESTS, run_serve_large, false},
+    {"log_filtered", "ops", LOG_BENCH_MESSAGES, run_log_filtered, false},
+    {"log_queued", "ops", LOG_BENCH_QUEUED_MESSAGES, run_log_queued, false},
+};
+
+static const harness_file bench_files[] = {
+    {"index.html", HTTP_BENCH_BODY_LEN},
+    {"large.bin", SERVE_BENCH_LARGE_BODY_LEN},
+};
+
+static char bench_root[MAX_SERVER_ROOT_LEN];
+static unsigned long excluded_ns = 0; // Time a run spent waiting on something else, not counted
+static char extra[MAX_MICROBENCH_EXTRA_LEN]; // More JSON fields about the last run
+
+
+static void print_usage(){
+    printf("Usage: sws_microbench [--repetitions N] [--filter NAME] [--output FILE]\n\n" \
+           "    --repetitions N    runs of every benchmark (default: %d)\n" \
+           "    --filter NAME      only run the benchmarks whose name contains NAME\n" \
+           "    --output FILE      write the JSON results to FILE (default: stdout)\n",
+           DEFAULT_MICROBENCH_REPETITIONS);
+}
+
+
+static unsigned long now_ns(){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NANOSEC_IN_SEC + now.tv_nsec;
+}
+
+
+static int compare_ns(const void *a, const void *b){
+    unsigned long lhs = *(const unsigned long *) a;
+    unsigned long rhs = *(const unsigned long *) b;
+
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+
+// BOUNDED BUFFER //
+
+static void *produce(void *args){
+    bbuf_bench_args *bench = (bbuf_bench_args *) args;
+
+    for(unsigned long i = 0; i < bench->ops; i++){
+        bbuf_insert(bench->bbuf, (int) i);
+    }
+
+    return NULL;
+}
+
+static void *consume(void *args){
+    bbuf_bench_args *bench = (bbuf_bench_args *) args;
+    int fd;
+
+    for(unsigned long i = 0; i < bench->ops; i++){
+        bbuf_remove(bench->bbuf, &fd);
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief num_threads producers and as many consumers pass BBUF_BENCH_OPS fds through a bounded buffer.
+ */
+static int run_bbuf(int num_threads){
+    pthread_t producers[MAX_MICROBENCH_THREADS];
+    pthread_t consumers[MAX_MICROBENCH_THREADS];
+    bbuf_bench_args bench = {.bbuf = bbuf_init(), .ops = BBUF_BENCH_OPS / num_threads};
+
+    if(!bench.bbuf){
+        return -1;
+    }
+
+    for(int i = 0; i < num_threads; i++){
+        if(pthread_create(&producers[i], NULL, produce, &bench) != 0 ||
+           pthread_create(&consumers[i], NULL, consume, &bench) != 0){
+            exit(EXIT_FAILURE); // Threads already started would block forever
+        }
+    }
+
+    for(int i = 0; i < num_threads; i++){
+        pthread_join(producers[i], NULL);
+        pthread_join(consumers[i], NULL);
+    }
+
+    bbuf_destroy(bench.bbuf);
+    return 0;
+}
+
+
+// RIO //
+
+static void *write_lines(void *args){
+    int fd = *(int *) args;
+    char chunk[RIO_BENCH_CHUNK_LEN];
+
+    // RIO_BENCH_CHUNK_LEN is a multiple of RIO_BENCH_LINE_LEN
+    for(int i = 0; i < RIO_BENCH_CHUNK_LEN; i++){
+        chunk[i] = (i + 1) % RIO_BENCH_LINE_LEN == 0 ? '\n' : 'a' + i % 26;
+    }
+
+    for(size_t written = 0; written < RIO_BENCH_BYTES; written += RIO_BENCH_CHUNK_LEN){
+        if(writen_b(fd, chunk, RIO_BENCH_CHUNK_LEN) == -1){
+            break;
+        }
+    }
+
+    close(fd);
+    return NULL;
+}
+
+
+/**
+ * @brief Read RIO_BENCH_BYTES from a pipe fed by another thread, by lines or by chunks.
+ */
+static int read_pipe(bool by_line){
+    int fds[2];
+    pthread_t writer;
+    rio_t rio;
+    char buff[RIO_BENCH_CHUNK_LEN];
+    size_t total = 0;
+    ssize_t rc;
+
+    if(pipe(fds) != 0){
+        return -1;
+    }
+
+    rio = readn_b_init(fds[0]);
+
+    if(!rio || pthread_create(&writer, NULL, write_lines, &fds[1]) != 0){
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    while((rc = by_line ? readline_b(rio, buff, sizeof(buff)) : readn_b(rio, buff, sizeof(buff))) > 0){
+        total += rc;
+    }
+
+    pthread_join(writer, NULL);
+    readn_b_destroy(&rio);
+    close(fds[0]);
+
+    return total == RIO_BENCH_BYTES ? 0 : -1;
+}
+
+static int run_readline_b(int num_threads){
+    return read_pipe(true);
+}
+
+static int run_readn_b(int num_threads){
+    return read_pipe(false);
+}
+
+
+// HTTP //
+
+/**
+ * @brief Parse HTTP_BENCH_REQUESTS requests off a pipe and formulate their responses.
+ */
+static int run_http_pipeline(int num_threads){
+    const char *request = "GET /index.html HTTP/1.1\r\nHost: localhost\r\nAccept-Encoding: identity\r\n\r\n";
+    int fds[2];
+    int rc = 0;
+
+    if(pipe(fds) != 0){
+        return -1;
+    }
+
+    for(int i = 0; i < HTTP_BENCH_REQUESTS && rc == 0; i++){
+        http_req req;
+        http_resp resp;
+        int status_code = 0;
+
+        writen_b(fds[1], (void *) request, strlen(request));
+        req = init_http_request(fds[0]);
+        resp = req ? get_http_response_from_request(req) : NULL;
+
+        if(resp) get_http_response_status_code(resp, &status_code);
+        rc = status_code == OK ? 0 : -1;
+
+        destroy_http_request(&req);
+        destroy_http_response(&resp);
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+    return rc;
+}
+
+
+/**
+ * @brief Serve num_requests requests for path like a worker, and report what
+ *        serve_connection costs per request.
+ */
+static int serve(const char *request, int num_requests){
+    harness_stats stats = {0};
+    unsigned long started_ns = now_ns();
+
+    if(harness_run(request, OK, num_requests, &stats) != 0 || stats.expected_responses != stats.requests){
+        return -1;
+    }
+
+    // Only the time spent in serve_connection is counted, not the reader threads or socketpairs
+    excluded_ns += now_ns() - started_ns - stats.wall_ns;
+    snprintf(extra, sizeof(extra), ", \"cpu_ns_per_request\": %.0f, \"read_syscalls_per_request\": %.2f, \"write_syscalls_per_request\": %.2f",
+             (double) stats.cpu_ns / stats.requests, (double) stats.read_syscalls / stats.requests, (double) stats.write_syscalls / stats.requests);
+    return 0;
+}
+
+static int run_serve_small(int num_threads){
+    return serve("GET /index.html HTTP/1.1\r\nHost: localhost\r\n\r\n", SERVE_BENCH_REQUESTS);
+}
+
+static int run_serve_large(int num_threads){
+    return serve("GET /large.bin HTTP/1.1\r\nHost: localhost\r\n\r\n", SERVE_BENCH_LARGE_REQUESTS);
+}
+
+
+// LOG //
+
+/**
+ * @brief LOG below the runtime level, what most DEBUG calls cost in production.
+ */
+static int run_log_filtered(int num_threads){
+    log_level saved_level = user_provided_log_level;
+
+    user_provided_log_level = INFO;
+
+    for(int i = 0; i < LOG_BENCH_MESSAGES; i++){
+        LOG(DEBUG, "Processing client request fd %d\n", i);
+
+        // The level is read again every time, like between the requests of a worker
+        __asm__ volatile("" ::: "memory");
+    }
+
+    user_provided_log_level = saved_level;
+    return 0;
+}
+
+
+/**
+ * @brief LOG into the ring of the thread, in bursts the log thread can drain
+ *        in between (the time waiting for it isn't counted).
+ */
+static int run_log_queued(int num_threads){
+    for(int i = 0; i < LOG_BENCH_QUEUED_MESSAGES; i++){
+        LOG(INFO, "Processing client request fd %d\n", i);
+
+        if((i + 1) % LOG_BENCH_BURST == 0){
+            unsigned long wait_started_ns = now_ns();
+            struct timespec drain = {.tv_nsec = 2 * LOG_FLUSH_INTERVAL_MS * 1000000L};
+
+            nanosleep(&drain, NULL);
+            excluded_ns += now_ns() - wait_started_ns;
+        }
+    }
+
+    return 0;
+}
+
+
+// RUNNER //
+
+/**
+ * @brief Run bench num_repetitions times with num_threads and print its results as a JSON object.
+ */
+static int run_benchmark(FILE *out, const microbench *bench, int num_threads, int num_repetitions, bool first){
+    unsigned long run_ns[MAX_MICROBENCH_REPETITIONS];
+    unsigned long median_ns;
+
+    for(int i = 0; i < num_repetitions; i++){
+        unsigned long started_ns = now_ns();
+
+        excluded_ns = 0;
+        extra[0] = '\0';
+
+        if(bench->run(num_threads) != 0){
+            return -1;
+        }
+
+        run_ns[i] = now_ns() - started_ns - excluded_ns;
+    }
+
+    qsort(run_ns, num_repetitions, sizeof(unsigned long), compare_ns);
+    median_ns = run_ns[num_repetitions / 2];
+
+    fprintf(out, "%s\n    {\"name\": \"%s\", \"threads\": %d, \"unit\": \"%s\", \"ops\": %lu, \"repetitions\": %d, "
+                 "\"median_ns\": %lu, \"min_ns\": %lu, \"max_ns\": %lu, \"ns_per_op\": %.2f, \"%s_per_sec\": %.1f%s}",
+            first ? "" : ",", bench->name, num_threads, bench->unit, bench->ops, num_repetitions,
+            median_ns, run_ns[0], run_ns[num_repetitions - 1], (double) median_ns / bench->ops,
+            bench->unit, bench->ops / (median_ns / 1e9), extra);
+    fflush(out);
+    return 0;
+}
+
+
+int main(int argc, char *argv[]){
+    int num_repetitions = DEFAULT_MICROBENCH_REPETITIONS;
+    const char *filter = "";
+    FILE *out = stdout;
+    int saved_stdout;
+    int saved_stderr;
+    int devnull_fd;
+    int rc = 0;
+    bool first = true;
+    const microbench *failed = NULL;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc){
+            num_repetitions = atoi(argv[++i]);
+        }
+
+        else if(strcmp(argv[i], "--filter") == 0 && i + 1 < argc){
+            filter = argv[++i];
+        }
+
+        else if(strcmp(argv[i], "--output") == 0 && i + 1 < argc){
+            out = fopen(argv[++i], "w");
+        }
+
+        else {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(num_repetitions < 1 || num_repetitions > MAX_MICROBENCH_REPETITIONS || !out){
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    else if(harness_create_root(bench_root, sizeof(bench_root), bench_files, 2) != 0){
+        fprintf(stderr, "Could not create a server root: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    // What's logged goes to /dev/null, the results to a copy of stdout
+    saved_stdout = dup(STDOUT_FILENO);
+    saved_stderr = dup(STDERR_FILENO);
+    devnull_fd = open("/dev/null", O_WRONLY);
+
+    if(out == stdout){
+        out = fdopen(saved_stdout, "w");
+    }
+
+    dup2(devnull_fd, STDOUT_FILENO);
+    dup2(devnull_fd, STDERR_FILENO);
+    log_init();
+
+    fprintf(out, "{\"benchmarks\": [");
+
+    for(size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]) && rc == 0; i++){
+        if(!strstr(benchmarks[i].name, filter)){
+            continue;
+        }
+
+        for(int num_threads = 1; num_threads <= (benchmarks[i].threaded ? MAX_MICROBENCH_THREADS : 1) && rc == 0; num_threads *= 2){
+            rc = run_benchmark(out, &benchmarks[i], num_threads, num_repetitions, first);
+            failed = rc == 0 ? NULL : &benchmarks[i];
+            first = false;
+        }
+    }
+
+    fprintf(out, "\n]}\n");
+    fclose(out);
+
+    log_flush();
+    dup2(saved_stderr, STDERR_FILENO);
+    close(devnull_fd);
+    harness_remove_root(bench_root, bench_files, 2);
+
+    if(failed){
+        fprintf(stderr, "%s failed, the benchmarks after it didn't run\n", failed->name);
+    }
+
+    return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
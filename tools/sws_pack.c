@@ -0,0 +1,67 @@
+/**
+ * @file sws_pack.c
+ * @brief Command line tool packing a server root into a site pack.
+ *
+ * Usage: sws-pack SERVER_ROOT PACK_FILE [--gzip] [--mime-types FILE]
+ *
+ * The pack can then be served with: sws PORT SERVER_ROOT --pack PACK_FILE
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "site_pack.h"
+#include "compression.h"
+#include "command_line.h"
+#include "mime.h"
+#include "log.h"
+
+#define PACK_GZIP_LEVEL 9 // Packing happens once, spend the time on smaller variants
+
+
+static void print_usage(){
+    printf("Usage: sws-pack SERVER_ROOT PACK_FILE [--gzip] [--mime-types FILE]\n\n" \
+           "    --gzip               to add gzip variants of compressible ressources that don't have one\n" \
+           "    --mime-types FILE    file mapping extensions to content types (default: " DEFAULT_MIME_TYPES_PATH ")\n");
+}
+
+
+int main(int argc, char *argv[]){
+    bool gzip_variants = false;
+    const char *mime_types = DEFAULT_MIME_TYPES_PATH;
+
+    if(argc < 3){
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    for(int i = 3; i < argc; i++){
+        if(strcmp(argv[i], "--gzip") == 0){
+            gzip_variants = true;
+        }
+
+        else if(strcmp(argv[i], "--mime-types") == 0 && i + 1 < argc){
+            mime_types = argv[++i];
+        }
+
+        else {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    compression_config compression = {.enabled = true,
+                                      .level = PACK_GZIP_LEVEL,
+                                      .min_size = DEFAULT_GZIP_MIN_SIZE,
+                                      .types = DEFAULT_GZIP_TYPES};
+
+    mime_registry_init(mime_types);
+
+    if(compression_init(&compression) != 0){
+        return EXIT_FAILURE;
+    }
+
+    return site_pack_write(argv[1], argv[2], gzip_variants) == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
+}